@@ -22,6 +22,20 @@ Maintainer: Sylvain Miermont
 
 #include <stdint.h>        /* C99 types */
 
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@brief Implementations of the encoding and decoding of full blocks
+*/
+enum b64_impl_e {
+    B64_IMPL_AUTO = 0,  /* best one supported by the CPU, selected on first use */
+    B64_IMPL_SCALAR,    /* table driven, portable */
+    B64_IMPL_SSSE3,     /* x86, 4 blocks at a time */
+    B64_IMPL_AVX2,      /* x86, 8 blocks at a time */
+    B64_IMPL_NEON       /* ARM, 16 blocks at a time, only if the target has NEON */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
 
@@ -41,7 +55,7 @@ int bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len);
 @param size number of characters to be decoded from base64 (w/o null char)
 @param out pointer to a data buffer where the function will output decoded data
 @param out_max_len usable size of the output data buffer
-@return >=0 number of bytes written to the data buffer, -1 for error
+@return >=0 number of bytes written to the data buffer, -1 for error (including invalid characters)
 */
 int b64_to_bin_nopad(const char * in, int size, uint8_t * out, int max_len);
 
@@ -57,6 +71,25 @@ int bin_to_b64(const uint8_t * in, int size, char * out, int max_len);
 */
 int b64_to_bin(const char * in, int size, uint8_t * out, int max_len);
 
+/* === implementation selection === */
+
+/**
+@brief Select the implementation used by all threads (only needed for benchmarks and tests)
+@param impl implementation, B64_IMPL_AUTO to select the best one again
+@return 0 if selected, -1 if not supported by the CPU or not compiled for this architecture
+*/
+int b64_set_impl(enum b64_impl_e impl);
+
+/**
+@brief Get the implementation in use (never B64_IMPL_AUTO)
+*/
+enum b64_impl_e b64_get_impl(void);
+
+/**
+@brief Get the name of an implementation, for display
+*/
+const char * b64_impl_name(enum b64_impl_e impl);
+
 #endif
 
 /* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,123 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Flight recorder
+        Memory-mapped circular log of RX, TX scheduling and time sync events
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_FLIGHTREC_H
+#define _LORA_PKTFWD_FLIGHTREC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define FLIGHTREC_MAGIC         "LGWFREC"   /* 7 characters + null, first bytes of the file */
+#define FLIGHTREC_VERSION       1
+#define FLIGHTREC_DEFAULT_SIZE  65536       /* default number of events kept (2 MiB file) */
+#define FLIGHTREC_MIN_SIZE      256         /* minimum number of events kept */
+#define FLIGHTREC_MAX_SIZE      (1 << 24)   /* maximum number of events kept (512 MiB file) */
+
+/* Event types, the meaning of the record fields depends on it */
+enum flightrec_type_e {
+    FLIGHTREC_RX = 1,       /* code: CRC status, size: payload size, count_us: RX timestamp, freq_hz: RX frequency, arg1: datarate, arg2: see FLIGHTREC_RX_ARG2 */
+    FLIGHTREC_ENQUEUE,      /* code: jit_error_e, size: payload size, count_us: TX timestamp, freq_hz: TX frequency, arg1: jit_pkt_type_e, arg2: concentrator time */
+    FLIGHTREC_PEEK,         /* code: jit_error_e, count_us: concentrator time, arg1: index of the packet to be sent (or -1) */
+    FLIGHTREC_DEQUEUE,      /* code: jit_error_e, size: payload size, count_us: TX timestamp, freq_hz: TX frequency, arg1: jit_pkt_type_e, arg2: packet index */
+    FLIGHTREC_SEND,         /* code: 0 if sent, 1 if lgw_send failed, size: payload size, count_us: TX timestamp, freq_hz: TX frequency, arg1: TX status before send, arg2: RF power */
+    FLIGHTREC_TIMERSYNC,    /* size: nb of samples used, count_us: counter value of the latest sample, arg1: drift (ppb), arg2: fit residual (ns) */
+    FLIGHTREC_GPS_SYNC,     /* code: 0 if synced, 1 if not, count_us: PPS timestamp, arg1: UTC seconds, arg2: XTAL error (ppb) */
+    FLIGHTREC_GPS_VALID     /* code: 1 if the GPS time reference became valid, 0 if invalid */
+};
+
+/* Packing of RX event arg2: RSSI (0.1 dBm, signed), SNR (0.25 dB, signed), bandwidth, FSK flag, IF chain */
+#define FLIGHTREC_RX_ARG2(rssi, snr, bw, fsk, chan) \
+    (((uint32_t)(uint16_t)(int16_t)(rssi) << 16) | ((uint32_t)(uint8_t)(int8_t)(snr) << 8) | \
+     (((uint32_t)(bw) & 0x7) << 5) | (((fsk) ? 1U : 0U) << 4) | ((uint32_t)(chan) & 0xF))
+#define FLIGHTREC_RX_RSSI(arg2)     ((int16_t)((arg2) >> 16))
+#define FLIGHTREC_RX_SNR(arg2)      ((int8_t)(((arg2) >> 8) & 0xFF))
+#define FLIGHTREC_RX_BW(arg2)       (((arg2) >> 5) & 0x7)
+#define FLIGHTREC_RX_FSK(arg2)      (((arg2) >> 4) & 0x1)
+#define FLIGHTREC_RX_CHAN(arg2)     ((arg2) & 0xF)
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/* File header, followed by nb_records records, all fields in host byte order */
+struct flightrec_header_s {
+    char magic[8];          /* FLIGHTREC_MAGIC */
+    uint32_t version;       /* FLIGHTREC_VERSION */
+    uint32_t header_size;   /* Size of this header, offset of the first record */
+    uint32_t record_size;   /* Size of a record */
+    uint32_t nb_records;    /* Number of records, a power of 2 */
+    uint32_t write_idx;     /* Number of events recorded, next record is write_idx % nb_records */
+    uint32_t pad;
+    uint64_t open_time_ns;  /* UTC time the log was started, in ns */
+    uint64_t gateway_id;    /* Gateway MAC address */
+    uint8_t reserved[16];
+};
+
+/* Event record, 32 bytes */
+struct flightrec_record_s {
+    uint32_t seq;           /* Event index + 1, written last (0: never written or being written) */
+    uint8_t type;           /* enum flightrec_type_e */
+    uint8_t code;           /* Result code, type specific */
+    uint16_t size;          /* Size, type specific */
+    uint64_t time_ns;       /* UTC time of the event, in ns */
+    uint32_t count_us;      /* Concentrator time, type specific */
+    uint32_t freq_hz;       /* Frequency, type specific */
+    uint32_t arg1;          /* Type specific */
+    uint32_t arg2;          /* Type specific */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Start recording events to a memory-mapped file.
+
+@param path[in] Path of the log file, a previous log is kept as <path>.prev
+@param nb_records[in] Number of events kept, rounded up to a power of 2
+@param gateway_id[in] Gateway MAC address, stored in the header
+@return 0 if recording is started, -1 otherwise
+
+The file is a shared mapping: events recorded before a crash are written back by the kernel.
+*/
+int flightrec_open(const char *path, uint32_t nb_records, uint64_t gateway_id);
+
+/**
+@brief Record an event (thread safe, lock-free, no effect if the recorder is not started).
+
+@param type[in] Event type (enum flightrec_type_e)
+@param code[in] Result code
+@param size[in] Size
+@param count_us[in] Concentrator time
+@param freq_hz[in] Frequency
+@param arg1[in] Type specific argument
+@param arg2[in] Type specific argument
+*/
+void flightrec_log(uint8_t type, uint8_t code, uint16_t size, uint32_t count_us, uint32_t freq_hz, uint32_t arg1, uint32_t arg2);
+
+/**
+@brief Write the recorded events back to the log file and wait for completion.
+
+Recording may go on, the file stays mapped until the process exits.
+*/
+void flightrec_flush(void);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
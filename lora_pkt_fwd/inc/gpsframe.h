@@ -0,0 +1,109 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : GPS serial stream framing
+        Incremental UBX/NMEA frame decoder working on a ring buffer
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_GPSFRAME_H
+#define _LORA_PKTFWD_GPSFRAME_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stddef.h>     /* size_t */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define GPS_FRAME_RING_SIZE     1024    /* Size of the serial ring buffer, must be a power of 2 */
+#define GPS_FRAME_MAX_SIZE      512     /* Maximum size of a frame (UBX header, payload and checksum) */
+#define GPS_FRAME_NMEA_MAX_SIZE 128     /* Maximum size of a NMEA sentence, standard says 82 */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum gps_frame_type_e {
+    GPS_FRAME_NONE,         /* No complete frame available */
+    GPS_FRAME_UBX,          /* UBX frame, with valid checksum */
+    GPS_FRAME_NMEA          /* NMEA sentence, from '$' to LF included */
+};
+
+enum gps_frame_state_e {
+    GPS_FRAME_STATE_HUNT,   /* Looking for a sync char */
+    GPS_FRAME_STATE_UBX,    /* UBX sync char found, waiting for complete frame */
+    GPS_FRAME_STATE_NMEA    /* NMEA sync char found, waiting for end of line */
+};
+
+struct gps_frame_stats_s {
+    uint32_t nb_ubx;            /* Number of UBX frames extracted */
+    uint32_t nb_nmea;           /* Number of NMEA sentences extracted */
+    uint32_t nb_errors;         /* Number of framing errors (bad sync, length or checksum) */
+    uint32_t nb_discarded;      /* Number of bytes discarded, not part of a valid frame */
+};
+
+struct gps_frame_decoder_s {
+    uint8_t ring[GPS_FRAME_RING_SIZE]; /* Serial data ring buffer */
+    size_t rd;                  /* Start of pending data (free-running index) */
+    size_t wr;                  /* End of pending data (free-running index) */
+    size_t scan;                /* Bytes already scanned from rd, in current state */
+    size_t frame_size;          /* Expected size of the UBX frame in progress (0 if unknown) */
+    enum gps_frame_state_e state;
+    struct gps_frame_stats_s stats;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a GPS frame decoder.
+
+@param dec[out] Decoder to be initialized
+*/
+void gps_frame_init(struct gps_frame_decoder_s *dec);
+
+/**
+@brief Get the largest contiguous free space of the ring buffer, to read serial data into.
+
+@param dec[in/out] Decoder
+@param size[out] Number of bytes which can be written at returned address
+@return Address where serial data can be written
+
+If the ring buffer is full, oldest bytes are discarded to make room for new ones.
+*/
+uint8_t *gps_frame_write_ptr(struct gps_frame_decoder_s *dec, size_t *size);
+
+/**
+@brief Commit serial data written at the address given by gps_frame_write_ptr.
+
+@param dec[in/out] Decoder
+@param size[in] Number of bytes written
+*/
+void gps_frame_commit(struct gps_frame_decoder_s *dec, size_t size);
+
+/**
+@brief Get the next complete frame from the decoder.
+
+@param dec[in/out] Decoder
+@param frame[out] Buffer where the frame is copied, at least GPS_FRAME_MAX_SIZE bytes
+@param size[out] Size of the frame
+@return Type of frame found, GPS_FRAME_NONE if more data is needed
+
+Partial frames are kept in the ring buffer, and bytes already examined are not scanned again
+when new data is committed. Bytes which cannot be part of a valid frame are discarded.
+*/
+enum gps_frame_type_e gps_frame_next(struct gps_frame_decoder_s *dec, char *frame, size_t *size);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
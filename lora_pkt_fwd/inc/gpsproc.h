@@ -0,0 +1,79 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : GPS message processing
+        Update the GPS time reference and the gateway position once a GPS
+        message has been parsed by the HAL
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_GPSPROC_H
+#define _LORA_PKTFWD_GPSPROC_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <time.h>       /* timespec */
+#include <pthread.h>    /* pthread_mutex_t */
+
+#include "timeref.h"
+#include "loragw_gps.h" /* struct tref, struct coord_s */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+enum gps_sync_status_e {
+    GPS_SYNC_OK = 0,        /* Time reference updated */
+    GPS_SYNC_NO_TIME,       /* Could not get GPS time from the HAL */
+    GPS_SYNC_NO_TRIGCNT,    /* Could not get the counter value captured on the PPS */
+    GPS_SYNC_OUT_OF_SYNC    /* Sync rejected by the HAL, previous time reference kept */
+};
+
+struct gps_sync_s {
+    struct timespec utc;    /* UTC time of the PPS */
+    struct timespec gps_time; /* GPS time of the PPS */
+    uint32_t trig_tstamp;   /* Concentrator counter value captured on the PPS */
+    struct tref ref;        /* Time reference computed by the HAL (published only if GPS_SYNC_OK) */
+};
+
+struct gps_pos_s {
+    bool valid;             /* Could we get valid GPS coordinates ? */
+    struct coord_s coord;   /* GPS position of the gateway */
+    struct coord_s err;     /* GPS position error of the gateway */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Update a time reference with the GPS time of the latest UBX NAV-TIMEGPS message.
+
+@param tr[in/out] Time reference, its mutex is locked while it is updated
+@param get_trigcnt[in] Function giving the concentrator counter value captured on the PPS of a GPS time, returns 0 on success
+@param sync[out] GPS time, counter value and time reference of this sync, for reporting
+@return Status of the sync, the fields of sync after the first failing step are not set
+*/
+enum gps_sync_status_e gps_process_sync(struct timeref_s *tr, int (*get_trigcnt)(struct timespec gps_time, uint32_t *trig_tstamp), struct gps_sync_s *sync);
+
+/**
+@brief Update the gateway position with the coordinates of the latest NMEA RMC sentence.
+
+@param mx[in] Mutex protecting pos, locked while it is updated
+@param pos[out] Gateway position, set as not valid if no valid coordinates could be got
+@return 0 if valid coordinates have been got, -1 otherwise
+*/
+int gps_process_coords(pthread_mutex_t *mx, struct gps_pos_s *pos);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,91 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Log-linear latency histogram
+        Constant relative precision over the full 32-bit range (HDR histogram like)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_HDRHIST_H
+#define _LORA_PKTFWD_HDRHIST_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define HDR_HIST_SUB_BITS   5   /* Values are recorded with (HDR_HIST_SUB_BITS - 1) significant bits, ie. 1/16 relative precision */
+#define HDR_HIST_NB_BUCKETS ((34 - HDR_HIST_SUB_BITS) << (HDR_HIST_SUB_BITS - 1)) /* Number of buckets to cover 32-bit values */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct hdr_hist_s {
+    uint32_t counts[HDR_HIST_NB_BUCKETS]; /* Number of values recorded per bucket */
+    uint32_t count;         /* Total number of values recorded */
+    uint32_t min;           /* Smallest value recorded (exact) */
+    uint32_t max;           /* Largest value recorded (exact) */
+    uint64_t sum;           /* Sum of the values recorded (exact) */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Reset a histogram, discarding all recorded values.
+
+@param hist[out] Histogram to be reset
+*/
+void hdr_hist_reset(struct hdr_hist_s *hist);
+
+/**
+@brief Record a value in a histogram.
+
+@param hist[in/out] Histogram
+@param value[in] Value to be recorded (typ. a delay in microseconds)
+
+Values below 2^HDR_HIST_SUB_BITS are recorded exactly, larger ones in a bucket which width is
+1/16 of the value at most. Recording is constant time, there is no allocation.
+*/
+void hdr_hist_record(struct hdr_hist_s *hist, uint32_t value);
+
+/**
+@brief Get a percentile of the values recorded in a histogram.
+
+@param hist[in] Histogram
+@param percentile[in] Percentile to be computed, from 0.0 to 100.0
+@return Highest value equivalent to the bucket holding the percentile (bounded by max), 0 if histogram is empty
+*/
+uint32_t hdr_hist_percentile(const struct hdr_hist_s *hist, double percentile);
+
+/**
+@brief Add the values recorded in a histogram to another one.
+
+@param dst[in/out] Histogram receiving the values
+@param src[in] Histogram which values are added
+*/
+void hdr_hist_merge(struct hdr_hist_s *dst, const struct hdr_hist_s *src);
+
+/**
+@brief Count the values recorded in a histogram that are lower than or equal to a bound.
+
+@param hist[in] Histogram
+@param bound[in] Upper bound, included
+@return Number of values up to the bound, values sharing the bucket of the bound being counted as lower
+*/
+uint32_t hdr_hist_count_le(const struct hdr_hist_s *hist, uint32_t bound);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -33,6 +33,15 @@ Maintainer: Michael Coracin
 #define JIT_QUEUE_MAX           32  /* Maximum number of packets to be stored in JiT queue */
 #define JIT_NUM_BEACON_IN_QUEUE 3   /* Number of beacons to be loaded in JiT queue at any time */
 
+#define JIT_ASAP_DELAY_FLOOR    100000  /* Default minimum delay given to an immediate downlink, in microseconds */
+#define JIT_ASAP_DELAY_CEILING  1000000 /* Default maximum delay given to an immediate downlink, in microseconds */
+#define JIT_ASAP_WINDOW         128 /* Number of TX latency measurements kept to compute ASAP delay */
+
+#define JIT_DC_BAND_MAX         8   /* Maximum number of duty-cycle limited sub-bands */
+#define JIT_DC_SLOTS            60  /* Number of slots a duty-cycle window is divided in (airtime accounting granularity) */
+#define JIT_DC_RING             (2 * JIT_DC_SLOTS + 1) /* Slots kept per sub-band: one window before and after a packet */
+#define JIT_DC_MIN_WINDOW       600 /* Minimum duty-cycle window, in seconds (must be longer than max TX advance) */
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC TYPES --------------------------------------------------------- */
 
@@ -54,6 +63,7 @@ enum jit_error_e {
     JIT_ERROR_TX_FREQ,      /* The required frequency for downlink is not supported */
     JIT_ERROR_TX_POWER,     /* The required power for downlink is not supported */
     JIT_ERROR_GPS_UNLOCKED, /* GPS timestamp could not be used as GPS is unlocked */
+    JIT_ERROR_DUTY_CYCLE,   /* Sub-band duty-cycle budget would be exceeded */
     JIT_ERROR_INVALID       /* Packet is invalid */
 };
 
@@ -63,14 +73,62 @@ struct jit_node_s {
     enum jit_pkt_type_e pkt_type;   /* Packet type: Downlink, Beacon... */
 
     /* Internal fields */
+    int64_t count_ext;              /* Packet timestamp on the 64-bit concentrator timeline */
     uint32_t pre_delay;             /* Amount of time before packet timestamp to be reserved */
     uint32_t post_delay;            /* Amount of time after packet timestamp to be reserved (time on air) */
+    uint32_t dc_airtime;            /* Airtime booked in the duty-cycle ledger, 0 if not duty-cycle limited */
+};
+
+struct jit_dc_band_s {
+    uint32_t freq_min;              /* Lowest frequency of the sub-band, in Hz */
+    uint32_t freq_max;              /* Highest frequency of the sub-band, in Hz */
+    float percent;                  /* Duty-cycle limit, in percent */
+    uint32_t window;                /* Observation window, in seconds */
+    uint64_t slot_us;               /* Duration of a ledger slot */
+    uint64_t budget_us;             /* Airtime allowed on any window */
+    int64_t slot_id[JIT_DC_RING];   /* Slot (time / slot_us) each ledger entry holds airtime for */
+    uint32_t airtime_us[JIT_DC_RING]; /* Airtime booked in each ledger entry */
+};
+
+struct jit_dc_stats_s {
+    uint32_t freq_min;              /* Lowest frequency of the sub-band, in Hz */
+    uint32_t freq_max;              /* Highest frequency of the sub-band, in Hz */
+    float percent;                  /* Duty-cycle limit, in percent */
+    uint32_t window;                /* Observation window, in seconds */
+    uint64_t used_us;               /* Airtime used on the last window, and booked for queued packets */
+    uint64_t budget_us;             /* Airtime allowed on any window */
 };
 
 struct jit_queue_s {
     uint8_t num_pkt;                /* Total number of packets in the queue (downlinks, beacons...) */
     uint8_t num_beacon;             /* Number of beacons in the queue */
     struct jit_node_s nodes[JIT_QUEUE_MAX]; /* Nodes/packets array in the queue */
+
+    /* Last packet dequeued, still to be emitted or being emitted */
+    bool tx_end_valid;              /* Set when a packet has been dequeued */
+    int64_t tx_end_us;              /* Time at which the last dequeued packet ends, on 64-bit timeline */
+    uint32_t tx_freq_hz;            /* Frequency of the last dequeued packet */
+    int64_t tx_count_ext;           /* Timestamp of the last dequeued packet, on 64-bit timeline */
+    uint32_t tx_dc_airtime;         /* Airtime booked for the last dequeued packet, until cancelled */
+
+    /* Last packet programmed in the concentrator, until emitted or overwritten */
+    uint32_t sched_freq_hz;         /* Frequency of the last programmed packet */
+    int64_t sched_count_ext;        /* Timestamp of the last programmed packet, on 64-bit timeline */
+    uint32_t sched_dc_airtime;      /* Airtime booked for the last programmed packet, until overwritten */
+
+    /* Class C "ASAP" delay, adapted to measured TX latency */
+    uint32_t asap_delay;            /* Delay given to an immediate downlink, compared to current time */
+    uint32_t asap_floor;            /* Minimum ASAP delay */
+    uint32_t asap_ceiling;          /* Maximum ASAP delay */
+    uint32_t tx_latency_p50;        /* Median TX latency on last JIT_ASAP_WINDOW packets */
+    uint32_t tx_latency_p99;        /* 99th percentile TX latency on last JIT_ASAP_WINDOW packets */
+    uint32_t tx_latency[JIT_ASAP_WINDOW]; /* Circular buffer of last TX latencies measured */
+    uint32_t tx_latency_sorted[JIT_ASAP_WINDOW]; /* Same latencies, in ascending order */
+    uint32_t tx_latency_nb;         /* Total number of TX latencies measured */
+
+    /* Duty-cycle ledger, airtime booked per sub-band at enqueue time */
+    uint8_t dc_nb_band;             /* Number of duty-cycle limited sub-bands */
+    struct jit_dc_band_s dc_band[JIT_DC_BAND_MAX];
 };
 
 /* -------------------------------------------------------------------------- */
@@ -105,7 +163,7 @@ void jit_queue_init(struct jit_queue_s *queue);
 @brief Add a packet in a Just-in-Time queue
 
 @param queue[in/out] Just in Time queue in which the packet should be inserted
-@param time[in] Current concentrator time
+@param time[in] Current concentrator time, on the 64-bit concentrator timeline
 @param packet[in] Packet to be queued in JiT queue
 @param pkt_type[in] Type of packet to be queued: Downlink, Beacon
 @return success if the function was able to queue the packet
@@ -113,6 +171,8 @@ void jit_queue_init(struct jit_queue_s *queue);
 This function is typically used when a packet is received from server for downlink.
 It will check if packet can be queued, with several criterias. Once the packet is queued, it has to be
 sent over the air. So all checks should happen before the packet being actually in the queue.
+The 32-bit packet timestamp is extended to the 64-bit timeline in the counter epoch (wrap) nearest
+to the current time, so all comparisons in the queue are free from counter roll-over.
 */
 enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type);
 
@@ -134,7 +194,7 @@ enum jit_error_e jit_dequeue(struct jit_queue_s *queue, int index, struct lgw_pk
 @brief Check if there is a packet soon to be sent from the JiT queue.
 
 @param queue[in] Just in Time queue to parse for peeking a packet
-@param time[in] Current concentrator time
+@param time[in] Current concentrator time, on the 64-bit concentrator timeline
 @param pkt_idx[out] Packet index which is soon to be dequeued.
 @return success if the function was able to parse the queue. pkt_idx is set to -1 if no packet found.
 
@@ -144,6 +204,101 @@ enough the current concentrator time.
 */
 enum jit_error_e jit_peek(struct jit_queue_s *queue, struct timeval *time, int *pkt_idx);
 
+/**
+@brief Report that the last dequeued packet has been programmed in the concentrator, to adapt ASAP delay.
+
+@param queue[in/out] Just in Time queue from which the packet was dequeued
+@param time[in] Current concentrator time, once the packet has been sent to the concentrator
+@param count_us[in] Timestamp of the packet sent
+@return TX latency measured, in microseconds
+
+The TX latency is the time between the moment the packet could be dequeued and the moment it
+was actually programmed in the concentrator (thread polling, concentrator access, SPI transfer).
+The ASAP delay given to immediate downlinks is derived from the 99th percentile of that latency.
+The packet is kept as the one scheduled in the concentrator, see jit_cancel_scheduled_tx.
+*/
+uint32_t jit_report_tx(struct jit_queue_s *queue, struct timeval *time, uint32_t count_us);
+
+/**
+@brief Report that the last dequeued packet will not be emitted, to release its duty-cycle airtime.
+
+@param queue[in/out] Just in Time queue from which the packet was dequeued
+@return success if the function was able to process the report
+
+Airtime is booked in the duty-cycle ledger when a packet is enqueued. It is released when a
+queued packet is dropped by jit_peek, and must be released with this function when a dequeued
+packet could not be programmed in the concentrator (concentrator busy, lgw_send failure).
+*/
+enum jit_error_e jit_cancel_tx(struct jit_queue_s *queue);
+
+/**
+@brief Report that the packet scheduled in the concentrator will be overwritten, to release its duty-cycle airtime.
+
+@param queue[in/out] Just in Time queue
+@return success if the function was able to process the report
+
+Must be called when the last dequeued packet is about to be programmed while the concentrator
+still holds a packet scheduled for later (TX_SCHEDULED status): that packet is never emitted.
+*/
+enum jit_error_e jit_cancel_scheduled_tx(struct jit_queue_s *queue);
+
+/**
+@brief Configure the bounds of the delay given to immediate downlinks.
+
+@param queue[in/out] Just in Time queue to be configured
+@param floor_us[in] Minimum ASAP delay, in microseconds
+@param ceiling_us[in] Maximum ASAP delay, in microseconds
+@return success if the bounds are valid and have been applied
+
+This function has to be called after jit_queue_init.
+*/
+enum jit_error_e jit_asap_set_bounds(struct jit_queue_s *queue, uint32_t floor_us, uint32_t ceiling_us);
+
+/**
+@brief Add a duty-cycle limited sub-band.
+
+@param queue[in/out] Just in Time queue to be configured
+@param freq_min[in] Lowest frequency of the sub-band, in Hz
+@param freq_max[in] Highest frequency of the sub-band, in Hz
+@param percent[in] Duty-cycle limit, in percent (eg. 1.0 for 1%)
+@param window[in] Observation window the limit applies to, in seconds
+@return success if the sub-band is valid and has been added
+
+This function has to be called after jit_queue_init. Packets which frequency is in no sub-band are
+not limited. Airtime is accounted in slots of window/JIT_DC_SLOTS, a packet is accepted if no
+window including its slot exceeds the budget.
+*/
+enum jit_error_e jit_duty_cycle_add_band(struct jit_queue_s *queue, uint32_t freq_min, uint32_t freq_max, float percent, uint32_t window);
+
+/**
+@brief Get the airtime used and remaining per duty-cycle limited sub-band.
+
+@param queue[in] Just in Time queue
+@param time[in] Current concentrator time, on the 64-bit concentrator timeline
+@param stats[out] Array of sub-band statistics, at least JIT_DC_BAND_MAX elements
+@return Number of sub-bands
+*/
+int jit_duty_cycle_get_stats(struct jit_queue_s *queue, struct timeval *time, struct jit_dc_stats_s *stats);
+
+/**
+@brief Get the current ASAP delay and the TX latency statistics it is derived from.
+
+@param queue[in] Just in Time queue
+@param asap_delay[out] Delay currently given to immediate downlinks, in microseconds
+@param latency_p50[out] Median TX latency, in microseconds (can be NULL)
+@param latency_p99[out] 99th percentile TX latency, in microseconds (can be NULL)
+*/
+void jit_asap_get_stats(struct jit_queue_s *queue, uint32_t *asap_delay, uint32_t *latency_p50, uint32_t *latency_p99);
+
+/**
+@brief Get the number of packets in the queue.
+
+@param queue[in] Just in Time queue
+@param nb_pkt[out] Number of packets in the queue, beacons included
+@param nb_beacon[out] Number of beacons in the queue
+*/
+void jit_get_occupancy(struct jit_queue_s *queue, uint8_t *nb_pkt, uint8_t *nb_beacon);
+
 /**
 @brief Debug function to print the queue's content on console
 
@@ -0,0 +1,141 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Local metrics endpoint
+        Serves counters, gauges and histograms in Prometheus text format
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_METRICS_H
+#define _LORA_PKTFWD_METRICS_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stddef.h>     /* size_t */
+#include <pthread.h>
+
+#include "hdrhist.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define METRICS_HIST_MAX_BOUNDS 16      /* Maximum number of buckets of a histogram, +Inf excluded */
+#define METRICS_UNIX_PREFIX     "unix:" /* Prefix of a listen address designating a Unix socket path */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct metrics_hist_s {
+    pthread_mutex_t mx;         /* Serialize observations and exposition */
+    int nb_bounds;              /* Number of buckets, +Inf excluded */
+    double bounds[METRICS_HIST_MAX_BOUNDS]; /* Upper bounds of buckets, increasing */
+    uint64_t buckets[METRICS_HIST_MAX_BOUNDS + 1]; /* Observations per bucket (not cumulative), last one is +Inf */
+    uint64_t count;             /* Total number of observations */
+    double sum;                 /* Sum of all observations */
+};
+
+struct metrics_buf_s {
+    char *data;                 /* Exposition text, null terminated */
+    size_t size;                /* Allocated size */
+    size_t len;                 /* Length of the text */
+    bool error;                 /* Set when memory could not be allocated, text is truncated */
+};
+
+/**
+@brief Callback filling the exposition text, called by the metrics thread for each request
+*/
+typedef void (*metrics_collect_cb)(struct metrics_buf_s *buf);
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a histogram.
+
+@param hist[out] Histogram to be initialized
+@param bounds[in] Upper bounds of the buckets, in increasing order
+@param nb_bounds[in] Number of bounds, at most METRICS_HIST_MAX_BOUNDS
+*/
+void metrics_hist_init(struct metrics_hist_s *hist, const double *bounds, int nb_bounds);
+
+/**
+@brief Record an observation in a histogram (thread safe).
+
+@param hist[in/out] Histogram
+@param value[in] Observed value, in the unit of the bounds
+*/
+void metrics_hist_observe(struct metrics_hist_s *hist, double value);
+
+/**
+@brief Append a counter to the exposition text.
+
+@param buf[in/out] Exposition text
+@param name[in] Metric name, ending with "_total" by convention
+@param help[in] Metric description
+@param value[in] Counter value, never decreasing over the life of the process
+*/
+void metrics_counter(struct metrics_buf_s *buf, const char *name, const char *help, uint64_t value);
+
+/**
+@brief Append a gauge to the exposition text.
+
+@param buf[in/out] Exposition text
+@param name[in] Metric name
+@param help[in] Metric description
+@param value[in] Current value
+*/
+void metrics_gauge(struct metrics_buf_s *buf, const char *name, const char *help, double value);
+
+/**
+@brief Append a histogram (cumulative buckets, sum and count) to the exposition text.
+
+@param buf[in/out] Exposition text
+@param name[in] Metric name
+@param help[in] Metric description
+@param hist[in] Histogram, read under its own lock
+*/
+void metrics_histogram(struct metrics_buf_s *buf, const char *name, const char *help, struct metrics_hist_s *hist);
+
+/**
+@brief Append a histogram rendered from a log-linear histogram to the exposition text.
+
+@param buf[in/out] Exposition text
+@param name[in] Metric name
+@param help[in] Metric description
+@param hist[in] Histogram, copied by the caller under the lock protecting it
+@param unit[in] Value of one recorded unit in the exposition unit (eg. 1E-6 for microseconds exposed in seconds)
+@param bounds[in] Upper bounds of the exposed buckets, in the exposition unit and increasing order
+@param nb_bounds[in] Number of bounds
+*/
+void metrics_hdr_histogram(struct metrics_buf_s *buf, const char *name, const char *help, const struct hdr_hist_s *hist, double unit, const double *bounds, int nb_bounds);
+
+/**
+@brief Start the metrics thread, listening for scrape requests.
+
+@param listen_addr[in] "unix:<path>" for a Unix socket, or a TCP port number bound to localhost
+@param collect[in] Callback generating the exposition text
+@return 0 if the endpoint is listening, -1 otherwise
+
+Each connection gets a single HTTP/1.0 response, whatever the request path is.
+*/
+int metrics_start(const char *listen_addr, metrics_collect_cb collect);
+
+/**
+@brief Stop the metrics thread and close the endpoint (no effect if it was not started).
+*/
+void metrics_stop(void);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
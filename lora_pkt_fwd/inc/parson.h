@@ -56,10 +56,88 @@ typedef int JSON_Status;
 typedef void * (*JSON_Malloc_Function)(size_t);
 typedef void   (*JSON_Free_Function)(void *);
 
+/* Bump allocator on a caller-provided buffer. Fields are read-only for the caller. */
+typedef struct json_arena_t {
+    char   *buffer;     /* memory given to json_arena_init */
+    size_t  size;       /* size of the buffer */
+    size_t  used;       /* bytes used since last reset, alignment included */
+    size_t  peak;       /* maximum of used since init */
+    size_t  nb_allocs;  /* number of allocations since last reset */
+    int     overflow;   /* set when an allocation did not fit since last reset */
+} JSON_Arena;
+
+/* Streaming parser handlers, called in document order, NULL handlers are skipped. Names and strings
+   are decoded and null-terminated in the caller scratch buffer, valid until the handler returns.
+   A handler returns JSONSaxContinue, JSONSaxStop to end the parsing successfully (early
+   termination), or JSONSaxAbort to make it fail. */
+enum json_sax_result_t {
+    JSONSaxAbort    = -1,
+    JSONSaxContinue = 0,
+    JSONSaxStop     = 1
+};
+typedef struct json_sax_t {
+    int (*begin_object)(void *context);
+    int (*end_object)(void *context);
+    int (*begin_array)(void *context);
+    int (*end_array)(void *context);
+    int (*key)(void *context, const char *name, size_t len);     /* followed by the value events */
+    int (*string)(void *context, const char *string, size_t len);
+    int (*number)(void *context, double number);
+    int (*boolean)(void *context, int boolean);
+    int (*null)(void *context);
+} JSON_Sax;
+
+/* Output of the single-pass serializer. Text is appended to buf; when it is full, flush is called
+   to make room, by consuming the buf[0..used) pending bytes and lowering used (e.g. send or write
+   them), or by replacing buf and size. Without flush, serialization fails when buf is full. */
+typedef struct json_writer_t JSON_Writer;
+typedef JSON_Status (*JSON_Writer_Flush)(JSON_Writer *writer, size_t needed); /* needed: bytes waiting */
+struct json_writer_t {
+    char   *buf;        /* output buffer */
+    size_t  size;       /* size of the buffer */
+    size_t  used;       /* bytes pending in the buffer */
+    size_t  total;      /* bytes written since init, flushed ones included */
+    JSON_Writer_Flush flush; /* NULL: fixed buffer */
+    void   *context;    /* for the flush function */
+    int     error;      /* set when the buffer was full and could not be flushed */
+};
+
 /* Call only once, before calling any other function from parson API. If not called, malloc and free
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
+/* Objects having at least nb_names names (default 16) get a hash index of their names, built by
+   the first lookup (get, dotget, or adding a name). As the index is built by a lookup, lookups in
+   a large object shared by several threads must be serialized. 0 disables the index for objects
+   without one yet, call it before parsing or building the objects it should apply to. */
+void json_set_object_index_threshold(size_t nb_names);
+
+/* Arena parsing: all values, names and strings of the parsed tree (and the file contents or
+   the copy used to remove comments) are taken from the arena, no other allocation is made.
+   The tree is read-only: functions modifying it fail, json_value_free does nothing, and it
+   is released at once by json_arena_reset. A parse returning NULL with arena->overflow set
+   needs a larger arena. */
+void json_arena_init(JSON_Arena *arena, void *buffer, size_t size);
+void json_arena_reset(JSON_Arena *arena); /* invalidates all trees parsed in the arena */
+JSON_Value * json_parse_file_arena(const char *filename, JSON_Arena *arena);
+JSON_Value * json_parse_file_with_comments_arena(const char *filename, JSON_Arena *arena);
+JSON_Value * json_parse_string_arena(const char *string, JSON_Arena *arena);
+JSON_Value * json_parse_string_with_comments_arena(const char *string, JSON_Arena *arena);
+
+/* Streaming parsing: same grammar and tokens as the tree parser, but no value is built and nothing
+   is allocated (except the file contents for json_parse_file_with_comments_sax). Duplicate names
+   are not detected. Parsing fails if a name or string does not fit in scratch (decoded strings are
+   never longer than in the document). Returns JSONSuccess when the document has been parsed or a
+   handler stopped the parsing, JSONFailure on error or when a handler aborted it. */
+JSON_Status json_parse_string_sax(const char *string, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size);
+
+/* WARNING: unlike json_parse_string_with_comments, this function modifies string. To avoid any
+   allocation, comments are overwritten with spaces in the caller's buffer, which must be writable
+   (not a string literal) and is left without its comments, even if the parsing fails. Pass a copy
+   if the original document is still needed. */
+JSON_Status json_parse_string_with_comments_sax(char *string, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size);
+JSON_Status json_parse_file_with_comments_sax(const char *filename, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size);
+
 /* Parses first JSON value in a file, returns NULL in case of error */
 JSON_Value * json_parse_file(const char *filename);
 
@@ -80,6 +158,15 @@ JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename);
 char *      json_serialize_to_string(const JSON_Value *value);
 
+/* Single-pass serialization, text is not null-terminated. The writer can be used for several values
+   in a row, and json_writer_append for text around them. A growable writer allocates its buffer,
+   doubling it when full, and writer->buf must be released with json_free_serialized_string. */
+void        json_writer_init(JSON_Writer *writer, char *buf, size_t size, JSON_Writer_Flush flush, void *context);
+JSON_Status json_writer_init_growable(JSON_Writer *writer, size_t initial_size);
+JSON_Status json_writer_append(JSON_Writer *writer, const char *text, size_t len);
+JSON_Status json_serialize_to_writer(JSON_Writer *writer, const JSON_Value *value);
+JSON_Status json_serialize_to_writer_pretty(JSON_Writer *writer, const JSON_Value *value);
+
 /* Pretty serialization */
 size_t      json_serialization_size_pretty(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
@@ -127,6 +214,7 @@ int           json_object_dotget_boolean(const JSON_Object *object, const char *
 /* Functions to get available names */
 size_t        json_object_get_count(const JSON_Object *object);
 const char  * json_object_get_name (const JSON_Object *object, size_t index);
+JSON_Value  * json_object_get_value_at(const JSON_Object *object, size_t index); /* value of the name at index, without lookup */
 
 /* Creates new name-value pair or frees and replaces old value with a new one.
  * json_object_set_value does not copy passed value so it shouldn't be freed afterwards. */
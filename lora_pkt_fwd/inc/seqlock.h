@@ -0,0 +1,77 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : sequence lock
+        Data written by a single thread at a time, read by any thread without
+        blocking. Readers copy the data and retry if an update overlapped.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_SEQLOCK_H
+#define _LORA_PKTFWD_SEQLOCK_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS (INLINE) -------------------------------------------- */
+
+/**
+@brief Start updating data protected by a sequence lock. Writers must be serialized.
+
+@param seq[in/out] Sequence counter of the data, odd while it is being updated
+*/
+static inline void seqlock_write_begin(uint32_t *seq) {
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+
+    __atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); /* odd sequence visible before data is modified */
+}
+
+/**
+@brief End updating data protected by a sequence lock.
+
+@param seq[in/out] Sequence counter of the data, even again once the update is visible
+*/
+static inline void seqlock_write_end(uint32_t *seq) {
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+
+    __atomic_store_n(seq, s + 1, __ATOMIC_RELEASE); /* data visible before even sequence */
+}
+
+/**
+@brief Start copying data protected by a sequence lock.
+
+@param seq[in] Sequence counter of the data
+@return Sequence value to be given to seqlock_read_retry() once the copy is done
+*/
+static inline uint32_t seqlock_read_begin(const uint32_t *seq) {
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+/**
+@brief Check if a copy of data protected by a sequence lock must be done again.
+
+@param seq[in] Sequence counter of the data
+@param start[in] Value returned by seqlock_read_begin() before the copy
+@return true if an update was in progress or overlapped the copy, false if the copy is consistent
+*/
+static inline bool seqlock_read_retry(const uint32_t *seq, uint32_t start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); /* copy done before sequence is checked again */
+    return ((start & 1) != 0) || (__atomic_load_n(seq, __ATOMIC_RELAXED) != start);
+}
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,70 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : GPS time reference
+        Time reference used for GPS <-> timestamp conversion, updated by the
+        GPS and validation threads, read by any thread through a sequence lock
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_TIMEREF_H
+#define _LORA_PKTFWD_TIMEREF_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <pthread.h>    /* pthread_mutex_t */
+
+#include "loragw_gps.h" /* struct tref */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct timeref_s {
+    pthread_mutex_t mx;     /* Serialize updates, readers do not take it */
+    uint32_t seq;           /* Sequence counter, odd while the reference is being updated */
+    bool valid;             /* Is the reference acceptable (ie. not too old) */
+    struct tref ref;        /* Time reference */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a time reference, as not valid.
+
+@param tr[out] Time reference to be initialized, before any thread uses it
+*/
+void timeref_init(struct timeref_s *tr);
+
+/**
+@brief Publish a new time reference and its validity.
+
+@param tr[in/out] Time reference, tr->mx must be locked by the caller
+@param ref[in] New reference
+@param valid[in] Validity of the new reference
+*/
+void timeref_publish(struct timeref_s *tr, const struct tref *ref, bool valid);
+
+/**
+@brief Get a consistent copy of a time reference, without locking.
+
+@param tr[in] Time reference
+@param ref[out] Copy of the reference
+@return Validity of the reference
+*/
+bool timeref_read(const struct timeref_s *tr, struct tref *ref);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -20,12 +20,52 @@ Maintainer: Michael Coracin
 /* -------------------------------------------------------------------------- */
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
+#include <stdint.h>      /* C99 types */
 #include <sys/time.h>    /* timeval */
 
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
 
-int get_concentrator_time(struct timeval *concent_time, struct timeval unix_time);
+/**
+@brief Get current host time, from the clock used for concentrator time synchronization.
+
+@param host_time[out] Host monotonic time (not affected by NTP steps or slewing)
+*/
+void get_host_time(struct timeval *host_time);
+
+/**
+@brief Convert host time to concentrator time, using the host/concentrator clock model.
+
+@param concent_time[out] Concentrator time (1MHz counter, extended beyond 32 bits)
+@param host_time[in] Host time, as given by get_host_time()
+@return 0 if the clock model is valid, -1 otherwise
+*/
+int get_concentrator_time(struct timeval *concent_time, struct timeval host_time);
+
+/**
+@brief Get the current host/concentrator clock model estimation.
+
+@param drift_ppm[out] Concentrator frequency error compared to host, in ppm (can be NULL)
+@param residual_us[out] RMS residual error of the model, in µs (can be NULL)
+@param uncertainty_us[out] Uncertainty bound of the last sample, half the round-trip of the counter read, in µs (can be NULL)
+@param nb_samples[out] Number of samples used by the model (can be NULL)
+@return 0 if the clock model is valid, -1 otherwise
+*/
+int get_timersync_model(double *drift_ppm, double *residual_us, double *uncertainty_us, int *nb_samples);
+
+/**
+@brief Add a (host, concentrator) time sample to the clock model.
+
+@param host_us[in] Host time at which the counter was sampled, in µs (same clock as get_host_time())
+@param count_us[in] Concentrator 32-bit counter value, in µs
+@param uncertainty_us[in] Uncertainty bound of the sample (half the round-trip of the counter read), in µs
+@return 0 if the sample was used, -1 if it was rejected as an outlier
+
+Called by thread_timersync for each counter read. The counter is extended to 64 bits, a wrap
+being detected when it goes backwards, so samples must be less than ~71 minutes apart. Offline
+tools can drive the clock model with simulated samples through this function.
+*/
+int timersync_sample(int64_t host_us, uint32_t count_us, double uncertainty_us);
 
 void thread_timersync(void);
 
@@ -0,0 +1,92 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : XTAL error correction estimator
+        Scalar Kalman filter on the GPS measured XTAL error
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+#ifndef _LORA_PKTFWD_XTALCORR_H
+#define _LORA_PKTFWD_XTALCORR_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define XCORR_DEFAULT_MAX_STDDEV    0.1 /* default standard deviation (in ppm) required to use the correction */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+struct xcorr_s {
+    uint32_t nb_samples;    /* Number of samples accepted since last reset */
+    uint32_t nb_rejected;   /* Number of samples rejected as outliers since last reset */
+    uint32_t nb_consecutive_rejected; /* Number of consecutive rejected samples */
+    double last_sample;     /* Last accepted sample, as a correction factor */
+    double estimate;        /* Estimated XTAL correction factor (1/xtal_err) */
+    double variance;        /* Variance of the estimate */
+    double noise_var;       /* Estimated variance of the measurement noise */
+    bool ready;             /* Set when the estimate has been precise enough once since last reset */
+    bool restored;          /* Set when the estimate has been restored and not confirmed by a sample yet */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Reset the XTAL correction estimator, discarding all previous samples.
+
+@param xc[out] Estimator to be reset
+*/
+void xcorr_reset(struct xcorr_s *xc);
+
+/**
+@brief Update the XTAL correction estimate with a new measurement.
+
+@param xc[in/out] Estimator
+@param xtal_err[in] XTAL error measured on a GPS PPS interval (concentrator counts / GPS time)
+@param max_stddev[in] Standard deviation of the estimate (in ppm) required to declare it ready early
+@return 0 if the sample has been used, -1 if it has been rejected as an outlier
+
+The estimate is declared ready (and stays ready until reset) as soon as its standard deviation is
+below max_stddev, or at most after 128 samples, when a plain average would be.
+*/
+int xcorr_update(struct xcorr_s *xc, double xtal_err, double max_stddev);
+
+/**
+@brief Restore a previously saved XTAL correction estimate.
+
+@param xc[out] Estimator
+@param saved[in] Estimator state, as saved
+@param age[in] Time elapsed since the last sample of the saved state, in seconds
+
+The variance of the estimate is increased according to its age, and the estimate is only used
+(declared ready) once the next sample agrees with it. Otherwise, the estimator restarts from
+that sample.
+*/
+void xcorr_restore(struct xcorr_s *xc, const struct xcorr_s *saved, double age);
+
+/**
+@brief Get the standard deviation of the XTAL correction estimate.
+
+@param xc[in] Estimator
+@return Standard deviation of the estimate, in ppm
+*/
+double xcorr_stddev(const struct xcorr_s *xc);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
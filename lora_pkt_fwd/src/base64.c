@@ -8,6 +8,8 @@
 
 Description:
     Base64 encoding & decoding library
+    Table driven, with SSSE3/AVX2 (x86) and NEON (ARM) kernels selected at run
+    time for the full blocks
 
 License: Revised BSD License, see LICENSE.TXT file include in the project
 Maintainer: Sylvain Miermont
@@ -20,9 +22,20 @@ Maintainer: Sylvain Miermont
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>     /* memcpy */
 
 #include "base64.h"
 
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    /* NEON is part of the target instruction set, no run time check needed */
+    #define B64_NEON
+    #include <arm_neon.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    /* SSSE3 and AVX2 kernels are compiled whatever the target, and used only if the CPU supports them */
+    #define B64_X86
+    #include <immintrin.h>
+#endif
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
 
@@ -35,61 +48,414 @@ Maintainer: Sylvain Miermont
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
+#define B64_INVALID         0xFF    /* decoding table value of characters out of the Base64 alphabet */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MODULE-WIDE VARIABLES ---------------------------------------- */
 
-static char code_62 = '+';    /* RFC 1421 standard character for code 62 */
-static char code_63 = '/';    /* RFC 1421 standard character for code 63 */
 static char code_pad = '=';    /* RFC 1421 padding character if padding */
 
+/* RFC 1421 standard alphabet, code 62 is '+' and code 63 is '/' */
+static const char enc_table[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* code of each ASCII character, B64_INVALID if not in the alphabet */
+static const uint8_t dec_table[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+static int impl_selected = B64_IMPL_AUTO; /* resolved on first use, shared by all threads */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
 
 /**
-@brief Convert a code in the range 0-63 to an ASCII character
+@brief Check if an implementation can be used on this CPU
 */
-char code_to_char(uint8_t x);
+static int impl_supported(enum b64_impl_e impl);
 
 /**
-@brief Convert an ASCII character to a code in the range 0-63
+@brief Get the selected implementation, selecting the best one on first use
 */
-uint8_t char_to_code(char x);
+static enum b64_impl_e impl_get(void);
+
+/**
+@brief Encode full blocks of 3 bytes into 4 characters each
+@return number of blocks encoded (all of them)
+*/
+static int encode_blocks_scalar(const uint8_t * in, int nb_blocks, char * out);
+
+/**
+@brief Decode full blocks of 4 characters into 3 bytes each
+@return number of blocks decoded, less than nb_blocks if an invalid character was found
+*/
+static int decode_blocks_scalar(const char * in, int nb_blocks, uint8_t * out);
+
+/**
+@brief Encode/decode full blocks with the selected implementation
+The vector kernels process as many blocks as their loads and stores allow, the
+scalar one does the rest (and reports invalid characters).
+*/
+static int encode_blocks(const uint8_t * in, int nb_blocks, char * out);
+static int decode_blocks(const char * in, int nb_blocks, uint8_t * out);
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
-char code_to_char(uint8_t x) {
-    if (x <= 25) {
-        return 'A' + x;
-    } else if ((x >= 26) && (x <= 51)) {
-        return 'a' + (x-26);
-    } else if ((x >= 52) && (x <= 61)) {
-        return '0' + (x-52);
-    } else if (x == 62) {
-        return code_62;
-    } else if (x == 63) {
-        return code_63;
-    } else {
-        DEBUG("ERROR: %i IS OUT OF RANGE 0-63 FOR BASE64 ENCODING\n", x);
-        exit(EXIT_FAILURE);
-    } //TODO: improve error management
+static int encode_blocks_scalar(const uint8_t * in, int nb_blocks, char * out) {
+    int i;
+    uint32_t b;
+
+    for (i=0; i < nb_blocks; ++i) {
+        b  = (uint32_t)in[3*i] << 16;
+        b |= (uint32_t)in[3*i + 1] << 8;
+        b |= (uint32_t)in[3*i + 2];
+        out[4*i + 0] = enc_table[(b >> 18) & 0x3F];
+        out[4*i + 1] = enc_table[(b >> 12) & 0x3F];
+        out[4*i + 2] = enc_table[(b >> 6 ) & 0x3F];
+        out[4*i + 3] = enc_table[ b        & 0x3F];
+    }
+    return nb_blocks;
 }
 
-uint8_t char_to_code(char x) {
-    if ((x >= 'A') && (x <= 'Z')) {
-        return (uint8_t)x - (uint8_t)'A';
-    } else if ((x >= 'a') && (x <= 'z')) {
-        return (uint8_t)x - (uint8_t)'a' + 26;
-    } else if ((x >= '0') && (x <= '9')) {
-        return (uint8_t)x - (uint8_t)'0' + 52;
-    } else if (x == code_62) {
-        return 62;
-    } else if (x == code_63) {
-        return 63;
-    } else {
-        DEBUG("ERROR: %c (0x%x) IS INVALID CHARACTER FOR BASE64 DECODING\n", x, x);
-        exit(EXIT_FAILURE);
-    } //TODO: improve error management
+static int decode_blocks_scalar(const char * in, int nb_blocks, uint8_t * out) {
+    int i;
+    uint8_t c0, c1, c2, c3;
+    uint32_t b;
+
+    for (i=0; i < nb_blocks; ++i) {
+        c0 = dec_table[(uint8_t)in[4*i]];
+        c1 = dec_table[(uint8_t)in[4*i + 1]];
+        c2 = dec_table[(uint8_t)in[4*i + 2]];
+        c3 = dec_table[(uint8_t)in[4*i + 3]];
+        if (((c0 | c1 | c2 | c3) & 0xC0) != 0) { /* B64_INVALID has the top bits set, codes have not */
+            DEBUG("ERROR: INVALID CHARACTER IN BLOCK %i FOR BASE64 DECODING\n", i);
+            break;
+        }
+        b = ((uint32_t)c0 << 18) | ((uint32_t)c1 << 12) | ((uint32_t)c2 << 6) | (uint32_t)c3;
+        out[3*i + 0] = (b >> 16) & 0xFF;
+        out[3*i + 1] = (b >> 8 ) & 0xFF;
+        out[3*i + 2] =  b        & 0xFF;
+    }
+    return i;
+}
+
+#ifdef B64_X86
+
+/* Kernels after W. Mula and D. Lemire, "Faster Base64 Encoding and Decoding
+ * using AVX2 Instructions", and A. Klomp's base64 library for the validation.
+ * Encoding: bytes are spread to 32-bit lanes (s1 s0 s2 s1), the 4 codes are
+ * extracted with 2 multiplications and translated to ASCII by adding an
+ * offset looked up by range. Decoding: the character nibbles index 2 tables
+ * whose AND is non zero for invalid characters, codes are merged back with 2
+ * multiply-add. */
+
+__attribute__((target("ssse3")))
+static int encode_blocks_ssse3(const uint8_t * in, int nb_blocks, char * out) {
+    const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i v, t0, t1, idx, r;
+    int i = 0;
+
+    /* 4 blocks per iteration, but 16 bytes are loaded */
+    while (3 * (nb_blocks - i) >= 16) {
+        v = _mm_loadu_si128((const __m128i *)(in + 3*i));
+        v = _mm_shuffle_epi8(v, shuf);
+        t0 = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+        t1 = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+        idx = _mm_or_si128(t0, t1);
+        /* 0: 26-51, 1-10: 52-61, 11: 62, 12: 63, 13: 0-25 */
+        r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+        r = _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, r));
+        _mm_storeu_si128((__m128i *)(out + 4*i), r);
+        i += 4;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int encode_blocks_avx2(const uint8_t * in, int nb_blocks, char * out) {
+    const __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m256i v, t0, t1, idx, r;
+    int i = 0;
+
+    /* 8 blocks per iteration, 2 loads of 16 bytes, 12 bytes apart */
+    while (3 * (nb_blocks - i) >= 28) {
+        v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + 3*i))),
+                                    _mm_loadu_si128((const __m128i *)(in + 3*i + 12)), 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+        t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+        idx = _mm256_or_si256(t0, t1);
+        r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+        r = _mm256_add_epi8(idx, _mm256_shuffle_epi8(offsets, r));
+        _mm256_storeu_si256((__m256i *)(out + 4*i), r);
+        i += 8;
+    }
+    _mm256_zeroupper(); /* the SSSE3 kernel is not VEX encoded, avoid the AVX to SSE transition penalty */
+    return i + encode_blocks_ssse3(in + 3*i, nb_blocks - i, out + 4*i);
+}
+
+__attribute__((target("ssse3")))
+static int decode_blocks_ssse3(const char * in, int nb_blocks, uint8_t * out) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    __m128i v, hi, lo, roll;
+    uint32_t tail;
+    int i = 0;
+
+    /* 4 blocks per iteration, exactly 12 bytes are stored */
+    while (nb_blocks - i >= 4) {
+        v = _mm_loadu_si128((const __m128i *)(in + 4*i));
+        hi = _mm_and_si128(_mm_srli_epi32(v, 4), _mm_set1_epi8(0x0F));
+        lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi)), _mm_setzero_si128())) != 0xFFFF) {
+            break; /* invalid character, reported by the scalar decoder */
+        }
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), hi));
+        v = _mm_add_epi8(v, roll);
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        v = _mm_shuffle_epi8(v, pack);
+        _mm_storel_epi64((__m128i *)(out + 3*i), v);
+        tail = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        memcpy(out + 3*i + 8, &tail, 4);
+        i += 4;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int decode_blocks_avx2(const char * in, int nb_blocks, uint8_t * out) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    __m256i v, hi, lo, roll;
+    int i = 0;
+
+    /* 8 blocks per iteration, exactly 24 bytes are stored */
+    while (nb_blocks - i >= 8) {
+        v = _mm256_loadu_si256((const __m256i *)(in + 4*i));
+        hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi8(0x0F));
+        lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi)), _mm256_setzero_si256())) != -1) {
+            break; /* invalid character, reported by the scalar decoder */
+        }
+        roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')), hi));
+        v = _mm256_add_epi8(v, roll);
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm_storeu_si128((__m128i *)(out + 3*i), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *)(out + 3*i + 16), _mm256_extracti128_si256(v, 1));
+        i += 8;
+    }
+    _mm256_zeroupper(); /* the SSSE3 kernel is not VEX encoded, avoid the AVX to SSE transition penalty */
+    return i + decode_blocks_ssse3(in + 4*i, nb_blocks - i, out + 3*i);
+}
+
+#endif /* B64_X86 */
+
+#ifdef B64_NEON
+
+/* 16 blocks per iteration, de-interleaved by the structure loads and stores */
+
+static inline uint8x16_t neon_encode_codes(uint8x16_t x) {
+    /* offset of each range of codes to its characters: 'A', 'a' - 26, '0' - 52, '+' - 62, '/' - 63 */
+    uint8x16_t r = vaddq_u8(x, vdupq_n_u8('A'));
+    r = vaddq_u8(r, vandq_u8(vcgeq_u8(x, vdupq_n_u8(26)), vdupq_n_u8(6)));
+    r = vsubq_u8(r, vandq_u8(vcgeq_u8(x, vdupq_n_u8(52)), vdupq_n_u8(75)));
+    r = vsubq_u8(r, vandq_u8(vceqq_u8(x, vdupq_n_u8(62)), vdupq_n_u8(15)));
+    r = vsubq_u8(r, vandq_u8(vceqq_u8(x, vdupq_n_u8(63)), vdupq_n_u8(12)));
+    return r;
+}
+
+static inline uint8x16_t neon_decode_chars(uint8x16_t c, uint8x16_t * invalid) {
+    uint8x16_t upper = vcleq_u8(vsubq_u8(c, vdupq_n_u8('A')), vdupq_n_u8(25));
+    uint8x16_t lower = vcleq_u8(vsubq_u8(c, vdupq_n_u8('a')), vdupq_n_u8(25));
+    uint8x16_t digit = vcleq_u8(vsubq_u8(c, vdupq_n_u8('0')), vdupq_n_u8(9));
+    uint8x16_t plus = vceqq_u8(c, vdupq_n_u8('+'));
+    uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+    uint8x16_t off;
+
+    off = vandq_u8(upper, vdupq_n_u8((uint8_t)-65));
+    off = vorrq_u8(off, vandq_u8(lower, vdupq_n_u8((uint8_t)-71)));
+    off = vorrq_u8(off, vandq_u8(digit, vdupq_n_u8(4)));
+    off = vorrq_u8(off, vandq_u8(plus, vdupq_n_u8(19)));
+    off = vorrq_u8(off, vandq_u8(slash, vdupq_n_u8(16)));
+    *invalid = vorrq_u8(*invalid, vmvnq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(vorrq_u8(digit, plus), slash))));
+    return vaddq_u8(c, off);
+}
+
+static int encode_blocks_neon(const uint8_t * in, int nb_blocks, char * out) {
+    uint8x16x3_t s;
+    uint8x16x4_t c;
+    int i = 0;
+
+    while (nb_blocks - i >= 16) {
+        s = vld3q_u8(in + 3*i);
+        c.val[0] = vshrq_n_u8(s.val[0], 2);
+        c.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(s.val[0], 4), vshrq_n_u8(s.val[1], 4)), vdupq_n_u8(0x3F));
+        c.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(s.val[1], 2), vshrq_n_u8(s.val[2], 6)), vdupq_n_u8(0x3F));
+        c.val[3] = vandq_u8(s.val[2], vdupq_n_u8(0x3F));
+        c.val[0] = neon_encode_codes(c.val[0]);
+        c.val[1] = neon_encode_codes(c.val[1]);
+        c.val[2] = neon_encode_codes(c.val[2]);
+        c.val[3] = neon_encode_codes(c.val[3]);
+        vst4q_u8((uint8_t *)(out + 4*i), c);
+        i += 16;
+    }
+    return i;
+}
+
+static int decode_blocks_neon(const char * in, int nb_blocks, uint8_t * out) {
+    uint8x16x4_t c;
+    uint8x16x3_t s;
+    uint8x16_t invalid;
+    uint8x8_t inv;
+    int i = 0;
+
+    while (nb_blocks - i >= 16) {
+        c = vld4q_u8((const uint8_t *)(in + 4*i));
+        invalid = vdupq_n_u8(0);
+        c.val[0] = neon_decode_chars(c.val[0], &invalid);
+        c.val[1] = neon_decode_chars(c.val[1], &invalid);
+        c.val[2] = neon_decode_chars(c.val[2], &invalid);
+        c.val[3] = neon_decode_chars(c.val[3], &invalid);
+        inv = vorr_u8(vget_low_u8(invalid), vget_high_u8(invalid));
+        if (vget_lane_u64(vreinterpret_u64_u8(inv), 0) != 0) {
+            break; /* invalid character, reported by the scalar decoder */
+        }
+        s.val[0] = vorrq_u8(vshlq_n_u8(c.val[0], 2), vshrq_n_u8(c.val[1], 4));
+        s.val[1] = vorrq_u8(vshlq_n_u8(c.val[1], 4), vshrq_n_u8(c.val[2], 2));
+        s.val[2] = vorrq_u8(vshlq_n_u8(c.val[2], 6), c.val[3]);
+        vst3q_u8(out + 3*i, s);
+        i += 16;
+    }
+    return i;
+}
+
+#endif /* B64_NEON */
+
+static int impl_supported(enum b64_impl_e impl) {
+    switch (impl) {
+        case B64_IMPL_AUTO:
+        case B64_IMPL_SCALAR:
+            return 1;
+#ifdef B64_X86
+        case B64_IMPL_SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case B64_IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#ifdef B64_NEON
+        case B64_IMPL_NEON:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+static enum b64_impl_e impl_get(void) {
+    int impl = __atomic_load_n(&impl_selected, __ATOMIC_RELAXED);
+
+    if (impl == B64_IMPL_AUTO) {
+        /* all threads select the same one, no lock needed */
+        if (impl_supported(B64_IMPL_NEON)) {
+            impl = B64_IMPL_NEON;
+        } else if (impl_supported(B64_IMPL_AVX2)) {
+            impl = B64_IMPL_AVX2;
+        } else if (impl_supported(B64_IMPL_SSSE3)) {
+            impl = B64_IMPL_SSSE3;
+        } else {
+            impl = B64_IMPL_SCALAR;
+        }
+        __atomic_store_n(&impl_selected, impl, __ATOMIC_RELAXED);
+    }
+    return (enum b64_impl_e)impl;
+}
+
+static int encode_blocks(const uint8_t * in, int nb_blocks, char * out) {
+    int done;
+
+    switch (impl_get()) {
+#ifdef B64_X86
+        case B64_IMPL_AVX2:
+            done = encode_blocks_avx2(in, nb_blocks, out);
+            break;
+        case B64_IMPL_SSSE3:
+            done = encode_blocks_ssse3(in, nb_blocks, out);
+            break;
+#endif
+#ifdef B64_NEON
+        case B64_IMPL_NEON:
+            done = encode_blocks_neon(in, nb_blocks, out);
+            break;
+#endif
+        default:
+            done = 0;
+    }
+    return done + encode_blocks_scalar(in + 3*done, nb_blocks - done, out + 4*done);
+}
+
+static int decode_blocks(const char * in, int nb_blocks, uint8_t * out) {
+    int done;
+
+    switch (impl_get()) {
+#ifdef B64_X86
+        case B64_IMPL_AVX2:
+            done = decode_blocks_avx2(in, nb_blocks, out);
+            break;
+        case B64_IMPL_SSSE3:
+            done = decode_blocks_ssse3(in, nb_blocks, out);
+            break;
+#endif
+#ifdef B64_NEON
+        case B64_IMPL_NEON:
+            done = decode_blocks_neon(in, nb_blocks, out);
+            break;
+#endif
+        default:
+            done = 0;
+    }
+    return done + decode_blocks_scalar(in + 4*done, nb_blocks - done, out + 3*done);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -138,15 +504,7 @@ int bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len) {
     }
 
     /* process all the full blocks */
-    for (i=0; i < full_blocks; ++i) {
-        b  = (0xFF & in[3*i]    ) << 16;
-        b |= (0xFF & in[3*i + 1]) << 8;
-        b |=  0xFF & in[3*i + 2];
-        out[4*i + 0] = code_to_char((b >> 18) & 0x3F);
-        out[4*i + 1] = code_to_char((b >> 12) & 0x3F);
-        out[4*i + 2] = code_to_char((b >> 6 ) & 0x3F);
-        out[4*i + 3] = code_to_char( b        & 0x3F);
-    }
+    encode_blocks(in, full_blocks, out);
 
     /* process the last 'partial' block and terminate string */
     i = full_blocks;
@@ -154,15 +512,15 @@ int bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len) {
         out[4*i] =  0; /* null character to terminate string */
     } else if (last_chars == 2) {
         b  = (0xFF & in[3*i]    ) << 16;
-        out[4*i + 0] = code_to_char((b >> 18) & 0x3F);
-        out[4*i + 1] = code_to_char((b >> 12) & 0x3F);
+        out[4*i + 0] = enc_table[(b >> 18) & 0x3F];
+        out[4*i + 1] = enc_table[(b >> 12) & 0x3F];
         out[4*i + 2] =  0; /* null character to terminate string */
     } else if (last_chars == 3) {
         b  = (0xFF & in[3*i]    ) << 16;
         b |= (0xFF & in[3*i + 1]) << 8;
-        out[4*i + 0] = code_to_char((b >> 18) & 0x3F);
-        out[4*i + 1] = code_to_char((b >> 12) & 0x3F);
-        out[4*i + 2] = code_to_char((b >> 6 ) & 0x3F);
+        out[4*i + 0] = enc_table[(b >> 18) & 0x3F];
+        out[4*i + 1] = enc_table[(b >> 12) & 0x3F];
+        out[4*i + 2] = enc_table[(b >> 6 ) & 0x3F];
         out[4*i + 3] = 0; /* null character to terminate string */
     }
 
@@ -175,8 +533,8 @@ int b64_to_bin_nopad(const char * in, int size, uint8_t * out, int max_len) {
     int full_blocks; /* number of 3 unsigned chars / 4 characters blocks */
     int last_chars; /* number of characters <4 in the last block */
     int last_bytes; /* number of unsigned chars <3 in the last block */
+    uint8_t c[3] = {0, 0, 0}; /* codes of the last block */
     uint32_t b;
-    ;
 
     /* check input values */
     if ((out == NULL) || (in == NULL)) {
@@ -215,29 +573,35 @@ int b64_to_bin_nopad(const char * in, int size, uint8_t * out, int max_len) {
     }
 
     /* process all the full blocks */
-    for (i=0; i < full_blocks; ++i) {
-        b  = (0x3F & char_to_code(in[4*i]    )) << 18;
-        b |= (0x3F & char_to_code(in[4*i + 1])) << 12;
-        b |= (0x3F & char_to_code(in[4*i + 2])) << 6;
-        b |=  0x3F & char_to_code(in[4*i + 3]);
-        out[3*i + 0] = (b >> 16) & 0xFF;
-        out[3*i + 1] = (b >> 8 ) & 0xFF;
-        out[3*i + 2] =  b        & 0xFF;
+    if (decode_blocks(in, full_blocks, out) != full_blocks) {
+        DEBUG("ERROR: INVALID CHARACTER FOR BASE64 DECODING\n");
+        return -1;
     }
 
     /* process the last 'partial' block */
     i = full_blocks;
+    if (last_bytes > 0) {
+        c[0] = dec_table[(uint8_t)in[4*i]];
+        c[1] = dec_table[(uint8_t)in[4*i + 1]];
+        if (last_bytes == 2) {
+            c[2] = dec_table[(uint8_t)in[4*i + 2]];
+        }
+        if (((c[0] | c[1] | c[2]) & 0xC0) != 0) {
+            DEBUG("ERROR: INVALID CHARACTER FOR BASE64 DECODING\n");
+            return -1;
+        }
+    }
     if (last_bytes == 1) {
-        b  = (0x3F & char_to_code(in[4*i]    )) << 18;
-        b |= (0x3F & char_to_code(in[4*i + 1])) << 12;
+        b  = (uint32_t)c[0] << 18;
+        b |= (uint32_t)c[1] << 12;
         out[3*i + 0] = (b >> 16) & 0xFF;
         if (((b >> 12) & 0x0F) != 0) {
             DEBUG("WARNING: last character contains unusable bits\n");
         }
     } else if (last_bytes == 2) {
-        b  = (0x3F & char_to_code(in[4*i]    )) << 18;
-        b |= (0x3F & char_to_code(in[4*i + 1])) << 12;
-        b |= (0x3F & char_to_code(in[4*i + 2])) << 6;
+        b  = (uint32_t)c[0] << 18;
+        b |= (uint32_t)c[1] << 12;
+        b |= (uint32_t)c[2] << 6;
         out[3*i + 0] = (b >> 16) & 0xFF;
         out[3*i + 1] = (b >> 8 ) & 0xFF;
         if (((b >> 6) & 0x03) != 0) {
@@ -304,5 +668,29 @@ int b64_to_bin(const char * in, int size, uint8_t * out, int max_len) {
     }
 }
 
+int b64_set_impl(enum b64_impl_e impl) {
+    if (!impl_supported(impl)) {
+        DEBUG("ERROR: BASE64 IMPLEMENTATION %i NOT SUPPORTED\n", impl);
+        return -1;
+    }
+    __atomic_store_n(&impl_selected, (int)impl, __ATOMIC_RELAXED);
+    return 0;
+}
+
+enum b64_impl_e b64_get_impl(void) {
+    return impl_get();
+}
+
+const char * b64_impl_name(enum b64_impl_e impl) {
+    switch (impl) {
+        case B64_IMPL_AUTO:     return "auto";
+        case B64_IMPL_SCALAR:   return "scalar";
+        case B64_IMPL_SSSE3:    return "SSSE3";
+        case B64_IMPL_AVX2:     return "AVX2";
+        case B64_IMPL_NEON:     return "NEON";
+        default:                return "unknown";
+    }
+}
+
 
 /* --- EOF ------------------------------------------------------------------ */
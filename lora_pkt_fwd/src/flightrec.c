@@ -0,0 +1,148 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Flight recorder
+        Memory-mapped circular log of RX, TX scheduling and time sync events
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdio.h>      /* snprintf, rename */
+#include <string.h>     /* memset, memcpy, strerror */
+#include <errno.h>      /* error messages */
+#include <time.h>       /* clock_gettime */
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close, ftruncate */
+#include <sys/mman.h>   /* mmap, msync */
+
+#include "trace.h"
+#include "flightrec.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static struct flightrec_header_s *fr_header = NULL; /* mapped file, NULL while recording is disabled */
+static struct flightrec_record_s *fr_records = NULL;
+static uint32_t fr_mask = 0;    /* nb_records - 1 */
+static size_t fr_map_size = 0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int flightrec_open(const char *path, uint32_t nb_records, uint64_t gateway_id) {
+    char prev_path[256];
+    uint32_t nb = FLIGHTREC_MIN_SIZE;
+    struct timespec now;
+    void *map;
+    int fd;
+
+    if (fr_header != NULL) {
+        MSG("ERROR: [flightrec] recorder already started\n");
+        return -1;
+    }
+    if (nb_records > FLIGHTREC_MAX_SIZE) {
+        nb_records = FLIGHTREC_MAX_SIZE;
+    }
+    while (nb < nb_records) {
+        nb <<= 1;
+    }
+
+    /* keep the log of the previous run, it may be the one explaining a crash */
+    snprintf(prev_path, sizeof prev_path, "%s.prev", path);
+    if ((rename(path, prev_path) != 0) && (errno != ENOENT)) {
+        MSG("WARNING: [flightrec] failed to rename %s to %s (%s)\n", path, prev_path, strerror(errno));
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        MSG("ERROR: [flightrec] failed to open %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    fr_map_size = sizeof(struct flightrec_header_s) + (size_t)nb * sizeof(struct flightrec_record_s);
+    if (ftruncate(fd, (off_t)fr_map_size) != 0) {
+        MSG("ERROR: [flightrec] failed to size %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, fr_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); /* mapping stays valid */
+    if (map == MAP_FAILED) {
+        MSG("ERROR: [flightrec] failed to map %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+
+    /* file is zero filled: all records are marked as never written */
+    clock_gettime(CLOCK_REALTIME, &now);
+    fr_header = (struct flightrec_header_s *)map;
+    fr_header->version = FLIGHTREC_VERSION;
+    fr_header->header_size = sizeof(struct flightrec_header_s);
+    fr_header->record_size = sizeof(struct flightrec_record_s);
+    fr_header->nb_records = nb;
+    fr_header->write_idx = 0;
+    fr_header->open_time_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    fr_header->gateway_id = gateway_id;
+    memcpy(fr_header->magic, FLIGHTREC_MAGIC, sizeof FLIGHTREC_MAGIC);
+    fr_mask = nb - 1;
+    __atomic_store_n(&fr_records, (struct flightrec_record_s *)(fr_header + 1), __ATOMIC_RELEASE);
+
+    MSG("INFO: [flightrec] recording %u events to %s (%lu bytes)\n", nb, path, (unsigned long)fr_map_size);
+    return 0;
+}
+
+void flightrec_log(uint8_t type, uint8_t code, uint16_t size, uint32_t count_us, uint32_t freq_hz, uint32_t arg1, uint32_t arg2) {
+    struct flightrec_record_s *records = __atomic_load_n(&fr_records, __ATOMIC_ACQUIRE);
+    struct flightrec_record_s *rec;
+    struct timespec now;
+    uint32_t idx;
+
+    if (records == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    /* claim a record, concurrent writers never share one unless the log wraps within an event */
+    idx = __atomic_fetch_add(&fr_header->write_idx, 1, __ATOMIC_RELAXED);
+    rec = &records[idx & fr_mask];
+
+    /* invalidate the record while it is modified, so that a torn record is detected by the decoder */
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->type = type;
+    rec->code = code;
+    rec->size = size;
+    rec->time_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    rec->count_us = count_us;
+    rec->freq_hz = freq_hz;
+    rec->arg1 = arg1;
+    rec->arg2 = arg2;
+    __atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+void flightrec_flush(void) {
+    if (fr_header == NULL) {
+        return;
+    }
+    if (msync(fr_header, fr_map_size, MS_SYNC) != 0) {
+        MSG("WARNING: [flightrec] failed to write log back (%s)\n", strerror(errno));
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
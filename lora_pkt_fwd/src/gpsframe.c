@@ -0,0 +1,272 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : GPS serial stream framing
+        Incremental UBX/NMEA frame decoder working on a ring buffer
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset, memcpy */
+
+#include "gpsframe.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RING_MASK               (GPS_FRAME_RING_SIZE - 1)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define UBX_SYNC_CHAR_1         0xB5
+#define UBX_SYNC_CHAR_2         0x62
+#define UBX_HEADER_SIZE         6   /* sync chars, class, id, 16-bit length */
+#define UBX_OVERHEAD_SIZE       8   /* header and 2-byte checksum */
+#define NMEA_SYNC_CHAR          '$'
+#define NMEA_END_CHAR           '\n'
+#define NMEA_CHECKSUM_CHAR      '*'
+
+#define RING_DISCARD_SIZE       (GPS_FRAME_RING_SIZE / 4) /* bytes dropped when ring is full */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static inline uint8_t ring_at(const struct gps_frame_decoder_s *dec, size_t offset) {
+    return dec->ring[(dec->rd + offset) & RING_MASK];
+}
+
+static void ring_copy(const struct gps_frame_decoder_s *dec, uint8_t *dst, size_t size) {
+    size_t start = dec->rd & RING_MASK;
+    size_t first = GPS_FRAME_RING_SIZE - start;
+
+    if (first >= size) {
+        memcpy(dst, &dec->ring[start], size);
+    } else {
+        memcpy(dst, &dec->ring[start], first);
+        memcpy(dst + first, dec->ring, size - first);
+    }
+}
+
+static void frame_consume(struct gps_frame_decoder_s *dec, size_t size) {
+    dec->rd += size;
+    dec->scan = 0;
+    dec->frame_size = 0;
+    dec->state = GPS_FRAME_STATE_HUNT;
+}
+
+/* Invalid frame: drop its sync char only, the frame body might hide a valid sync char */
+static void frame_error(struct gps_frame_decoder_s *dec) {
+    dec->stats.nb_errors += 1;
+    dec->stats.nb_discarded += 1;
+    frame_consume(dec, 1);
+}
+
+static int hex_value(uint8_t c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    } else if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    } else if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    } else {
+        return -1;
+    }
+}
+
+/* Check UBX frame in progress, return its size when complete and valid, 0 otherwise */
+static size_t ubx_check(struct gps_frame_decoder_s *dec, size_t pending, bool *error) {
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+    size_t i;
+
+    *error = false;
+    if (pending < 2) {
+        return 0;
+    }
+    if (ring_at(dec, 1) != UBX_SYNC_CHAR_2) {
+        *error = true;
+        return 0;
+    }
+    if (dec->frame_size == 0) {
+        if (pending < UBX_HEADER_SIZE) {
+            return 0;
+        }
+        dec->frame_size = UBX_OVERHEAD_SIZE + ((size_t)ring_at(dec, 4) | ((size_t)ring_at(dec, 5) << 8));
+        if (dec->frame_size > GPS_FRAME_MAX_SIZE) {
+            *error = true;
+            return 0;
+        }
+    }
+    if (pending < dec->frame_size) {
+        return 0;
+    }
+
+    /* 8-bit Fletcher checksum over class, id, length and payload */
+    for (i = 2; i < (dec->frame_size - 2); ++i) {
+        ck_a += ring_at(dec, i);
+        ck_b += ck_a;
+    }
+    if ((ck_a != ring_at(dec, dec->frame_size - 2)) || (ck_b != ring_at(dec, dec->frame_size - 1))) {
+        *error = true;
+        return 0;
+    }
+    return dec->frame_size;
+}
+
+/* Check NMEA sentence in progress, return its size when complete and valid, 0 otherwise */
+static size_t nmea_check(struct gps_frame_decoder_s *dec, size_t pending, bool *error) {
+    uint8_t c;
+    uint8_t checksum = 0;
+    size_t size = 0;
+    size_t i;
+    int hi, lo;
+
+    *error = false;
+
+    /* resume end-of-line search where previous call stopped */
+    for (i = (dec->scan > 0) ? dec->scan : 1; i < pending; ++i) {
+        c = ring_at(dec, i);
+        if (c == NMEA_END_CHAR) {
+            size = i + 1;
+            break;
+        } else if ((c == NMEA_SYNC_CHAR) || (c == UBX_SYNC_CHAR_1) || (i >= GPS_FRAME_NMEA_MAX_SIZE)) {
+            /* truncated or runaway sentence */
+            *error = true;
+            return 0;
+        }
+    }
+    if (size == 0) {
+        dec->scan = i;
+        return 0;
+    }
+
+    /* "$<data>*hh\r\n", checksum is the XOR of all chars in <data> */
+    for (i = 1; i < size; ++i) {
+        c = ring_at(dec, i);
+        if (c == NMEA_CHECKSUM_CHAR) {
+            break;
+        }
+        checksum ^= c;
+    }
+    if ((i + 3) > size) {
+        *error = true;
+        return 0;
+    }
+    hi = hex_value(ring_at(dec, i + 1));
+    lo = hex_value(ring_at(dec, i + 2));
+    if ((hi < 0) || (lo < 0) || (checksum != (uint8_t)((hi << 4) | lo))) {
+        *error = true;
+        return 0;
+    }
+    return size;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void gps_frame_init(struct gps_frame_decoder_s *dec) {
+    memset(dec, 0, sizeof *dec);
+    dec->state = GPS_FRAME_STATE_HUNT;
+}
+
+uint8_t *gps_frame_write_ptr(struct gps_frame_decoder_s *dec, size_t *size) {
+    size_t pending = dec->wr - dec->rd;
+    size_t start;
+    size_t free_space;
+
+    if (pending == GPS_FRAME_RING_SIZE) {
+        /* reader is too slow or stream is garbage, drop oldest bytes and resync */
+        dec->stats.nb_discarded += RING_DISCARD_SIZE;
+        frame_consume(dec, RING_DISCARD_SIZE);
+        pending -= RING_DISCARD_SIZE;
+    }
+
+    start = dec->wr & RING_MASK;
+    free_space = GPS_FRAME_RING_SIZE - pending;
+    *size = GPS_FRAME_RING_SIZE - start;
+    if (*size > free_space) {
+        *size = free_space;
+    }
+    return &dec->ring[start];
+}
+
+void gps_frame_commit(struct gps_frame_decoder_s *dec, size_t size) {
+    dec->wr += size;
+}
+
+enum gps_frame_type_e gps_frame_next(struct gps_frame_decoder_s *dec, char *frame, size_t *size) {
+    size_t pending;
+    size_t frame_size;
+    bool error;
+    uint8_t c;
+
+    while (dec->rd != dec->wr) {
+        pending = dec->wr - dec->rd;
+
+        switch (dec->state) {
+            case GPS_FRAME_STATE_HUNT:
+                c = ring_at(dec, 0);
+                if (c == UBX_SYNC_CHAR_1) {
+                    dec->state = GPS_FRAME_STATE_UBX;
+                } else if (c == NMEA_SYNC_CHAR) {
+                    dec->state = GPS_FRAME_STATE_NMEA;
+                } else {
+                    dec->stats.nb_discarded += 1;
+                    dec->rd += 1;
+                }
+                break;
+
+            case GPS_FRAME_STATE_UBX:
+                frame_size = ubx_check(dec, pending, &error);
+                if (error) {
+                    frame_error(dec);
+                } else if (frame_size == 0) {
+                    return GPS_FRAME_NONE;
+                } else {
+                    ring_copy(dec, (uint8_t *)frame, frame_size);
+                    *size = frame_size;
+                    dec->stats.nb_ubx += 1;
+                    frame_consume(dec, frame_size);
+                    return GPS_FRAME_UBX;
+                }
+                break;
+
+            case GPS_FRAME_STATE_NMEA:
+                frame_size = nmea_check(dec, pending, &error);
+                if (error) {
+                    frame_error(dec);
+                } else if (frame_size == 0) {
+                    return GPS_FRAME_NONE;
+                } else {
+                    ring_copy(dec, (uint8_t *)frame, frame_size);
+                    frame[frame_size] = '\0'; /* NMEA sentences are small enough to be terminated */
+                    *size = frame_size;
+                    dec->stats.nb_nmea += 1;
+                    frame_consume(dec, frame_size);
+                    return GPS_FRAME_NMEA;
+                }
+                break;
+
+            default:
+                frame_consume(dec, 0);
+                break;
+        }
+    }
+
+    return GPS_FRAME_NONE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,78 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : GPS message processing
+        Update the GPS time reference and the gateway position once a GPS
+        message has been parsed by the HAL
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <time.h>       /* timespec */
+#include <pthread.h>
+
+#include "timeref.h"
+#include "gpsproc.h"
+#include "loragw_gps.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+enum gps_sync_status_e gps_process_sync(struct timeref_s *tr, int (*get_trigcnt)(struct timespec gps_time, uint32_t *trig_tstamp), struct gps_sync_s *sync) {
+    int i;
+
+    /* get GPS time for synchronization */
+    if (lgw_gps_get(&sync->utc, &sync->gps_time, NULL, NULL) != LGW_GPS_SUCCESS) {
+        return GPS_SYNC_NO_TIME;
+    }
+
+    /* get timestamp captured on PPM pulse */
+    if (get_trigcnt(sync->gps_time, &sync->trig_tstamp) != 0) {
+        return GPS_SYNC_NO_TRIGCNT;
+    }
+
+    /* try to update time reference with the new GPS time & timestamp */
+    pthread_mutex_lock(&tr->mx);
+    sync->ref = tr->ref; /* no concurrent writer, reference can be accessed directly */
+    i = lgw_gps_sync(&sync->ref, sync->trig_tstamp, sync->utc, sync->gps_time);
+    if (i == LGW_GPS_SUCCESS) {
+        timeref_publish(tr, &sync->ref, tr->valid);
+    }
+    pthread_mutex_unlock(&tr->mx);
+
+    return (i == LGW_GPS_SUCCESS) ? GPS_SYNC_OK : GPS_SYNC_OUT_OF_SYNC;
+}
+
+int gps_process_coords(pthread_mutex_t *mx, struct gps_pos_s *pos) {
+    struct coord_s coord;
+    struct coord_s gpserr;
+    int i = lgw_gps_get(NULL, NULL, &coord, &gpserr);
+
+    /* update gateway coordinates */
+    pthread_mutex_lock(mx);
+    if (i == LGW_GPS_SUCCESS) {
+        pos->valid = true;
+        pos->coord = coord;
+        pos->err = gpserr;
+        // TODO: report other GPS statistics (typ. signal quality & integrity)
+    } else {
+        pos->valid = false;
+    }
+    pthread_mutex_unlock(mx);
+
+    return (i == LGW_GPS_SUCCESS) ? 0 : -1;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
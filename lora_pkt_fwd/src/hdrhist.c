@@ -0,0 +1,146 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Log-linear latency histogram
+        Constant relative precision over the full 32-bit range (HDR histogram like)
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <string.h>     /* memset */
+
+#include "hdrhist.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define HALF_SUB_COUNT      (1U << (HDR_HIST_SUB_BITS - 1)) /* buckets per power of 2, above linear range */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* Bucket index: linear below 2^SUB_BITS, then HALF_SUB_COUNT buckets per power of 2 */
+static unsigned bucket_index(uint32_t value) {
+    unsigned shift;
+
+    if (value < (1U << HDR_HIST_SUB_BITS)) {
+        return value;
+    }
+    shift = (31 - __builtin_clz(value)) - (HDR_HIST_SUB_BITS - 1);
+    return (shift * HALF_SUB_COUNT) + (value >> shift);
+}
+
+/* Highest value falling in a bucket */
+static uint32_t bucket_highest(unsigned index) {
+    unsigned shift;
+    uint64_t low;
+
+    if (index < (1U << HDR_HIST_SUB_BITS)) {
+        return index;
+    }
+    shift = (index / HALF_SUB_COUNT) - 1;
+    low = (uint64_t)(index - (shift * HALF_SUB_COUNT)) << shift;
+    return (uint32_t)(low + (1ULL << shift) - 1);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void hdr_hist_reset(struct hdr_hist_s *hist) {
+    memset(hist, 0, sizeof *hist);
+}
+
+void hdr_hist_record(struct hdr_hist_s *hist, uint32_t value) {
+    hist->counts[bucket_index(value)] += 1;
+    if ((hist->count == 0) || (value < hist->min)) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->count += 1;
+    hist->sum += value;
+}
+
+uint32_t hdr_hist_percentile(const struct hdr_hist_s *hist, double percentile) {
+    uint64_t rank;
+    uint64_t cumul = 0;
+    uint32_t value;
+    unsigned i;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    if (percentile > 100.0) {
+        percentile = 100.0;
+    }
+    /* rank of the percentile value, at least the first one */
+    rank = (uint64_t)((percentile / 100.0) * hist->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (i = bucket_index(hist->min); i < HDR_HIST_NB_BUCKETS; ++i) {
+        cumul += hist->counts[i];
+        if (cumul >= rank) {
+            break;
+        }
+    }
+    value = bucket_highest(i);
+    if (value > hist->max) {
+        value = hist->max;
+    }
+    return value;
+}
+
+void hdr_hist_merge(struct hdr_hist_s *dst, const struct hdr_hist_s *src) {
+    unsigned i;
+
+    if (src->count == 0) {
+        return;
+    }
+    for (i = 0; i < HDR_HIST_NB_BUCKETS; ++i) {
+        dst->counts[i] += src->counts[i];
+    }
+    if ((dst->count == 0) || (src->min < dst->min)) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+}
+
+uint32_t hdr_hist_count_le(const struct hdr_hist_s *hist, uint32_t bound) {
+    uint32_t cumul = 0;
+    unsigned last;
+    unsigned i;
+
+    /* exact outside of the recorded range */
+    if ((hist->count == 0) || (bound < hist->min)) {
+        return 0;
+    }
+    if (bound >= hist->max) {
+        return hist->count;
+    }
+
+    last = bucket_index(bound);
+    for (i = bucket_index(hist->min); i <= last; ++i) {
+        cumul += hist->counts[i];
+    }
+    return cumul;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -43,6 +43,9 @@ Maintainer: Michael Coracin
                                             to ensure beacon can be sent */
 #define BEACON_RESERVED         2120000 /* Time on air of the beacon, with some margin */
 
+#define ASAP_MIN_DELAY          (TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY + TX_MARGIN_DELAY) /* Lowest ASAP delay not rejected as too late */
+#define ASAP_MIN_SAMPLES        8       /* Number of TX latency measurements needed before adapting ASAP delay */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
 static pthread_mutex_t mx_jit_queue = PTHREAD_MUTEX_INITIALIZER; /* control access to JIT queue */
@@ -50,6 +53,176 @@ static pthread_mutex_t mx_jit_queue = PTHREAD_MUTEX_INITIALIZER; /* control acce
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
+/* Concentrator time as given by timersync, on the 64-bit concentrator timeline */
+static int64_t jit_time_us(struct timeval *time) {
+    return (int64_t)time->tv_sec * 1000000LL + (int64_t)time->tv_usec;
+}
+
+/* Extend a 32-bit counter value to the 64-bit timeline, in the epoch nearest to ref_us (+/- ~35 minutes) */
+static int64_t jit_extend_count(uint32_t count_us, int64_t ref_us) {
+    return ref_us + (int32_t)(count_us - (uint32_t)ref_us);
+}
+
+/* Index of the first of the n sorted latencies not lower than value */
+static uint32_t jit_latency_rank(const uint32_t *sorted, uint32_t n, uint32_t value) {
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    uint32_t mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (sorted[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Update TX latency percentiles and derive the ASAP delay, mutex must be locked */
+static void jit_asap_update(struct jit_queue_s *queue) {
+    const uint32_t *sorted = queue->tx_latency_sorted;
+    uint32_t n;
+    uint32_t delay;
+
+    n = (queue->tx_latency_nb < JIT_ASAP_WINDOW) ? queue->tx_latency_nb : JIT_ASAP_WINDOW;
+    if (n == 0) {
+        return;
+    }
+
+    /* nearest-rank percentiles */
+    queue->tx_latency_p50 = sorted[(n * 50 + 99) / 100 - 1];
+    queue->tx_latency_p99 = sorted[(n * 99 + 99) / 100 - 1];
+
+    /* Keep the conservative delay until enough measurements are available */
+    if (n < ASAP_MIN_SAMPLES) {
+        return;
+    }
+
+    /* The packet must be accepted by enqueue criteria, and be dequeued in time:
+        with a delay of TX_JIT_DELAY + latency, the packet is programmed before
+        its timestamp in 99% of cases */
+    delay = TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY + queue->tx_latency_p99;
+    if (delay < queue->asap_floor) {
+        delay = queue->asap_floor;
+    } else if (delay > queue->asap_ceiling) {
+        delay = queue->asap_ceiling;
+    }
+    queue->asap_delay = delay;
+}
+
+/* Add a TX latency measurement to the window and update the ASAP delay, mutex must be locked */
+static void jit_asap_add(struct jit_queue_s *queue, uint32_t latency) {
+    uint32_t *sorted = queue->tx_latency_sorted;
+    uint32_t *slot = &queue->tx_latency[queue->tx_latency_nb % JIT_ASAP_WINDOW];
+    uint32_t n;
+    uint32_t i;
+
+    /* Keep the sorted copy of the window up to date, without sorting it again on each TX:
+        the oldest measurement is removed, and the new one inserted at its rank */
+    n = (queue->tx_latency_nb < JIT_ASAP_WINDOW) ? queue->tx_latency_nb : JIT_ASAP_WINDOW;
+    if (n == JIT_ASAP_WINDOW) {
+        i = jit_latency_rank(sorted, n, *slot);
+        n -= 1;
+        memmove(&sorted[i], &sorted[i + 1], (n - i) * sizeof(sorted[0]));
+    }
+    i = jit_latency_rank(sorted, n, latency);
+    memmove(&sorted[i + 1], &sorted[i], (n - i) * sizeof(sorted[0]));
+    sorted[i] = latency;
+    *slot = latency;
+    queue->tx_latency_nb += 1;
+
+    jit_asap_update(queue);
+}
+
+/* Duty-cycle ledger slot holding a time, on the 64-bit concentrator timeline */
+static int64_t jit_dc_slot(const struct jit_dc_band_s *band, int64_t time_us) {
+    int64_t slot_us = (int64_t)band->slot_us;
+
+    return (time_us >= 0) ? (time_us / slot_us) : -((slot_us - 1 - time_us) / slot_us);
+}
+
+static unsigned jit_dc_index(int64_t slot) {
+    int64_t r = slot % JIT_DC_RING;
+
+    return (unsigned)((r < 0) ? (r + JIT_DC_RING) : r);
+}
+
+static struct jit_dc_band_s *jit_dc_find_band(struct jit_queue_s *queue, uint32_t freq_hz) {
+    int i;
+
+    for (i = 0; i < queue->dc_nb_band; i++) {
+        if ((freq_hz >= queue->dc_band[i].freq_min) && (freq_hz <= queue->dc_band[i].freq_max)) {
+            return &queue->dc_band[i];
+        }
+    }
+    return NULL;
+}
+
+/* Check that adding airtime to a slot keeps every window including that slot within budget, mutex must be locked */
+static bool jit_dc_check(const struct jit_dc_band_s *band, int64_t slot, uint32_t airtime_us) {
+    uint64_t booked[JIT_DC_RING]; /* slots from (slot - JIT_DC_SLOTS) to (slot + JIT_DC_SLOTS) */
+    uint64_t sum = 0;
+    int64_t id;
+    unsigned idx;
+    int k;
+
+    for (k = 0; k < JIT_DC_RING; k++) {
+        id = slot - JIT_DC_SLOTS + k;
+        idx = jit_dc_index(id);
+        booked[k] = (band->slot_id[idx] == id) ? band->airtime_us[idx] : 0;
+    }
+    booked[JIT_DC_SLOTS] += airtime_us;
+
+    /* slide a window of (JIT_DC_SLOTS + 1) slots, so that it always covers the full duration */
+    for (k = 0; k <= JIT_DC_SLOTS; k++) {
+        sum += booked[k];
+    }
+    if (sum > band->budget_us) {
+        return false;
+    }
+    for (k = 1; k <= JIT_DC_SLOTS; k++) {
+        sum += booked[k + JIT_DC_SLOTS] - booked[k - 1];
+        if (sum > band->budget_us) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Book airtime in a slot, the entry is recycled if it holds a slot older than any window still checked */
+static void jit_dc_book(struct jit_dc_band_s *band, int64_t slot, uint32_t airtime_us) {
+    unsigned idx = jit_dc_index(slot);
+
+    if (band->slot_id[idx] != slot) {
+        band->slot_id[idx] = slot;
+        band->airtime_us[idx] = 0;
+    }
+    band->airtime_us[idx] += airtime_us;
+}
+
+/* Release airtime booked for a packet which will not be emitted, mutex must be locked */
+static void jit_dc_unbook(struct jit_queue_s *queue, uint32_t freq_hz, int64_t count_ext, uint32_t airtime_us) {
+    struct jit_dc_band_s *band;
+    int64_t slot;
+    unsigned idx;
+
+    if (airtime_us == 0) {
+        return;
+    }
+    band = jit_dc_find_band(queue, freq_hz);
+    if (band == NULL) {
+        return;
+    }
+    slot = jit_dc_slot(band, count_ext);
+    idx = jit_dc_index(slot);
+    if (band->slot_id[idx] != slot) {
+        return; /* entry already recycled for a later slot */
+    }
+    band->airtime_us[idx] = (band->airtime_us[idx] > airtime_us) ? (band->airtime_us[idx] - airtime_us) : 0;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
 
@@ -87,6 +260,9 @@ void jit_queue_init(struct jit_queue_s *queue) {
         queue->nodes[i].pre_delay = 0;
         queue->nodes[i].post_delay = 0;
     }
+    queue->asap_floor = JIT_ASAP_DELAY_FLOOR;
+    queue->asap_ceiling = JIT_ASAP_DELAY_CEILING;
+    queue->asap_delay = JIT_ASAP_DELAY_CEILING;
 
     pthread_mutex_unlock(&mx_jit_queue);
 }
@@ -96,15 +272,15 @@ int compare(const void *a, const void *b, void *arg)
     struct jit_node_s *p = (struct jit_node_s *)a;
     struct jit_node_s *q = (struct jit_node_s *)b;
     int *counter = (int *)arg;
-    int p_count, q_count;
+    int64_t p_count, q_count;
 
-    p_count = p->pkt.count_us;
-    q_count = q->pkt.count_us;
+    p_count = p->count_ext;
+    q_count = q->count_ext;
 
     if (p_count > q_count)
         *counter = *counter + 1;
 
-    return p_count - q_count;
+    return (p_count > q_count) - (p_count < q_count);
 }
 
 void jit_sort_queue(struct jit_queue_s *queue) {
@@ -119,9 +295,9 @@ void jit_sort_queue(struct jit_queue_s *queue) {
     MSG_DEBUG(DEBUG_JIT, "sorting queue done - swapped:%d\n", counter);
 }
 
-bool jit_collision_test(uint32_t p1_count_us, uint32_t p1_pre_delay, uint32_t p1_post_delay, uint32_t p2_count_us, uint32_t p2_pre_delay, uint32_t p2_post_delay) {
-    if (((p1_count_us - p2_count_us) <= (p1_pre_delay + p2_post_delay + TX_MARGIN_DELAY)) ||
-        ((p2_count_us - p1_count_us) <= (p2_pre_delay + p1_post_delay + TX_MARGIN_DELAY))) {
+bool jit_collision_test(int64_t p1_count_us, uint32_t p1_pre_delay, uint32_t p1_post_delay, int64_t p2_count_us, uint32_t p2_pre_delay, uint32_t p2_post_delay) {
+    if (((p1_count_us >= p2_count_us) && ((p1_count_us - p2_count_us) <= (p1_pre_delay + p2_post_delay + TX_MARGIN_DELAY))) ||
+        ((p2_count_us >= p1_count_us) && ((p2_count_us - p1_count_us) <= (p2_pre_delay + p1_post_delay + TX_MARGIN_DELAY)))) {
         return true;
     } else {
         return false;
@@ -130,20 +306,26 @@ bool jit_collision_test(uint32_t p1_count_us, uint32_t p1_pre_delay, uint32_t p1
 
 enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type) {
     int i = 0;
-    uint32_t time_us = time->tv_sec * 1000000UL + time->tv_usec; /* convert time in µs */
+    int64_t time_us;
+    int64_t count_ext;
     uint32_t packet_post_delay = 0;
     uint32_t packet_pre_delay = 0;
     uint32_t target_pre_delay = 0;
     enum jit_error_e err_collision;
-    uint32_t asap_count_us;
-
-    MSG_DEBUG(DEBUG_JIT, "Current concentrator time is %u, pkt_type=%d\n", time_us, pkt_type);
+    int64_t asap_count_us;
+    uint32_t packet_airtime = 0;
+    struct jit_dc_band_s *dc_band;
+    int64_t dc_slot;
+    uint32_t dc_airtime = 0;
 
-    if (packet == NULL) {
+    if ((time == NULL) || (packet == NULL)) {
         MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: invalid parameter\n");
         return JIT_ERROR_INVALID;
     }
 
+    time_us = jit_time_us(time);
+    MSG_DEBUG(DEBUG_JIT, "Current concentrator time is %lld, pkt_type=%d\n", (long long)time_us, pkt_type);
+
     if (jit_queue_is_full(queue)) {
         MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: cannot enqueue packet, JIT queue is full\n");
         return JIT_ERROR_FULL;
@@ -156,11 +338,13 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
         case JIT_PKT_TYPE_DOWNLINK_CLASS_C:
             packet_pre_delay = TX_START_DELAY + TX_JIT_DELAY;
             packet_post_delay = lgw_time_on_air(packet) * 1000UL; /* in us */
+            packet_airtime = packet_post_delay;
             break;
         case JIT_PKT_TYPE_BEACON:
             /* As defined in LoRaWAN spec */
             packet_pre_delay = TX_START_DELAY + BEACON_GUARD + TX_JIT_DELAY;
             packet_post_delay = BEACON_RESERVED;
+            packet_airtime = lgw_time_on_air(packet) * 1000UL; /* in us */
             break;
         default:
             break;
@@ -175,10 +359,18 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
         packet->tx_mode = TIMESTAMPED;
 
         /* Search for the ASAP timestamp to be given to the packet */
-        asap_count_us = time_us + 1E6; /* TODO: Take 1 second margin, to be refined */
+        asap_count_us = time_us + queue->asap_delay; /* adapted to measured TX latency */
+
+        /* Do not overlap with the packet already dequeued, which is not in the queue anymore
+         *      t_asap < t_end_last + pre_delay + margin
+         */
+        if ((queue->tx_end_valid == true) && ((queue->tx_end_us + packet_pre_delay + TX_MARGIN_DELAY) > asap_count_us)) {
+            asap_count_us = queue->tx_end_us + packet_pre_delay + TX_MARGIN_DELAY;
+            MSG_DEBUG(DEBUG_JIT, "DEBUG: IMMEDIATE downlink delayed after last dequeued packet (count_us=%u)\n", (uint32_t)asap_count_us);
+        }
         if (queue->num_pkt == 0) {
             /* If the jit queue is empty, we can insert this packet */
-            MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink, first in JiT queue (count_us=%u)\n", asap_count_us);
+            MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink, first in JiT queue (count_us=%u)\n", (uint32_t)asap_count_us);
         } else {
             /* Else we can try to insert it:
                 - ASAP meaning NOW + MARGIN
@@ -188,29 +380,29 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
 
             /* First, try if the ASAP time collides with an already enqueued downlink */
             for (i=0; i<queue->num_pkt; i++) {
-                if (jit_collision_test(asap_count_us, packet_pre_delay, packet_post_delay, queue->nodes[i].pkt.count_us, queue->nodes[i].pre_delay, queue->nodes[i].post_delay) == true) {
-                    MSG_DEBUG(DEBUG_JIT, "DEBUG: cannot insert IMMEDIATE downlink at count_us=%u, collides with %u (index=%d)\n", asap_count_us, queue->nodes[i].pkt.count_us, i);
+                if (jit_collision_test(asap_count_us, packet_pre_delay, packet_post_delay, queue->nodes[i].count_ext, queue->nodes[i].pre_delay, queue->nodes[i].post_delay) == true) {
+                    MSG_DEBUG(DEBUG_JIT, "DEBUG: cannot insert IMMEDIATE downlink at count_us=%u, collides with %u (index=%d)\n", (uint32_t)asap_count_us, queue->nodes[i].pkt.count_us, i);
                     break;
                 }
             }
             if (i == queue->num_pkt) {
                 /* No collision with ASAP time, we can insert it */
-                MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink ASAP at %u (no collision)\n", asap_count_us);
+                MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink ASAP at %u (no collision)\n", (uint32_t)asap_count_us);
             } else {
                 /* Search for the best slot then */
                 for (i=0; i<queue->num_pkt; i++) {
-                    asap_count_us = queue->nodes[i].pkt.count_us + queue->nodes[i].post_delay + packet_pre_delay + TX_JIT_DELAY + TX_MARGIN_DELAY;
+                    asap_count_us = queue->nodes[i].count_ext + queue->nodes[i].post_delay + packet_pre_delay + TX_JIT_DELAY + TX_MARGIN_DELAY;
                     if (i == (queue->num_pkt - 1)) {
                         /* Last packet index, we can insert after this one */
-                        MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink, last in JiT queue (count_us=%u)\n", asap_count_us);
+                        MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink, last in JiT queue (count_us=%u)\n", (uint32_t)asap_count_us);
                     } else {
                         /* Check if packet can be inserted between this index and the next one */
-                        MSG_DEBUG(DEBUG_JIT, "DEBUG: try to insert IMMEDIATE downlink (count_us=%u) between index %d and index %d?\n", asap_count_us, i, i+1);
-                        if (jit_collision_test(asap_count_us, packet_pre_delay, packet_post_delay, queue->nodes[i+1].pkt.count_us, queue->nodes[i+1].pre_delay, queue->nodes[i+1].post_delay) == true) {
-                            MSG_DEBUG(DEBUG_JIT, "DEBUG: failed to insert IMMEDIATE downlink (count_us=%u), continue...\n", asap_count_us);
+                        MSG_DEBUG(DEBUG_JIT, "DEBUG: try to insert IMMEDIATE downlink (count_us=%u) between index %d and index %d?\n", (uint32_t)asap_count_us, i, i+1);
+                        if (jit_collision_test(asap_count_us, packet_pre_delay, packet_post_delay, queue->nodes[i+1].count_ext, queue->nodes[i+1].pre_delay, queue->nodes[i+1].post_delay) == true) {
+                            MSG_DEBUG(DEBUG_JIT, "DEBUG: failed to insert IMMEDIATE downlink (count_us=%u), continue...\n", (uint32_t)asap_count_us);
                             continue;
                         } else {
-                            MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink (count_us=%u)\n", asap_count_us);
+                            MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink (count_us=%u)\n", (uint32_t)asap_count_us);
                             break;
                         }
                     }
@@ -218,7 +410,10 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
             }
         }
         /* Set packet with ASAP timestamp */
-        packet->count_us = asap_count_us;
+        packet->count_us = (uint32_t)asap_count_us;
+        count_ext = asap_count_us;
+    } else {
+        count_ext = jit_extend_count(packet->count_us, time_us);
     }
 
     /* Check criteria_1: is it already too late to send this packet ?
@@ -226,11 +421,10 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
      *  Note: - Also add some margin, to be checked how much is needed, if needed
      *        - Valid for both Downlinks and Beacon packets
      *
-     *  Warning: unsigned arithmetic (handle roll-over)
      *      t_packet < t_current + TX_START_DELAY + MARGIN
      */
-    if ((packet->count_us - time_us) <= (TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY)) {
-        MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet REJECTED, already too late to send it (current=%u, packet=%u, type=%d)\n", time_us, packet->count_us, pkt_type);
+    if ((count_ext - time_us) <= (TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY)) {
+        MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet REJECTED, already too late to send it (current=%u, packet=%u, type=%d)\n", (uint32_t)time_us, packet->count_us, pkt_type);
         pthread_mutex_unlock(&mx_jit_queue);
         return JIT_ERROR_TOO_LATE;
     }
@@ -243,12 +437,11 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
      *  So let's define a safe delay above which we can say that the packet is out of bound: TX_MAX_ADVANCE_DELAY
      *  Note: - Valid for Downlinks only, not for Beacon packets
      *
-     *  Warning: unsigned arithmetic (handle roll-over)
-                t_packet > t_current + TX_MAX_ADVANCE_DELAY
+     *      t_packet > t_current + TX_MAX_ADVANCE_DELAY
      */
     if ((pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_A) || (pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_B)) {
-        if ((packet->count_us - time_us) > TX_MAX_ADVANCE_DELAY) {
-            MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet REJECTED, timestamp seems wrong, too much in advance (current=%u, packet=%u, type=%d)\n", time_us, packet->count_us, pkt_type);
+        if ((count_ext - time_us) > TX_MAX_ADVANCE_DELAY) {
+            MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet REJECTED, timestamp seems wrong, too much in advance (current=%u, packet=%u, type=%d)\n", (uint32_t)time_us, packet->count_us, pkt_type);
             pthread_mutex_unlock(&mx_jit_queue);
             return JIT_ERROR_TOO_EARLY;
         }
@@ -268,11 +461,10 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
         }
 
         /* Check if there is a collision
-         *  Warning: unsigned arithmetic (handle roll-over)
          *      t_packet_new - pre_delay_packet_new < t_packet_prev + post_delay_packet_prev (OVERLAP on post delay)
          *      t_packet_new + post_delay_packet_new > t_packet_prev - pre_delay_packet_prev (OVERLAP on pre delay)
          */
-        if (jit_collision_test(packet->count_us, packet_pre_delay, packet_post_delay, queue->nodes[i].pkt.count_us, target_pre_delay, queue->nodes[i].post_delay) == true) {
+        if (jit_collision_test(count_ext, packet_pre_delay, packet_post_delay, queue->nodes[i].count_ext, target_pre_delay, queue->nodes[i].post_delay) == true) {
             switch (queue->nodes[i].pkt_type) {
                 case JIT_PKT_TYPE_DOWNLINK_CLASS_A:
                 case JIT_PKT_TYPE_DOWNLINK_CLASS_B:
@@ -297,11 +489,30 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, struct timeval *time, st
         }
     }
 
+    /* Check criteria_4: does this new packet exceed the duty-cycle budget of its sub-band ?
+     *  Airtime is booked when the packet is enqueued, at its timestamp, so that packets already
+     *  queued are accounted for. It is released if the packet is dropped or not emitted.
+     *  Note: - Valid for both Downlinks and Beacon packets
+     */
+    dc_band = jit_dc_find_band(queue, packet->freq_hz);
+    if (dc_band != NULL) {
+        dc_slot = jit_dc_slot(dc_band, count_ext);
+        if (jit_dc_check(dc_band, dc_slot, packet_airtime) == false) {
+            MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet (type=%d) REJECTED, duty-cycle budget of sub-band [%u:%u] exceeded (%u)\n", pkt_type, dc_band->freq_min, dc_band->freq_max, packet->count_us);
+            pthread_mutex_unlock(&mx_jit_queue);
+            return JIT_ERROR_DUTY_CYCLE;
+        }
+        jit_dc_book(dc_band, dc_slot, packet_airtime);
+        dc_airtime = packet_airtime;
+    }
+
     /* Finally enqueue it */
     /* Insert packet at the end of the queue */
     memcpy(&(queue->nodes[queue->num_pkt].pkt), packet, sizeof(struct lgw_pkt_tx_s));
+    queue->nodes[queue->num_pkt].count_ext = count_ext;
     queue->nodes[queue->num_pkt].pre_delay = packet_pre_delay;
     queue->nodes[queue->num_pkt].post_delay = packet_post_delay;
+    queue->nodes[queue->num_pkt].dc_airtime = dc_airtime;
     queue->nodes[queue->num_pkt].pkt_type = pkt_type;
     if (pkt_type == JIT_PKT_TYPE_BEACON) {
         queue->num_beacon++;
@@ -342,6 +553,11 @@ enum jit_error_e jit_dequeue(struct jit_queue_s *queue, int index, struct lgw_pk
     memcpy(packet, &(queue->nodes[index].pkt), sizeof(struct lgw_pkt_tx_s));
     queue->num_pkt--;
     *pkt_type = queue->nodes[index].pkt_type;
+    queue->tx_end_us = queue->nodes[index].count_ext + queue->nodes[index].post_delay;
+    queue->tx_end_valid = true;
+    queue->tx_freq_hz = queue->nodes[index].pkt.freq_hz;
+    queue->tx_count_ext = queue->nodes[index].count_ext;
+    queue->tx_dc_airtime = queue->nodes[index].dc_airtime;
     if (*pkt_type == JIT_PKT_TYPE_BEACON) {
         queue->num_beacon--;
         MSG_DEBUG(DEBUG_BEACON, "--- Beacon dequeued ---\n");
@@ -368,7 +584,7 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, struct timeval *time, int *
     /* Return index of node containing a packet inline with given time */
     int i = 0;
     int idx_highest_priority = -1;
-    uint32_t time_us;
+    int64_t time_us;
 
     if ((time == NULL) || (pkt_idx == NULL)) {
         MSG("ERROR: invalid parameter\n");
@@ -379,7 +595,7 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, struct timeval *time, int *
         return JIT_ERROR_EMPTY;
     }
 
-    time_us = time->tv_sec * 1000000UL + time->tv_usec;
+    time_us = jit_time_us(time);
 
     pthread_mutex_lock(&mx_jit_queue);
 
@@ -389,17 +605,17 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, struct timeval *time, int *
          *  If a packet seems too much in advance, and was not rejected at enqueue time,
          *  it means that we missed it for peeking, we need to drop it
          *
-         *  Warning: unsigned arithmetic
-         *      t_packet > t_current + TX_MAX_ADVANCE_DELAY
+         *      t_packet < t_current or t_packet > t_current + TX_MAX_ADVANCE_DELAY
          */
-        if ((queue->nodes[i].pkt.count_us - time_us) >= TX_MAX_ADVANCE_DELAY) {
-            /* We drop the packet to avoid lock-up */
+        if ((queue->nodes[i].count_ext < time_us) || ((queue->nodes[i].count_ext - time_us) >= TX_MAX_ADVANCE_DELAY)) {
+            /* We drop the packet to avoid lock-up, it will not use the airtime booked for it */
+            jit_dc_unbook(queue, queue->nodes[i].pkt.freq_hz, queue->nodes[i].count_ext, queue->nodes[i].dc_airtime);
             queue->num_pkt--;
             if (queue->nodes[i].pkt_type == JIT_PKT_TYPE_BEACON) {
                 queue->num_beacon--;
-                MSG("WARNING: --- Beacon dropped (current_time=%u, packet_time=%u) ---\n", time_us, queue->nodes[i].pkt.count_us);
+                MSG("WARNING: --- Beacon dropped (current_time=%u, packet_time=%u) ---\n", (uint32_t)time_us, queue->nodes[i].pkt.count_us);
             } else {
-                MSG("WARNING: --- Packet dropped (current_time=%u, packet_time=%u) ---\n", time_us, queue->nodes[i].pkt.count_us);
+                MSG("WARNING: --- Packet dropped (current_time=%u, packet_time=%u) ---\n", (uint32_t)time_us, queue->nodes[i].pkt.count_us);
             }
 
             /* Replace dropped packet with last packet of the queue */
@@ -409,25 +625,24 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, struct timeval *time, int *
             /* Sort queue in ascending order of packet timestamp */
             jit_sort_queue(queue);
 
-            /* restart loop  after purge to find packet to be sent */
-            i = 0;
+            /* restart loop  after purge to find packet to be sent (queue has been re-sorted) */
+            i = -1;
+            idx_highest_priority = -1;
             continue;
         }
 
         /* Then look for highest priority packet to be sent:
-         *  Warning: unsigned arithmetic (handle roll-over)
          *      t_packet < t_highest
          */
-        if ((idx_highest_priority == -1) || (((queue->nodes[i].pkt.count_us - time_us) < (queue->nodes[idx_highest_priority].pkt.count_us - time_us)))) {
+        if ((idx_highest_priority == -1) || (queue->nodes[i].count_ext < queue->nodes[idx_highest_priority].count_ext)) {
             idx_highest_priority = i;
         }
     }
 
     /* Peek criteria 1: look for a packet to be sent in next TX_JIT_DELAY ms timeframe
-     *  Warning: unsigned arithmetic (handle roll-over)
      *      t_packet < t_current + TX_JIT_DELAY
      */
-    if ((queue->nodes[idx_highest_priority].pkt.count_us - time_us) < TX_JIT_DELAY) {
+    if ((idx_highest_priority != -1) && ((queue->nodes[idx_highest_priority].count_ext - time_us) < TX_JIT_DELAY)) {
         *pkt_idx = idx_highest_priority;
         MSG_DEBUG(DEBUG_JIT, "peek packet with count_us=%u at index %d\n",
             queue->nodes[idx_highest_priority].pkt.count_us, idx_highest_priority);
@@ -440,6 +655,189 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, struct timeval *time, int *
     return JIT_ERROR_OK;
 }
 
+uint32_t jit_report_tx(struct jit_queue_s *queue, struct timeval *time, uint32_t count_us) {
+    int64_t time_us;
+    int64_t latency;
+
+    if ((queue == NULL) || (time == NULL)) {
+        MSG("ERROR: invalid parameter\n");
+        return 0;
+    }
+
+    time_us = jit_time_us(time);
+
+    /* A packet cannot be dequeued before (count_us - TX_JIT_DELAY) */
+    latency = time_us - (jit_extend_count(count_us, time_us) - TX_JIT_DELAY);
+    if (latency < 0) {
+        latency = 0;
+    } else if (latency > UINT32_MAX) {
+        latency = UINT32_MAX;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    jit_asap_add(queue, (uint32_t)latency);
+    queue->sched_freq_hz = queue->tx_freq_hz;
+    queue->sched_count_ext = queue->tx_count_ext;
+    queue->sched_dc_airtime = queue->tx_dc_airtime;
+    pthread_mutex_unlock(&mx_jit_queue);
+
+    MSG_DEBUG(DEBUG_JIT, "TX latency %lld us, ASAP delay is now %u us\n", (long long)latency, queue->asap_delay);
+    return (uint32_t)latency;
+}
+
+enum jit_error_e jit_cancel_tx(struct jit_queue_s *queue) {
+    if (queue == NULL) {
+        MSG("ERROR: invalid parameter\n");
+        return JIT_ERROR_INVALID;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    jit_dc_unbook(queue, queue->tx_freq_hz, queue->tx_count_ext, queue->tx_dc_airtime);
+    queue->tx_dc_airtime = 0; /* only released once */
+    pthread_mutex_unlock(&mx_jit_queue);
+
+    MSG_DEBUG(DEBUG_JIT, "cancelled TX of packet with count_us=%u\n", (uint32_t)queue->tx_count_ext);
+    return JIT_ERROR_OK;
+}
+
+enum jit_error_e jit_cancel_scheduled_tx(struct jit_queue_s *queue) {
+    if (queue == NULL) {
+        MSG("ERROR: invalid parameter\n");
+        return JIT_ERROR_INVALID;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    jit_dc_unbook(queue, queue->sched_freq_hz, queue->sched_count_ext, queue->sched_dc_airtime);
+    queue->sched_dc_airtime = 0; /* only released once */
+    pthread_mutex_unlock(&mx_jit_queue);
+
+    MSG_DEBUG(DEBUG_JIT, "cancelled scheduled TX of packet with count_us=%u\n", (uint32_t)queue->sched_count_ext);
+    return JIT_ERROR_OK;
+}
+
+enum jit_error_e jit_asap_set_bounds(struct jit_queue_s *queue, uint32_t floor_us, uint32_t ceiling_us) {
+    if (queue == NULL) {
+        MSG("ERROR: invalid parameter\n");
+        return JIT_ERROR_INVALID;
+    }
+
+    if ((floor_us < ASAP_MIN_DELAY) || (ceiling_us < floor_us) || (ceiling_us > TX_MAX_ADVANCE_DELAY)) {
+        MSG("ERROR: invalid ASAP delay bounds [%u:%u], floor must be at least %u us\n", floor_us, ceiling_us, ASAP_MIN_DELAY);
+        return JIT_ERROR_INVALID;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    queue->asap_floor = floor_us;
+    queue->asap_ceiling = ceiling_us;
+    if (queue->tx_latency_nb < ASAP_MIN_SAMPLES) {
+        queue->asap_delay = ceiling_us;
+    } else {
+        jit_asap_update(queue);
+    }
+    pthread_mutex_unlock(&mx_jit_queue);
+
+    return JIT_ERROR_OK;
+}
+
+enum jit_error_e jit_duty_cycle_add_band(struct jit_queue_s *queue, uint32_t freq_min, uint32_t freq_max, float percent, uint32_t window) {
+    struct jit_dc_band_s *band;
+    int i;
+
+    if (queue == NULL) {
+        MSG("ERROR: invalid parameter\n");
+        return JIT_ERROR_INVALID;
+    }
+
+    if ((freq_min > freq_max) || (percent <= 0.0) || (percent > 100.0) || (window < JIT_DC_MIN_WINDOW)) {
+        MSG("ERROR: invalid duty-cycle sub-band [%u:%u] %.2f%% on %u s, window must be at least %u s\n", freq_min, freq_max, percent, window, JIT_DC_MIN_WINDOW);
+        return JIT_ERROR_INVALID;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    if (queue->dc_nb_band >= JIT_DC_BAND_MAX) {
+        pthread_mutex_unlock(&mx_jit_queue);
+        MSG("ERROR: too many duty-cycle sub-bands, %u max\n", JIT_DC_BAND_MAX);
+        return JIT_ERROR_FULL;
+    }
+    band = &queue->dc_band[queue->dc_nb_band];
+    band->freq_min = freq_min;
+    band->freq_max = freq_max;
+    band->percent = percent;
+    band->window = window;
+    band->slot_us = ((uint64_t)window * 1000000ULL) / JIT_DC_SLOTS;
+    band->budget_us = (uint64_t)((double)window * 1E6 * percent / 100.0);
+    for (i = 0; i < JIT_DC_RING; i++) {
+        band->slot_id[i] = INT64_MIN; /* holds no slot */
+        band->airtime_us[i] = 0;
+    }
+    queue->dc_nb_band += 1;
+    pthread_mutex_unlock(&mx_jit_queue);
+
+    return JIT_ERROR_OK;
+}
+
+int jit_duty_cycle_get_stats(struct jit_queue_s *queue, struct timeval *time, struct jit_dc_stats_s *stats) {
+    struct jit_dc_band_s *band;
+    int64_t first_slot;
+    int nb_band;
+    int i, j;
+
+    if ((queue == NULL) || (time == NULL) || (stats == NULL)) {
+        MSG("ERROR: invalid parameter\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    nb_band = queue->dc_nb_band;
+    for (i = 0; i < nb_band; i++) {
+        band = &queue->dc_band[i];
+        stats[i].freq_min = band->freq_min;
+        stats[i].freq_max = band->freq_max;
+        stats[i].percent = band->percent;
+        stats[i].window = band->window;
+        stats[i].budget_us = band->budget_us;
+        stats[i].used_us = 0;
+        first_slot = jit_dc_slot(band, jit_time_us(time)) - JIT_DC_SLOTS;
+        for (j = 0; j < JIT_DC_RING; j++) {
+            if (band->slot_id[j] >= first_slot) {
+                stats[i].used_us += band->airtime_us[j];
+            }
+        }
+    }
+    pthread_mutex_unlock(&mx_jit_queue);
+
+    return nb_band;
+}
+
+void jit_asap_get_stats(struct jit_queue_s *queue, uint32_t *asap_delay, uint32_t *latency_p50, uint32_t *latency_p99) {
+    if ((queue == NULL) || (asap_delay == NULL)) {
+        MSG("ERROR: invalid parameter\n");
+        return;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    *asap_delay = queue->asap_delay;
+    if (latency_p50 != NULL) {
+        *latency_p50 = queue->tx_latency_p50;
+    }
+    if (latency_p99 != NULL) {
+        *latency_p99 = queue->tx_latency_p99;
+    }
+    pthread_mutex_unlock(&mx_jit_queue);
+}
+
+void jit_get_occupancy(struct jit_queue_s *queue, uint8_t *nb_pkt, uint8_t *nb_beacon) {
+    if ((queue == NULL) || (nb_pkt == NULL) || (nb_beacon == NULL)) {
+        MSG("ERROR: invalid parameter\n");
+        return;
+    }
+
+    pthread_mutex_lock(&mx_jit_queue);
+    *nb_pkt = queue->num_pkt;
+    *nb_beacon = queue->num_beacon;
+    pthread_mutex_unlock(&mx_jit_queue);
+}
+
 void jit_print_queue(struct jit_queue_s *queue, bool show_all, int debug_level) {
     int i = 0;
     int loop_end;
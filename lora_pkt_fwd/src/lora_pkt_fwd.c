@@ -39,6 +39,7 @@ Maintainer: Michael Coracin
 #include <errno.h>          /* error messages */
 #include <math.h>           /* modf */
 #include <assert.h>
+#include <termios.h>        /* tcgetattr, tcsetattr */
 
 #include <sys/socket.h>     /* socket specific definitions */
 #include <netinet/in.h>     /* INET constants and stuff */
@@ -50,6 +51,13 @@ Maintainer: Michael Coracin
 #include "trace.h"
 #include "jitqueue.h"
 #include "timersync.h"
+#include "timeref.h"
+#include "gpsframe.h"
+#include "gpsproc.h"
+#include "xtalcorr.h"
+#include "metrics.h"
+#include "hdrhist.h"
+#include "flightrec.h"
 #include "parson.h"
 #include "base64.h"
 #include "loragw_hal.h"
@@ -84,8 +92,11 @@ Maintainer: Michael Coracin
 
 #define PROTOCOL_VERSION    2           /* v1.3 */
 
-#define XERR_INIT_AVG       128         /* nb of measurements the XTAL correction is averaged on as initial value */
-#define XERR_FILT_COEF      256         /* coefficient for low-pass XTAL error tracking */
+#define STATE_SAVE_PERIOD   300         /* time interval in seconds between saves of the XTAL correction state */
+#define STATE_MAX_AGE       86400       /* maximum age in seconds of a saved XTAL correction state to be restored */
+
+#define GPS_SERIAL_VMIN     255         /* nb of chars a GPS serial read waits for, at most */
+#define GPS_SERIAL_VTIME    1           /* inter-char timeout in 1/10 sec ending a GPS serial read */
 
 #define PKT_PUSH_DATA   0
 #define PKT_PUSH_ACK    1
@@ -101,9 +112,19 @@ Maintainer: Michael Coracin
 #define MIN_FSK_PREAMB  3 /* minimum FSK preamble length for this application */
 #define STD_FSK_PREAMB  5
 
-#define STATUS_SIZE     200
+#define RX_BW_NB        3 /* Lora bandwidths accounted for: 125, 250 and 500 kHz */
+#define RX_DR_FSK       (6 * RX_BW_NB) /* index of FSK in per-datarate RX measurements, after Lora SF7 to SF12 */
+#define RX_DR_NB        (RX_DR_FSK + 1)
+
+#define STATUS_CHAN_SIZE 144 /* max size of a "rxch" array element of the status report */
+#define STATUS_DR_SIZE  112 /* max size of a "rxdr" array element of the status report */
+#define STATUS_RX_SIZE  (16 + (LGW_IF_CHAIN_NB * STATUS_CHAN_SIZE) + (RX_DR_NB * STATUS_DR_SIZE))
+#define STATUS_SIZE     (320 + STATUS_RX_SIZE)
 #define TX_BUFF_SIZE    ((540 * NB_PKT_MAX) + 30 + STATUS_SIZE)
 
+#define DOWN_ARENA_SIZE 32768 /* JSON arena for PULL_RESP parsing, fits any tree a 1000-byte datagram can hold */
+#define CONF_ARENA_SIZE 65536 /* JSON arena for configuration files, larger files are parsed on the heap */
+
 #define UNIX_GPS_EPOCH_OFFSET 315964800 /* Number of seconds ellapsed between 01.Jan.1970 00:00:00
                                                                           and 06.Jan.1980 00:00:00 */
 
@@ -115,6 +136,8 @@ Maintainer: Michael Coracin
 #define DEFAULT_BEACON_POWER        14
 #define DEFAULT_BEACON_INFODESC     0
 
+#define DEFAULT_DUTY_CYCLE_WINDOW   3600 /* duty-cycle observation window, in seconds (ETSI EN 300 220) */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
 
@@ -154,6 +177,9 @@ pthread_mutex_t mx_concent = PTHREAD_MUTEX_INITIALIZER; /* control access to the
 static pthread_mutex_t mx_xcorr = PTHREAD_MUTEX_INITIALIZER; /* control access to the XTAL correction */
 static bool xtal_correct_ok = false; /* set true when XTAL correction is stable enough */
 static double xtal_correct = 1.0;
+static struct xcorr_s xtal_estimator; /* XTAL correction estimator, updated by validation thread */
+static double xtal_correct_max_stddev = XCORR_DEFAULT_MAX_STDDEV; /* XTAL correction precision required for beaconing, in ppm */
+static char state_file_path[128] = "\0"; /* path of the file XTAL correction state is saved to (empty = disabled) */
 
 /* GPS configuration and synchronization */
 static char gps_tty_path[64] = "\0"; /* path of the TTY port GPS is connected on */
@@ -161,9 +187,8 @@ static int gps_tty_fd = -1; /* file descriptor of the GPS TTY port */
 static bool gps_enabled = false; /* is GPS enabled on that gateway ? */
 
 /* GPS time reference */
-static pthread_mutex_t mx_timeref = PTHREAD_MUTEX_INITIALIZER; /* control access to GPS time reference */
-static bool gps_ref_valid; /* is GPS reference acceptable (ie. not too old) */
-static struct tref time_reference_gps; /* time reference used for GPS <-> timestamp conversion */
+/* Readers take a snapshot with timeref_read(), writers lock timeref_gps.mx and publish with timeref_publish() */
+static struct timeref_s timeref_gps; /* time reference used for GPS <-> timestamp conversion, and its validity */
 
 /* Reference coordinates, for broadcasting (beacon) */
 static struct coord_s reference_coord;
@@ -171,6 +196,16 @@ static struct coord_s reference_coord;
 /* Enable faking the GPS coordinates of the gateway */
 static bool gps_fake_enable; /* enable the feature */
 
+/* radio packets received on a channel or at a datarate */
+struct meas_rx_s {
+    uint32_t nb_rcv;        /* count packets received */
+    uint32_t nb_ok;         /* count packets received with PAYLOAD CRC OK */
+    uint32_t nb_bad;        /* count packets received with PAYLOAD CRC ERROR */
+    uint32_t nb_nocrc;      /* count packets received with NO PAYLOAD CRC */
+    uint32_t payload_byte;  /* sum of radio payload bytes */
+    uint32_t airtime_ms;    /* sum of packets time-on-air, in milliseconds */
+};
+
 /* measurements to establish statistics */
 static pthread_mutex_t mx_meas_up = PTHREAD_MUTEX_INITIALIZER; /* control access to the upstream measurements */
 static uint32_t meas_nb_rx_rcv = 0; /* count packets received */
@@ -182,10 +217,16 @@ static uint32_t meas_up_network_byte = 0; /* sum of UDP bytes sent for upstream
 static uint32_t meas_up_payload_byte = 0; /* sum of radio payload bytes sent for upstream traffic */
 static uint32_t meas_up_dgram_sent = 0; /* number of datagrams sent for upstream traffic */
 static uint32_t meas_up_ack_rcv = 0; /* number of datagrams acknowledged for upstream traffic */
+static struct meas_rx_s meas_rx_if[LGW_IF_CHAIN_NB]; /* packets received per IF chain */
+static struct meas_rx_s meas_rx_dr[RX_DR_NB]; /* packets received per datarate (Lora SF and BW, or FSK) */
+static struct hdr_hist_s meas_up_ack_rtt; /* PUSH_DATA to PUSH_ACK round-trip times, in microseconds */
+static struct hdr_hist_s meas_up_ack_rtt_total; /* round-trip times of previous intervals, for metrics */
 
 static pthread_mutex_t mx_meas_dw = PTHREAD_MUTEX_INITIALIZER; /* control access to the downstream measurements */
 static uint32_t meas_dw_pull_sent = 0; /* number of PULL requests sent for downstream traffic */
 static uint32_t meas_dw_ack_rcv = 0; /* number of PULL requests acknowledged for downstream traffic */
+static struct hdr_hist_s meas_dw_ack_rtt; /* PULL_DATA to PULL_ACK round-trip times, in microseconds */
+static struct hdr_hist_s meas_dw_ack_rtt_total; /* round-trip times of previous intervals, for metrics */
 static uint32_t meas_dw_dgram_rcv = 0; /* count PULL response packets received for downstream traffic */
 static uint32_t meas_dw_network_byte = 0; /* sum of UDP bytes sent for upstream traffic */
 static uint32_t meas_dw_payload_byte = 0; /* sum of radio payload bytes sent for upstream traffic */
@@ -196,14 +237,72 @@ static uint32_t meas_nb_tx_rejected_collision_packet = 0; /* count packets were
 static uint32_t meas_nb_tx_rejected_collision_beacon = 0; /* count packets were TX request were rejected due to collision with a beacon already programmed */
 static uint32_t meas_nb_tx_rejected_too_late = 0; /* count packets were TX request were rejected because it is too late to program it */
 static uint32_t meas_nb_tx_rejected_too_early = 0; /* count packets were TX request were rejected because timestamp is too much in advance */
+static uint32_t meas_nb_tx_rejected_duty_cycle = 0; /* count packets were TX request were rejected because sub-band duty-cycle budget is exhausted */
 static uint32_t meas_nb_beacon_queued = 0; /* count beacon inserted in jit queue */
 static uint32_t meas_nb_beacon_sent = 0; /* count beacon actually sent to concentrator */
 static uint32_t meas_nb_beacon_rejected = 0; /* count beacon rejected for queuing */
 
 static pthread_mutex_t mx_meas_gps = PTHREAD_MUTEX_INITIALIZER; /* control access to the GPS statistics */
-static bool gps_coord_valid; /* could we get valid GPS coordinates ? */
-static struct coord_s meas_gps_coord; /* GPS position of the gateway */
-static struct coord_s meas_gps_err; /* GPS position of the gateway */
+static struct gps_pos_s meas_gps_pos; /* GPS position of the gateway */
+static struct gps_frame_stats_s meas_gps_frame; /* GPS serial stream framing statistics */
+
+/* measurements accumulated over the life of the process, for the metrics endpoint */
+struct meas_total_s {
+    uint32_t *meas;         /* measurement, reset at each statistics interval */
+    uint64_t total;         /* sum of the measurement over previous intervals, protected by the same mutex */
+    const char *name;       /* metric name */
+    const char *help;       /* metric description */
+};
+
+static struct meas_total_s meas_up_total[] = { /* protected by mx_meas_up */
+    {&meas_nb_rx_rcv,       0, "lora_pkt_fwd_rx_packets_total",         "Radio packets received"},
+    {&meas_nb_rx_ok,        0, "lora_pkt_fwd_rx_crc_ok_total",          "Radio packets received with PAYLOAD CRC OK"},
+    {&meas_nb_rx_bad,       0, "lora_pkt_fwd_rx_crc_bad_total",         "Radio packets received with PAYLOAD CRC ERROR"},
+    {&meas_nb_rx_nocrc,     0, "lora_pkt_fwd_rx_no_crc_total",          "Radio packets received with NO PAYLOAD CRC"},
+    {&meas_up_pkt_fwd,      0, "lora_pkt_fwd_up_packets_total",         "Radio packets forwarded to the server"},
+    {&meas_up_network_byte, 0, "lora_pkt_fwd_up_network_bytes_total",   "UDP bytes sent for upstream traffic"},
+    {&meas_up_payload_byte, 0, "lora_pkt_fwd_up_payload_bytes_total",   "Radio payload bytes forwarded to the server"},
+    {&meas_up_dgram_sent,   0, "lora_pkt_fwd_up_datagrams_total",       "PUSH_DATA datagrams sent"},
+    {&meas_up_ack_rcv,      0, "lora_pkt_fwd_up_acks_total",            "PUSH_DATA datagrams acknowledged"}
+};
+
+static struct meas_total_s meas_dw_total[] = { /* protected by mx_meas_dw */
+    {&meas_dw_pull_sent,    0, "lora_pkt_fwd_dw_pull_total",            "PULL_DATA requests sent"},
+    {&meas_dw_ack_rcv,      0, "lora_pkt_fwd_dw_acks_total",            "PULL_DATA requests acknowledged"},
+    {&meas_dw_dgram_rcv,    0, "lora_pkt_fwd_dw_datagrams_total",       "Valid PULL_RESP datagrams received"},
+    {&meas_dw_network_byte, 0, "lora_pkt_fwd_dw_network_bytes_total",   "UDP bytes of valid PULL_RESP datagrams received"},
+    {&meas_dw_payload_byte, 0, "lora_pkt_fwd_dw_payload_bytes_total",   "Radio payload bytes received for downlink"},
+    {&meas_nb_tx_ok,        0, "lora_pkt_fwd_tx_ok_total",              "Packets programmed in the concentrator for TX"},
+    {&meas_nb_tx_fail,      0, "lora_pkt_fwd_tx_fail_total",            "Packets failed to be programmed in the concentrator"},
+    {&meas_nb_tx_requested, 0, "lora_pkt_fwd_tx_requested_total",       "TX requests received from the server"},
+    {&meas_nb_tx_rejected_collision_packet, 0, "lora_pkt_fwd_tx_rejected_collision_packet_total", "TX requests rejected for collision with a packet"},
+    {&meas_nb_tx_rejected_collision_beacon, 0, "lora_pkt_fwd_tx_rejected_collision_beacon_total", "TX requests rejected for collision with a beacon"},
+    {&meas_nb_tx_rejected_too_late,  0, "lora_pkt_fwd_tx_rejected_too_late_total",  "TX requests rejected for being too late"},
+    {&meas_nb_tx_rejected_too_early, 0, "lora_pkt_fwd_tx_rejected_too_early_total", "TX requests rejected for being too much in advance"},
+    {&meas_nb_tx_rejected_duty_cycle, 0, "lora_pkt_fwd_tx_rejected_duty_cycle_total", "TX requests rejected for exceeding sub-band duty-cycle"},
+    {&meas_nb_beacon_queued,   0, "lora_pkt_fwd_beacon_queued_total",   "Beacons inserted in JIT queue"},
+    {&meas_nb_beacon_sent,     0, "lora_pkt_fwd_beacon_sent_total",     "Beacons programmed in the concentrator"},
+    {&meas_nb_beacon_rejected, 0, "lora_pkt_fwd_beacon_rejected_total", "Beacons rejected for queuing"}
+};
+
+/* local metrics endpoint */
+static char metrics_listen[128] = "\0"; /* "unix:<path>" or localhost TCP port the metrics are served on (empty = disabled) */
+static time_t start_time; /* process start time, for the metrics endpoint */
+
+/* flight recorder */
+static char flightrec_path[128] = "\0"; /* path of the event log file (empty = disabled) */
+static uint32_t flightrec_size = FLIGHTREC_DEFAULT_SIZE; /* number of events kept in the log */
+
+/* JSON parsing of configuration files, no allocation per node */
+static char conf_arena_buf[CONF_ARENA_SIZE];
+static JSON_Arena conf_arena;
+
+/* RX channels frequencies, for per-channel statistics */
+static uint32_t rx_rf_freq_hz[LGW_RF_CHAIN_NB]; /* center frequency of radios */
+static uint32_t rx_if_freq_hz[LGW_IF_CHAIN_NB]; /* frequency of IF chains, 0 if disabled */
+static const double rtt_bounds[] = {0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0}; /* in seconds */
+static const double tx_latency_bounds[] = {0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5}; /* in seconds */
+static struct metrics_hist_s hist_tx_latency; /* delay between a packet is due in JIT queue and programmed in the concentrator */
 
 static pthread_mutex_t mx_stat_rep = PTHREAD_MUTEX_INITIALIZER; /* control access to the status report */
 static bool report_ready = false; /* true when there is a new report to send to the server */
@@ -224,6 +323,15 @@ static uint32_t autoquit_threshold = 0; /* enable auto-quit after a number of no
 
 /* Just In Time TX scheduling */
 static struct jit_queue_s jit_queue;
+static uint32_t asap_delay_floor = JIT_ASAP_DELAY_FLOOR; /* minimum delay given to immediate downlinks, in us */
+static uint32_t asap_delay_ceiling = JIT_ASAP_DELAY_CEILING; /* maximum delay given to immediate downlinks, in us */
+static int dc_conf_nb = 0; /* number of duty-cycle limited sub-bands configured */
+static struct {
+    uint32_t freq_min;
+    uint32_t freq_max;
+    float percent;
+    uint32_t window;
+} dc_conf[JIT_DC_BAND_MAX]; /* duty-cycle limited sub-bands, applied to JIT queue once initialized */
 
 /* Gateway specificities */
 static int8_t antenna_gain = 0;
@@ -246,9 +354,33 @@ static uint16_t crc16(const uint8_t * data, unsigned size);
 
 static double difftimespec(struct timespec end, struct timespec beginning);
 
-static void gps_process_sync(void);
+static int gps_get_trigcnt(struct timespec gps_time, uint32_t *trig_tstamp);
+
+static void gps_update_timeref(void);
+
+static void meas_accumulate(struct meas_total_s *table, unsigned size);
+
+static void rtt_summary(const struct hdr_hist_s *hist, double *summary);
+
+static void rx_if_set_freq(uint8_t if_chain, const struct lgw_conf_rxif_s *ifconf);
+
+static int rx_dr_index(const struct lgw_pkt_rx_s *p);
+
+static void rx_dr_name(int index, char *name, size_t size);
+
+static uint32_t rx_time_on_air(const struct lgw_pkt_rx_s *p);
+
+static void rx_account(struct meas_rx_s *meas, const struct lgw_pkt_rx_s *p, uint32_t airtime_ms);
+
+static void rx_print(const char *name, const struct meas_rx_s *meas);
 
-static void gps_process_coords(void);
+static int rx_stats_json(char *buf, size_t size, const struct meas_rx_s *rx_if, const struct meas_rx_s *rx_dr);
+
+static void metrics_collect(struct metrics_buf_s *buf);
+
+static uint32_t concentrator_count(const struct timeval *concent_time);
+
+static JSON_Value * parse_conf_file(const char *conf_file);
 
 /* threads */
 void thread_up(void);
@@ -279,6 +411,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
     JSON_Object *conf_obj = NULL;
     JSON_Object *conf_lbt_obj = NULL;
     JSON_Object *conf_lbtchan_obj = NULL;
+    JSON_Object *conf_dc_obj = NULL;
     JSON_Value *val = NULL;
     JSON_Array *conf_array = NULL;
     struct lgw_conf_board_s boardconf;
@@ -288,7 +421,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
     uint32_t sf, bw, fdev;
 
     /* try to parse JSON */
-    root_val = json_parse_file_with_comments(conf_file);
+    root_val = parse_conf_file(conf_file);
     if (root_val == NULL) {
         MSG("ERROR: %s is not a valid JSON file\n", conf_file);
         exit(EXIT_FAILURE);
@@ -411,6 +544,26 @@ static int parse_SX1301_configuration(const char * conf_file) {
     }
     MSG("INFO: antenna_gain %d dBi\n", antenna_gain);
 
+    /* set duty-cycle limited sub-bands (optional) */
+    conf_array = json_object_get_array(conf_obj, "duty_cycle");
+    if (conf_array != NULL) {
+        dc_conf_nb = 0;
+        for (i = 0; i < (int)json_array_get_count(conf_array); i++) {
+            if (i >= JIT_DC_BAND_MAX) {
+                MSG("ERROR: duty-cycle sub-band %d not supported, skip it\n", i);
+                break;
+            }
+            conf_dc_obj = json_array_get_object(conf_array, i);
+            dc_conf[i].freq_min = (uint32_t)json_object_get_number(conf_dc_obj, "freq_min");
+            dc_conf[i].freq_max = (uint32_t)json_object_get_number(conf_dc_obj, "freq_max");
+            dc_conf[i].percent = (float)json_object_get_number(conf_dc_obj, "percent");
+            val = json_object_get_value(conf_dc_obj, "window");
+            dc_conf[i].window = (val != NULL) ? (uint32_t)json_value_get_number(val) : DEFAULT_DUTY_CYCLE_WINDOW;
+            MSG("INFO: duty-cycle sub-band %d> [%u:%u] Hz, %.2f%% on %u s\n", i, dc_conf[i].freq_min, dc_conf[i].freq_max, dc_conf[i].percent, dc_conf[i].window);
+            dc_conf_nb += 1;
+        }
+    }
+
     /* set configuration for tx gains */
     memset(&txlut, 0, sizeof txlut); /* initialize configuration structure */
     for (i = 0; i < TX_GAIN_LUT_SIZE_MAX; i++) {
@@ -533,6 +686,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             MSG("ERROR: invalid configuration for radio %i\n", i);
             return -1;
         }
+        rx_rf_freq_hz[i] = (rfconf.enable == true) ? rfconf.freq_hz : 0;
     }
 
     /* set configuration for Lora multi-SF channels (bandwidth cannot be set) */
@@ -567,6 +721,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             MSG("ERROR: invalid configuration for Lora multi-SF channel %i\n", i);
             return -1;
         }
+        rx_if_set_freq(i, &ifconf);
     }
 
     /* set configuration for Lora standard channel */
@@ -609,6 +764,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             MSG("ERROR: invalid configuration for Lora standard channel\n");
             return -1;
         }
+        rx_if_set_freq(8, &ifconf);
     }
 
     /* set configuration for FSK channel */
@@ -652,6 +808,7 @@ static int parse_SX1301_configuration(const char * conf_file) {
             MSG("ERROR: invalid configuration for FSK channel\n");
             return -1;
         }
+        rx_if_set_freq(9, &ifconf);
     }
     json_value_free(root_val);
 
@@ -667,7 +824,7 @@ static int parse_gateway_configuration(const char * conf_file) {
     unsigned long long ull = 0;
 
     /* try to parse JSON */
-    root_val = json_parse_file_with_comments(conf_file);
+    root_val = parse_conf_file(conf_file);
     if (root_val == NULL) {
         MSG("ERROR: %s is not a valid JSON file\n", conf_file);
         exit(EXIT_FAILURE);
@@ -843,6 +1000,39 @@ static int parse_gateway_configuration(const char * conf_file) {
         MSG("INFO: Beaconing information descriptor is set to %u\n", beacon_infodesc);
     }
 
+    /* XTAL correction precision required to start beaconing (optional) */
+    val = json_object_get_value(conf_obj, "xtal_correct_stddev_ppm");
+    if (val != NULL) {
+        xtal_correct_max_stddev = json_value_get_number(val);
+        MSG("INFO: XTAL correction is used once its standard deviation is below %.3f ppm\n", xtal_correct_max_stddev);
+    }
+
+    /* XTAL correction state file, for warm restart (optional) */
+    str = json_object_get_string(conf_obj, "state_file");
+    if (str != NULL) {
+        snprintf(state_file_path, sizeof state_file_path, "%s", str);
+        MSG("INFO: XTAL correction state is saved to \"%s\"\n", state_file_path);
+    }
+
+    /* Local metrics endpoint (optional) */
+    str = json_object_get_string(conf_obj, "metrics_listen");
+    if (str != NULL) {
+        snprintf(metrics_listen, sizeof metrics_listen, "%s", str);
+        MSG("INFO: metrics are served on \"%s\"\n", metrics_listen);
+    }
+
+    /* Flight recorder (optional) */
+    str = json_object_get_string(conf_obj, "flight_recorder");
+    if (str != NULL) {
+        snprintf(flightrec_path, sizeof flightrec_path, "%s", str);
+        MSG("INFO: RX/TX events are recorded to \"%s\"\n", flightrec_path);
+    }
+    val = json_object_get_value(conf_obj, "flight_recorder_size");
+    if (val != NULL) {
+        flightrec_size = (uint32_t)json_value_get_number(val);
+        MSG("INFO: flight recorder keeps the last %u events\n", flightrec_size);
+    }
+
     /* Auto-quit threshold (optional) */
     val = json_object_get_value(conf_obj, "autoquit_threshold");
     if (val != NULL) {
@@ -850,6 +1040,18 @@ static int parse_gateway_configuration(const char * conf_file) {
         MSG("INFO: Auto-quit after %u non-acknowledged PULL_DATA\n", autoquit_threshold);
     }
 
+    /* Class C ASAP delay bounds (optional) */
+    val = json_object_get_value(conf_obj, "classc_asap_floor_ms");
+    if (val != NULL) {
+        asap_delay_floor = (uint32_t)json_value_get_number(val) * 1000;
+        MSG("INFO: Immediate downlinks are delayed by at least %u ms\n", asap_delay_floor / 1000);
+    }
+    val = json_object_get_value(conf_obj, "classc_asap_ceiling_ms");
+    if (val != NULL) {
+        asap_delay_ceiling = (uint32_t)json_value_get_number(val) * 1000;
+        MSG("INFO: Immediate downlinks are delayed by at most %u ms\n", asap_delay_ceiling / 1000);
+    }
+
     /* free JSON parsing data structure */
     json_value_free(root_val);
     return 0;
@@ -884,6 +1086,349 @@ static double difftimespec(struct timespec end, struct timespec beginning) {
     return x;
 }
 
+/* Parse a configuration file in the configuration arena, falling back to the heap if it does not fit */
+static JSON_Value * parse_conf_file(const char *conf_file) {
+    JSON_Value *root_val;
+
+    if (conf_arena.buffer == NULL) {
+        json_arena_init(&conf_arena, conf_arena_buf, sizeof conf_arena_buf);
+    }
+    json_arena_reset(&conf_arena); /* previous configuration tree is no longer used */
+    root_val = json_parse_file_with_comments_arena(conf_file, &conf_arena);
+    if ((root_val == NULL) && (conf_arena.overflow != 0)) {
+        MSG_DEBUG(DEBUG_LOG, "INFO: %s does not fit in %u bytes, parsed on the heap\n", conf_file, CONF_ARENA_SIZE);
+        root_val = json_parse_file_with_comments(conf_file);
+    }
+    return root_val;
+}
+
+/* 32-bit counter value corresponding to a concentrator time given by timersync */
+static uint32_t concentrator_count(const struct timeval *concent_time) {
+    return (uint32_t)((int64_t)concent_time->tv_sec * 1000000LL + (int64_t)concent_time->tv_usec);
+}
+
+/* Save XTAL correction state and latest GPS time reference, if XTAL correction is in use */
+static int save_state(void) {
+    JSON_Value *root_val;
+    JSON_Object *root_obj;
+    struct xcorr_s xc;
+    struct tref ref;
+    bool xc_ok;
+    char tmp_path[sizeof state_file_path + 4];
+    int ret = -1;
+
+    if (state_file_path[0] == '\0') {
+        return 0;
+    }
+    pthread_mutex_lock(&mx_xcorr);
+    xc = xtal_estimator;
+    xc_ok = xtal_correct_ok;
+    pthread_mutex_unlock(&mx_xcorr);
+    if ((xc_ok == false) || (timeref_read(&timeref_gps, &ref) == false)) {
+        return 0;
+    }
+
+    /* JSON numbers are serialized with 6 decimals, so ratios are saved in ppm */
+    root_val = json_value_init_object();
+    if (root_val == NULL) {
+        MSG("ERROR: [state] failed to create JSON state object\n");
+        return -1;
+    }
+    root_obj = json_value_get_object(root_val);
+    json_object_dotset_number(root_obj, "xtal.correct_ppm", (xc.estimate - 1.0) * 1E6);
+    json_object_dotset_number(root_obj, "xtal.stddev_ppm", xcorr_stddev(&xc));
+    json_object_dotset_number(root_obj, "xtal.noise_ppm", sqrt(xc.noise_var) * 1E6);
+    json_object_dotset_number(root_obj, "xtal.nb_samples", xc.nb_samples);
+    json_object_dotset_number(root_obj, "tref.systime", (double)ref.systime);
+    json_object_dotset_number(root_obj, "tref.count_us", ref.count_us);
+    json_object_dotset_number(root_obj, "tref.utc_sec", (double)ref.utc.tv_sec);
+    json_object_dotset_number(root_obj, "tref.utc_nsec", (double)ref.utc.tv_nsec);
+    json_object_dotset_number(root_obj, "tref.gps_sec", (double)ref.gps.tv_sec);
+    json_object_dotset_number(root_obj, "tref.gps_nsec", (double)ref.gps.tv_nsec);
+    json_object_dotset_number(root_obj, "tref.xtal_err_ppm", (ref.xtal_err - 1.0) * 1E6);
+
+    /* write a temporary file and rename it, so that an interrupted save never corrupts the state */
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", state_file_path);
+    if (json_serialize_to_file_pretty(root_val, tmp_path) != JSONSuccess) {
+        MSG("WARNING: [state] failed to write %s\n", tmp_path);
+    } else if (rename(tmp_path, state_file_path) != 0) {
+        MSG("WARNING: [state] failed to rename %s to %s (%s)\n", tmp_path, state_file_path, strerror(errno));
+    } else {
+        MSG_DEBUG(DEBUG_LOG, "INFO: [state] XTAL correction state saved to %s\n", state_file_path);
+        ret = 0;
+    }
+    json_value_free(root_val);
+    return ret;
+}
+
+/* Restore XTAL correction state, must be called with mx_xcorr locked */
+static int load_state(void) {
+    JSON_Value *root_val;
+    JSON_Object *root_obj;
+    struct xcorr_s saved;
+    double stddev, noise;
+    time_t systime;
+    double age;
+
+    if (state_file_path[0] == '\0') {
+        return 0;
+    }
+    if (access(state_file_path, R_OK) != 0) {
+        MSG("INFO: [state] no XTAL correction state to restore from %s\n", state_file_path);
+        return 0;
+    }
+    root_val = json_parse_file(state_file_path);
+    root_obj = json_value_get_object(root_val);
+    if ((root_obj == NULL) || (json_object_dotget_value(root_obj, "xtal.correct_ppm") == NULL) ||
+        (json_object_dotget_value(root_obj, "xtal.stddev_ppm") == NULL) || (json_object_dotget_value(root_obj, "xtal.noise_ppm") == NULL) ||
+        (json_object_dotget_value(root_obj, "xtal.nb_samples") == NULL) || (json_object_dotget_value(root_obj, "tref.systime") == NULL)) {
+        MSG("WARNING: [state] %s is not a valid state file, ignored\n", state_file_path);
+        json_value_free(root_val);
+        return -1;
+    }
+
+    /* the saved time reference tells when XTAL correction was last confirmed by GPS */
+    /* note: it cannot be reused as is, the concentrator counter restarts with the concentrator */
+    systime = (time_t)json_object_dotget_number(root_obj, "tref.systime");
+    age = difftime(time(NULL), systime);
+    if ((age < 0) || (age > STATE_MAX_AGE)) {
+        MSG("WARNING: [state] saved XTAL correction state is too old (%.0f sec), ignored\n", age);
+        json_value_free(root_val);
+        return -1;
+    }
+
+    memset(&saved, 0, sizeof saved);
+    saved.estimate = 1.0 + json_object_dotget_number(root_obj, "xtal.correct_ppm") / 1E6;
+    stddev = json_object_dotget_number(root_obj, "xtal.stddev_ppm") / 1E6;
+    noise = json_object_dotget_number(root_obj, "xtal.noise_ppm") / 1E6;
+    saved.variance = stddev * stddev;
+    saved.noise_var = noise * noise;
+    saved.nb_samples = (uint32_t)json_object_dotget_number(root_obj, "xtal.nb_samples");
+    json_value_free(root_val);
+
+    xcorr_restore(&xtal_estimator, &saved, age);
+    if (xtal_estimator.restored == false) {
+        MSG("WARNING: [state] saved XTAL correction state has too few samples, ignored\n");
+        return -1;
+    }
+    MSG("INFO: [state] XTAL correction restored: %+.3f ppm +/- %.3f ppm (age: %.0f sec), waiting for GPS confirmation\n", (xtal_estimator.estimate - 1.0) * 1E6, xcorr_stddev(&xtal_estimator), age);
+    return 0;
+}
+
+static void rx_if_set_freq(uint8_t if_chain, const struct lgw_conf_rxif_s *ifconf) {
+    if ((ifconf->enable == true) && (ifconf->rf_chain < LGW_RF_CHAIN_NB) && (rx_rf_freq_hz[ifconf->rf_chain] != 0)) {
+        rx_if_freq_hz[if_chain] = (uint32_t)((int32_t)rx_rf_freq_hz[ifconf->rf_chain] + ifconf->freq_hz);
+    } else {
+        rx_if_freq_hz[if_chain] = 0;
+    }
+}
+
+/* Index of a packet datarate in per-datarate measurements, -1 if not accounted for */
+static int rx_dr_index(const struct lgw_pkt_rx_s *p) {
+    int sf, bw;
+
+    if (p->modulation == MOD_FSK) {
+        return RX_DR_FSK;
+    } else if (p->modulation != MOD_LORA) {
+        return -1;
+    }
+    switch (p->datarate) {
+        case DR_LORA_SF7:  sf = 0; break;
+        case DR_LORA_SF8:  sf = 1; break;
+        case DR_LORA_SF9:  sf = 2; break;
+        case DR_LORA_SF10: sf = 3; break;
+        case DR_LORA_SF11: sf = 4; break;
+        case DR_LORA_SF12: sf = 5; break;
+        default: return -1;
+    }
+    switch (p->bandwidth) {
+        case BW_125KHZ: bw = 0; break;
+        case BW_250KHZ: bw = 1; break;
+        case BW_500KHZ: bw = 2; break;
+        default: return -1;
+    }
+    return (sf * RX_BW_NB) + bw;
+}
+
+/* Datarate name of per-datarate measurements index, as in the "datr" field of rxpk */
+static void rx_dr_name(int index, char *name, size_t size) {
+    if (index == RX_DR_FSK) {
+        snprintf(name, size, "FSK");
+    } else {
+        snprintf(name, size, "SF%dBW%d", 7 + (index / RX_BW_NB), 125 << (index % RX_BW_NB));
+    }
+}
+
+static uint32_t rx_time_on_air(const struct lgw_pkt_rx_s *p) {
+    struct lgw_pkt_tx_s pkt;
+
+    memset(&pkt, 0, sizeof pkt);
+    pkt.modulation = p->modulation;
+    pkt.bandwidth = p->bandwidth;
+    pkt.datarate = p->datarate;
+    pkt.coderate = p->coderate;
+    pkt.preamble = (p->modulation == MOD_LORA) ? STD_LORA_PREAMB : STD_FSK_PREAMB;
+    pkt.no_crc = (p->status == STAT_NO_CRC);
+    pkt.size = p->size;
+    return lgw_time_on_air(&pkt);
+}
+
+/* Account a received packet, caller holds mx_meas_up */
+static void rx_account(struct meas_rx_s *meas, const struct lgw_pkt_rx_s *p, uint32_t airtime_ms) {
+    meas->nb_rcv += 1;
+    switch (p->status) {
+        case STAT_CRC_OK: meas->nb_ok += 1; break;
+        case STAT_CRC_BAD: meas->nb_bad += 1; break;
+        case STAT_NO_CRC: meas->nb_nocrc += 1; break;
+        default: break;
+    }
+    meas->payload_byte += p->size;
+    meas->airtime_ms += airtime_ms;
+}
+
+static void rx_print(const char *name, const struct meas_rx_s *meas) {
+    printf("# %s: %u received (CRC_OK %u, CRC_FAIL %u, NO_CRC %u), %u bytes, airtime %u ms (%.2f%%)\n", name, meas->nb_rcv, meas->nb_ok, meas->nb_bad, meas->nb_nocrc, meas->payload_byte, meas->airtime_ms, meas->airtime_ms / (10.0 * stat_interval));
+}
+
+/* Write per-channel and per-datarate statistics as status report fields, return their length */
+static int rx_stats_json(char *buf, size_t size, const struct meas_rx_s *rx_if, const struct meas_rx_s *rx_dr) {
+    int i;
+    int n = 0;
+    bool first = true;
+    char name[16];
+
+    n += snprintf(buf + n, size - n, ",\"rxch\":[");
+    for (i = 0; (i < LGW_IF_CHAIN_NB) && ((size_t)n < size); ++i) {
+        if (rx_if_freq_hz[i] == 0) {
+            continue;
+        }
+        n += snprintf(buf + n, size - n, "%s{\"chan\":%d,\"freq\":%.6f,\"rxnb\":%u,\"rxok\":%u,\"rxbd\":%u,\"byte\":%u,\"toa\":%u,\"occu\":%.2f}", (first == true) ? "" : ",", i, rx_if_freq_hz[i] / 1E6, rx_if[i].nb_rcv, rx_if[i].nb_ok, rx_if[i].nb_bad, rx_if[i].payload_byte, rx_if[i].airtime_ms, rx_if[i].airtime_ms / (10.0 * stat_interval));
+        first = false;
+    }
+    if ((size_t)n < size) {
+        n += snprintf(buf + n, size - n, "],\"rxdr\":[");
+    }
+    first = true;
+    for (i = 0; (i < RX_DR_NB) && ((size_t)n < size); ++i) {
+        if (rx_dr[i].nb_rcv == 0) {
+            continue;
+        }
+        rx_dr_name(i, name, sizeof name);
+        n += snprintf(buf + n, size - n, "%s{\"datr\":\"%s\",\"rxnb\":%u,\"rxok\":%u,\"rxbd\":%u,\"byte\":%u,\"toa\":%u}", (first == true) ? "" : ",", name, rx_dr[i].nb_rcv, rx_dr[i].nb_ok, rx_dr[i].nb_bad, rx_dr[i].payload_byte, rx_dr[i].airtime_ms);
+        first = false;
+    }
+    if ((size_t)n < size) {
+        n += snprintf(buf + n, size - n, "]");
+    }
+    if ((size_t)n >= size) {
+        MSG("WARNING: [main] per-channel statistics truncated\n");
+        buf[0] = '\0';
+        return 0;
+    }
+    return n;
+}
+
+/* Add interval measurements to their totals, caller holds the measurements mutex and resets them */
+static void meas_accumulate(struct meas_total_s *table, unsigned size) {
+    unsigned i;
+
+    for (i = 0; i < size; ++i) {
+        table[i].total += *table[i].meas;
+    }
+}
+
+/* Get p50, p90, p99 and max of round-trip times, in milliseconds */
+static void rtt_summary(const struct hdr_hist_s *hist, double *summary) {
+    summary[0] = hdr_hist_percentile(hist, 50.0) / 1E3;
+    summary[1] = hdr_hist_percentile(hist, 90.0) / 1E3;
+    summary[2] = hdr_hist_percentile(hist, 99.0) / 1E3;
+    summary[3] = hist->max / 1E3;
+}
+
+/* Generate metrics exposition text, called by metrics thread for each scrape */
+static void metrics_collect(struct metrics_buf_s *buf) {
+    unsigned i;
+    uint32_t asap_delay, latency_p50, latency_p99;
+    uint8_t jit_nb_pkt, jit_nb_beacon;
+    double ts_drift, ts_residual, ts_uncertainty;
+    int ts_nb_samples;
+    struct tref ref;
+    bool ref_ok;
+    bool coord_ok;
+    struct gps_frame_stats_s frame;
+    struct xcorr_s xc;
+    bool xc_ok;
+    struct hdr_hist_s rtt;
+
+    metrics_gauge(buf, "lora_pkt_fwd_start_time_seconds", "Start time of the packet forwarder since unix epoch", (double)start_time);
+
+    /* counters and round-trip times: totals of previous intervals plus current interval */
+    pthread_mutex_lock(&mx_meas_up);
+    for (i = 0; i < ARRAY_SIZE(meas_up_total); ++i) {
+        metrics_counter(buf, meas_up_total[i].name, meas_up_total[i].help, meas_up_total[i].total + *meas_up_total[i].meas);
+    }
+    rtt = meas_up_ack_rtt_total;
+    hdr_hist_merge(&rtt, &meas_up_ack_rtt);
+    pthread_mutex_unlock(&mx_meas_up);
+    metrics_hdr_histogram(buf, "lora_pkt_fwd_push_ack_rtt_seconds", "PUSH_DATA to PUSH_ACK round-trip time", &rtt, 1E-6, rtt_bounds, ARRAY_SIZE(rtt_bounds));
+    pthread_mutex_lock(&mx_meas_dw);
+    for (i = 0; i < ARRAY_SIZE(meas_dw_total); ++i) {
+        metrics_counter(buf, meas_dw_total[i].name, meas_dw_total[i].help, meas_dw_total[i].total + *meas_dw_total[i].meas);
+    }
+    rtt = meas_dw_ack_rtt_total;
+    hdr_hist_merge(&rtt, &meas_dw_ack_rtt);
+    pthread_mutex_unlock(&mx_meas_dw);
+    metrics_hdr_histogram(buf, "lora_pkt_fwd_pull_ack_rtt_seconds", "PULL_DATA to PULL_ACK round-trip time", &rtt, 1E-6, rtt_bounds, ARRAY_SIZE(rtt_bounds));
+
+    /* JIT */
+    jit_get_occupancy(&jit_queue, &jit_nb_pkt, &jit_nb_beacon);
+    metrics_gauge(buf, "lora_pkt_fwd_jit_queue_packets", "Packets in JIT queue, beacons included", (double)jit_nb_pkt);
+    metrics_gauge(buf, "lora_pkt_fwd_jit_queue_beacons", "Beacons in JIT queue", (double)jit_nb_beacon);
+    jit_asap_get_stats(&jit_queue, &asap_delay, &latency_p50, &latency_p99);
+    metrics_gauge(buf, "lora_pkt_fwd_jit_asap_delay_seconds", "Delay given to immediate downlinks", asap_delay / 1E6);
+    metrics_gauge(buf, "lora_pkt_fwd_jit_tx_latency_p50_seconds", "Median TX latency on last JIT_ASAP_WINDOW packets", latency_p50 / 1E6);
+    metrics_gauge(buf, "lora_pkt_fwd_jit_tx_latency_p99_seconds", "99th percentile TX latency on last JIT_ASAP_WINDOW packets", latency_p99 / 1E6);
+    metrics_histogram(buf, "lora_pkt_fwd_jit_tx_latency_seconds", "Delay between a packet is due in JIT queue and programmed in the concentrator", &hist_tx_latency);
+
+    /* timer sync */
+    if (get_timersync_model(&ts_drift, &ts_residual, &ts_uncertainty, &ts_nb_samples) == 0) {
+        metrics_gauge(buf, "lora_pkt_fwd_timersync_valid", "Host/concentrator clock model is valid", 1.0);
+        metrics_gauge(buf, "lora_pkt_fwd_timersync_drift_ppm", "Host/concentrator clock drift", ts_drift);
+        metrics_gauge(buf, "lora_pkt_fwd_timersync_residual_seconds", "Residual of the host/concentrator clock model", ts_residual / 1E6);
+        metrics_gauge(buf, "lora_pkt_fwd_timersync_uncertainty_seconds", "Uncertainty of the last host/concentrator clock sample", ts_uncertainty / 1E6);
+        metrics_gauge(buf, "lora_pkt_fwd_timersync_samples", "Samples used by the host/concentrator clock model", (double)ts_nb_samples);
+    } else {
+        metrics_gauge(buf, "lora_pkt_fwd_timersync_valid", "Host/concentrator clock model is valid", 0.0);
+    }
+
+    /* GPS */
+    metrics_gauge(buf, "lora_pkt_fwd_gps_enabled", "GPS is enabled", (gps_enabled == true) ? 1.0 : 0.0);
+    if (gps_enabled == false) {
+        return;
+    }
+    ref_ok = timeref_read(&timeref_gps, &ref);
+    metrics_gauge(buf, "lora_pkt_fwd_gps_time_reference_valid", "GPS time reference is valid", (ref_ok == true) ? 1.0 : 0.0);
+    metrics_gauge(buf, "lora_pkt_fwd_gps_time_reference_age_seconds", "Age of the GPS time reference", difftime(time(NULL), ref.systime));
+    pthread_mutex_lock(&mx_meas_gps);
+    coord_ok = meas_gps_pos.valid;
+    frame = meas_gps_frame;
+    pthread_mutex_unlock(&mx_meas_gps);
+    metrics_gauge(buf, "lora_pkt_fwd_gps_coordinates_valid", "GPS coordinates are valid", (coord_ok == true) ? 1.0 : 0.0);
+    metrics_counter(buf, "lora_pkt_fwd_gps_ubx_frames_total", "UBX frames received from GPS", frame.nb_ubx);
+    metrics_counter(buf, "lora_pkt_fwd_gps_nmea_sentences_total", "NMEA sentences received from GPS", frame.nb_nmea);
+    metrics_counter(buf, "lora_pkt_fwd_gps_framing_errors_total", "GPS serial framing errors", frame.nb_errors);
+    metrics_counter(buf, "lora_pkt_fwd_gps_discarded_bytes_total", "GPS serial bytes not part of a valid frame", frame.nb_discarded);
+    pthread_mutex_lock(&mx_xcorr);
+    xc = xtal_estimator;
+    xc_ok = xtal_correct_ok;
+    pthread_mutex_unlock(&mx_xcorr);
+    metrics_gauge(buf, "lora_pkt_fwd_xtal_correction_ppm", "Estimated XTAL correction", (xc.estimate - 1.0) * 1E6);
+    metrics_gauge(buf, "lora_pkt_fwd_xtal_correction_stddev_ppm", "Standard deviation of the XTAL correction estimate", xcorr_stddev(&xc));
+    metrics_gauge(buf, "lora_pkt_fwd_xtal_correction_samples", "Samples accepted by the XTAL correction estimator since its last reset", (double)xc.nb_samples);
+    metrics_gauge(buf, "lora_pkt_fwd_xtal_correction_rejected", "Samples rejected by the XTAL correction estimator since its last reset", (double)xc.nb_rejected);
+    metrics_gauge(buf, "lora_pkt_fwd_xtal_correction_in_use", "XTAL correction is used", (xc_ok == true) ? 1.0 : 0.0);
+}
+
 static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error) {
     uint8_t buff_ack[64]; /* buffer to give feedback to server */
     int buff_index;
@@ -954,6 +1499,14 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error)
                 memcpy((void *)(buff_ack + buff_index), (void *)"\"GPS_UNLOCKED\"", 14);
                 buff_index += 14;
                 break;
+            case JIT_ERROR_DUTY_CYCLE:
+                memcpy((void *)(buff_ack + buff_index), (void *)"\"DUTY_CYCLE\"", 12);
+                buff_index += 12;
+                /* update stats */
+                pthread_mutex_lock(&mx_meas_dw);
+                meas_nb_tx_rejected_duty_cycle += 1;
+                pthread_mutex_unlock(&mx_meas_dw);
+                break;
             default:
                 memcpy((void *)(buff_ack + buff_index), (void *)"\"UNKNOWN\"", 9);
                 buff_index += 9;
@@ -1021,17 +1574,39 @@ int main(void)
     uint32_t cp_nb_tx_rejected_collision_beacon = 0;
     uint32_t cp_nb_tx_rejected_too_late = 0;
     uint32_t cp_nb_tx_rejected_too_early = 0;
+    uint32_t cp_nb_tx_rejected_duty_cycle = 0;
     uint32_t cp_nb_beacon_queued = 0;
     uint32_t cp_nb_beacon_sent = 0;
     uint32_t cp_nb_beacon_rejected = 0;
+    struct hdr_hist_s cp_up_ack_rtt;
+    struct meas_rx_s cp_rx_if[LGW_IF_CHAIN_NB];
+    struct meas_rx_s cp_rx_dr[RX_DR_NB];
+    struct hdr_hist_s cp_dw_ack_rtt;
 
     /* GPS coordinates variables */
     bool coord_ok = false;
     struct coord_s cp_gps_coord = {0.0, 0.0, 0};
+    struct gps_frame_stats_s cp_gps_frame = {0, 0, 0, 0};
+    struct tref cp_time_ref;
+    struct xcorr_s cp_xcorr;
+    bool cp_xcorr_ok = false;
 
     /* SX1301 data variables */
     uint32_t trig_tstamp;
 
+    /* JiT variables */
+    uint32_t asap_delay;
+    uint32_t tx_latency_p50;
+    uint32_t tx_latency_p99;
+    double ts_drift;
+    double ts_residual;
+    double ts_uncertainty;
+    int ts_nb_samples;
+    struct timeval host_time;
+    struct timeval concent_time;
+    struct jit_dc_stats_s dc_stats[JIT_DC_BAND_MAX];
+    int dc_nb_band;
+
     /* statistics variable */
     time_t t;
     char stat_timestamp[24];
@@ -1040,6 +1615,12 @@ int main(void)
     float rx_nocrc_ratio;
     float up_ack_ratio;
     float dw_ack_ratio;
+    double up_rtt[4]; /* p50, p90, p99, max */
+    double dw_rtt[4];
+    char up_rtt_json[64];
+    char dw_rtt_json[64];
+    char rx_json[STATUS_RX_SIZE];
+    char name[16];
 
     /* display version informations */
     MSG("*** Beacon Packet Forwarder for Lora Gateway ***\nVersion: " VERSION_STRING "\n");
@@ -1053,6 +1634,7 @@ int main(void)
     #else
         MSG("INFO: Host endianness unknown\n");
     #endif
+    MSG("INFO: Base64 implementation: %s\n", b64_impl_name(b64_get_impl()));
 
     /* load configuration files */
     if (access(debug_cfg_path, R_OK) == 0) { /* if there is a debug conf, parse only the debug conf */
@@ -1097,17 +1679,18 @@ int main(void)
         exit(EXIT_FAILURE);
     }
 
+    /* GPS time reference is not valid until GPS is synchronized */
+    timeref_init(&timeref_gps);
+
     /* Start GPS a.s.a.p., to allow it to lock */
     if (gps_tty_path[0] != '\0') { /* do not try to open GPS device if no path set */
         i = lgw_gps_enable(gps_tty_path, "ubx7", 0, &gps_tty_fd); /* HAL only supports u-blox 7 for now */
         if (i != LGW_GPS_SUCCESS) {
             printf("WARNING: [main] impossible to open %s for GPS sync (check permissions)\n", gps_tty_path);
             gps_enabled = false;
-            gps_ref_valid = false;
         } else {
             printf("INFO: [main] TTY port %s open for GPS synchronization\n", gps_tty_path);
             gps_enabled = true;
-            gps_ref_valid = false;
         }
     }
 
@@ -1199,6 +1782,17 @@ int main(void)
         exit(EXIT_FAILURE);
     }
 
+    /* start flight recorder, before any event can occur */
+    if (flightrec_path[0] != '\0') {
+        if (flightrec_open(flightrec_path, flightrec_size, lgwm) != 0) {
+            MSG("WARNING: [main] flight recorder disabled\n");
+        }
+    }
+
+    /* initialize metrics histograms, filled by threads */
+    start_time = time(NULL);
+    metrics_hist_init(&hist_tx_latency, tx_latency_bounds, ARRAY_SIZE(tx_latency_bounds));
+
     /* spawn threads to manage upstream and downstream */
     i = pthread_create( &thrid_up, NULL, (void * (*)(void *))thread_up, NULL);
     if (i != 0) {
@@ -1235,6 +1829,15 @@ int main(void)
         }
     }
 
+    /* start local metrics endpoint */
+    if (metrics_listen[0] != '\0') {
+        if (metrics_start(metrics_listen, metrics_collect) == 0) {
+            MSG("INFO: [main] metrics endpoint listening on %s\n", metrics_listen);
+        } else {
+            MSG("WARNING: [main] metrics endpoint disabled\n");
+        }
+    }
+
     /* configure signal handling */
     sigemptyset(&sigact.sa_mask);
     sigact.sa_flags = 0;
@@ -1263,6 +1866,14 @@ int main(void)
         cp_up_payload_byte = meas_up_payload_byte;
         cp_up_dgram_sent   = meas_up_dgram_sent;
         cp_up_ack_rcv      = meas_up_ack_rcv;
+        meas_accumulate(meas_up_total, ARRAY_SIZE(meas_up_total));
+        cp_up_ack_rtt = meas_up_ack_rtt;
+        hdr_hist_merge(&meas_up_ack_rtt_total, &meas_up_ack_rtt);
+        hdr_hist_reset(&meas_up_ack_rtt);
+        memcpy(cp_rx_if, meas_rx_if, sizeof cp_rx_if);
+        memcpy(cp_rx_dr, meas_rx_dr, sizeof cp_rx_dr);
+        memset(meas_rx_if, 0, sizeof meas_rx_if);
+        memset(meas_rx_dr, 0, sizeof meas_rx_dr);
         meas_nb_rx_rcv = 0;
         meas_nb_rx_ok = 0;
         meas_nb_rx_bad = 0;
@@ -1302,9 +1913,14 @@ int main(void)
         cp_nb_tx_rejected_collision_beacon +=  meas_nb_tx_rejected_collision_beacon;
         cp_nb_tx_rejected_too_late         +=  meas_nb_tx_rejected_too_late;
         cp_nb_tx_rejected_too_early        +=  meas_nb_tx_rejected_too_early;
+        cp_nb_tx_rejected_duty_cycle       +=  meas_nb_tx_rejected_duty_cycle;
         cp_nb_beacon_queued   +=  meas_nb_beacon_queued;
         cp_nb_beacon_sent     +=  meas_nb_beacon_sent;
         cp_nb_beacon_rejected +=  meas_nb_beacon_rejected;
+        meas_accumulate(meas_dw_total, ARRAY_SIZE(meas_dw_total));
+        cp_dw_ack_rtt = meas_dw_ack_rtt;
+        hdr_hist_merge(&meas_dw_ack_rtt_total, &meas_dw_ack_rtt);
+        hdr_hist_reset(&meas_dw_ack_rtt);
         meas_dw_pull_sent = 0;
         meas_dw_ack_rcv = 0;
         meas_dw_dgram_rcv = 0;
@@ -1317,6 +1933,7 @@ int main(void)
         meas_nb_tx_rejected_collision_beacon = 0;
         meas_nb_tx_rejected_too_late = 0;
         meas_nb_tx_rejected_too_early = 0;
+        meas_nb_tx_rejected_duty_cycle = 0;
         meas_nb_beacon_queued = 0;
         meas_nb_beacon_sent = 0;
         meas_nb_beacon_rejected = 0;
@@ -1330,9 +1947,14 @@ int main(void)
         /* access GPS statistics, copy them */
         if (gps_enabled == true) {
             pthread_mutex_lock(&mx_meas_gps);
-            coord_ok = gps_coord_valid;
-            cp_gps_coord = meas_gps_coord;
+            coord_ok = meas_gps_pos.valid;
+            cp_gps_coord = meas_gps_pos.coord;
+            cp_gps_frame = meas_gps_frame;
             pthread_mutex_unlock(&mx_meas_gps);
+            pthread_mutex_lock(&mx_xcorr);
+            cp_xcorr = xtal_estimator;
+            cp_xcorr_ok = xtal_correct_ok;
+            pthread_mutex_unlock(&mx_xcorr);
         }
 
         /* overwrite with reference coordinates if function is enabled */
@@ -1348,8 +1970,37 @@ int main(void)
         printf("# RF packets forwarded: %u (%u bytes)\n", cp_up_pkt_fwd, cp_up_payload_byte);
         printf("# PUSH_DATA datagrams sent: %u (%u bytes)\n", cp_up_dgram_sent, cp_up_network_byte);
         printf("# PUSH_DATA acknowledged: %.2f%%\n", 100.0 * up_ack_ratio);
+        if (cp_up_ack_rtt.count > 0) {
+            rtt_summary(&cp_up_ack_rtt, up_rtt);
+            printf("# PUSH_ACK round-trip time: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", up_rtt[0], up_rtt[1], up_rtt[2], up_rtt[3]);
+            snprintf(up_rtt_json, sizeof up_rtt_json, ",\"uprt\":[%.1f,%.1f,%.1f,%.1f]", up_rtt[0], up_rtt[1], up_rtt[2], up_rtt[3]);
+        } else {
+            printf("# PUSH_ACK round-trip time: no PUSH_ACK received\n");
+            up_rtt_json[0] = '\0';
+        }
+        printf("### [RX CHANNELS] ###\n");
+        for (i = 0; i < LGW_IF_CHAIN_NB; ++i) {
+            if (rx_if_freq_hz[i] != 0) {
+                snprintf(name, sizeof name, "IF%d %.3fMHz", i, rx_if_freq_hz[i] / 1E6);
+                rx_print(name, &cp_rx_if[i]);
+            }
+        }
+        for (i = 0; i < RX_DR_NB; ++i) {
+            if (cp_rx_dr[i].nb_rcv != 0) {
+                rx_dr_name(i, name, sizeof name);
+                rx_print(name, &cp_rx_dr[i]);
+            }
+        }
         printf("### [DOWNSTREAM] ###\n");
         printf("# PULL_DATA sent: %u (%.2f%% acknowledged)\n", cp_dw_pull_sent, 100.0 * dw_ack_ratio);
+        if (cp_dw_ack_rtt.count > 0) {
+            rtt_summary(&cp_dw_ack_rtt, dw_rtt);
+            printf("# PULL_ACK round-trip time: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", dw_rtt[0], dw_rtt[1], dw_rtt[2], dw_rtt[3]);
+            snprintf(dw_rtt_json, sizeof dw_rtt_json, ",\"dwrt\":[%.1f,%.1f,%.1f,%.1f]", dw_rtt[0], dw_rtt[1], dw_rtt[2], dw_rtt[3]);
+        } else {
+            printf("# PULL_ACK round-trip time: no PULL_ACK received\n");
+            dw_rtt_json[0] = '\0';
+        }
         printf("# PULL_RESP(onse) datagrams received: %u (%u bytes)\n", cp_dw_dgram_rcv, cp_dw_network_byte);
         printf("# RF packets sent to concentrator: %u (%u bytes)\n", (cp_nb_tx_ok+cp_nb_tx_fail), cp_dw_payload_byte);
         printf("# TX errors: %u\n", cp_nb_tx_fail);
@@ -1358,6 +2009,7 @@ int main(void)
             printf("# TX rejected (collision beacon): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_collision_beacon / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_collision_beacon);
             printf("# TX rejected (too late): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_too_late / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_too_late);
             printf("# TX rejected (too early): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_too_early / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_too_early);
+            printf("# TX rejected (duty cycle): %.2f%% (req:%u, rej:%u)\n", 100.0 * cp_nb_tx_rejected_duty_cycle / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_duty_cycle);
         }
         printf("# BEACON queued: %u\n", cp_nb_beacon_queued);
         printf("# BEACON sent so far: %u\n", cp_nb_beacon_sent);
@@ -1373,19 +2025,39 @@ int main(void)
             printf("# SX1301 time (PPS): %u\n", trig_tstamp);
         }
         jit_print_queue (&jit_queue, false, DEBUG_LOG);
+        jit_asap_get_stats(&jit_queue, &asap_delay, &tx_latency_p50, &tx_latency_p99);
+        printf("# TX latency: p50 %.1f ms, p99 %.1f ms\n", tx_latency_p50 / 1E3, tx_latency_p99 / 1E3);
+        printf("# Class C ASAP delay: %u ms\n", asap_delay / 1000);
+        get_host_time(&host_time);
+        if (get_concentrator_time(&concent_time, host_time) == 0) {
+            dc_nb_band = jit_duty_cycle_get_stats(&jit_queue, &concent_time, dc_stats);
+            for (i = 0; i < dc_nb_band; i++) {
+                printf("# Duty cycle %.3f-%.3f MHz (%.2f%%): %.1f s used, %.1f s remaining on %u s\n", dc_stats[i].freq_min / 1E6, dc_stats[i].freq_max / 1E6, dc_stats[i].percent, dc_stats[i].used_us / 1E6, (dc_stats[i].used_us < dc_stats[i].budget_us) ? (dc_stats[i].budget_us - dc_stats[i].used_us) / 1E6 : 0.0, dc_stats[i].window);
+            }
+        }
+        if (get_timersync_model(&ts_drift, &ts_residual, &ts_uncertainty, &ts_nb_samples) == 0) {
+            printf("# Host/SX1301 clock drift: %.3f ppm, residual %.1f us (%d samples), last sample +/-%.1f us\n", ts_drift, ts_residual, ts_nb_samples, ts_uncertainty);
+        } else {
+            printf("# Host/SX1301 clock not synchronized\n");
+        }
         printf("### [GPS] ###\n");
         if (gps_enabled == true) {
-            /* no need for mutex, display is not critical */
-            if (gps_ref_valid == true) {
-                printf("# Valid time reference (age: %li sec)\n", (long)difftime(time(NULL), time_reference_gps.systime));
+            if (timeref_read(&timeref_gps, &cp_time_ref) == true) {
+                printf("# Valid time reference (age: %li sec)\n", (long)difftime(time(NULL), cp_time_ref.systime));
             } else {
-                printf("# Invalid time reference (age: %li sec)\n", (long)difftime(time(NULL), time_reference_gps.systime));
+                printf("# Invalid time reference (age: %li sec)\n", (long)difftime(time(NULL), cp_time_ref.systime));
             }
             if (coord_ok == true) {
                 printf("# GPS coordinates: latitude %.5f, longitude %.5f, altitude %i m\n", cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt);
             } else {
                 printf("# no valid GPS coordinates available yet\n");
             }
+            if (cp_xcorr.nb_samples > 0) {
+                printf("# XTAL correction: %+.3f ppm +/- %.3f ppm (%u samples, %u rejected), %s\n", (cp_xcorr.estimate - 1.0) * 1E6, xcorr_stddev(&cp_xcorr), cp_xcorr.nb_samples, cp_xcorr.nb_rejected, (cp_xcorr_ok == true) ? "in use" : "not in use yet");
+            } else {
+                printf("# XTAL correction: no sample yet\n");
+            }
+            printf("# GPS serial: %u UBX frames, %u NMEA sentences, %u framing errors, %u bytes discarded\n", cp_gps_frame.nb_ubx, cp_gps_frame.nb_nmea, cp_gps_frame.nb_errors, cp_gps_frame.nb_discarded);
         } else if (gps_fake_enable == true) {
             printf("# GPS *FAKE* coordinates: latitude %.5f, longitude %.5f, altitude %i m\n", cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt);
         } else {
@@ -1394,24 +2066,31 @@ int main(void)
         printf("##### END #####\n");
 
         /* generate a JSON report (will be sent to server by upstream thread) */
+        rx_stats_json(rx_json, sizeof rx_json, cp_rx_if, cp_rx_dr);
         pthread_mutex_lock(&mx_stat_rep);
         if (((gps_enabled == true) && (coord_ok == true)) || (gps_fake_enable == true)) {
-            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"lati\":%.5f,\"long\":%.5f,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u}", stat_timestamp, cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok);
+            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"lati\":%.5f,\"long\":%.5f,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u%s%s%s}", stat_timestamp, cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, up_rtt_json, dw_rtt_json, rx_json);
         } else {
-            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u}", stat_timestamp, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok);
+            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%.1f,\"dwnb\":%u,\"txnb\":%u%s%s%s}", stat_timestamp, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, up_rtt_json, dw_rtt_json, rx_json);
         }
         report_ready = true;
         pthread_mutex_unlock(&mx_stat_rep);
     }
 
+    /* stop metrics endpoint first, a scrape must not wait for a mutex held by a cancelled thread */
+    metrics_stop();
+
     /* wait for upstream thread to finish (1 fetch cycle max) */
     pthread_join(thrid_up, NULL);
+    if (gps_enabled == true) {
+        /* wait for validation thread to save the state (1 cycle max), before any thread holding a lock is cancelled */
+        pthread_join(thrid_valid, NULL);
+    }
     pthread_cancel(thrid_down); /* don't wait for downstream thread */
     pthread_cancel(thrid_jit); /* don't wait for jit thread */
     pthread_cancel(thrid_timersync); /* don't wait for timer sync thread */
     if (gps_enabled == true) {
         pthread_cancel(thrid_gps); /* don't wait for GPS thread */
-        pthread_cancel(thrid_valid); /* don't wait for validation thread */
 
         i = lgw_gps_disable(gps_tty_fd);
         if (i == LGW_HAL_SUCCESS) {
@@ -1435,6 +2114,9 @@ int main(void)
         }
     }
 
+    /* make sure the last events reach the disk */
+    flightrec_flush();
+
     MSG("INFO: Exiting packet forwarder program\n");
     exit(EXIT_SUCCESS);
 }
@@ -1481,6 +2163,10 @@ void thread_up(void) {
     uint32_t mote_addr = 0;
     uint16_t mote_fcnt = 0;
 
+    /* per-channel accounting variables */
+    uint32_t airtime;
+    int dr_index;
+
     /* set upstream socket RX timeout */
     i = setsockopt(sock_up, SOL_SOCKET, SO_RCVTIMEO, (void *)&push_timeout_half, sizeof push_timeout_half);
     if (i != 0) {
@@ -1515,12 +2201,9 @@ void thread_up(void) {
             continue;
         }
 
-        /* get a copy of GPS time reference (avoid 1 mutex per packet) */
+        /* get a snapshot of GPS time reference, used for all packets of the batch */
         if ((nb_pkt > 0) && (gps_enabled == true)) {
-            pthread_mutex_lock(&mx_timeref);
-            ref_ok = gps_ref_valid;
-            local_ref = time_reference_gps;
-            pthread_mutex_unlock(&mx_timeref);
+            ref_ok = timeref_read(&timeref_gps, &local_ref);
         } else {
             ref_ok = false;
         }
@@ -1552,8 +2235,18 @@ void thread_up(void) {
             mote_fcnt |= p->payload[7] << 8;
 
             /* basic packet filtering */
+            airtime = rx_time_on_air(p);
+            dr_index = rx_dr_index(p);
             pthread_mutex_lock(&mx_meas_up);
             meas_nb_rx_rcv += 1;
+            if (p->if_chain < LGW_IF_CHAIN_NB) {
+                rx_account(&meas_rx_if[p->if_chain], p, airtime);
+            }
+            if (dr_index >= 0) {
+                rx_account(&meas_rx_dr[dr_index], p, airtime);
+            }
+            flightrec_log(FLIGHTREC_RX, p->status, p->size, p->count_us, p->freq_hz, p->datarate,
+                          FLIGHTREC_RX_ARG2(lroundf(p->rssi * 10.0), lroundf(p->snr * 4.0), p->bandwidth, p->modulation == MOD_FSK, p->if_chain));
             switch(p->status) {
                 case STAT_CRC_OK:
                     meas_nb_rx_ok += 1;
@@ -1871,6 +2564,7 @@ void thread_up(void) {
                 continue;
             } else {
                 MSG("INFO: [up] PUSH_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
+                hdr_hist_record(&meas_up_ack_rtt, (uint32_t)(1E6 * difftimespec(recv_time, send_time)));
                 meas_up_ack_rcv += 1;
                 break;
             }
@@ -1905,6 +2599,8 @@ void thread_down(void) {
     bool req_ack = false; /* keep track of whether PULL_DATA was acknowledged or not */
 
     /* JSON parsing variables */
+    static char arena_buf[DOWN_ARENA_SIZE]; /* PULL_RESP parse tree, reset for each datagram */
+    JSON_Arena arena;
     JSON_Value *root_val = NULL;
     JSON_Object *txpk_obj = NULL;
     JSON_Value *val = NULL; /* needed to detect the absence of some fields */
@@ -1938,7 +2634,7 @@ void thread_down(void) {
     uint32_t autoquit_cnt = 0; /* count the number of PULL_DATA sent since the latest PULL_ACK */
 
     /* Just In Time downlink */
-    struct timeval current_unix_time;
+    struct timeval current_host_time;
     struct timeval current_concentrator_time;
     enum jit_error_e jit_result = JIT_ERROR_OK;
     enum jit_pkt_type_e downlink_type;
@@ -2052,8 +2748,19 @@ void thread_down(void) {
     beacon_pkt.payload[beacon_pyld_idx++] = 0xFF &  field_crc2;
     beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc2 >> 8);
 
+    /* JSON parsing arena initialization */
+    json_arena_init(&arena, arena_buf, sizeof arena_buf);
+
     /* JIT queue initialization */
     jit_queue_init(&jit_queue);
+    if (jit_asap_set_bounds(&jit_queue, asap_delay_floor, asap_delay_ceiling) != JIT_ERROR_OK) {
+        MSG("WARNING: [down] invalid Class C ASAP delay bounds, using defaults [%u:%u] ms\n", JIT_ASAP_DELAY_FLOOR / 1000, JIT_ASAP_DELAY_CEILING / 1000);
+    }
+    for (i = 0; i < dc_conf_nb; i++) {
+        if (jit_duty_cycle_add_band(&jit_queue, dc_conf[i].freq_min, dc_conf[i].freq_max, dc_conf[i].percent, dc_conf[i].window) != JIT_ERROR_OK) {
+            MSG("WARNING: [down] duty-cycle sub-band %d ignored\n", i);
+        }
+    }
 
     while (!exit_sig && !quit_sig) {
 
@@ -2091,17 +2798,16 @@ void thread_down(void) {
             beacon_loop = JIT_NUM_BEACON_IN_QUEUE - jit_queue.num_beacon;
             retry = 0;
             while (beacon_loop && (beacon_period != 0)) {
-                pthread_mutex_lock(&mx_timeref);
                 /* Wait for GPS to be ready before inserting beacons in JiT queue */
-                if ((gps_ref_valid == true) && (xtal_correct_ok == true)) {
+                if ((timeref_read(&timeref_gps, &local_ref) == true) && (xtal_correct_ok == true)) {
 
                     /* compute GPS time for next beacon to come      */
                     /*   LoRaWAN: T = k*beacon_period + TBeaconDelay */
                     /*            with TBeaconDelay = [1.5ms +/- 1µs]*/
                     if (last_beacon_gps_time.tv_sec == 0) {
                         /* if no beacon has been queued, get next slot from current GPS time */
-                        diff_beacon_time = time_reference_gps.gps.tv_sec % ((time_t)beacon_period);
-                        next_beacon_gps_time.tv_sec = time_reference_gps.gps.tv_sec +
+                        diff_beacon_time = local_ref.gps.tv_sec % ((time_t)beacon_period);
+                        next_beacon_gps_time.tv_sec = local_ref.gps.tv_sec +
                                                         ((time_t)beacon_period - diff_beacon_time);
                     } else {
                         /* if there is already a beacon, take it as reference */
@@ -2115,7 +2821,7 @@ void thread_down(void) {
                     {
                     time_t time_unix;
 
-                    time_unix = time_reference_gps.gps.tv_sec + UNIX_GPS_EPOCH_OFFSET;
+                    time_unix = local_ref.gps.tv_sec + UNIX_GPS_EPOCH_OFFSET;
                     MSG_DEBUG(DEBUG_BEACON, "GPS-now : %s", ctime(&time_unix));
                     time_unix = last_beacon_gps_time.tv_sec + UNIX_GPS_EPOCH_OFFSET;
                     MSG_DEBUG(DEBUG_BEACON, "GPS-last: %s", ctime(&time_unix));
@@ -2125,8 +2831,7 @@ void thread_down(void) {
 #endif
 
                     /* convert GPS time to concentrator time, and set packet counter for JiT trigger */
-                    lgw_gps2cnt(time_reference_gps, next_beacon_gps_time, &(beacon_pkt.count_us));
-                    pthread_mutex_unlock(&mx_timeref);
+                    lgw_gps2cnt(local_ref, next_beacon_gps_time, &(beacon_pkt.count_us));
 
                     /* apply frequency correction to beacon TX frequency */
                     if (beacon_freq_nb > 1) {
@@ -2150,9 +2855,10 @@ void thread_down(void) {
                     beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc1 >> 8);
 
                     /* Insert beacon packet in JiT queue */
-                    gettimeofday(&current_unix_time, NULL);
-                    get_concentrator_time(&current_concentrator_time, current_unix_time);
+                    get_host_time(&current_host_time);
+                    get_concentrator_time(&current_concentrator_time, current_host_time);
                     jit_result = jit_enqueue(&jit_queue, &current_concentrator_time, &beacon_pkt, JIT_PKT_TYPE_BEACON);
+                    flightrec_log(FLIGHTREC_ENQUEUE, jit_result, beacon_pkt.size, beacon_pkt.count_us, beacon_pkt.freq_hz, JIT_PKT_TYPE_BEACON, concentrator_count(&current_concentrator_time));
                     if (jit_result == JIT_ERROR_OK) {
                         /* update stats */
                         pthread_mutex_lock(&mx_meas_dw);
@@ -2186,7 +2892,6 @@ void thread_down(void) {
                         MSG_DEBUG(DEBUG_BEACON, "--> beacon queuing retry=%d\n", retry);
                     }
                 } else {
-                    pthread_mutex_unlock(&mx_timeref);
                     break;
                 }
             }
@@ -2214,6 +2919,7 @@ void thread_down(void) {
                         autoquit_cnt = 0;
                         pthread_mutex_lock(&mx_meas_dw);
                         meas_dw_ack_rcv += 1;
+                        hdr_hist_record(&meas_dw_ack_rtt, (uint32_t)(1E6 * difftimespec(recv_time, send_time)));
                         pthread_mutex_unlock(&mx_meas_dw);
                         MSG("INFO: [down] PULL_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
                     }
@@ -2230,7 +2936,11 @@ void thread_down(void) {
 
             /* initialize TX struct and try to parse JSON */
             memset(&txpkt, 0, sizeof txpkt);
-            root_val = json_parse_string_with_comments((const char *)(buff_down + 4)); /* JSON offset */
+            json_arena_reset(&arena); /* json_value_free is a no-op on arena trees, previous tree is released here */
+            root_val = json_parse_string_with_comments_arena((const char *)(buff_down + 4), &arena); /* JSON offset */
+            if ((root_val == NULL) && (arena.overflow != 0)) {
+                root_val = json_parse_string_with_comments((const char *)(buff_down + 4)); /* should not happen, see DOWN_ARENA_SIZE */
+            }
             if (root_val == NULL) {
                 MSG("WARNING: [down] invalid JSON, TX aborted\n");
                 continue;
@@ -2269,12 +2979,7 @@ void thread_down(void) {
                         continue;
                     }
                     if (gps_enabled == true) {
-                        pthread_mutex_lock(&mx_timeref);
-                        if (gps_ref_valid == true) {
-                            local_ref = time_reference_gps;
-                            pthread_mutex_unlock(&mx_timeref);
-                        } else {
-                            pthread_mutex_unlock(&mx_timeref);
+                        if (timeref_read(&timeref_gps, &local_ref) == false) {
                             MSG("WARNING: [down] no valid GPS time reference yet, impossible to send packet on specific GPS time, TX aborted\n");
                             json_value_free(root_val);
 
@@ -2486,6 +3191,11 @@ void thread_down(void) {
                 continue;
             }
             i = b64_to_bin(str, strlen(str), txpkt.payload, sizeof txpkt.payload);
+            if (i < 0) {
+                MSG("WARNING: [down] invalid or too long Base64 payload in \"txpk.data\", TX aborted\n");
+                json_value_free(root_val);
+                continue;
+            }
             if (i != txpkt.size) {
                 MSG("WARNING: [down] mismatch between .size and .data size once converter to binary\n");
             }
@@ -2529,9 +3239,10 @@ void thread_down(void) {
 
             /* insert packet to be sent into JIT queue */
             if (jit_result == JIT_ERROR_OK) {
-                gettimeofday(&current_unix_time, NULL);
-                get_concentrator_time(&current_concentrator_time, current_unix_time);
+                get_host_time(&current_host_time);
+                get_concentrator_time(&current_concentrator_time, current_host_time);
                 jit_result = jit_enqueue(&jit_queue, &current_concentrator_time, &txpkt, downlink_type);
+                flightrec_log(FLIGHTREC_ENQUEUE, jit_result, txpkt.size, txpkt.count_us, txpkt.freq_hz, downlink_type, concentrator_count(&current_concentrator_time));
                 if (jit_result != JIT_ERROR_OK) {
                     printf("ERROR: Packet REJECTED (jit error=%d)\n", jit_result);
                 }
@@ -2575,22 +3286,28 @@ void thread_jit(void) {
     int result = LGW_HAL_SUCCESS;
     struct lgw_pkt_tx_s pkt;
     int pkt_index = -1;
-    struct timeval current_unix_time;
+    struct timeval current_host_time;
     struct timeval current_concentrator_time;
     enum jit_error_e jit_result;
     enum jit_pkt_type_e pkt_type;
     uint8_t tx_status;
+    uint32_t tx_latency;
 
     while (!exit_sig && !quit_sig) {
         wait_ms(10);
 
         /* transfer data and metadata to the concentrator, and schedule TX */
-        gettimeofday(&current_unix_time, NULL);
-        get_concentrator_time(&current_concentrator_time, current_unix_time);
+        get_host_time(&current_host_time);
+        get_concentrator_time(&current_concentrator_time, current_host_time);
         jit_result = jit_peek(&jit_queue, &current_concentrator_time, &pkt_index);
+        if ((jit_result != JIT_ERROR_EMPTY) && ((jit_result != JIT_ERROR_OK) || (pkt_index > -1))) {
+            /* only record peeks with an outcome, an idle queue is polled every 10 ms */
+            flightrec_log(FLIGHTREC_PEEK, jit_result, 0, concentrator_count(&current_concentrator_time), 0, (uint32_t)pkt_index, 0);
+        }
         if (jit_result == JIT_ERROR_OK) {
             if (pkt_index > -1) {
                 jit_result = jit_dequeue(&jit_queue, pkt_index, &pkt, &pkt_type);
+                flightrec_log(FLIGHTREC_DEQUEUE, jit_result, pkt.size, pkt.count_us, pkt.freq_hz, pkt_type, (uint32_t)pkt_index);
                 if (jit_result == JIT_ERROR_OK) {
                     /* update beacon stats */
                     if (pkt_type == JIT_PKT_TYPE_BEACON) {
@@ -2608,6 +3325,7 @@ void thread_jit(void) {
                     }
 
                     /* check if concentrator is free for sending new packet */
+                    tx_status = TX_STATUS_UNKNOWN;
                     pthread_mutex_lock(&mx_concent); /* may have to wait for a fetch to finish */
                     result = lgw_status(TX_STATUS, &tx_status);
                     pthread_mutex_unlock(&mx_concent); /* free concentrator ASAP */
@@ -2617,10 +3335,12 @@ void thread_jit(void) {
                         if (tx_status == TX_EMITTING) {
                             MSG("ERROR: concentrator is currently emitting\n");
                             print_tx_status(tx_status);
+                            jit_cancel_tx(&jit_queue);
                             continue;
                         } else if (tx_status == TX_SCHEDULED) {
                             MSG("WARNING: a downlink was already scheduled, overwritting it...\n");
                             print_tx_status(tx_status);
+                            jit_cancel_scheduled_tx(&jit_queue);
                         } else {
                             /* Nothing to do */
                         }
@@ -2630,17 +3350,25 @@ void thread_jit(void) {
                     pthread_mutex_lock(&mx_concent); /* may have to wait for a fetch to finish */
                     result = lgw_send(pkt);
                     pthread_mutex_unlock(&mx_concent); /* free concentrator ASAP */
+                    flightrec_log(FLIGHTREC_SEND, (result == LGW_HAL_ERROR) ? 1 : 0, pkt.size, pkt.count_us, pkt.freq_hz, tx_status, (uint32_t)pkt.rf_power);
                     if (result == LGW_HAL_ERROR) {
                         pthread_mutex_lock(&mx_meas_dw);
                         meas_nb_tx_fail += 1;
                         pthread_mutex_unlock(&mx_meas_dw);
                         MSG("WARNING: [jit] lgw_send failed\n");
+                        jit_cancel_tx(&jit_queue);
                         continue;
                     } else {
                         pthread_mutex_lock(&mx_meas_dw);
                         meas_nb_tx_ok += 1;
                         pthread_mutex_unlock(&mx_meas_dw);
                         MSG_DEBUG(DEBUG_PKT_FWD, "lgw_send done: count_us=%u\n", pkt.count_us);
+
+                        /* measure how late the packet was programmed, to adapt ASAP delay */
+                        get_host_time(&current_host_time);
+                        get_concentrator_time(&current_concentrator_time, current_host_time);
+                        tx_latency = jit_report_tx(&jit_queue, &current_concentrator_time, pkt.count_us);
+                        metrics_hist_observe(&hist_tx_latency, tx_latency / 1E6);
                     }
                 } else {
                     MSG("ERROR: jit_dequeue failed with %d\n", jit_result);
@@ -2657,147 +3385,94 @@ void thread_jit(void) {
 /* -------------------------------------------------------------------------- */
 /* --- THREAD 4: PARSE GPS MESSAGE AND KEEP GATEWAY IN SYNC ----------------- */
 
-static void gps_process_sync(void) {
-    struct timespec gps_time;
-    struct timespec utc;
-    uint32_t trig_tstamp; /* concentrator timestamp associated with PPM pulse */
-    int i = lgw_gps_get(&utc, &gps_time, NULL, NULL);
-
-    /* get GPS time for synchronization */
-    if (i != LGW_GPS_SUCCESS) {
-        MSG("WARNING: [gps] could not get GPS time from GPS\n");
-        return;
-    }
+/* counter value captured on the PPS, the concentrator does not need the GPS time */
+static int gps_get_trigcnt(struct timespec gps_time, uint32_t *trig_tstamp) {
+    int i;
 
-    /* get timestamp captured on PPM pulse  */
+    (void)gps_time;
     pthread_mutex_lock(&mx_concent);
-    i = lgw_get_trigcnt(&trig_tstamp);
+    i = lgw_get_trigcnt(trig_tstamp);
     pthread_mutex_unlock(&mx_concent);
-    if (i != LGW_HAL_SUCCESS) {
+    return (i == LGW_HAL_SUCCESS) ? 0 : -1;
+}
+
+static void gps_update_timeref(void) {
+    struct gps_sync_s sync;
+    enum gps_sync_status_e status = gps_process_sync(&timeref_gps, gps_get_trigcnt, &sync);
+
+    if (status == GPS_SYNC_NO_TIME) {
+        MSG("WARNING: [gps] could not get GPS time from GPS\n");
+        return;
+    } else if (status == GPS_SYNC_NO_TRIGCNT) {
         MSG("WARNING: [gps] failed to read concentrator timestamp\n");
         return;
     }
-
-    /* try to update time reference with the new GPS time & timestamp */
-    pthread_mutex_lock(&mx_timeref);
-    i = lgw_gps_sync(&time_reference_gps, trig_tstamp, utc, gps_time);
-    pthread_mutex_unlock(&mx_timeref);
-    if (i != LGW_GPS_SUCCESS) {
+    flightrec_log(FLIGHTREC_GPS_SYNC, (status == GPS_SYNC_OK) ? 0 : 1, 0, sync.trig_tstamp, 0, (uint32_t)sync.utc.tv_sec, (uint32_t)lround((sync.ref.xtal_err - 1.0) * 1E9));
+    if (status != GPS_SYNC_OK) {
         MSG("WARNING: [gps] GPS out of sync, keeping previous time reference\n");
     }
 }
 
-static void gps_process_coords(void) {
-    /* position variable */
-    struct coord_s coord;
-    struct coord_s gpserr;
-    int    i = lgw_gps_get(NULL, NULL, &coord, &gpserr);
-
-    /* update gateway coordinates */
-    pthread_mutex_lock(&mx_meas_gps);
-    if (i == LGW_GPS_SUCCESS) {
-        gps_coord_valid = true;
-        meas_gps_coord = coord;
-        meas_gps_err = gpserr;
-        // TODO: report other GPS statistics (typ. signal quality & integrity)
-    } else {
-        gps_coord_valid = false;
-    }
-    pthread_mutex_unlock(&mx_meas_gps);
-}
-
 void thread_gps(void) {
     /* serial variables */
-    char serial_buff[128]; /* buffer to receive GPS data */
-    size_t wr_idx = 0;     /* pointer to end of chars in buffer */
+    struct gps_frame_decoder_s decoder; /* framing state machine and ring buffer */
+    char frame[GPS_FRAME_MAX_SIZE + 1]; /* linear copy of a complete frame, for the HAL parsers */
+    size_t frame_size;
+    enum gps_frame_type_e frame_type;
+    struct termios ttyopt; /* serial port options */
+    uint8_t *wr_ptr;
+    size_t wr_size;
+    ssize_t nb_char;
 
     /* variables for PPM pulse GPS synchronization */
     enum gps_msg latest_msg; /* keep track of latest NMEA message parsed */
 
     /* initialize some variables before loop */
-    memset(serial_buff, 0, sizeof serial_buff);
+    gps_frame_init(&decoder);
 
-    while (!exit_sig && !quit_sig) {
-        size_t rd_idx = 0;
-        size_t frame_end_idx = 0;
+    /* read serial data by bursts rather than by minimum message size */
+    if (tcgetattr(gps_tty_fd, &ttyopt) == 0) {
+        ttyopt.c_cc[VMIN] = GPS_SERIAL_VMIN;
+        ttyopt.c_cc[VTIME] = GPS_SERIAL_VTIME;
+        if (tcsetattr(gps_tty_fd, TCSANOW, &ttyopt) != 0) {
+            MSG("WARNING: [gps] failed to set serial port read timeouts, keeping default settings\n");
+        }
+    } else {
+        MSG("WARNING: [gps] failed to get serial port settings, keeping default settings\n");
+    }
 
-        /* blocking non-canonical read on serial port */
-        ssize_t nb_char = read(gps_tty_fd, serial_buff + wr_idx, LGW_GPS_MIN_MSG_SIZE);
+    while (!exit_sig && !quit_sig) {
+        /* blocking non-canonical read on serial port, straight into the ring buffer */
+        wr_ptr = gps_frame_write_ptr(&decoder, &wr_size);
+        nb_char = read(gps_tty_fd, wr_ptr, wr_size);
         if (nb_char <= 0) {
-            MSG("WARNING: [gps] read() returned value %d\n", nb_char);
+            MSG("WARNING: [gps] read() returned value %d\n", (int)nb_char);
             continue;
         }
-        wr_idx += (size_t)nb_char;
-
-        /*******************************************
-         * Scan buffer for UBX/NMEA sync chars and *
-         * attempt to decode frame if one is found *
-         *******************************************/
-        while(rd_idx < wr_idx) {
-            size_t frame_size = 0;
-
-            /* Scan buffer for UBX sync char */
-            if(serial_buff[rd_idx] == (char)LGW_GPS_UBX_SYNC_CHAR) {
-
-                /***********************
-                 * Found UBX sync char *
-                 ***********************/
-                latest_msg = lgw_parse_ubx(&serial_buff[rd_idx], (wr_idx - rd_idx), &frame_size);
-
-                if (frame_size > 0) {
-                    if (latest_msg == INCOMPLETE) {
-                        /* UBX header found but frame appears to be missing bytes */
-                        frame_size = 0;
-                    } else if (latest_msg == INVALID) {
-                        /* message header received but message appears to be corrupted */
-                        MSG("WARNING: [gps] could not get a valid message from GPS (no time)\n");
-                        frame_size = 0;
-                    } else if (latest_msg == UBX_NAV_TIMEGPS) {
-                        gps_process_sync();
-                    }
-                }
-            } else if(serial_buff[rd_idx] == LGW_GPS_NMEA_SYNC_CHAR) {
-                /************************
-                 * Found NMEA sync char *
-                 ************************/
-                /* scan for NMEA end marker (LF = 0x0a) */
-                char* nmea_end_ptr = memchr(&serial_buff[rd_idx],(int)0x0a, (wr_idx - rd_idx));
-
-                if(nmea_end_ptr) {
-                    /* found end marker */
-                    frame_size = nmea_end_ptr - &serial_buff[rd_idx] + 1;
-                    latest_msg = lgw_parse_nmea(&serial_buff[rd_idx], frame_size);
-
-                    if(latest_msg == INVALID || latest_msg == UNKNOWN) {
-                        /* checksum failed */
-                        frame_size = 0;
-                    } else if (latest_msg == NMEA_RMC) { /* Get location from RMC frames */
-                        gps_process_coords();
-                    }
+        gps_frame_commit(&decoder, (size_t)nb_char);
+
+        /* decode all frames completed by this read, partial frames stay in the ring buffer */
+        while ((frame_type = gps_frame_next(&decoder, frame, &frame_size)) != GPS_FRAME_NONE) {
+            if (frame_type == GPS_FRAME_UBX) {
+                latest_msg = lgw_parse_ubx(frame, frame_size, &frame_size);
+                if (latest_msg == INVALID) {
+                    /* message framed with a valid checksum but not understood by the parser */
+                    MSG("WARNING: [gps] could not get a valid message from GPS (no time)\n");
+                } else if (latest_msg == UBX_NAV_TIMEGPS) {
+                    gps_update_timeref();
                 }
-            }
-
-            if(frame_size > 0) {
-                /* At this point message is a checksum verified frame
-                   we're processed or ignored. Remove frame from buffer */
-                rd_idx += frame_size;
-                frame_end_idx = rd_idx;
             } else {
-                rd_idx++;
+                latest_msg = lgw_parse_nmea(frame, frame_size);
+                if (latest_msg == NMEA_RMC) { /* Get location from RMC frames */
+                    gps_process_coords(&mx_meas_gps, &meas_gps_pos);
+                }
             }
-        } /* ...for(rd_idx = 0... */
-
-        if(frame_end_idx) {
-          /* Frames have been processed. Remove bytes to end of last processed frame */
-          memcpy(serial_buff, &serial_buff[frame_end_idx], wr_idx - frame_end_idx);
-          wr_idx -= frame_end_idx;
-        } /* ...for(rd_idx = 0... */
-
-        /* Prevent buffer overflow */
-        if((sizeof(serial_buff) - wr_idx) < LGW_GPS_MIN_MSG_SIZE) {
-            memcpy(serial_buff, &serial_buff[LGW_GPS_MIN_MSG_SIZE], wr_idx - LGW_GPS_MIN_MSG_SIZE);
-            wr_idx -= LGW_GPS_MIN_MSG_SIZE;
         }
+
+        /* publish framing statistics */
+        pthread_mutex_lock(&mx_meas_gps);
+        meas_gps_frame = decoder.stats;
+        pthread_mutex_unlock(&mx_meas_gps);
     }
     MSG("\nINFO: End of GPS thread\n");
 }
@@ -2809,13 +3484,14 @@ void thread_valid(void) {
 
     /* GPS reference validation variables */
     long gps_ref_age = 0;
+    struct tref cur_ref;
     bool ref_valid_local = false;
     double xtal_err_cpy;
 
-    /* variables for XTAL correction averaging */
-    unsigned init_cpt = 0;
-    double init_acc = 0.0;
-    double x;
+    /* variables for XTAL correction estimation */
+    uint32_t last_count_us = 0; /* time reference of the last sample, to use each sample once */
+    bool new_sample = false;
+    time_t last_save_time; /* last time XTAL correction state was saved */
 
     /* correction debug */
     // FILE * log_file = NULL;
@@ -2827,27 +3503,37 @@ void thread_valid(void) {
     // strftime(log_name,sizeof log_name,"xtal_err_%Y%m%dT%H%M%SZ.csv",localtime(&now_time));
     // log_file = fopen(log_name, "w");
     // setbuf(log_file, NULL);
-    // fprintf(log_file,"\"xtal_correct\",\"XERR_INIT_AVG %u XERR_FILT_COEF %u\"\n", XERR_INIT_AVG, XERR_FILT_COEF); // DEBUG
+    // fprintf(log_file,"\"xtal_correct\",\"xtal_stddev\"\n"); // DEBUG
+    pthread_mutex_lock(&mx_xcorr);
+    xcorr_reset(&xtal_estimator);
+    load_state();
+    pthread_mutex_unlock(&mx_xcorr);
+    time(&last_save_time);
 
     /* main loop task */
     while (!exit_sig && !quit_sig) {
         wait_ms(1000);
 
         /* calculate when the time reference was last updated */
-        pthread_mutex_lock(&mx_timeref);
-        gps_ref_age = (long)difftime(time(NULL), time_reference_gps.systime);
+        pthread_mutex_lock(&timeref_gps.mx);
+        cur_ref = timeref_gps.ref; /* no concurrent writer, reference can be accessed directly */
+        gps_ref_age = (long)difftime(time(NULL), cur_ref.systime);
         if ((gps_ref_age >= 0) && (gps_ref_age <= GPS_REF_MAX_AGE)) {
             /* time ref is ok, validate and  */
-            gps_ref_valid = true;
             ref_valid_local = true;
-            xtal_err_cpy = time_reference_gps.xtal_err;
+            xtal_err_cpy = cur_ref.xtal_err;
+            new_sample = (cur_ref.count_us != last_count_us);
+            last_count_us = cur_ref.count_us;
             //printf("XTAL err: %.15lf (1/XTAL_err:%.15lf)\n", xtal_err_cpy, 1/xtal_err_cpy); // DEBUG
         } else {
             /* time ref is too old, invalidate */
-            gps_ref_valid = false;
             ref_valid_local = false;
         }
-        pthread_mutex_unlock(&mx_timeref);
+        if (ref_valid_local != timeref_gps.valid) {
+            timeref_publish(&timeref_gps, &cur_ref, ref_valid_local);
+            flightrec_log(FLIGHTREC_GPS_VALID, ref_valid_local ? 1 : 0, 0, cur_ref.count_us, 0, 0, 0);
+        }
+        pthread_mutex_unlock(&timeref_gps.mx);
 
         /* manage XTAL correction */
         if (ref_valid_local == false) {
@@ -2855,34 +3541,32 @@ void thread_valid(void) {
             pthread_mutex_lock(&mx_xcorr);
             xtal_correct_ok = false;
             xtal_correct = 1.0;
+            if (xtal_estimator.restored == false) { /* keep restored state until GPS can confirm it */
+                xcorr_reset(&xtal_estimator);
+            }
             pthread_mutex_unlock(&mx_xcorr);
-            init_cpt = 0;
-            init_acc = 0.0;
-        } else {
-            if (init_cpt < XERR_INIT_AVG) {
-                /* initial accumulation */
-                init_acc += xtal_err_cpy;
-                ++init_cpt;
-            } else if (init_cpt == XERR_INIT_AVG) {
-                /* initial average calculation */
-                pthread_mutex_lock(&mx_xcorr);
-                xtal_correct = (double)(XERR_INIT_AVG) / init_acc;
-                //printf("XERR_INIT_AVG=%d, init_acc=%.15lf\n", XERR_INIT_AVG, init_acc);
-                xtal_correct_ok = true;
-                pthread_mutex_unlock(&mx_xcorr);
-                ++init_cpt;
-                // fprintf(log_file,"%.18lf,\"average\"\n", xtal_correct); // DEBUG
-            } else {
-                /* tracking with low-pass filter */
-                x = 1 / xtal_err_cpy;
-                pthread_mutex_lock(&mx_xcorr);
-                xtal_correct = xtal_correct - xtal_correct/XERR_FILT_COEF + x/XERR_FILT_COEF;
-                pthread_mutex_unlock(&mx_xcorr);
-                // fprintf(log_file,"%.18lf,\"track\"\n", xtal_correct); // DEBUG
+        } else if (new_sample == true) {
+            /* only use each GPS sync once, a missed PPS would otherwise be counted as a new measurement */
+            pthread_mutex_lock(&mx_xcorr);
+            if (xcorr_update(&xtal_estimator, xtal_err_cpy, xtal_correct_max_stddev) != 0) {
+                MSG_DEBUG(DEBUG_LOG, "WARNING: [valid] XTAL error sample %.15lf rejected\n", xtal_err_cpy);
             }
+            xtal_correct = xtal_estimator.estimate;
+            xtal_correct_ok = xtal_estimator.ready;
+            pthread_mutex_unlock(&mx_xcorr);
+            // fprintf(log_file,"%.18lf,%.6lf\n", xtal_correct, xcorr_stddev(&xtal_estimator)); // DEBUG
+        }
+
+        /* periodically save XTAL correction state, for warm restart */
+        if (difftime(time(NULL), last_save_time) >= STATE_SAVE_PERIOD) {
+            save_state();
+            time(&last_save_time);
         }
         // printf("Time ref: %s, XTAL correct: %s (%.15lf)\n", ref_valid_local?"valid":"invalid", xtal_correct_ok?"valid":"invalid", xtal_correct); // DEBUG
     }
+
+    /* keep latest XTAL correction for next start, from this thread so that the periodic save cannot run at the same time */
+    save_state();
     MSG("\nINFO: End of validation thread\n");
 }
 
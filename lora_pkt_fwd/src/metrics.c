@@ -0,0 +1,378 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : Local metrics endpoint
+        Serves counters, gauges and histograms in Prometheus text format
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* snprintf */
+#include <stdarg.h>     /* va_list */
+#include <stdlib.h>     /* malloc, realloc, free, strtol */
+#include <string.h>     /* memset, strncmp, strstr */
+#include <errno.h>      /* error messages */
+#include <math.h>       /* isnan, isinf */
+#include <unistd.h>     /* close, unlink */
+#include <poll.h>       /* poll */
+
+#include <sys/socket.h> /* socket specific definitions */
+#include <sys/un.h>     /* sockaddr_un */
+#include <netinet/in.h> /* INET constants and stuff */
+#include <arpa/inet.h>  /* htonl, htons */
+
+#include <pthread.h>
+
+#include "trace.h"
+#include "metrics.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define METRICS_BUF_INIT_SIZE   8192    /* initial size of the exposition text buffer, grown as needed */
+#define METRICS_POLL_MS         200     /* time in ms between checks of the stop request */
+#define METRICS_REQ_TIMEOUT_MS  1000    /* time in ms a client has to send its request */
+#define METRICS_REQ_SIZE        1024    /* size of the request buffer, request is not interpreted */
+#define METRICS_BACKLOG         4
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static int sock_listen = -1;
+static bool listen_unix = false;
+static char unix_path[108] = "\0"; /* size of sun_path */
+static metrics_collect_cb collect_cb = NULL;
+static pthread_t thrid_metrics;
+static volatile bool stop_req = false;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void buf_printf(struct metrics_buf_s *buf, const char *fmt, ...) {
+    va_list ap;
+    int n;
+    size_t new_size;
+    char *new_data;
+
+    if (buf->error == true) {
+        return;
+    }
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            buf->error = true;
+            return;
+        }
+        if ((size_t)n < (buf->size - buf->len)) {
+            buf->len += (size_t)n;
+            return;
+        }
+        new_size = 2 * buf->size;
+        while (new_size <= (buf->len + (size_t)n)) {
+            new_size *= 2;
+        }
+        new_data = realloc(buf->data, new_size);
+        if (new_data == NULL) {
+            buf->data[buf->len] = '\0';
+            buf->error = true;
+            return;
+        }
+        buf->data = new_data;
+        buf->size = new_size;
+    }
+}
+
+static void buf_header(struct metrics_buf_s *buf, const char *name, const char *help, const char *type) {
+    buf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Prometheus float format: NaN, +Inf, -Inf or a Go ParseFloat compatible number */
+static void buf_double(struct metrics_buf_s *buf, double value) {
+    if (isnan(value)) {
+        buf_printf(buf, "NaN");
+    } else if (isinf(value)) {
+        buf_printf(buf, (value > 0) ? "+Inf" : "-Inf");
+    } else {
+        buf_printf(buf, "%.9g", value);
+    }
+}
+
+static int send_all(int fd, const char *data, size_t size) {
+    ssize_t n;
+
+    while (size > 0) {
+        n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Wait for the end of the request headers (or timeout), then send exposition text */
+static void serve_client(int fd, struct metrics_buf_s *buf) {
+    char req[METRICS_REQ_SIZE];
+    size_t req_len = 0;
+    ssize_t n;
+    struct pollfd pfd;
+    char header[160];
+    int header_len;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (req_len < (sizeof req - 1)) {
+        if (poll(&pfd, 1, METRICS_REQ_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        n = recv(fd, req + req_len, sizeof req - 1 - req_len, 0);
+        if (n <= 0) {
+            break;
+        }
+        req_len += (size_t)n;
+        req[req_len] = '\0';
+        if ((strstr(req, "\r\n\r\n") != NULL) || (strstr(req, "\n\n") != NULL)) {
+            break;
+        }
+    }
+
+    buf->len = 0;
+    buf->data[0] = '\0';
+    buf->error = false;
+    collect_cb(buf);
+    if (buf->error == true) {
+        MSG("WARNING: [metrics] not enough memory, exposition text truncated\n");
+    }
+
+    header_len = snprintf(header, sizeof header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long)buf->len);
+    if (send_all(fd, header, (size_t)header_len) == 0) {
+        send_all(fd, buf->data, buf->len);
+    }
+}
+
+static void *thread_metrics(void *arg) {
+    struct metrics_buf_s buf;
+    struct pollfd pfd;
+    int fd;
+
+    (void)arg;
+    buf.size = METRICS_BUF_INIT_SIZE;
+    buf.data = malloc(buf.size);
+    if (buf.data == NULL) {
+        MSG("ERROR: [metrics] failed to allocate exposition buffer\n");
+        return NULL;
+    }
+
+    pfd.fd = sock_listen;
+    pfd.events = POLLIN;
+    while (stop_req == false) {
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) {
+            continue;
+        }
+        fd = accept(sock_listen, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        serve_client(fd, &buf);
+        close(fd);
+    }
+
+    free(buf.data);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void metrics_hist_init(struct metrics_hist_s *hist, const double *bounds, int nb_bounds) {
+    memset(hist, 0, sizeof *hist);
+    pthread_mutex_init(&hist->mx, NULL);
+    if (nb_bounds > METRICS_HIST_MAX_BOUNDS) {
+        nb_bounds = METRICS_HIST_MAX_BOUNDS;
+    }
+    memcpy(hist->bounds, bounds, nb_bounds * sizeof bounds[0]);
+    hist->nb_bounds = nb_bounds;
+}
+
+void metrics_hist_observe(struct metrics_hist_s *hist, double value) {
+    int i;
+
+    for (i = 0; (i < hist->nb_bounds) && (value > hist->bounds[i]); ++i);
+    pthread_mutex_lock(&hist->mx);
+    hist->buckets[i] += 1;
+    hist->count += 1;
+    hist->sum += value;
+    pthread_mutex_unlock(&hist->mx);
+}
+
+void metrics_counter(struct metrics_buf_s *buf, const char *name, const char *help, uint64_t value) {
+    buf_header(buf, name, help, "counter");
+    buf_printf(buf, "%s %llu\n", name, (unsigned long long)value);
+}
+
+void metrics_gauge(struct metrics_buf_s *buf, const char *name, const char *help, double value) {
+    buf_header(buf, name, help, "gauge");
+    buf_printf(buf, "%s ", name);
+    buf_double(buf, value);
+    buf_printf(buf, "\n");
+}
+
+void metrics_histogram(struct metrics_buf_s *buf, const char *name, const char *help, struct metrics_hist_s *hist) {
+    struct metrics_hist_s cp;
+    uint64_t cumul = 0;
+    int i;
+
+    pthread_mutex_lock(&hist->mx);
+    memcpy(cp.bounds, hist->bounds, sizeof cp.bounds);
+    memcpy(cp.buckets, hist->buckets, sizeof cp.buckets);
+    cp.nb_bounds = hist->nb_bounds;
+    cp.count = hist->count;
+    cp.sum = hist->sum;
+    pthread_mutex_unlock(&hist->mx);
+
+    buf_header(buf, name, help, "histogram");
+    for (i = 0; i < cp.nb_bounds; ++i) {
+        cumul += cp.buckets[i];
+        buf_printf(buf, "%s_bucket{le=\"", name);
+        buf_double(buf, cp.bounds[i]);
+        buf_printf(buf, "\"} %llu\n", (unsigned long long)cumul);
+    }
+    buf_printf(buf, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cp.count);
+    buf_printf(buf, "%s_sum ", name);
+    buf_double(buf, cp.sum);
+    buf_printf(buf, "\n%s_count %llu\n", name, (unsigned long long)cp.count);
+}
+
+void metrics_hdr_histogram(struct metrics_buf_s *buf, const char *name, const char *help, const struct hdr_hist_s *hist, double unit, const double *bounds, int nb_bounds) {
+    double bound;
+    uint32_t cumul;
+    int i;
+
+    buf_header(buf, name, help, "histogram");
+    for (i = 0; i < nb_bounds; ++i) {
+        bound = bounds[i] / unit; /* in recorded unit */
+        cumul = (bound < UINT32_MAX) ? hdr_hist_count_le(hist, (uint32_t)(bound + 0.5)) : hist->count;
+        buf_printf(buf, "%s_bucket{le=\"", name);
+        buf_double(buf, bounds[i]);
+        buf_printf(buf, "\"} %lu\n", (unsigned long)cumul);
+    }
+    buf_printf(buf, "%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)hist->count);
+    buf_printf(buf, "%s_sum ", name);
+    buf_double(buf, hist->sum * unit);
+    buf_printf(buf, "\n%s_count %lu\n", name, (unsigned long)hist->count);
+}
+
+int metrics_start(const char *listen_addr, metrics_collect_cb collect) {
+    struct sockaddr_un addr_un;
+    struct sockaddr_in addr_in;
+    const char *path;
+    char *end;
+    long port;
+    int sock;
+    int opt = 1;
+    int i;
+
+    if ((listen_addr == NULL) || (collect == NULL)) {
+        MSG("ERROR: [metrics] invalid parameter\n");
+        return -1;
+    }
+
+    if (strncmp(listen_addr, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX)) == 0) {
+        path = listen_addr + strlen(METRICS_UNIX_PREFIX);
+        if ((path[0] == '\0') || (strlen(path) >= sizeof addr_un.sun_path)) {
+            MSG("ERROR: [metrics] invalid Unix socket path \"%s\"\n", path);
+            return -1;
+        }
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0) {
+            MSG("ERROR: [metrics] socket creation failed: %s\n", strerror(errno));
+            return -1;
+        }
+        memset(&addr_un, 0, sizeof addr_un);
+        addr_un.sun_family = AF_UNIX;
+        strcpy(addr_un.sun_path, path);
+        unlink(path); /* stale socket from a previous run */
+        i = bind(sock, (struct sockaddr *)&addr_un, sizeof addr_un);
+        snprintf(unix_path, sizeof unix_path, "%s", path);
+        listen_unix = true;
+    } else {
+        port = strtol(listen_addr, &end, 10);
+        if ((*end != '\0') || (port <= 0) || (port > 65535)) {
+            MSG("ERROR: [metrics] invalid listen address \"%s\", must be \"%s<path>\" or a TCP port\n", listen_addr, METRICS_UNIX_PREFIX);
+            return -1;
+        }
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock < 0) {
+            MSG("ERROR: [metrics] socket creation failed: %s\n", strerror(errno));
+            return -1;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt);
+        memset(&addr_in, 0, sizeof addr_in);
+        addr_in.sin_family = AF_INET;
+        addr_in.sin_port = htons((uint16_t)port);
+        addr_in.sin_addr.s_addr = htonl(INADDR_LOOPBACK); /* local scraper only */
+        i = bind(sock, (struct sockaddr *)&addr_in, sizeof addr_in);
+        listen_unix = false;
+    }
+    if ((i != 0) || (listen(sock, METRICS_BACKLOG) != 0)) {
+        MSG("ERROR: [metrics] failed to listen on %s: %s\n", listen_addr, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    sock_listen = sock;
+    collect_cb = collect;
+    stop_req = false;
+    i = pthread_create(&thrid_metrics, NULL, thread_metrics, NULL);
+    if (i != 0) {
+        MSG("ERROR: [metrics] impossible to create metrics thread\n");
+        close(sock_listen);
+        sock_listen = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_stop(void) {
+    if (sock_listen < 0) {
+        return;
+    }
+    stop_req = true;
+    pthread_join(thrid_metrics, NULL); /* collection must not be interrupted while holding a lock */
+    close(sock_listen);
+    sock_listen = -1;
+    if (listen_unix == true) {
+        unlink(unix_path);
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -28,15 +28,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <float.h>
 
 #define STARTING_CAPACITY         15
 #define ARRAY_MAX_CAPACITY    122880 /* 15*(2^13) */
 #define OBJECT_MAX_CAPACITY      960 /* 15*(2^6)  */
 #define MAX_NESTING               19
-#define DOUBLE_SERIALIZATION_FORMAT "%f"
+#define NUMBER_FAST_DIGITS        15 /* significant digits of a number exactly held by a double mantissa */
+#define NUMBER_FAST_POW10         22 /* largest power of 10 exactly held by a double */
+#define NUMBER_MAX_INTEGER  9007199254740992.0 /* 2^53, integers below are serialized without formatting */
+#define NUMBER_FAST_DECIMALS       9 /* most decimals of a number serialized without formatting */
+#define ARENA_ALIGN                8 /* alignment of arena allocations, enough for doubles and pointers */
+#define OBJECT_INDEX_MIN_COUNT    16 /* default number of names from which lookups use a hash index */
 
 #define SIZEOF_TOKEN(a)       (sizeof(a) - 1)
 #define SKIP_CHAR(str)        ((*str)++)
@@ -49,6 +56,8 @@
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
 
+static size_t object_index_min_count = OBJECT_INDEX_MIN_COUNT; /* 0: never index */
+
 #define IS_CONT(b) (((unsigned char)(b) & 0xC0) == 0x80) /* is utf-8 continuation byte */
 
 /* Type definitions */
@@ -63,27 +72,45 @@ typedef union json_value_value {
 
 struct json_value_t {
     JSON_Value_Type     type;
+    int                 in_arena; /* allocated in an arena, released by json_arena_reset only */
     JSON_Value_Value    value;
 };
 
+/* Hash index slot, item is the position of the name in the object + 1, 0 for an empty slot */
+typedef struct json_object_slot_t {
+    uint32_t hash;
+    uint32_t item;
+} JSON_Object_Slot;
+
 struct json_object_t {
     char       **names;
     JSON_Value **values;
     size_t       count;
     size_t       capacity;
+    JSON_Arena  *arena; /* arena the object is allocated in, NULL if allocated on the heap */
+    JSON_Object_Slot *index; /* open addressing hash index of the names, built by the first lookup
+                                once the object is large enough, NULL if not built */
+    size_t       index_size; /* number of slots of the index, a power of 2 at least twice the capacity */
 };
 
 struct json_array_t {
     JSON_Value **items;
     size_t       count;
     size_t       capacity;
+    JSON_Arena  *arena; /* arena the array is allocated in, NULL if allocated on the heap */
 };
 
+/* Allocation */
+static void * arena_alloc(JSON_Arena *arena, size_t size);
+static void   arena_shrink(JSON_Arena *arena, void *ptr, size_t size, size_t new_size);
+static void * parson_alloc(JSON_Arena *arena, size_t size);
+static void   parson_release(JSON_Arena *arena, void *ptr);
+
 /* Various */
-static char * read_file(const char *filename);
+static char * read_file(const char *filename, JSON_Arena *arena);
 static void   remove_comments(char *string, const char *start_token, const char *end_token);
-static char * parson_strndup(const char *string, size_t n);
-static char * parson_strdup(const char *string);
+static char * parson_strndup(const char *string, size_t n, JSON_Arena *arena);
+static char * parson_strdup(const char *string, JSON_Arena *arena);
 static int    is_utf16_hex(const unsigned char *string);
 static int    num_bytes_in_utf8_sequence(unsigned char c);
 static int    verify_utf8_sequence(const unsigned char *string, int *len);
@@ -91,52 +118,115 @@ static int    is_valid_utf8(const char *string, size_t string_len);
 static int    is_decimal(const char *string, size_t length);
 
 /* JSON Object */
-static JSON_Object * json_object_init(void);
+static JSON_Object * json_object_init(JSON_Arena *arena);
 static JSON_Status   json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
+static JSON_Status   json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value);
 static JSON_Status   json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value  * json_object_nget_value(const JSON_Object *object, const char *name, size_t n);
+static uint32_t      json_object_hash(const char *name, size_t n);
+static JSON_Status   json_object_index_build(JSON_Object *object);
+static void          json_object_index_insert(JSON_Object *object, size_t position, uint32_t hash);
+static void          json_object_index_drop(JSON_Object *object);
 static void          json_object_free(JSON_Object *object);
 
 /* JSON Array */
-static JSON_Array * json_array_init(void);
+static JSON_Array * json_array_init(JSON_Arena *arena);
 static JSON_Status  json_array_add(JSON_Array *array, JSON_Value *value);
 static JSON_Status  json_array_resize(JSON_Array *array, size_t new_capacity);
 static void         json_array_free(JSON_Array *array);
 
 /* JSON Value */
-static JSON_Value * json_value_init_string_no_copy(char *string);
+static JSON_Value * json_value_alloc(JSON_Value_Type type, JSON_Arena *arena);
+static JSON_Value * json_value_init_string_no_copy(char *string, JSON_Arena *arena);
 
 /* Parser */
 static void         skip_quotes(const char **string);
 static int          parse_utf_16(const char **unprocessed, char **processed);
-static char *       process_string(const char *input, size_t len);
-static char *       get_quoted_string(const char **string);
-static JSON_Value * parse_object_value(const char **string, size_t nesting);
-static JSON_Value * parse_array_value(const char **string, size_t nesting);
-static JSON_Value * parse_string_value(const char **string);
-static JSON_Value * parse_boolean_value(const char **string);
-static JSON_Value * parse_number_value(const char **string);
-static JSON_Value * parse_null_value(const char **string);
-static JSON_Value * parse_value(const char **string, size_t nesting);
+static int          unescape_string(const char *input, size_t len, char *output);
+static char *       process_string(const char *input, size_t len, JSON_Arena *arena);
+static char *       get_quoted_string(const char **string, JSON_Arena *arena);
+static JSON_Value * parse_object_value(const char **string, size_t nesting, JSON_Arena *arena);
+static JSON_Value * parse_array_value(const char **string, size_t nesting, JSON_Arena *arena);
+static JSON_Value * parse_string_value(const char **string, JSON_Arena *arena);
+static JSON_Value * parse_boolean_value(const char **string, JSON_Arena *arena);
+static int          parse_number_fast(const char *string, double *number, const char **end);
+static JSON_Status  lex_string(const char **string, const char **start, size_t *len);
+static JSON_Status  lex_number(const char **string, double *number);
+static JSON_Status  lex_boolean(const char **string, int *boolean);
+static JSON_Status  lex_null(const char **string);
+static JSON_Value * parse_number_value(const char **string, JSON_Arena *arena);
+static JSON_Value * parse_null_value(const char **string, JSON_Arena *arena);
+static JSON_Value * parse_value(const char **string, size_t nesting, JSON_Arena *arena);
+static JSON_Value * parse_root_value(const char *string, JSON_Arena *arena);
+static JSON_Value * parse_root_value_with_comments(const char *string, JSON_Arena *arena);
+
+/* Streaming parser */
+typedef struct json_sax_parser_t {
+    const JSON_Sax *sax;
+    void           *context;
+    char           *scratch; /* decoded names and strings */
+    size_t          scratch_size;
+} JSON_Sax_Parser;
+static int          sax_parse_value(const char **string, size_t nesting, JSON_Sax_Parser *parser);
+static int          sax_parse_object(const char **string, size_t nesting, JSON_Sax_Parser *parser);
+static int          sax_parse_array(const char **string, size_t nesting, JSON_Sax_Parser *parser);
+static int          sax_parse_string(const char **string, const char **decoded, size_t *len, JSON_Sax_Parser *parser);
+static JSON_Status  sax_parse_root(const char *string, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size);
 
 /* Serialization */
-static int    json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty, char *num_buf);
-static int    json_serialize_string(const char *string, char *buf);
-static int    append_indent(char *buf, int level);
-static int    append_string(char *buf, const char *string);
+static int    json_serialize_to_writer_r(const JSON_Value *value, JSON_Writer *writer, int level, int is_pretty);
+static int    json_serialize_string(const char *string, JSON_Writer *writer);
+static int    json_serialize_number(double num, char *buf);
+static int    append_indent(JSON_Writer *writer, int level);
+static int    writer_append(JSON_Writer *writer, const char *text, size_t len);
+static JSON_Status writer_grow(JSON_Writer *writer, size_t needed);
+static JSON_Status writer_flush_file(JSON_Writer *writer, size_t needed);
+static JSON_Status json_serialize_to_file_r(const JSON_Value *value, const char *filename, int is_pretty);
+static char * json_serialize_to_string_r(const JSON_Value *value, int is_pretty);
+
+/* Allocation */
+static void * arena_alloc(JSON_Arena *arena, size_t size) {
+    size_t pad = (size_t)(-(uintptr_t)(arena->buffer + arena->used)) & (ARENA_ALIGN - 1);
+    void *ptr;
+    if (pad > arena->size - arena->used || size > arena->size - arena->used - pad) {
+        arena->overflow = 1;
+        return NULL;
+    }
+    ptr = arena->buffer + arena->used + pad;
+    arena->used += pad + size;
+    arena->nb_allocs++;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    return ptr;
+}
+
+/* Gives back the end of the last allocation, no effect on older ones */
+static void arena_shrink(JSON_Arena *arena, void *ptr, size_t size, size_t new_size) {
+    if ((char*)ptr + size == arena->buffer + arena->used)
+        arena->used -= size - new_size;
+}
+
+static void * parson_alloc(JSON_Arena *arena, size_t size) {
+    return arena ? arena_alloc(arena, size) : parson_malloc(size);
+}
+
+static void parson_release(JSON_Arena *arena, void *ptr) {
+    if (arena == NULL)
+        parson_free(ptr);
+}
 
 /* Various */
-static char * parson_strndup(const char *string, size_t n) {
-    char *output_string = (char*)parson_malloc(n + 1);
+static char * parson_strndup(const char *string, size_t n, JSON_Arena *arena) {
+    char *output_string = (char*)parson_alloc(arena, n + 1);
     if (!output_string)
         return NULL;
     output_string[n] = '\0';
-    strncpy(output_string, string, n);
+    memcpy(output_string, string, n);
     return output_string;
 }
 
-static char * parson_strdup(const char *string) {
-    return parson_strndup(string, strlen(string));
+static char * parson_strdup(const char *string, JSON_Arena *arena) {
+    return parson_strndup(string, strlen(string), arena);
 }
 
 static int is_utf16_hex(const unsigned char *s) {
@@ -223,7 +313,7 @@ static int is_decimal(const char *string, size_t length) {
     return 1;
 }
 
-static char * read_file(const char * filename) {
+static char * read_file(const char * filename, JSON_Arena *arena) {
     FILE *fp = fopen(filename, "r");
     size_t file_size;
     long pos;
@@ -238,7 +328,7 @@ static char * read_file(const char * filename) {
     }
     file_size = pos;
     rewind(fp);
-    file_contents = (char*)parson_malloc(sizeof(char) * (file_size + 1));
+    file_contents = (char*)parson_alloc(arena, sizeof(char) * (file_size + 1));
     if (!file_contents) {
         fclose(fp);
         return NULL;
@@ -246,7 +336,7 @@ static char * read_file(const char * filename) {
     if (fread(file_contents, file_size, 1, fp) < 1) {
         if (ferror(fp)) {
             fclose(fp);
-            parson_free(file_contents);
+            parson_release(arena, file_contents);
             return NULL;
         }
     }
@@ -287,22 +377,37 @@ static void remove_comments(char *string, const char *start_token, const char *e
 }
 
 /* JSON Object */
-static JSON_Object * json_object_init(void) {
-    JSON_Object *new_obj = (JSON_Object*)parson_malloc(sizeof(JSON_Object));
+static JSON_Object * json_object_init(JSON_Arena *arena) {
+    JSON_Object *new_obj = (JSON_Object*)parson_alloc(arena, sizeof(JSON_Object));
     if (!new_obj)
         return NULL;
     new_obj->names = (char**)NULL;
     new_obj->values = (JSON_Value**)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->arena = arena;
+    new_obj->index = NULL;
+    new_obj->index_size = 0;
     return new_obj;
 }
 
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value) {
-    size_t index = 0;
+    char *name_copy = NULL;
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
     }
+    name_copy = parson_strdup(name, object->arena);
+    if (name_copy == NULL)
+        return JSONFailure;
+    if (json_object_add_no_copy(object, name_copy, value) == JSONFailure) {
+        parson_release(object->arena, name_copy);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Takes ownership of name on success only */
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, JSON_Value *value) {
     if (object->count >= object->capacity) {
         size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
         if (new_capacity > OBJECT_MAX_CAPACITY)
@@ -312,11 +417,10 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
     }
     if (json_object_get_value(object, name) != NULL)
         return JSONFailure;
-    index = object->count;
-    object->names[index] = parson_strdup(name);
-    if (object->names[index] == NULL)
-        return JSONFailure;
-    object->values[index] = value;
+    object->names[object->count] = name;
+    object->values[object->count] = value;
+    if (object->index != NULL)
+        json_object_index_insert(object, object->count, json_object_hash(name, strlen(name)));
     object->count++;
     return JSONSuccess;
 }
@@ -331,13 +435,13 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
             return JSONFailure; /* Shouldn't happen */
     }
 
-    temp_names = (char**)parson_malloc(new_capacity * sizeof(char*));
+    temp_names = (char**)parson_alloc(object->arena, new_capacity * sizeof(char*));
     if (temp_names == NULL)
         return JSONFailure;
 
-    temp_values = (JSON_Value**)parson_malloc(new_capacity * sizeof(JSON_Value*));
+    temp_values = (JSON_Value**)parson_alloc(object->arena, new_capacity * sizeof(JSON_Value*));
     if (temp_values == NULL) {
-        parson_free(temp_names);
+        parson_release(object->arena, temp_names);
         return JSONFailure;
     }
 
@@ -345,26 +449,82 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
         memcpy(temp_names, object->names, object->count * sizeof(char*));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value*));
     }
-    parson_free(object->names);
-    parson_free(object->values);
+    parson_release(object->arena, object->names);
+    parson_release(object->arena, object->values);
     object->names = temp_names;
     object->values = temp_values;
     object->capacity = new_capacity;
+    json_object_index_drop(object); /* too small for the new capacity, rebuilt on next lookup */
     return JSONSuccess;
 }
 
 static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        name_length = strlen(object->names[i]);
-        if (name_length != n)
-            continue;
-        if (strncmp(object->names[i], name, n) == 0)
+    size_t i, mask;
+    uint32_t hash;
+    const JSON_Object_Slot *slot;
+    if (object == NULL)
+        return NULL;
+    if (object->index == NULL && object_index_min_count > 0 && object->count >= object_index_min_count)
+        json_object_index_build((JSON_Object*)object); /* the index is a cache, not part of the value */
+    if (object->index != NULL) {
+        hash = json_object_hash(name, n);
+        mask = object->index_size - 1;
+        for (i = hash & mask; object->index[i].item != 0; i = (i + 1) & mask) {
+            slot = &object->index[i];
+            if (slot->hash == hash && strncmp(object->names[slot->item - 1], name, n) == 0 &&
+                object->names[slot->item - 1][n] == '\0')
+                return object->values[slot->item - 1];
+        }
+        return NULL;
+    }
+    for (i = 0; i < object->count; i++) {
+        if (strncmp(object->names[i], name, n) == 0 && object->names[i][n] == '\0')
             return object->values[i];
     }
     return NULL;
 }
 
+/* FNV-1a */
+static uint32_t json_object_hash(const char *name, size_t n) {
+    uint32_t hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static JSON_Status json_object_index_build(JSON_Object *object) {
+    size_t i, size = 1;
+    while (size < 2 * object->capacity)
+        size <<= 1;
+    object->index = (JSON_Object_Slot*)parson_alloc(object->arena, size * sizeof(JSON_Object_Slot));
+    if (object->index == NULL)
+        return JSONFailure; /* lookups stay linear */
+    memset(object->index, 0, size * sizeof(JSON_Object_Slot));
+    object->index_size = size;
+    for (i = 0; i < object->count; i++)
+        json_object_index_insert(object, i, json_object_hash(object->names[i], strlen(object->names[i])));
+    return JSONSuccess;
+}
+
+/* Load factor stays below 1/2: the index is dropped when the capacity grows */
+static void json_object_index_insert(JSON_Object *object, size_t position, uint32_t hash) {
+    size_t mask = object->index_size - 1;
+    size_t i = hash & mask;
+    while (object->index[i].item != 0)
+        i = (i + 1) & mask;
+    object->index[i].hash = hash;
+    object->index[i].item = (uint32_t)(position + 1);
+}
+
+static void json_object_index_drop(JSON_Object *object) {
+    parson_release(object->arena, object->index);
+    object->index = NULL;
+    object->index_size = 0;
+}
+
 static void json_object_free(JSON_Object *object) {
     while(object->count--) {
         parson_free(object->names[object->count]);
@@ -372,17 +532,19 @@ static void json_object_free(JSON_Object *object) {
     }
     parson_free(object->names);
     parson_free(object->values);
+    parson_free(object->index);
     parson_free(object);
 }
 
 /* JSON Array */
-static JSON_Array * json_array_init(void) {
-    JSON_Array *new_array = (JSON_Array*)parson_malloc(sizeof(JSON_Array));
+static JSON_Array * json_array_init(JSON_Arena *arena) {
+    JSON_Array *new_array = (JSON_Array*)parson_alloc(arena, sizeof(JSON_Array));
     if (!new_array)
         return NULL;
     new_array->items = (JSON_Value**)NULL;
     new_array->capacity = 0;
     new_array->count = 0;
+    new_array->arena = arena;
     return new_array;
 }
 
@@ -404,14 +566,14 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity) {
     if (new_capacity == 0) {
         return JSONFailure;
     }
-    new_items = (JSON_Value**)parson_malloc(new_capacity * sizeof(JSON_Value*));
+    new_items = (JSON_Value**)parson_alloc(array->arena, new_capacity * sizeof(JSON_Value*));
     if (new_items == NULL) {
         return JSONFailure;
     }
     if (array->items != NULL && array->count > 0) {
         memcpy(new_items, array->items, array->count * sizeof(JSON_Value*));
     }
-    parson_free(array->items);
+    parson_release(array->arena, array->items);
     array->items = new_items;
     array->capacity = new_capacity;
     return JSONSuccess;
@@ -425,11 +587,19 @@ static void json_array_free(JSON_Array *array) {
 }
 
 /* JSON Value */
-static JSON_Value * json_value_init_string_no_copy(char *string) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+static JSON_Value * json_value_alloc(JSON_Value_Type type, JSON_Arena *arena) {
+    JSON_Value *new_value = (JSON_Value*)parson_alloc(arena, sizeof(JSON_Value));
+    if (!new_value)
+        return NULL;
+    new_value->type = type;
+    new_value->in_arena = (arena != NULL);
+    return new_value;
+}
+
+static JSON_Value * json_value_init_string_no_copy(char *string, JSON_Arena *arena) {
+    JSON_Value *new_value = json_value_alloc(JSONString, arena);
     if (!new_value)
         return NULL;
-    new_value->type = JSONString;
     new_value->value.string = string;
     return new_value;
 }
@@ -490,15 +660,12 @@ static int parse_utf_16(const char **unprocessed, char **processed) {
 }
 
 
-/* Copies and processes passed string up to supplied length.
+/* Decodes passed string up to supplied length into output (len + 1 bytes at most, decoding never
+makes a string longer) and returns the decoded length, or -1 if the string is invalid.
 Example: "\u006Corem ipsum" -> lorem ipsum */
-static char* process_string(const char *input, size_t len) {
+static int unescape_string(const char *input, size_t len, char *output) {
     const char *input_ptr = input;
-    size_t initial_size = (len + 1) * sizeof(char);
-    size_t final_size = 0;
-    char *output = (char*)parson_malloc(initial_size);
     char *output_ptr = output;
-    char *resized_output = NULL;
     while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < len) {
         if (*input_ptr == '\\') {
             input_ptr++;
@@ -513,13 +680,13 @@ static char* process_string(const char *input, size_t len) {
                 case 't':  *output_ptr = '\t'; break;
                 case 'u':
                     if (parse_utf_16(&input_ptr, &output_ptr) == JSONFailure)
-                        goto error;
+                        return -1;
                     break;
                 default:
-                    goto error;
+                    return -1;
             }
         } else if ((unsigned char)*input_ptr < 0x20) {
-            goto error; /* 0x00-0x19 are invalid characters for json string (http://www.ietf.org/rfc/rfc4627.txt) */
+            return -1; /* 0x00-0x19 are invalid characters for json string (http://www.ietf.org/rfc/rfc4627.txt) */
         } else {
             *output_ptr = *input_ptr;
         }
@@ -527,8 +694,27 @@ static char* process_string(const char *input, size_t len) {
         input_ptr++;
     }
     *output_ptr = '\0';
+    return (int)(output_ptr - output);
+}
+
+/* Copies and processes passed string up to supplied length. */
+static char* process_string(const char *input, size_t len, JSON_Arena *arena) {
+    size_t initial_size = (len + 1) * sizeof(char);
+    size_t final_size = 0;
+    char *output = (char*)parson_alloc(arena, initial_size);
+    char *resized_output = NULL;
+    int decoded_len;
+    if (output == NULL)
+        return NULL;
+    decoded_len = unescape_string(input, len, output);
+    if (decoded_len < 0)
+        goto error;
     /* resize to new length */
-    final_size = (size_t)(output_ptr-output) + 1;
+    final_size = (size_t)decoded_len + 1;
+    if (arena != NULL) {
+        arena_shrink(arena, output, initial_size, final_size);
+        return output;
+    }
     resized_output = (char*)parson_malloc(final_size);
     if (resized_output == NULL)
         goto error;
@@ -536,52 +722,56 @@ static char* process_string(const char *input, size_t len) {
     parson_free(output);
     return resized_output;
 error:
-    parson_free(output);
+    parson_release(arena, output);
     return NULL;
 }
 
 /* Return processed contents of a string between quotes and
    skips passed argument to a matching quote. */
-static char * get_quoted_string(const char **string) {
-    const char *string_start = *string;
+static char * get_quoted_string(const char **string, JSON_Arena *arena) {
+    const char *string_start = NULL;
     size_t string_len = 0;
-    skip_quotes(string);
-    if (**string == '\0')
+    if (lex_string(string, &string_start, &string_len) == JSONFailure)
         return NULL;
-    string_len = *string - string_start - 2; /* length without quotes */
-    return process_string(string_start + 1, string_len);
+    return process_string(string_start, string_len, arena);
 }
 
-static JSON_Value * parse_value(const char **string, size_t nesting) {
+static JSON_Value * parse_value(const char **string, size_t nesting, JSON_Arena *arena) {
     if (nesting > MAX_NESTING)
         return NULL;
     SKIP_WHITESPACES(string);
     switch (**string) {
         case '{':
-            return parse_object_value(string, nesting + 1);
+            return parse_object_value(string, nesting + 1, arena);
         case '[':
-            return parse_array_value(string, nesting + 1);
+            return parse_array_value(string, nesting + 1, arena);
         case '\"':
-            return parse_string_value(string);
+            return parse_string_value(string, arena);
         case 'f': case 't':
-            return parse_boolean_value(string);
+            return parse_boolean_value(string, arena);
         case '-':
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
-            return parse_number_value(string);
+            return parse_number_value(string, arena);
         case 'n':
-            return parse_null_value(string);
+            return parse_null_value(string, arena);
         default:
             return NULL;
     }
 }
 
-static JSON_Value * parse_object_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = json_value_init_object(), *new_value = NULL;
-    JSON_Object *output_object = json_value_get_object(output_value);
+static JSON_Value * parse_object_value(const char **string, size_t nesting, JSON_Arena *arena) {
+    JSON_Value *output_value = json_value_alloc(JSONObject, arena), *new_value = NULL;
+    JSON_Object *output_object = NULL;
     char *new_key = NULL;
     if (output_value == NULL)
         return NULL;
+    output_object = json_object_init(arena);
+    if (output_object == NULL) {
+        parson_release(arena, output_value);
+        return NULL;
+    }
+    output_value->value.object = output_object;
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
     if (**string == '}') { /* empty object */
@@ -589,26 +779,26 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
         return output_value;
     }
     while (**string != '\0') {
-        new_key = get_quoted_string(string);
+        new_key = get_quoted_string(string, arena);
         SKIP_WHITESPACES(string);
         if (new_key == NULL || **string != ':') {
+            parson_release(arena, new_key);
             json_value_free(output_value);
             return NULL;
         }
         SKIP_CHAR(string);
-        new_value = parse_value(string, nesting);
+        new_value = parse_value(string, nesting, arena);
         if (new_value == NULL) {
-            parson_free(new_key);
+            parson_release(arena, new_key);
             json_value_free(output_value);
             return NULL;
         }
-        if(json_object_add(output_object, new_key, new_value) == JSONFailure) {
-            parson_free(new_key);
-            parson_free(new_value);
+        if(json_object_add_no_copy(output_object, new_key, new_value) == JSONFailure) {
+            parson_release(arena, new_key);
+            json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
-        parson_free(new_key);
         SKIP_WHITESPACES(string);
         if (**string != ',')
             break;
@@ -616,8 +806,8 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
-        json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
+    if (**string != '}' || /* Trim object after parsing is over (pointless in an arena) */
+        (arena == NULL && json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure)) {
             json_value_free(output_value);
             return NULL;
     }
@@ -625,11 +815,17 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
     return output_value;
 }
 
-static JSON_Value * parse_array_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = json_value_init_array(), *new_array_value = NULL;
-    JSON_Array *output_array = json_value_get_array(output_value);
+static JSON_Value * parse_array_value(const char **string, size_t nesting, JSON_Arena *arena) {
+    JSON_Value *output_value = json_value_alloc(JSONArray, arena), *new_array_value = NULL;
+    JSON_Array *output_array = NULL;
     if (!output_value)
         return NULL;
+    output_array = json_array_init(arena);
+    if (output_array == NULL) {
+        parson_release(arena, output_value);
+        return NULL;
+    }
+    output_value->value.array = output_array;
     SKIP_CHAR(string);
     SKIP_WHITESPACES(string);
     if (**string == ']') { /* empty array */
@@ -637,13 +833,13 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
         return output_value;
     }
     while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
+        new_array_value = parse_value(string, nesting, arena);
         if (!new_array_value) {
             json_value_free(output_value);
             return NULL;
         }
         if(json_array_add(output_array, new_array_value) == JSONFailure) {
-            parson_free(new_array_value);
+            json_value_free(new_array_value);
             json_value_free(output_value);
             return NULL;
         }
@@ -654,8 +850,8 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
+    if (**string != ']' || /* Trim array after parsing is over (pointless in an arena) */
+        (arena == NULL && json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure)) {
             json_value_free(output_value);
             return NULL;
     }
@@ -663,74 +859,360 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
     return output_value;
 }
 
-static JSON_Value * parse_string_value(const char **string) {
+static JSON_Value * parse_string_value(const char **string, JSON_Arena *arena) {
     JSON_Value *value = NULL;
-    char *new_string = get_quoted_string(string);
+    char *new_string = get_quoted_string(string, arena);
     if (new_string == NULL)
         return NULL;
-    value = json_value_init_string_no_copy(new_string);
+    value = json_value_init_string_no_copy(new_string, arena);
     if (value == NULL) {
-        parson_free(new_string);
+        parson_release(arena, new_string);
         return NULL;
     }
     return value;
 }
 
-static JSON_Value * parse_boolean_value(const char **string) {
+static JSON_Value * parse_boolean_value(const char **string, JSON_Arena *arena) {
+    JSON_Value *output_value = NULL;
+    int boolean;
+    if (lex_boolean(string, &boolean) == JSONFailure)
+        return NULL;
+    output_value = json_value_alloc(JSONBoolean, arena);
+    if (output_value != NULL)
+        output_value->value.boolean = boolean;
+    return output_value;
+}
+
+/* Exact conversion of the common numbers: at most 15 significant digits and a power of 10 within
+   [-22, 22] are both exact doubles, so one multiplication or division rounds like strtod does.
+   Returns 0 (and strtod must be used) for anything else, including what is_decimal rejects. */
+static int parse_number_fast(const char *string, double *number, const char **end) {
+    static const double pow10[NUMBER_FAST_POW10 + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *ptr = string;
+    uint64_t mantissa = 0;
+    int nb_digits = 0; /* significant digits, leading zeros excluded */
+    int exp10 = 0, exp_value = 0, exp_negative = 0, negative = 0;
+    double value;
+
+    if (*ptr == '-') {
+        negative = 1;
+        ptr++;
+    }
+    if (*ptr == '0') {
+        ptr++;
+        if (*ptr != '.' && *ptr != 'e' && *ptr != 'E' && !isdigit((unsigned char)*ptr)) {
+            goto done;
+        }
+        if (*ptr != '.')
+            return 0; /* leading zero or 0eN, rejected by is_decimal */
+    } else if (isdigit((unsigned char)*ptr)) {
+        while (isdigit((unsigned char)*ptr)) {
+            if (++nb_digits > NUMBER_FAST_DIGITS)
+                return 0;
+            mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            ptr++;
+        }
+    } else {
+        return 0;
+    }
+    if (*ptr == '.') {
+        ptr++;
+        if (!isdigit((unsigned char)*ptr))
+            return 0;
+        while (isdigit((unsigned char)*ptr)) {
+            if (mantissa != 0 || *ptr != '0') {
+                if (++nb_digits > NUMBER_FAST_DIGITS)
+                    return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*ptr - '0');
+            exp10--;
+            ptr++;
+        }
+    }
+    if (*ptr == 'e' || *ptr == 'E') {
+        ptr++;
+        if (*ptr == '-' || *ptr == '+') {
+            exp_negative = (*ptr == '-');
+            ptr++;
+        }
+        if (!isdigit((unsigned char)*ptr))
+            return 0;
+        while (isdigit((unsigned char)*ptr)) {
+            if (exp_value > 1000)
+                return 0;
+            exp_value = exp_value * 10 + (*ptr - '0');
+            ptr++;
+        }
+        exp10 += exp_negative ? -exp_value : exp_value;
+    }
+done:
+    if (isalnum((unsigned char)*ptr) || *ptr == '.' || *ptr == '_')
+        return 0; /* let strtod decide how much of it is a number */
+    if (exp10 < -NUMBER_FAST_POW10 || exp10 > NUMBER_FAST_POW10)
+        return 0;
+    value = (double)mantissa;
+    if (exp10 < 0)
+        value /= pow10[-exp10];
+    else
+        value *= pow10[exp10];
+    *number = negative ? -value : value;
+    *end = ptr;
+    return 1;
+}
+
+static JSON_Value * parse_number_value(const char **string, JSON_Arena *arena) {
+    double number;
+    JSON_Value *output_value = NULL;
+    if (lex_number(string, &number) == JSONFailure)
+        return NULL;
+    output_value = json_value_alloc(JSONNumber, arena);
+    if (output_value != NULL)
+        output_value->value.number = number;
+    return output_value;
+}
+
+static JSON_Value * parse_null_value(const char **string, JSON_Arena *arena) {
+    if (lex_null(string) == JSONFailure)
+        return NULL;
+    return json_value_alloc(JSONNull, arena);
+}
+
+/* Tokenizer, shared by the tree and the streaming parsers, no allocation */
+
+/* Bounds of the contents of a string between quotes (still escaped),
+   skips passed argument to a matching quote. */
+static JSON_Status lex_string(const char **string, const char **start, size_t *len) {
+    const char *string_start = *string;
+    skip_quotes(string);
+    if (**string == '\0')
+        return JSONFailure;
+    *start = string_start + 1;
+    *len = *string - string_start - 2; /* length without quotes */
+    return JSONSuccess;
+}
+
+static JSON_Status lex_number(const char **string, double *number) {
+    const char *fast_end;
+    char *end;
+    if (parse_number_fast(*string, number, &fast_end)) {
+        *string = fast_end;
+        return JSONSuccess;
+    }
+    *number = strtod(*string, &end);
+    if (!is_decimal(*string, end - *string))
+        return JSONFailure;
+    *string = end;
+    return JSONSuccess;
+}
+
+static JSON_Status lex_boolean(const char **string, int *boolean) {
     size_t true_token_size = SIZEOF_TOKEN("true");
     size_t false_token_size = SIZEOF_TOKEN("false");
     if (strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
-        return json_value_init_boolean(1);
+        *boolean = 1;
     } else if (strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
-        return json_value_init_boolean(0);
+        *boolean = 0;
+    } else {
+        return JSONFailure;
     }
-    return NULL;
+    return JSONSuccess;
 }
 
-static JSON_Value * parse_number_value(const char **string) {
-    char *end;
-    double number = strtod(*string, &end);
-    JSON_Value *output_value;
-    if (is_decimal(*string, end - *string)) {
-        *string = end;
-        output_value = json_value_init_number(number);
-    } else {
-        output_value = NULL;
+static JSON_Status lex_null(const char **string) {
+    size_t token_size = SIZEOF_TOKEN("null");
+    if (strncmp("null", *string, token_size) != 0)
+        return JSONFailure;
+    *string += token_size;
+    return JSONSuccess;
+}
+
+static JSON_Value * parse_root_value(const char *string, JSON_Arena *arena) {
+    if (string == NULL)
+        return NULL;
+    SKIP_WHITESPACES(&string);
+    if (*string != '{' && *string != '[')
+        return NULL;
+    return parse_value((const char**)&string, 0, arena);
+}
+
+static JSON_Value * parse_root_value_with_comments(const char *string, JSON_Arena *arena) {
+    JSON_Value *result = NULL;
+    char *string_mutable_copy = NULL;
+    if (string == NULL)
+        return NULL;
+    string_mutable_copy = parson_strdup(string, arena);
+    if (string_mutable_copy == NULL)
+        return NULL;
+    remove_comments(string_mutable_copy, "/*", "*/");
+    remove_comments(string_mutable_copy, "//", "\n");
+    result = parse_root_value(string_mutable_copy, arena);
+    parson_release(arena, string_mutable_copy);
+    return result;
+}
+
+/* Streaming parser: same grammar as parse_value and same tokens, events instead of values.
+   Returns 0 to go on, 1 when a handler stopped the parsing, -1 on error or abort. */
+#define SAX_EVENT(handler, args) do { if (parser->sax->handler != NULL) { \
+                                        int result_ = parser->sax->handler args; \
+                                        if (result_ != JSONSaxContinue) { return result_ == JSONSaxStop ? 1 : -1; } \
+                                   } } while (0)
+
+static int sax_parse_value(const char **string, size_t nesting, JSON_Sax_Parser *parser) {
+    const char *decoded = NULL;
+    size_t len = 0;
+    double number;
+    int boolean;
+    if (nesting > MAX_NESTING)
+        return -1;
+    SKIP_WHITESPACES(string);
+    switch (**string) {
+        case '{':
+            return sax_parse_object(string, nesting + 1, parser);
+        case '[':
+            return sax_parse_array(string, nesting + 1, parser);
+        case '\"':
+            if (sax_parse_string(string, &decoded, &len, parser) < 0)
+                return -1;
+            SAX_EVENT(string, (parser->context, decoded, len));
+            return 0;
+        case 'f': case 't':
+            if (lex_boolean(string, &boolean) == JSONFailure)
+                return -1;
+            SAX_EVENT(boolean, (parser->context, boolean));
+            return 0;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            if (lex_number(string, &number) == JSONFailure)
+                return -1;
+            SAX_EVENT(number, (parser->context, number));
+            return 0;
+        case 'n':
+            if (lex_null(string) == JSONFailure)
+                return -1;
+            SAX_EVENT(null, (parser->context));
+            return 0;
+        default:
+            return -1;
     }
-    return output_value;
 }
 
-static JSON_Value * parse_null_value(const char **string) {
-    size_t token_size = SIZEOF_TOKEN("null");
-    if (strncmp("null", *string, token_size) == 0) {
-        *string += token_size;
-        return json_value_init_null();
+static int sax_parse_object(const char **string, size_t nesting, JSON_Sax_Parser *parser) {
+    const char *key = NULL;
+    size_t len = 0;
+    int result;
+    SKIP_CHAR(string);
+    SAX_EVENT(begin_object, (parser->context));
+    SKIP_WHITESPACES(string);
+    if (**string == '}') { /* empty object */
+        SKIP_CHAR(string);
+        SAX_EVENT(end_object, (parser->context));
+        return 0;
     }
-    return NULL;
+    while (**string != '\0') {
+        result = sax_parse_string(string, &key, &len, parser);
+        SKIP_WHITESPACES(string);
+        if (result < 0 || **string != ':')
+            return -1;
+        SAX_EVENT(key, (parser->context, key, len));
+        SKIP_CHAR(string);
+        result = sax_parse_value(string, nesting, parser);
+        if (result != 0)
+            return result;
+        SKIP_WHITESPACES(string);
+        if (**string != ',')
+            break;
+        SKIP_CHAR(string);
+        SKIP_WHITESPACES(string);
+    }
+    SKIP_WHITESPACES(string);
+    if (**string != '}')
+        return -1;
+    SKIP_CHAR(string);
+    SAX_EVENT(end_object, (parser->context));
+    return 0;
+}
+
+static int sax_parse_array(const char **string, size_t nesting, JSON_Sax_Parser *parser) {
+    int result;
+    SKIP_CHAR(string);
+    SAX_EVENT(begin_array, (parser->context));
+    SKIP_WHITESPACES(string);
+    if (**string == ']') { /* empty array */
+        SKIP_CHAR(string);
+        SAX_EVENT(end_array, (parser->context));
+        return 0;
+    }
+    while (**string != '\0') {
+        result = sax_parse_value(string, nesting, parser);
+        if (result != 0)
+            return result;
+        SKIP_WHITESPACES(string);
+        if (**string != ',')
+            break;
+        SKIP_CHAR(string);
+        SKIP_WHITESPACES(string);
+    }
+    SKIP_WHITESPACES(string);
+    if (**string != ']')
+        return -1;
+    SKIP_CHAR(string);
+    SAX_EVENT(end_array, (parser->context));
+    return 0;
+}
+
+/* Decodes a quoted string in the scratch buffer, the only memory used */
+static int sax_parse_string(const char **string, const char **decoded, size_t *len, JSON_Sax_Parser *parser) {
+    const char *raw = NULL;
+    size_t raw_len = 0;
+    int decoded_len;
+    if (**string != '\"' || lex_string(string, &raw, &raw_len) == JSONFailure)
+        return -1;
+    if (raw_len >= parser->scratch_size)
+        return -1;
+    decoded_len = unescape_string(raw, raw_len, parser->scratch);
+    if (decoded_len < 0)
+        return -1;
+    *decoded = parser->scratch;
+    *len = (size_t)decoded_len;
+    return 0;
+}
+
+#undef SAX_EVENT
+
+static JSON_Status sax_parse_root(const char *string, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size) {
+    JSON_Sax_Parser parser;
+    if (string == NULL || sax == NULL || scratch == NULL)
+        return JSONFailure;
+    parser.sax = sax;
+    parser.context = context;
+    parser.scratch = scratch;
+    parser.scratch_size = scratch_size;
+    SKIP_WHITESPACES(&string);
+    if (*string != '{' && *string != '[')
+        return JSONFailure;
+    return sax_parse_value(&string, 0, &parser) < 0 ? JSONFailure : JSONSuccess;
 }
 
 /* Serialization */
-#define APPEND_STRING(str) do { written = append_string(buf, (str)); \
-                                if (written < 0) { return -1; } \
-                                if (buf != NULL) { buf += written; } \
-                                written_total += written; } while(0)
+/* Only used with string literals */
+#define APPEND_STRING(str) do { if (writer_append(writer, (str), SIZEOF_TOKEN(str)) < 0) { return -1; } } while(0)
 
-#define APPEND_INDENT(level) do { written = append_indent(buf, (level)); \
-                                  if (written < 0) { return -1; } \
-                                  if (buf != NULL) { buf += written; } \
-                                  written_total += written; } while(0)
+#define APPEND_INDENT(level) do { if (append_indent(writer, (level)) < 0) { return -1; } } while(0)
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty, char *num_buf)
+static int json_serialize_to_writer_r(const JSON_Value *value, JSON_Writer *writer, int level, int is_pretty)
 {
-    const char *key = NULL, *string = NULL;
-    JSON_Value *temp_value = NULL;
+    const char *key = NULL;
     JSON_Array *array = NULL;
     JSON_Object *object = NULL;
     size_t i = 0, count = 0;
-    double num = 0.0;
-    int written = -1, written_total = 0;
+    char num_buf[64];
+    int written = -1;
 
     switch (json_value_get_type(value)) {
         case JSONArray:
@@ -742,13 +1224,8 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             for (i = 0; i < count; i++) {
                 if (is_pretty)
                     APPEND_INDENT(level+1);
-                temp_value = json_array_get_value(array, i);
-                written = json_serialize_to_buffer_r(temp_value, buf, level+1, is_pretty, num_buf);
-                if (written < 0)
+                if (json_serialize_to_writer_r(json_array_get_value(array, i), writer, level+1, is_pretty) < 0)
                     return -1;
-                if (buf != NULL)
-                    buf += written;
-                written_total += written;
                 if (i < (count - 1))
                     APPEND_STRING(",");
                 if (is_pretty)
@@ -757,7 +1234,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (count > 0 && is_pretty)
                 APPEND_INDENT(level);
             APPEND_STRING("]");
-            return written_total;
+            return 0;
         case JSONObject:
             object = json_value_get_object(value);
             count  = json_object_get_count(object);
@@ -768,22 +1245,13 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
                 key = json_object_get_name(object, i);
                 if (is_pretty)
                     APPEND_INDENT(level+1);
-                written = json_serialize_string(key, buf);
-                if (written < 0)
+                if (json_serialize_string(key, writer) < 0)
                     return -1;
-                if (buf != NULL)
-                    buf += written;
-                written_total += written;
                 APPEND_STRING(":");
                 if (is_pretty)
                     APPEND_STRING(" ");
-                temp_value = json_object_get_value(object, key);
-                written = json_serialize_to_buffer_r(temp_value, buf, level+1, is_pretty, num_buf);
-                if (written < 0)
+                if (json_serialize_to_writer_r(object->values[i], writer, level+1, is_pretty) < 0)
                     return -1;
-                if (buf != NULL)
-                    buf += written;
-                written_total += written;
                 if (i < (count - 1))
                     APPEND_STRING(",");
                 if (is_pretty)
@@ -792,39 +1260,23 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (count > 0 && is_pretty)
                 APPEND_INDENT(level);
             APPEND_STRING("}");
-            return written_total;
+            return 0;
         case JSONString:
-            string = json_value_get_string(value);
-            written = json_serialize_string(string, buf);
-            if (written < 0)
-                return -1;
-            if (buf != NULL)
-                buf += written;
-            written_total += written;
-            return written_total;
+            return json_serialize_string(json_value_get_string(value), writer);
         case JSONBoolean:
             if (json_value_get_boolean(value))
                 APPEND_STRING("true");
             else
                 APPEND_STRING("false");
-            return written_total;
+            return 0;
         case JSONNumber:
-            num = json_value_get_number(value);
-            if (buf != NULL)
-                num_buf = buf;
-            if (num == ((double)(int)num)) /*  check if num is integer */
-                written = sprintf(num_buf, "%d", (int)num);
-            else
-                written = sprintf(num_buf, DOUBLE_SERIALIZATION_FORMAT, num);
+            written = json_serialize_number(json_value_get_number(value), num_buf);
             if (written < 0)
                 return -1;
-            if (buf != NULL)
-                buf += written;
-            written_total += written;
-            return written_total;
+            return writer_append(writer, num_buf, (size_t)written);
         case JSONNull:
             APPEND_STRING("null");
-            return written_total;
+            return 0;
         case JSONError:
             return -1;
         default:
@@ -832,49 +1284,139 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
     }
 }
 
-static int json_serialize_string(const char *string, char *buf) {
-    size_t i = 0, len = strlen(string);
-    char c = '\0';
-    int written = -1, written_total = 0;
+static int json_serialize_string(const char *string, JSON_Writer *writer) {
+    const char *run = string; /* characters written as is, appended at once */
+    const char *escaped;
     APPEND_STRING("\"");
-    for (i = 0; i < len; i++) {
-        c = string[i];
-        switch (c) {
-            case '\"': APPEND_STRING("\\\""); break;
-            case '\\': APPEND_STRING("\\\\"); break;
-            case '/':  APPEND_STRING("\\/"); break; /* to make json embeddable in xml\/html */
-            case '\b': APPEND_STRING("\\b"); break;
-            case '\f': APPEND_STRING("\\f"); break;
-            case '\n': APPEND_STRING("\\n"); break;
-            case '\r': APPEND_STRING("\\r"); break;
-            case '\t': APPEND_STRING("\\t"); break;
-            default:
-                if (buf != NULL) {
-                    buf[0] = c;
-                    buf += 1;
-                }
-                written_total += 1;
-                break;
+    for (; *string != '\0'; string++) {
+        switch (*string) {
+            case '\"': escaped = "\\\""; break;
+            case '\\': escaped = "\\\\"; break;
+            case '/':  escaped = "\\/"; break; /* to make json embeddable in xml\/html */
+            case '\b': escaped = "\\b"; break;
+            case '\f': escaped = "\\f"; break;
+            case '\n': escaped = "\\n"; break;
+            case '\r': escaped = "\\r"; break;
+            case '\t': escaped = "\\t"; break;
+            default: continue;
         }
+        if (writer_append(writer, run, (size_t)(string - run)) < 0 || writer_append(writer, escaped, 2) < 0)
+            return -1;
+        run = string + 1;
     }
+    if (writer_append(writer, run, (size_t)(string - run)) < 0)
+        return -1;
     APPEND_STRING("\"");
-    return written_total;
-}
-
-static int append_indent(char *buf, int level) {
+    return 0;
+}
+
+/* Shortest representation parsed back to the same double: integers are written digit by digit, and
+   so are short decimals (num * 10^d rounded to the integer r, for the fewest decimals d such that
+   r / 10^d gives back num, which is what strtod computes for that decimal as both are exact), other
+   numbers with the fewest of 15, 16 or 17 significant digits that round-trips (any 15 digits
+   decimal is held by a distinct normal double, so a shorter one would be found by %.15g, subnormal
+   doubles have less precision and are tried from 1 digit). JSON has no
+   representation for NaN and infinities, they are written as null. */
+static int json_serialize_number(double num, char *buf) {
+    static const double pow10[NUMBER_FAST_DECIMALS + 1] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+    char digits[24];
+    uint64_t integer = 0;
+    double scaled;
+    int precision, decimals = 0, len = 0, written = 0, exact = 0;
+    if (num != num || num - num != 0.0)
+        return sprintf(buf, "null");
+    if (num == floor(num)) {
+        exact = fabs(num) < NUMBER_MAX_INTEGER;
+        integer = exact ? (uint64_t)fabs(num) : 0;
+    } else if (fabs(num) >= 1e-4) { /* %g would use the fixed notation too */
+        for (decimals = 1; decimals <= NUMBER_FAST_DECIMALS; decimals++) {
+            scaled = fabs(num) * pow10[decimals];
+            if (scaled >= 1e15)
+                break;
+            if (floor(scaled + 0.5) / pow10[decimals] == fabs(num)) {
+                exact = 1;
+                integer = (uint64_t)floor(scaled + 0.5);
+                break;
+            }
+        }
+    }
+    if (exact) {
+        if (num < 0)
+            buf[written++] = '-';
+        do {
+            digits[len++] = (char)('0' + integer % 10);
+            integer /= 10;
+            if (len == decimals)
+                digits[len++] = '.';
+        } while (integer != 0 || len <= decimals);
+        if (digits[len - 1] == '.')
+            digits[len++] = '0';
+        while (len > 0)
+            buf[written++] = digits[--len];
+        buf[written] = '\0';
+        return written;
+    }
+    for (precision = (fabs(num) < DBL_MIN) ? 1 : 15; precision < 17; precision++) {
+        written = sprintf(buf, "%.*g", precision, num);
+        if (strtod(buf, NULL) == num)
+            return written;
+    }
+    return sprintf(buf, "%.17g", num);
+}
+
+static int append_indent(JSON_Writer *writer, int level) {
     int i;
-    int written = -1, written_total = 0;
     for (i = 0; i < level; i++) {
         APPEND_STRING("    ");
     }
-    return written_total;
+    return 0;
 }
 
-static int append_string(char *buf, const char *string) {
-    if (buf == NULL) {
-        return (int)strlen(string);
+/* Without buffer, text is only counted */
+static int writer_append(JSON_Writer *writer, const char *text, size_t len) {
+    size_t room;
+    if (writer->error)
+        return -1;
+    if (writer->buf == NULL) {
+        writer->total += len;
+        return 0;
+    }
+    while (len > writer->size - writer->used) {
+        room = writer->size - writer->used;
+        memcpy(writer->buf + writer->used, text, room);
+        writer->used += room;
+        writer->total += room;
+        text += room;
+        len -= room;
+        if (writer->flush == NULL || writer->flush(writer, len) != JSONSuccess || writer->used >= writer->size) {
+            writer->error = 1;
+            return -1;
+        }
     }
-    return sprintf(buf, "%s", string);
+    memcpy(writer->buf + writer->used, text, len);
+    writer->used += len;
+    writer->total += len;
+    return 0;
+}
+
+static JSON_Status writer_grow(JSON_Writer *writer, size_t needed) {
+    size_t new_size = MAX(writer->size * 2, writer->used + needed);
+    char *new_buf = (char*)parson_malloc(new_size);
+    if (new_buf == NULL)
+        return JSONFailure;
+    memcpy(new_buf, writer->buf, writer->used);
+    parson_free(writer->buf);
+    writer->buf = new_buf;
+    writer->size = new_size;
+    return JSONSuccess;
+}
+
+static JSON_Status writer_flush_file(JSON_Writer *writer, size_t needed) {
+    (void)needed;
+    if (fwrite(writer->buf, 1, writer->used, (FILE*)writer->context) != writer->used)
+        return JSONFailure;
+    writer->used = 0;
+    return JSONSuccess;
 }
 
 #undef APPEND_STRING
@@ -882,50 +1424,83 @@ static int append_string(char *buf, const char *string) {
 
 /* Parser API */
 JSON_Value * json_parse_file(const char *filename) {
-    char *file_contents = read_file(filename);
+    return json_parse_file_arena(filename, NULL);
+}
+
+JSON_Value * json_parse_file_with_comments(const char *filename) {
+    return json_parse_file_with_comments_arena(filename, NULL);
+}
+
+JSON_Value * json_parse_string(const char *string) {
+    return parse_root_value(string, NULL);
+}
+
+JSON_Value * json_parse_string_with_comments(const char *string) {
+    return parse_root_value_with_comments(string, NULL);
+}
+
+/* Arena API */
+void json_arena_init(JSON_Arena *arena, void *buffer, size_t size) {
+    arena->buffer = (char*)buffer;
+    arena->size = size;
+    arena->peak = 0;
+    json_arena_reset(arena);
+}
+
+void json_arena_reset(JSON_Arena *arena) {
+    arena->used = 0;
+    arena->nb_allocs = 0;
+    arena->overflow = 0;
+}
+
+JSON_Value * json_parse_file_arena(const char *filename, JSON_Arena *arena) {
+    char *file_contents = read_file(filename, arena);
     JSON_Value *output_value = NULL;
     if (file_contents == NULL)
         return NULL;
-    output_value = json_parse_string(file_contents);
-    parson_free(file_contents);
+    output_value = parse_root_value(file_contents, arena);
+    parson_release(arena, file_contents);
     return output_value;
 }
 
-JSON_Value * json_parse_file_with_comments(const char *filename) {
-    char *file_contents = read_file(filename);
+JSON_Value * json_parse_file_with_comments_arena(const char *filename, JSON_Arena *arena) {
+    char *file_contents = read_file(filename, arena);
     JSON_Value *output_value = NULL;
     if (file_contents == NULL)
         return NULL;
-    output_value = json_parse_string_with_comments(file_contents);
-    parson_free(file_contents);
+    output_value = parse_root_value_with_comments(file_contents, arena);
+    parson_release(arena, file_contents);
     return output_value;
 }
 
-JSON_Value * json_parse_string(const char *string) {
+JSON_Value * json_parse_string_arena(const char *string, JSON_Arena *arena) {
+    return parse_root_value(string, arena);
+}
+
+JSON_Value * json_parse_string_with_comments_arena(const char *string, JSON_Arena *arena) {
+    return parse_root_value_with_comments(string, arena);
+}
+
+JSON_Status json_parse_string_sax(const char *string, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size) {
+    return sax_parse_root(string, sax, context, scratch, scratch_size);
+}
+
+/* Comments are blanked out in place, string is modified (see parson.h) */
+JSON_Status json_parse_string_with_comments_sax(char *string, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size) {
     if (string == NULL)
-        return NULL;
-    SKIP_WHITESPACES(&string);
-    if (*string != '{' && *string != '[')
-        return NULL;
-    return parse_value((const char**)&string, 0);
+        return JSONFailure;
+    remove_comments(string, "/*", "*/");
+    remove_comments(string, "//", "\n");
+    return sax_parse_root(string, sax, context, scratch, scratch_size);
 }
 
-JSON_Value * json_parse_string_with_comments(const char *string) {
-    JSON_Value *result = NULL;
-    char *string_mutable_copy = NULL, *string_mutable_copy_ptr = NULL;
-    string_mutable_copy = parson_strdup(string);
-    if (string_mutable_copy == NULL)
-        return NULL;
-    remove_comments(string_mutable_copy, "/*", "*/");
-    remove_comments(string_mutable_copy, "//", "\n");
-    string_mutable_copy_ptr = string_mutable_copy;
-    SKIP_WHITESPACES(&string_mutable_copy_ptr);
-    if (*string_mutable_copy_ptr != '{' && *string_mutable_copy_ptr != '[') {
-        parson_free(string_mutable_copy);
-        return NULL;
-    }
-    result = parse_value((const char**)&string_mutable_copy_ptr, 0);
-    parson_free(string_mutable_copy);
+JSON_Status json_parse_file_with_comments_sax(const char *filename, const JSON_Sax *sax, void *context, char *scratch, size_t scratch_size) {
+    JSON_Status result;
+    char *file_contents = read_file(filename, NULL);
+    if (file_contents == NULL)
+        return JSONFailure;
+    result = json_parse_string_with_comments_sax(file_contents, sax, context, scratch, scratch_size);
+    parson_free(file_contents);
     return result;
 }
 
@@ -959,11 +1534,16 @@ int json_object_get_boolean(const JSON_Object *object, const char *name) {
 }
 
 JSON_Value * json_object_dotget_value(const JSON_Object *object, const char *name) {
-    const char *dot_position = strchr(name, '.');
-    if (!dot_position)
-        return json_object_get_value(object, name);
-    object = json_value_get_object(json_object_nget_value(object, name, dot_position - name));
-    return json_object_dotget_value(object, dot_position + 1);
+    const char *dot_position;
+    if (name == NULL)
+        return NULL;
+    while ((dot_position = strchr(name, '.')) != NULL) {
+        object = json_value_get_object(json_object_nget_value(object, name, dot_position - name));
+        if (object == NULL)
+            return NULL;
+        name = dot_position + 1;
+    }
+    return json_object_get_value(object, name);
 }
 
 const char * json_object_dotget_string(const JSON_Object *object, const char *name) {
@@ -996,6 +1576,12 @@ const char * json_object_get_name(const JSON_Object *object, size_t index) {
     return object->names[index];
 }
 
+JSON_Value * json_object_get_value_at(const JSON_Object *object, size_t index) {
+    if (index >= json_object_get_count(object))
+        return NULL;
+    return object->values[index];
+}
+
 /* JSON Array API */
 JSON_Value * json_array_get_value(const JSON_Array *array, size_t index) {
     if (index >= json_array_get_count(array))
@@ -1053,6 +1639,8 @@ int json_value_get_boolean(const JSON_Value *value) {
 }
 
 void json_value_free(JSON_Value *value) {
+    if (value != NULL && value->in_arena)
+        return; /* released with the whole arena */
     switch (json_value_get_type(value)) {
         case JSONObject:
             json_object_free(value->value.object);
@@ -1070,11 +1658,10 @@ void json_value_free(JSON_Value *value) {
 }
 
 JSON_Value * json_value_init_object(void) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = json_value_alloc(JSONObject, NULL);
     if (!new_value)
         return NULL;
-    new_value->type = JSONObject;
-    new_value->value.object = json_object_init();
+    new_value->value.object = json_object_init(NULL);
     if (!new_value->value.object) {
         parson_free(new_value);
         return NULL;
@@ -1083,11 +1670,10 @@ JSON_Value * json_value_init_object(void) {
 }
 
 JSON_Value * json_value_init_array(void) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = json_value_alloc(JSONArray, NULL);
     if (!new_value)
         return NULL;
-    new_value->type = JSONArray;
-    new_value->value.array = json_array_init();
+    new_value->value.array = json_array_init(NULL);
     if (!new_value->value.array) {
         parson_free(new_value);
         return NULL;
@@ -1104,39 +1690,33 @@ JSON_Value * json_value_init_string(const char *string) {
     string_len = strlen(string);
     if (!is_valid_utf8(string, string_len))
         return NULL;
-    copy = parson_strndup(string, string_len);
+    copy = parson_strndup(string, string_len, NULL);
     if (copy == NULL)
         return NULL;
-    value = json_value_init_string_no_copy(copy);
+    value = json_value_init_string_no_copy(copy, NULL);
     if (value == NULL)
         parson_free(copy);
     return value;
 }
 
 JSON_Value * json_value_init_number(double number) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = json_value_alloc(JSONNumber, NULL);
     if (!new_value)
         return NULL;
-    new_value->type = JSONNumber;
     new_value->value.number = number;
     return new_value;
 }
 
 JSON_Value * json_value_init_boolean(int boolean) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = json_value_alloc(JSONBoolean, NULL);
     if (!new_value)
         return NULL;
-    new_value->type = JSONBoolean;
     new_value->value.boolean = boolean ? 1 : 0;
     return new_value;
 }
 
 JSON_Value * json_value_init_null(void) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
-    if (!new_value)
-        return NULL;
-    new_value->type = JSONNull;
-    return new_value;
+    return json_value_alloc(JSONNull, NULL);
 }
 
 JSON_Value * json_value_deep_copy(const JSON_Value *value) {
@@ -1195,10 +1775,10 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
             return json_value_init_number(json_value_get_number(value));
         case JSONString:
             temp_string = json_value_get_string(value);
-            temp_string_copy = parson_strdup(temp_string);
+            temp_string_copy = parson_strdup(temp_string, NULL);
             if (temp_string_copy == NULL)
                 return NULL;
-            return_value = json_value_init_string_no_copy(temp_string_copy);
+            return_value = json_value_init_string_no_copy(temp_string_copy, NULL);
             if (return_value == NULL)
                 parson_free(temp_string_copy);
             return return_value;
@@ -1211,115 +1791,119 @@ JSON_Value * json_value_deep_copy(const JSON_Value *value) {
     }
 }
 
+/* One traversal, the file is written by blocks, without building the whole text */
+static JSON_Status json_serialize_to_file_r(const JSON_Value *value, const char *filename, int is_pretty) {
+    char buf[4096];
+    JSON_Writer writer;
+    JSON_Status return_code = JSONSuccess;
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+        return JSONFailure;
+    json_writer_init(&writer, buf, sizeof buf, writer_flush_file, fp);
+    if (json_serialize_to_writer_r(value, &writer, 0, is_pretty) < 0 || writer_flush_file(&writer, 0) != JSONSuccess)
+        return_code = JSONFailure;
+    if (fclose(fp) == EOF)
+        return_code = JSONFailure;
+    return return_code;
+}
+
+/* One traversal, in a buffer doubled when full */
+static char * json_serialize_to_string_r(const JSON_Value *value, int is_pretty) {
+    JSON_Writer writer;
+    if (json_writer_init_growable(&writer, 1024) != JSONSuccess)
+        return NULL;
+    if (json_serialize_to_writer_r(value, &writer, 0, is_pretty) < 0 || writer_append(&writer, "", 1) < 0) {
+        json_free_serialized_string(writer.buf);
+        return NULL;
+    }
+    return writer.buf;
+}
+
+void json_writer_init(JSON_Writer *writer, char *buf, size_t size, JSON_Writer_Flush flush, void *context) {
+    writer->buf = buf;
+    writer->size = size;
+    writer->used = 0;
+    writer->total = 0;
+    writer->flush = flush;
+    writer->context = context;
+    writer->error = 0;
+}
+
+JSON_Status json_writer_init_growable(JSON_Writer *writer, size_t initial_size) {
+    char *buf = (char*)parson_malloc(MAX(initial_size, 1));
+    if (buf == NULL)
+        return JSONFailure;
+    json_writer_init(writer, buf, MAX(initial_size, 1), writer_grow, NULL);
+    return JSONSuccess;
+}
+
+JSON_Status json_writer_append(JSON_Writer *writer, const char *text, size_t len) {
+    if (writer == NULL || text == NULL)
+        return JSONFailure;
+    return writer_append(writer, text, len) < 0 ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_serialize_to_writer(JSON_Writer *writer, const JSON_Value *value) {
+    if (writer == NULL)
+        return JSONFailure;
+    return json_serialize_to_writer_r(value, writer, 0, 0) < 0 ? JSONFailure : JSONSuccess;
+}
+
+JSON_Status json_serialize_to_writer_pretty(JSON_Writer *writer, const JSON_Value *value) {
+    if (writer == NULL)
+        return JSONFailure;
+    return json_serialize_to_writer_r(value, writer, 0, 1) < 0 ? JSONFailure : JSONSuccess;
+}
+
 size_t json_serialization_size(const JSON_Value *value) {
-    char num_buf[1100]; /* recursively allocating buffer on stack is a bad idea, so let's do it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Writer writer;
+    json_writer_init(&writer, NULL, 0, NULL, NULL);
+    return json_serialize_to_writer_r(value, &writer, 0, 0) < 0 ? 0 : writer.total + 1;
 }
 
+/* Size is checked first, the buffer is left untouched when it is too small */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
-    int written = -1;
+    JSON_Writer writer;
     size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
+    if (buf == NULL || needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes)
         return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0)
+    json_writer_init(&writer, buf, buf_size_in_bytes, NULL, NULL);
+    if (json_serialize_to_writer_r(value, &writer, 0, 0) < 0 || writer_append(&writer, "", 1) < 0)
         return JSONFailure;
     return JSONSuccess;
 }
 
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename) {
-    JSON_Status return_code = JSONSuccess;
-    FILE *fp = NULL;
-    char *serialized_string = json_serialize_to_string(value);
-    if (serialized_string == NULL) {
-        return JSONFailure;
-    }
-    fp = fopen (filename, "w");
-    if (fp != NULL) {
-        if (fputs (serialized_string, fp) == EOF) {
-            return_code = JSONFailure;
-        }
-        if (fclose (fp) == EOF) {
-            return_code = JSONFailure;
-        }
-    }
-    json_free_serialized_string(serialized_string);
-    return return_code;
+    return json_serialize_to_file_r(value, filename, 0);
 }
 
 char * json_serialize_to_string(const JSON_Value *value) {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char*)parson_malloc(buf_size_bytes);
-    if (buf == NULL)
-        return NULL;
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return json_serialize_to_string_r(value, 0);
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value) {
-    char num_buf[1100]; /* recursively allocating buffer on stack is a bad idea, so let's do it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Writer writer;
+    json_writer_init(&writer, NULL, 0, NULL, NULL);
+    return json_serialize_to_writer_r(value, &writer, 0, 1) < 0 ? 0 : writer.total + 1;
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf, size_t buf_size_in_bytes) {
-    int written = -1;
+    JSON_Writer writer;
     size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes)
+    if (buf == NULL || needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes)
         return JSONFailure;
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0)
+    json_writer_init(&writer, buf, buf_size_in_bytes, NULL, NULL);
+    if (json_serialize_to_writer_r(value, &writer, 0, 1) < 0 || writer_append(&writer, "", 1) < 0)
         return JSONFailure;
     return JSONSuccess;
 }
 
 JSON_Status json_serialize_to_file_pretty(const JSON_Value *value, const char *filename) {
-    JSON_Status return_code = JSONSuccess;
-    FILE *fp = NULL;
-    char *serialized_string = json_serialize_to_string_pretty(value);
-    if (serialized_string == NULL) {
-        return JSONFailure;
-    }
-    fp = fopen (filename, "w");
-    if (fp != NULL) {
-        if (fputs (serialized_string, fp) == EOF) {
-            return_code = JSONFailure;
-        }
-        if (fclose (fp) == EOF) {
-            return_code = JSONFailure;
-        }
-    }
-    json_free_serialized_string(serialized_string);
-    return return_code;
+    return json_serialize_to_file_r(value, filename, 1);
 }
 
 char * json_serialize_to_string_pretty(const JSON_Value *value) {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char*)parson_malloc(buf_size_bytes);
-    if (buf == NULL)
-        return NULL;
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
-        return NULL;
-    }
-    return buf;
+    return json_serialize_to_string_r(value, 1);
 }
 
 void json_free_serialized_string(char *string) {
@@ -1329,7 +1913,7 @@ void json_free_serialized_string(char *string) {
 JSON_Status json_array_remove(JSON_Array *array, size_t ix) {
     JSON_Value *temp_value = NULL;
     size_t last_element_ix = 0;
-    if (array == NULL || ix >= json_array_get_count(array)) {
+    if (array == NULL || array->arena != NULL || ix >= json_array_get_count(array)) {
         return JSONFailure;
     }
     last_element_ix = json_array_get_count(array) - 1;
@@ -1346,7 +1930,7 @@ JSON_Status json_array_remove(JSON_Array *array, size_t ix) {
 }
 
 JSON_Status json_array_replace_value(JSON_Array *array, size_t ix, JSON_Value *value) {
-    if (array == NULL || value == NULL || ix >= json_array_get_count(array)) {
+    if (array == NULL || array->arena != NULL || value == NULL || ix >= json_array_get_count(array)) {
         return JSONFailure;
     }
     json_value_free(json_array_get_value(array, ix));
@@ -1400,7 +1984,7 @@ JSON_Status json_array_replace_null(JSON_Array *array, size_t i) {
 
 JSON_Status json_array_clear(JSON_Array *array) {
     size_t i = 0;
-    if (array == NULL)
+    if (array == NULL || array->arena != NULL)
         return JSONFailure;
     for (i = 0; i < json_array_get_count(array); i++) {
         json_value_free(json_array_get_value(array, i));
@@ -1410,7 +1994,7 @@ JSON_Status json_array_clear(JSON_Array *array) {
 }
 
 JSON_Status json_array_append_value(JSON_Array *array, JSON_Value *value) {
-    if (array == NULL || value == NULL)
+    if (array == NULL || array->arena != NULL || value == NULL)
         return JSONFailure;
     return json_array_add(array, value);
 }
@@ -1462,7 +2046,7 @@ JSON_Status json_array_append_null(JSON_Array *array) {
 JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Value *value) {
     size_t i = 0;
     JSON_Value *old_value;
-    if (object == NULL || name == NULL || value == NULL)
+    if (object == NULL || object->arena != NULL || name == NULL || value == NULL)
         return JSONFailure;
     old_value = json_object_get_value(object, name);
     if (old_value != NULL) { /* free and overwrite old value */
@@ -1499,13 +2083,13 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
     char *current_name = NULL;
     JSON_Object *temp_obj = NULL;
     JSON_Value *new_value = NULL;
-    if (value == NULL || name == NULL || value == NULL)
+    if (object == NULL || object->arena != NULL || name == NULL || value == NULL)
         return JSONFailure;
     dot_pos = strchr(name, '.');
     if (dot_pos == NULL) {
         return json_object_set_value(object, name, value);
     } else {
-        current_name = parson_strndup(name, dot_pos - name);
+        current_name = parson_strndup(name, dot_pos - name, NULL);
         temp_obj = json_object_get_object(object, current_name);
         if (temp_obj == NULL) {
             new_value = json_value_init_object();
@@ -1571,7 +2155,7 @@ JSON_Status json_object_dotset_null(JSON_Object *object, const char *name) {
 
 JSON_Status json_object_remove(JSON_Object *object, const char *name) {
     size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL)
+    if (object == NULL || object->arena != NULL || json_object_get_value(object, name) == NULL)
         return JSONFailure;
     last_item_index = json_object_get_count(object) - 1;
     for (i = 0; i < json_object_get_count(object); i++) {
@@ -1583,6 +2167,7 @@ JSON_Status json_object_remove(JSON_Object *object, const char *name) {
                 object->values[i] = object->values[last_item_index];
             }
             object->count -= 1;
+            json_object_index_drop(object);
             return JSONSuccess;
         }
     }
@@ -1596,7 +2181,7 @@ JSON_Status json_object_dotremove(JSON_Object *object, const char *name) {
     if (dot_pos == NULL) {
         return json_object_remove(object, name);
     } else {
-        current_name = parson_strndup(name, dot_pos - name);
+        current_name = parson_strndup(name, dot_pos - name, NULL);
         temp_obj = json_object_get_object(object, current_name);
         if (temp_obj == NULL) {
             parson_free(current_name);
@@ -1609,7 +2194,7 @@ JSON_Status json_object_dotremove(JSON_Object *object, const char *name) {
 
 JSON_Status json_object_clear(JSON_Object *object) {
     size_t i = 0;
-    if (object == NULL) {
+    if (object == NULL || object->arena != NULL) {
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
@@ -1617,6 +2202,7 @@ JSON_Status json_object_clear(JSON_Object *object) {
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    json_object_index_drop(object);
     return JSONSuccess;
 }
 
@@ -1763,3 +2349,7 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
     parson_malloc = malloc_fun;
     parson_free = free_fun;
 }
+
+void json_set_object_index_threshold(size_t nb_names) {
+    object_index_min_count = nb_names;
+}
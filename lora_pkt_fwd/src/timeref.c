@@ -0,0 +1,56 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : GPS time reference
+        Time reference used for GPS <-> timestamp conversion, updated by the
+        GPS and validation threads, read by any thread through a sequence lock
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset, memcpy */
+#include <pthread.h>
+
+#include "seqlock.h"
+#include "timeref.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void timeref_init(struct timeref_s *tr) {
+    memset(tr, 0, sizeof *tr);
+    pthread_mutex_init(&tr->mx, NULL);
+}
+
+void timeref_publish(struct timeref_s *tr, const struct tref *ref, bool valid) {
+    seqlock_write_begin(&tr->seq);
+    memcpy(&tr->ref, ref, sizeof tr->ref);
+    tr->valid = valid;
+    seqlock_write_end(&tr->seq);
+}
+
+bool timeref_read(const struct timeref_s *tr, struct tref *ref) {
+    uint32_t seq;
+    bool valid;
+
+    do {
+        seq = seqlock_read_begin(&tr->seq);
+        memcpy(ref, &tr->ref, sizeof tr->ref);
+        valid = tr->valid;
+    } while (seqlock_read_retry(&tr->seq, seq));
+    return valid;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
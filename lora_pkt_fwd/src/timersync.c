@@ -17,12 +17,19 @@ Maintainer: Michael Coracin
 /* -------------------------------------------------------------------------- */
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
+#define _GNU_SOURCE     /* needed for CLOCK_MONOTONIC_RAW to be defined */
 #include <stdio.h>        /* printf, fprintf, snprintf, fopen, fputs */
 #include <stdint.h>        /* C99 types */
+#include <stdbool.h>       /* bool type */
+#include <string.h>        /* memset */
+#include <time.h>          /* clock_gettime */
+#include <math.h>          /* fabs, sqrt */
 #include <pthread.h>
 
 #include "trace.h"
 #include "timersync.h"
+#include "seqlock.h"
+#include "flightrec.h"
 #include "loragw_hal.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
@@ -30,24 +37,54 @@ Maintainer: Michael Coracin
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
 
-/* -------------------------------------------------------------------------- */
-/* --- PRIVATE MACROS ------------------------------------------------------- */
-
-#define timersub(a, b, result)                                                \
-  do {                                                                        \
-    (result)->tv_sec = (a)->tv_sec - (b)->tv_sec;                             \
-    (result)->tv_usec = (a)->tv_usec - (b)->tv_usec;                          \
-    if ((result)->tv_usec < 0) {                                              \
-      --(result)->tv_sec;                                                     \
-      (result)->tv_usec += 1000000;                                           \
-    }                                                                         \
-  } while (0)
+#ifndef CLOCK_MONOTONIC_RAW
+    #define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC /* not slewed by NTP, fallback for older kernels */
+#endif
+
+#define TS_NB_SAMPLES       16      /* number of (host, concentrator) samples used for regression */
+#define TS_NB_FAST_SAMPLES  4       /* number of samples taken at fast rate after start or reset */
+#define TS_FAST_PERIOD_MS   5000    /* sampling period until model has TS_NB_FAST_SAMPLES samples */
+#define TS_PERIOD_MS        60000   /* sampling period once model is established */
+#define TS_OUTLIER_MIN_US   100.0   /* residual below which a sample is never considered an outlier */
+#define TS_OUTLIER_K        4.0     /* outlier threshold, in number of residual standard deviations */
+#define TS_MAX_REJECT       3       /* consecutive outliers after which the model is reset (counter reset) */
+#define TS_MAX_PPM          100.0   /* maximum plausible frequency error between host and concentrator */
+#define TS_BURST_SIZE       8       /* number of bracketed counter reads per sync, best one is kept */
+
+/* clock model: count = count_ref + (1 + ppm/1E6) * (host - host_ref) */
+struct ts_model_s {
+    bool valid;
+    int64_t host_ref;   /* host time at model reference point, in µs */
+    int64_t count_ref;  /* extended concentrator counter at model reference point, in µs */
+    double ppm;         /* concentrator frequency error compared to host, in ppm */
+    double residual;    /* RMS residual of the regression, in µs */
+    int nb_samples;     /* number of samples used for the model */
+    double uncertainty; /* uncertainty bound of the last sample (half round-trip of counter read), in µs */
+};
+
+struct ts_sample_s {
+    double host_us;     /* host monotonic time, relative to model origin */
+    double count_us;    /* extended concentrator counter, relative to model origin */
+    bool outlier;       /* sample rejected by regression */
+};
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
 
-static pthread_mutex_t mx_timersync = PTHREAD_MUTEX_INITIALIZER; /* control access to timer sync offsets */
-static struct timeval offset_unix_concent = {0,0}; /* timer offset between unix host and concentrator */
+/* clock model, written by timersync thread only, published to readers through a seqlock:
+    readers never block, and only retry if they overlap with a model update (every few seconds) */
+static uint32_t model_seq = 0;      /* odd while the model is being updated */
+static struct ts_model_s model;
+
+/* samples history, only used by timersync thread */
+static struct ts_sample_s samples[TS_NB_SAMPLES];
+static int samples_nb = 0;
+static int samples_idx = 0;
+static int64_t origin_host = 0;     /* host time of the first sample */
+static int64_t origin_count = 0;    /* extended counter of the first sample */
+static uint32_t last_count = 0;     /* last 32-bit counter value read */
+static uint32_t count_epoch = 0;    /* number of counter wraps (or resets) since start */
+static double last_uncertainty = 0.0; /* uncertainty bound of the last sample, in µs */
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE SHARED VARIABLES (GLOBAL) ------------------------------------ */
@@ -55,28 +92,269 @@ extern bool exit_sig;
 extern bool quit_sig;
 extern pthread_mutex_t mx_concent;
 
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static int64_t timeval_to_us(const struct timeval *tv) {
+    return (int64_t)tv->tv_sec * 1000000LL + (int64_t)tv->tv_usec;
+}
+
+static void us_to_timeval(int64_t us, struct timeval *tv) {
+    tv->tv_sec = (time_t)(us / 1000000LL);
+    tv->tv_usec = (suseconds_t)(us % 1000000LL);
+}
+
+/* Least squares fit of count = a + b * host on samples not flagged as outliers */
+static int fit_samples(double *a, double *b, double *rms) {
+    int i, n = 0;
+    double mx = 0.0, my = 0.0;
+    double sxx = 0.0, sxy = 0.0;
+    double dx, dy, r, sr2 = 0.0;
+
+    for (i = 0; i < samples_nb; i++) {
+        if (samples[i].outlier == false) {
+            mx += samples[i].host_us;
+            my += samples[i].count_us;
+            n++;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+    mx /= n;
+    my /= n;
+    for (i = 0; i < samples_nb; i++) {
+        if (samples[i].outlier == false) {
+            dx = samples[i].host_us - mx;
+            dy = samples[i].count_us - my;
+            sxx += dx * dx;
+            sxy += dx * dy;
+        }
+    }
+
+    /* not enough time span to estimate frequency: offset only */
+    if ((n < 2) || (sxx < 1.0)) {
+        *b = 1.0;
+    } else {
+        *b = sxy / sxx;
+        if (fabs(*b - 1.0) * 1E6 > TS_MAX_PPM) {
+            *b = 1.0;
+        }
+    }
+    *a = my - *b * mx;
+
+    for (i = 0; i < samples_nb; i++) {
+        if (samples[i].outlier == false) {
+            r = samples[i].count_us - (*a + *b * samples[i].host_us);
+            sr2 += r * r;
+        }
+    }
+    *rms = sqrt(sr2 / n);
+
+    return n;
+}
+
+/* Publish a new clock model, only called by timersync thread */
+static void model_publish(const struct ts_model_s *new_model) {
+    seqlock_write_begin(&model_seq);
+    memcpy(&model, new_model, sizeof model);
+    seqlock_write_end(&model_seq);
+}
+
+/* Get a consistent copy of the clock model, wait-free unless an update is in progress */
+static void model_read(struct ts_model_s *copy) {
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&model_seq);
+        memcpy(copy, &model, sizeof model);
+    } while (seqlock_read_retry(&model_seq, seq));
+}
+
+/* Fit model on samples history, rejecting outliers, and publish it */
+static void update_model(void) {
+    int i, n;
+    double a, b, rms, r, thr;
+    double ref;
+    struct ts_model_s new_model;
+
+    for (i = 0; i < samples_nb; i++) {
+        samples[i].outlier = false;
+    }
+    n = fit_samples(&a, &b, &rms);
+
+    /* one pass of outlier rejection: host scheduling or SPI latency only delays samples */
+    thr = TS_OUTLIER_K * rms;
+    if (thr < TS_OUTLIER_MIN_US) {
+        thr = TS_OUTLIER_MIN_US;
+    }
+    for (i = 0; i < samples_nb; i++) {
+        r = samples[i].count_us - (a + b * samples[i].host_us);
+        if (fabs(r) > thr) {
+            samples[i].outlier = true;
+            n--;
+        }
+    }
+    if (n < samples_nb) {
+        n = fit_samples(&a, &b, &rms);
+    }
+    if (n == 0) {
+        return;
+    }
+
+    /* model reference point is the latest sample, to keep extrapolation short */
+    ref = samples[(samples_idx + TS_NB_SAMPLES - 1) % TS_NB_SAMPLES].host_us;
+
+    new_model.host_ref = origin_host + (int64_t)ref;
+    new_model.count_ref = origin_count + (int64_t)(a + b * ref);
+    new_model.ppm = (b - 1.0) * 1E6;
+    new_model.residual = rms;
+    new_model.nb_samples = n;
+    new_model.uncertainty = last_uncertainty;
+    new_model.valid = true;
+    model_publish(&new_model);
+    flightrec_log(FLIGHTREC_TIMERSYNC, 0, (uint16_t)n, last_count, 0, (uint32_t)lround(new_model.ppm * 1E3), (uint32_t)lround(rms * 1E3));
+}
+
+/* Check a new sample against the current model, returns its residual in µs */
+static double sample_residual(int64_t host_us, int64_t count_ext) {
+    /* no concurrent writer, model can be accessed directly */
+    return (double)(count_ext - model.count_ref) - (1.0 + model.ppm / 1E6) * (double)(host_us - model.host_ref);
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
-int get_concentrator_time(struct timeval *concent_time, struct timeval unix_time) {
-    struct timeval local_timeval;
+void get_host_time(struct timeval *host_time) {
+    struct timespec ts;
+
+    if (host_time == NULL) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    host_time->tv_sec = ts.tv_sec;
+    host_time->tv_usec = ts.tv_nsec / 1000;
+}
+
+int get_concentrator_time(struct timeval *concent_time, struct timeval host_time) {
+    int64_t host_us;
+    int64_t count_us;
+    struct ts_model_s m;
 
     if (concent_time == NULL) {
         MSG("ERROR: %s invalid parameter\n", __FUNCTION__);
         return -1;
     }
 
-    pthread_mutex_lock(&mx_timersync); /* protect global variable access */
-    timersub(&unix_time, &offset_unix_concent, &local_timeval);
-    pthread_mutex_unlock(&mx_timersync);
+    host_us = timeval_to_us(&host_time);
+
+    /* extrapolate concentrator counter from clock model */
+    model_read(&m);
+    count_us = m.count_ref + (int64_t)((1.0 + m.ppm / 1E6) * (double)(host_us - m.host_ref));
+
+    if (m.valid == false) {
+        MSG_DEBUG(DEBUG_TIMERSYNC, "WARNING: concentrator time is not synchronized yet\n");
+        us_to_timeval(host_us, concent_time);
+        return -1;
+    }
 
-    /* TODO: handle sx1301 coutner wrap-up !! */
-    concent_time->tv_sec = local_timeval.tv_sec;
-    concent_time->tv_usec = local_timeval.tv_usec;
+    /* extended counter value, to be truncated to 32 bits by caller */
+    us_to_timeval(count_us, concent_time);
 
-    MSG_DEBUG(DEBUG_TIMERSYNC, " --> TIME: unix current time is   %ld,%ld\n", unix_time.tv_sec, unix_time.tv_usec);
-    MSG_DEBUG(DEBUG_TIMERSYNC, "           offset is              %ld,%ld\n", offset_unix_concent.tv_sec, offset_unix_concent.tv_usec);
-    MSG_DEBUG(DEBUG_TIMERSYNC, "           sx1301 current time is %ld,%ld\n", local_timeval.tv_sec, local_timeval.tv_usec);
+    MSG_DEBUG(DEBUG_TIMERSYNC, " --> TIME: host current time is   %ld,%ld\n", host_time.tv_sec, host_time.tv_usec);
+    MSG_DEBUG(DEBUG_TIMERSYNC, "           sx1301 current time is %ld,%ld\n", concent_time->tv_sec, concent_time->tv_usec);
+
+    return 0;
+}
+
+int get_timersync_model(double *drift_ppm, double *residual_us, double *uncertainty_us, int *nb_samples) {
+    struct ts_model_s m;
+
+    model_read(&m);
+    if (drift_ppm != NULL) {
+        *drift_ppm = m.ppm;
+    }
+    if (residual_us != NULL) {
+        *residual_us = m.residual;
+    }
+    if (uncertainty_us != NULL) {
+        *uncertainty_us = m.uncertainty;
+    }
+    if (nb_samples != NULL) {
+        *nb_samples = m.nb_samples;
+    }
+
+    return (m.valid == true) ? 0 : -1;
+}
+
+int timersync_sample(int64_t host_us, uint32_t count_us, double uncertainty_us) {
+    static int nb_reject = 0;
+    int64_t count_ext;
+    uint32_t epoch;
+    double residual;
+    double thr;
+
+    last_uncertainty = uncertainty_us;
+
+    /* Extend 32-bit counter to the 64-bit timeline, assuming less than one wrap (~71min) between samples */
+    epoch = count_epoch;
+    if ((samples_nb > 0) && (count_us < last_count)) {
+        epoch += 1;
+    }
+    count_ext = ((int64_t)epoch << 32) | count_us;
+    if (samples_nb == 0) {
+        origin_host = host_us;
+        origin_count = count_ext;
+    }
+
+    /* Reject a sample too far from the model, unless it happens repeatedly (concentrator reset) */
+    if (samples_nb >= TS_NB_FAST_SAMPLES) {
+        residual = sample_residual(host_us, count_ext);
+        thr = TS_OUTLIER_K * model.residual;
+        if (thr < TS_OUTLIER_MIN_US) {
+            thr = TS_OUTLIER_MIN_US;
+        }
+        if (thr < TS_OUTLIER_K * last_uncertainty) {
+            thr = TS_OUTLIER_K * last_uncertainty;
+        }
+        if (fabs(residual) > thr) {
+            nb_reject += 1;
+            if (nb_reject < TS_MAX_REJECT) {
+                MSG("WARNING: [timersync] sample rejected, residual=%.0fµs (threshold %.0fµs)\n", residual, thr);
+                return -1;
+            }
+            MSG("WARNING: [timersync] %d consecutive samples rejected, resetting clock model\n", nb_reject);
+            /* keep the timeline monotonic: a counter reset starts a new epoch */
+            epoch = count_epoch + 1;
+            count_ext = ((int64_t)epoch << 32) | count_us;
+            samples_nb = 0;
+            samples_idx = 0;
+            origin_host = host_us;
+            origin_count = count_ext;
+        }
+    }
+    nb_reject = 0;
+    last_count = count_us;
+    if (epoch != count_epoch) {
+        count_epoch = epoch;
+        MSG("INFO: [timersync] new concentrator counter epoch %u\n", count_epoch);
+    }
+
+    /* Add sample to history, and update model */
+    samples[samples_idx].host_us = (double)(host_us - origin_host);
+    samples[samples_idx].count_us = (double)(count_ext - origin_count);
+    samples_idx = (samples_idx + 1) % TS_NB_SAMPLES;
+    if (samples_nb < TS_NB_SAMPLES) {
+        samples_nb += 1;
+    }
+    update_model();
+
+    MSG_DEBUG(DEBUG_TIMERSYNC, "  sx1301    = %u (µs) - extended %lld\n", count_us, (long long)count_ext);
+    MSG_DEBUG(DEBUG_TIMERSYNC, "  host time = %lld (µs)\n", (long long)host_us);
+
+    MSG("INFO: host/sx1301 clock model: drift=%.3fppm - residual=%.1fµs (%d/%d samples)\n",
+        model.ppm, model.residual, model.nb_samples, samples_nb);
 
     return 0;
 }
@@ -85,62 +363,59 @@ int get_concentrator_time(struct timeval *concent_time, struct timeval unix_time
 /* --- THREAD 6: REGULARLAY MONITOR THE OFFSET BETWEEN UNIX CLOCK AND CONCENTRATOR CLOCK -------- */
 
 void thread_timersync(void) {
-    struct timeval unix_timeval;
-    struct timeval concentrator_timeval;
+    struct timeval host_before, host_after;
     uint32_t sx1301_timecount = 0;
-    struct timeval offset_previous = {0,0};
-    struct timeval offset_drift = {0,0}; /* delta between current and previous offset */
+    uint32_t timecount;
+    int64_t rtt, rtt_min, rtt_max;
+    int i;
+    int64_t host_us = 0;
+    double uncertainty;
 
     while (!exit_sig && !quit_sig) {
         /* Regularly disable GPS mode of concentrator's counter, in order to get
-            real timer value for synchronizing with host's unix timer */
-        MSG("\nINFO: Disabling GPS mode for concentrator's counter...\n");
+            real timer value for synchronizing with host's monotonic timer.
+            The concentrator is locked for the whole burst, so that the counter
+            spends as little time as possible out of GPS (PPS latching) mode,
+            and reads are not delayed by other threads accessing the concentrator */
+        rtt_min = INT64_MAX;
+        rtt_max = 0;
         pthread_mutex_lock(&mx_concent);
         lgw_reg_w(LGW_GPS_EN, 0);
-        pthread_mutex_unlock(&mx_concent);
-
-        /* Get current unix time */
-        gettimeofday(&unix_timeval, NULL);
+        for (i = 0; i < TS_BURST_SIZE; i++) {
+            /* Bracket counter read (1MHz) with host time, not affected by NTP steps or slewing */
+            get_host_time(&host_before);
+            lgw_get_trigcnt(&timecount);
+            get_host_time(&host_after);
 
-        /* Get current concentrator counter value (1MHz) */
-        pthread_mutex_lock(&mx_concent);
-        lgw_get_trigcnt(&sx1301_timecount);
-        pthread_mutex_unlock(&mx_concent);
-        concentrator_timeval.tv_sec = sx1301_timecount / 1000000UL;
-        concentrator_timeval.tv_usec = sx1301_timecount - (concentrator_timeval.tv_sec * 1000000UL);
-
-        /* Compute offset between unix and concentrator timers, with microsecond precision */
-        offset_previous.tv_sec = offset_unix_concent.tv_sec;
-        offset_previous.tv_usec = offset_unix_concent.tv_usec;
-
-        /* TODO: handle sx1301 coutner wrap-up */
-        pthread_mutex_lock(&mx_timersync); /* protect global variable access */
-        timersub(&unix_timeval, &concentrator_timeval, &offset_unix_concent);
-        pthread_mutex_unlock(&mx_timersync);
-
-        timersub(&offset_unix_concent, &offset_previous, &offset_drift);
-
-        MSG_DEBUG(DEBUG_TIMERSYNC, "  sx1301    = %u (µs) - timeval (%ld,%ld)\n",
-            sx1301_timecount,
-            concentrator_timeval.tv_sec,
-            concentrator_timeval.tv_usec);
-        MSG_DEBUG(DEBUG_TIMERSYNC, "  unix_timeval = %ld,%ld\n", unix_timeval.tv_sec, unix_timeval.tv_usec);
-
-        MSG("INFO: host/sx1301 time offset=(%lds:%ldµs) - drift=%ldµs\n",
-            offset_unix_concent.tv_sec,
-            offset_unix_concent.tv_usec,
-            offset_drift.tv_sec * 1000000UL + offset_drift.tv_usec);
-        MSG("INFO: Enabling GPS mode for concentrator's counter.\n\n");
-        pthread_mutex_lock(&mx_concent); /* TODO: Is it necessary to protect here? */
+            /* keep the read with the smallest round-trip, counter was sampled in the middle +/- rtt/2 */
+            rtt = timeval_to_us(&host_after) - timeval_to_us(&host_before);
+            if (rtt < rtt_min) {
+                rtt_min = rtt;
+                host_us = timeval_to_us(&host_before) + rtt / 2;
+                sx1301_timecount = timecount;
+            }
+            if (rtt > rtt_max) {
+                rtt_max = rtt;
+            }
+        }
         lgw_reg_w(LGW_GPS_EN, 1);
         pthread_mutex_unlock(&mx_concent);
+        uncertainty = (double)(rtt_min + 1) / 2.0; /* includes host clock resolution */
+
+        MSG("INFO: [timersync] counter sampled with +/-%.1fµs uncertainty (round-trip min %lldµs, max %lldµs)\n",
+            uncertainty, (long long)rtt_min, (long long)rtt_max);
+
+        if (timersync_sample(host_us, sx1301_timecount, uncertainty) != 0) {
+            wait_ms(TS_FAST_PERIOD_MS);
+            continue;
+        }
 
         /* delay next sync */
         /* If we consider a crystal oscillator precision of about 20ppm worst case, and a clock
             running at 1MHz, this would mean 1µs drift every 50000µs (10000000/20).
-            As here the time precision is not critical, we should be able to cope with at least 1ms drift,
-            which should occur after 50s (50000µs * 1000).
-            Let's set the thread sleep to 1 minute for now */
-        wait_ms(60000);
+            The drift is now estimated and compensated by the clock model, so the sampling
+            period only has to follow the drift variations (temperature).
+            Sample faster at start, to get a first frequency estimate quickly */
+        wait_ms((samples_nb < TS_NB_FAST_SAMPLES) ? TS_FAST_PERIOD_MS : TS_PERIOD_MS);
     }
 }
@@ -0,0 +1,133 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    LoRa concentrator : XTAL error correction estimator
+        Scalar Kalman filter on the GPS measured XTAL error
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <string.h>     /* memset */
+#include <math.h>       /* sqrt */
+
+#include "xtalcorr.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS & TYPES -------------------------------------------- */
+
+#define XCORR_MIN_SAMPLES       8       /* nb of samples required before the estimate can be declared ready */
+#define XCORR_MAX_SAMPLES       128     /* nb of samples after which the estimate is declared ready anyway */
+#define XCORR_TRACK_COEF        256     /* steady-state tracking time constant, in samples (former low-pass coefficient) */
+#define XCORR_NOISE_WINDOW      64      /* nb of samples the measurement noise estimate is averaged on */
+#define XCORR_INIT_NOISE        1E-6    /* measurement noise standard deviation assumed before it is estimated */
+#define XCORR_MIN_NOISE         0.4E-6  /* lower bound of the measurement noise standard deviation (1 us counter resolution on 1 s) */
+#define XCORR_OUTLIER_K         5.0     /* samples further than K sigma from the prediction are rejected */
+#define XCORR_MAX_REJECT        3       /* nb of consecutive rejected samples before accepting a step change */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void xcorr_reset(struct xcorr_s *xc) {
+    memset(xc, 0, sizeof *xc);
+    xc->estimate = 1.0;
+}
+
+void xcorr_restore(struct xcorr_s *xc, const struct xcorr_s *saved, double age) {
+    xcorr_reset(xc);
+    if (saved->nb_samples < XCORR_MIN_SAMPLES) {
+        return;
+    }
+    xc->nb_samples = XCORR_MIN_SAMPLES; /* restored estimate must be precise enough to be used early */
+    xc->estimate = saved->estimate;
+    xc->noise_var = saved->noise_var;
+    xc->last_sample = saved->estimate;
+    /* one random walk step per second elapsed */
+    xc->variance = saved->variance + (age * xc->noise_var / ((double)XCORR_TRACK_COEF * (double)XCORR_TRACK_COEF));
+    xc->restored = true;
+}
+
+int xcorr_update(struct xcorr_s *xc, double xtal_err, double max_stddev) {
+    double x = 1.0 / xtal_err;
+    double q, p_pred, innov, d, w, k;
+    bool confirm = false;
+
+    if (xc->restored == true) {
+        /* first sample after restore: check XTAL did not move (typ. temperature change) since state was saved */
+        xc->restored = false;
+        innov = x - xc->estimate;
+        if ((innov * innov) > (XCORR_OUTLIER_K * XCORR_OUTLIER_K * (xc->variance + xc->noise_var))) {
+            xcorr_reset(xc);
+        } else {
+            confirm = true;
+        }
+    }
+
+    if (xc->nb_samples == 0) {
+        xc->estimate = x;
+        xc->last_sample = x;
+        xc->noise_var = XCORR_INIT_NOISE * XCORR_INIT_NOISE;
+        xc->variance = xc->noise_var;
+        xc->nb_samples = 1;
+        return 0;
+    }
+
+    /* predict: random walk, scaled so that steady-state gain is 1/XCORR_TRACK_COEF */
+    q = xc->noise_var / ((double)XCORR_TRACK_COEF * (double)XCORR_TRACK_COEF);
+    p_pred = xc->variance + q;
+    innov = x - xc->estimate;
+
+    /* reject outliers (GPS glitch), unless they persist */
+    if ((xc->nb_samples >= XCORR_MIN_SAMPLES) && (xc->nb_consecutive_rejected < XCORR_MAX_REJECT) &&
+        ((innov * innov) > (XCORR_OUTLIER_K * XCORR_OUTLIER_K * (p_pred + xc->noise_var)))) {
+        xc->nb_rejected += 1;
+        xc->nb_consecutive_rejected += 1;
+        xc->variance = p_pred;
+        return -1;
+    }
+    xc->nb_consecutive_rejected = 0;
+
+    /* measurement noise, from successive samples difference (insensitive to slow drift) */
+    /* a restored estimate is not a sample, keep it out of noise estimation */
+    if (confirm == false) {
+        d = x - xc->last_sample;
+        w = 1.0 / (double)((xc->nb_samples < XCORR_NOISE_WINDOW) ? xc->nb_samples : XCORR_NOISE_WINDOW);
+        xc->noise_var += w * ((d * d / 2.0) - xc->noise_var);
+        if (xc->noise_var < (XCORR_MIN_NOISE * XCORR_MIN_NOISE)) {
+            xc->noise_var = XCORR_MIN_NOISE * XCORR_MIN_NOISE;
+        }
+    }
+
+    /* update */
+    k = p_pred / (p_pred + xc->noise_var);
+    xc->estimate += k * innov;
+    xc->variance = (1.0 - k) * p_pred;
+    xc->last_sample = x;
+    xc->nb_samples += 1;
+
+    /* ready as soon as precise enough, and no later than a plain average on XCORR_MAX_SAMPLES would be */
+    if ((xc->ready == false) && (xc->nb_samples >= XCORR_MIN_SAMPLES)) {
+        if ((xcorr_stddev(xc) <= max_stddev) || (xc->nb_samples >= XCORR_MAX_SAMPLES)) {
+            xc->ready = true;
+        }
+    }
+    return 0;
+}
+
+double xcorr_stddev(const struct xcorr_s *xc) {
+    /* estimate is close to 1.0, so its absolute deviation is a relative one */
+    return sqrt(xc->variance) * 1E6;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
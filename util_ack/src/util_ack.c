@@ -8,6 +8,8 @@
 
 Description:
     Network sink, receives UDP packets and sends an acknowledge
+    Acknowledges are scheduled on a timer wheel, with a random latency, loss,
+    duplication and reordering, to emulate the backhaul of many gateways
 
 License: Revised BSD License, see LICENSE.TXT file include in the project
 Maintainer: Sylvain Miermont
@@ -25,13 +27,16 @@ Maintainer: Sylvain Miermont
 #endif
 
 #include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
 #include <stdio.h>      /* printf, fprintf, sprintf, fopen, fputs */
-#include <unistd.h>     /* usleep */
+#include <unistd.h>     /* getopt */
 
 #include <string.h>     /* memset */
 #include <time.h>       /* time, clock_gettime, strftime, gmtime, clock_nanosleep*/
 #include <stdlib.h>     /* atoi, exit */
 #include <errno.h>      /* error messages */
+#include <math.h>       /* exp, log, sqrt, cos */
+#include <poll.h>       /* poll */
 
 #include <sys/socket.h> /* socket specific definitions */
 #include <netinet/in.h> /* INET constants and stuff */
@@ -57,6 +62,380 @@ Maintainer: Sylvain Miermont
 #define PKT_PULL_RESP    3
 #define PKT_PULL_ACK     4
 
+#define ACK_SIZE            4           /* version, token, type */
+#define ACK_POOL_SIZE       16384       /* acknowledges waiting to be sent */
+#define ACK_MAX_DELAY_MS    60000       /* random latencies are capped to this value */
+#define ACK_RECV_BATCH      64          /* datagrams received before running the timers */
+#define WHEEL_SIZE          4096        /* timer wheel slots of 1 ms, a power of 2 */
+#define ACK_MAX_GATEWAYS    4096        /* gateways with statistics, the others are only counted in the totals */
+#define ACK_TABLE_SIZE      8192        /* hash table slots, a power of 2, twice ACK_MAX_GATEWAYS */
+#define DEFAULT_LATENCY_MS  30          /* constant latency by default */
+#define DEFAULT_REPORT_S    10          /* statistics report interval by default */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+enum latency_law_e {
+    LATENCY_CONSTANT,       /* param1 ms */
+    LATENCY_UNIFORM,        /* between param1 and param2 ms */
+    LATENCY_LOGNORMAL       /* median param1 ms, shape param2 (standard deviation of the log) */
+};
+
+/* Statistics of a gateway, since the start */
+struct gw_stats_s {
+    bool used;
+    uint64_t mac;
+    uint32_t nb_push;       /* PUSH_DATA received */
+    uint32_t nb_pull;       /* PULL_DATA received */
+    uint32_t nb_ack;        /* acknowledges sent, duplicates included */
+    uint32_t nb_lost;       /* acknowledges not sent on purpose */
+    uint32_t nb_dup;        /* acknowledges sent twice */
+    uint32_t nb_reorder;    /* acknowledges delayed to be sent after later ones */
+    uint32_t nb_overflow;   /* acknowledges not sent because ACK_POOL_SIZE were already waiting */
+    double sum_delay_ms;    /* sum of the latencies of the acknowledges sent */
+    uint32_t max_delay_ms;
+};
+
+/* Acknowledge waiting in the timer wheel */
+struct ack_s {
+    struct ack_s *next;
+    uint64_t expire_ms;     /* time to send it */
+    uint32_t delay_ms;      /* latency applied */
+    struct gw_stats_s *gw;  /* statistics of the gateway */
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    uint8_t data[ACK_SIZE];
+};
+
+/* Slot of the timer wheel, a FIFO list so that acknowledges due the same ms are sent in order */
+struct wheel_slot_s {
+    struct ack_s *head;
+    struct ack_s *tail;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* emulated backhaul */
+static enum latency_law_e latency_law = LATENCY_CONSTANT;
+static double latency_p1 = DEFAULT_LATENCY_MS;
+static double latency_p2 = 0.0;
+static double loss_prob = 0.0;
+static double dup_prob = 0.0;
+static double reorder_prob = 0.0;
+static uint64_t rng_state;
+
+/* acknowledges scheduled */
+static struct ack_s ack_pool[ACK_POOL_SIZE];
+static struct ack_s *ack_free = NULL;
+static struct wheel_slot_s wheel[WHEEL_SIZE];
+static uint64_t wheel_tick = 0; /* last ms processed */
+static uint32_t wheel_count = 0; /* acknowledges in the wheel */
+
+/* statistics */
+static struct gw_stats_s gw_table[ACK_TABLE_SIZE];
+static struct gw_stats_s gw_untracked; /* all the gateways beyond ACK_MAX_GATEWAYS */
+static uint32_t nb_gateways = 0;
+static uint32_t nb_invalid = 0;
+
+static bool verbose = false;
+
+/* self-check, see check_wheel */
+static uint32_t check_nb_sent = 0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+void usage(void);
+
+static int parse_latency(const char *arg);
+
+static uint64_t now_ms(void);
+
+static double rng_uniform(void);
+
+static uint32_t draw_latency(void);
+
+static struct gw_stats_s * gw_lookup(uint64_t mac);
+
+static int schedule_ack(const uint8_t *ack, const struct sockaddr_storage *addr, socklen_t addr_len, struct gw_stats_s *gw, uint32_t delay_ms, uint64_t now);
+
+static void wheel_init(uint64_t now);
+
+static void run_timers(int sock, uint64_t now);
+
+static int check_wheel(void);
+
+static void report(void);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+void usage(void) {
+    MSG("Usage: util_ack {options} <port number>\n");
+    MSG("Available options:\n");
+    MSG(" -h print this help\n");
+    MSG(" -l <law> latency of the acknowledges (default const:%d):\n", DEFAULT_LATENCY_MS);
+    MSG("          const:<ms>, uniform:<min ms>:<max ms> or lognormal:<median ms>:<sigma>\n");
+    MSG(" -p <float> probability of losing an acknowledge, in percent\n");
+    MSG(" -u <float> probability of duplicating an acknowledge, in percent\n");
+    MSG(" -r <float> probability of reordering an acknowledge (delayed by a second latency), in percent\n");
+    MSG(" -s <uint> seed of the random generator (default 1), the same seed and traffic give the same acknowledges\n");
+    MSG(" -i <uint> statistics report interval in seconds (default %d, 0 to disable)\n", DEFAULT_REPORT_S);
+    MSG(" -v display every datagram received and acknowledge sent\n");
+    MSG(" -t check the timer wheel against a simulated clock and exit\n");
+}
+
+static int parse_latency(const char *arg) {
+    if (sscanf(arg, "const:%lf", &latency_p1) == 1) {
+        latency_law = LATENCY_CONSTANT;
+    } else if (sscanf(arg, "uniform:%lf:%lf", &latency_p1, &latency_p2) == 2) {
+        latency_law = LATENCY_UNIFORM;
+        if (latency_p2 < latency_p1) {
+            return -1;
+        }
+    } else if (sscanf(arg, "lognormal:%lf:%lf", &latency_p1, &latency_p2) == 2) {
+        latency_law = LATENCY_LOGNORMAL;
+        if ((latency_p1 <= 0.0) || (latency_p2 < 0.0)) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    return (latency_p1 < 0.0) ? -1 : 0;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/* xorshift64*, uniform in [0, 1), reproducible whatever the C library */
+static double rng_uniform(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static uint32_t draw_latency(void) {
+    double d, n;
+
+    switch (latency_law) {
+        case LATENCY_UNIFORM:
+            d = latency_p1 + (latency_p2 - latency_p1) * rng_uniform();
+            break;
+        case LATENCY_LOGNORMAL:
+            /* Box-Muller transform for the normal variable */
+            n = sqrt(-2.0 * log(1.0 - rng_uniform())) * cos(2.0 * M_PI * rng_uniform());
+            d = latency_p1 * exp(latency_p2 * n);
+            break;
+        default:
+            d = latency_p1;
+    }
+    return (d < ACK_MAX_DELAY_MS) ? (uint32_t)(d + 0.5) : ACK_MAX_DELAY_MS;
+}
+
+/* Find the statistics of a gateway, adding it if needed, NULL if the table is full */
+static struct gw_stats_s * gw_lookup(uint64_t mac) {
+    uint32_t i;
+
+    /* Fibonacci hashing, the MAC addresses of a fleet often differ only by their last bytes */
+    i = (uint32_t)((mac * 0x9E3779B97F4A7C15ULL) >> 51) & (ACK_TABLE_SIZE - 1);
+    while (gw_table[i].used) {
+        if (gw_table[i].mac == mac) {
+            return &gw_table[i];
+        }
+        i = (i + 1) & (ACK_TABLE_SIZE - 1);
+    }
+    if (nb_gateways >= ACK_MAX_GATEWAYS) {
+        return NULL;
+    }
+    gw_table[i].used = true;
+    gw_table[i].mac = mac;
+    nb_gateways += 1;
+    return &gw_table[i];
+}
+
+/* Put an acknowledge in the timer wheel, -1 if too many are already waiting */
+static int schedule_ack(const uint8_t *ack, const struct sockaddr_storage *addr, socklen_t addr_len, struct gw_stats_s *gw, uint32_t delay_ms, uint64_t now) {
+    struct ack_s *a = ack_free;
+    struct wheel_slot_s *slot;
+
+    if (a == NULL) {
+        return -1;
+    }
+    ack_free = a->next;
+    a->next = NULL;
+    a->expire_ms = now + delay_ms;
+    a->delay_ms = delay_ms;
+    a->gw = gw;
+    a->addr = *addr;
+    a->addr_len = addr_len;
+    memcpy(a->data, ack, ACK_SIZE);
+
+    /* delays longer than the wheel stay in their slot for more than one turn,
+       a null delay lands in the slot of the last run, that run_timers visits again */
+    slot = &wheel[a->expire_ms & (WHEEL_SIZE - 1)];
+    if (slot->tail == NULL) {
+        slot->head = a;
+    } else {
+        slot->tail->next = a;
+    }
+    slot->tail = a;
+    wheel_count += 1;
+    return 0;
+}
+
+static void wheel_init(uint64_t now) {
+    int i;
+
+    memset(wheel, 0, sizeof wheel);
+    ack_free = NULL;
+    for (i = 0; i < ACK_POOL_SIZE; i++) {
+        ack_pool[i].next = ack_free;
+        ack_free = &ack_pool[i];
+    }
+    wheel_tick = now;
+    wheel_count = 0;
+}
+
+/* Send the acknowledges due, up to now (no socket: self-check, nothing is sent) */
+static void run_timers(int sock, uint64_t now) {
+    struct wheel_slot_s *slot;
+    struct ack_s *a, *prev, *next;
+    char host_name[64];
+    char port_name[64];
+    uint64_t tick, last;
+
+    if (wheel_count == 0) {
+        wheel_tick = now;
+        return;
+    }
+    /* the slot of the last run is visited again, acknowledges may have been added
+       to it in the same ms, one turn of the wheel visits all the slots */
+    last = (now - wheel_tick >= WHEEL_SIZE) ? wheel_tick + WHEEL_SIZE - 1 : now;
+    for (tick = wheel_tick; tick <= last; tick++) {
+        slot = &wheel[tick & (WHEEL_SIZE - 1)];
+        prev = NULL;
+        for (a = slot->head; a != NULL; a = next) {
+            next = a->next;
+            if (a->expire_ms > now) {
+                prev = a; /* next turn */
+                continue;
+            }
+            if (sock == -1) {
+                check_nb_sent += 1;
+            } else if (sendto(sock, (void *)a->data, ACK_SIZE, 0, (struct sockaddr *)&a->addr, a->addr_len) == -1) {
+                MSG("WARNING: sendto returned %s\n", strerror(errno));
+            } else {
+                a->gw->nb_ack += 1;
+                a->gw->sum_delay_ms += a->delay_ms;
+                if (a->delay_ms > a->gw->max_delay_ms) {
+                    a->gw->max_delay_ms = a->delay_ms;
+                }
+            }
+            if (verbose) {
+                getnameinfo((struct sockaddr *)&a->addr, a->addr_len, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
+                printf("<-  pkt out, %s for host %s (port %s), after %u ms\n", (a->data[3] == PKT_PUSH_ACK) ? "PUSH_ACK" : "PULL_ACK",
+                       host_name, port_name, a->delay_ms);
+            }
+
+            /* unlink and release */
+            if (prev == NULL) {
+                slot->head = next;
+            } else {
+                prev->next = next;
+            }
+            if (slot->tail == a) {
+                slot->tail = prev;
+            }
+            a->next = ack_free;
+            ack_free = a;
+            wheel_count -= 1;
+        }
+    }
+    wheel_tick = now;
+}
+
+/* Drive the wheel with a simulated clock: runs in the same ms, 1 ms steps and
+   gaps longer than a turn, null, short and longer than a turn delays. After
+   each run, nothing due may be left in the wheel, and all the acknowledges must
+   be sent in the end. Returns the number of errors. */
+static int check_wheel(void) {
+    static const uint8_t ack[ACK_SIZE] = {PROTOCOL_VERSION, 0, 0, PKT_PUSH_ACK};
+    struct sockaddr_storage addr;
+    struct gw_stats_s gw;
+    struct ack_s *a;
+    uint64_t now = 1000;
+    uint32_t nb_scheduled = 0;
+    uint32_t delay;
+    double r;
+    int errors = 0;
+    int i, j, n;
+
+    memset(&addr, 0, sizeof addr);
+    memset(&gw, 0, sizeof gw);
+    rng_state = 0x9E3779B97F4A7C15ULL;
+    wheel_init(now);
+    check_nb_sent = 0;
+
+    for (i = 0; i < 100000; i++) {
+        /* several runs in the same ms are what the poll loop does under load */
+        r = rng_uniform();
+        now += (r < 0.4) ? 0 : (r < 0.9) ? 1 : (r < 0.99) ? 2 + (uint64_t)(rng_uniform() * 50) : (uint64_t)(rng_uniform() * 3 * WHEEL_SIZE);
+        n = (int)(rng_uniform() * 4);
+        for (j = 0; j < n; j++) {
+            r = rng_uniform();
+            delay = (r < 0.3) ? 0 : (r < 0.6) ? 1 + (uint32_t)(rng_uniform() * 3) : (uint32_t)(rng_uniform() * 3 * WHEEL_SIZE);
+            if (schedule_ack(ack, &addr, sizeof addr, &gw, delay, now) == 0) {
+                nb_scheduled += 1;
+            }
+        }
+        run_timers(-1, now);
+        for (j = 0; j < WHEEL_SIZE; j++) {
+            for (a = wheel[j].head; a != NULL; a = a->next) {
+                if (a->expire_ms <= now) {
+                    if (errors < 10) {
+                        MSG("ERROR: acknowledge due at %llu ms still waiting at %llu ms\n", (unsigned long long)a->expire_ms, (unsigned long long)now);
+                    }
+                    errors += 1;
+                }
+            }
+        }
+    }
+    run_timers(-1, now + 3 * WHEEL_SIZE);
+    if ((check_nb_sent != nb_scheduled) || (wheel_count != 0)) {
+        MSG("ERROR: %u acknowledges scheduled, %u sent, %u left\n", nb_scheduled, check_nb_sent, wheel_count);
+        errors += 1;
+    }
+    printf("timer wheel: %u acknowledges, %d errors\n", nb_scheduled, errors);
+    return errors;
+}
+
+static void report(void) {
+    struct gw_stats_s *gw;
+    char stat_timestamp[24];
+    time_t t;
+    int i;
+
+    t = time(NULL);
+    strftime(stat_timestamp, sizeof stat_timestamp, "%F %T %Z", gmtime(&t));
+    printf("### %s: %u gateways, %u invalid datagrams, %u acknowledges waiting\n", stat_timestamp, nb_gateways, nb_invalid, wheel_count);
+    for (i = 0; i <= ACK_TABLE_SIZE; i++) {
+        gw = (i < ACK_TABLE_SIZE) ? &gw_table[i] : &gw_untracked;
+        if (!gw->used || (gw->nb_push + gw->nb_pull == 0)) {
+            continue;
+        }
+        printf("  %016llX %s PUSH_DATA %u, PULL_DATA %u, acks sent %u, lost %u, duplicated %u, reordered %u, overflow %u, latency mean %.1f ms max %u ms\n",
+               (unsigned long long)gw->mac, (gw == &gw_untracked) ? "(others)" : "", gw->nb_push, gw->nb_pull, gw->nb_ack, gw->nb_lost,
+               gw->nb_dup, gw->nb_reorder, gw->nb_overflow, (gw->nb_ack > 0) ? gw->sum_delay_ms / gw->nb_ack : 0.0, gw->max_delay_ms);
+    }
+    fflush(stdout);
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- MAIN FUNCTION -------------------------------------------------------- */
 
@@ -74,19 +453,78 @@ int main(int argc, char **argv)
 
     /* variables for receiving and sending packets */
     struct sockaddr_storage dist_addr;
-    socklen_t addr_len = sizeof dist_addr;
+    socklen_t addr_len;
     uint8_t databuf[4096];
     int byte_nb;
+    struct pollfd pfd;
+    uint64_t now, next_report;
+    unsigned report_s = DEFAULT_REPORT_S;
+    unsigned long seed = 1;
+    int timeout;
 
     /* variables for protocol management */
     uint32_t raw_mac_h; /* Most Significant Nibble, network order */
     uint32_t raw_mac_l; /* Least Significant Nibble, network order */
     uint64_t gw_mac; /* MAC address of the client (gateway) */
     uint8_t ack_command;
+    struct gw_stats_s *gw;
+    uint32_t delay, dup_delay;
+    bool lost, reorder, dup;
+
+    while ((i = getopt (argc, argv, "hl:p:u:r:s:i:vt")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+
+            case 'l': /* -l <law> latency */
+                if (parse_latency(optarg) != 0) {
+                    MSG("ERROR: invalid latency %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'p': /* -p <float> loss probability */
+                loss_prob = atof(optarg) / 100.0;
+                break;
+
+            case 'u': /* -u <float> duplication probability */
+                dup_prob = atof(optarg) / 100.0;
+                break;
+
+            case 'r': /* -r <float> reordering probability */
+                reorder_prob = atof(optarg) / 100.0;
+                break;
+
+            case 's': /* -s <uint> random seed */
+                seed = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'i': /* -i <uint> report interval */
+                report_s = (unsigned)strtoul(optarg, NULL, 0);
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 't': /* -t self-check */
+                return (check_wheel() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+            default:
+                MSG("ERROR: argument parsing options, use -h option for help\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
 
     /* check if port number was passed as parameter */
-    if (argc != 2) {
-        MSG("Usage: util_ack <port number>\n");
+    if (optind != argc - 1) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    if ((loss_prob < 0.0) || (loss_prob > 1.0) || (dup_prob < 0.0) || (dup_prob > 1.0) || (reorder_prob < 0.0) || (reorder_prob > 1.0)) {
+        MSG("ERROR: probabilities must be between 0 and 100 %%\n");
         exit(EXIT_FAILURE);
     }
 
@@ -97,7 +535,7 @@ int main(int argc, char **argv)
     hints.ai_flags = AI_PASSIVE; /* will assign local IP automatically */
 
     /* look for address */
-    i = getaddrinfo(NULL, argv[1], &hints, &result);
+    i = getaddrinfo(NULL, argv[optind], &hints, &result);
     if (i != 0) {
         MSG("ERROR: getaddrinfo returned %s\n", gai_strerror(i));
         exit(EXIT_FAILURE);
@@ -128,66 +566,135 @@ int main(int argc, char **argv)
         }
         exit(EXIT_FAILURE);
     }
-    MSG("INFO: util_ack listening on port %s\n", argv[1]);
+    MSG("INFO: util_ack listening on port %s\n", argv[optind]);
     freeaddrinfo(result);
 
+    /* seed through splitmix64, xorshift needs a non zero state */
+    rng_state = (uint64_t)seed + 0x9E3779B97F4A7C15ULL;
+    rng_state = (rng_state ^ (rng_state >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    rng_state = (rng_state ^ (rng_state >> 27)) * 0x94D049BB133111EBULL;
+    rng_state = (rng_state ^ (rng_state >> 31)) | 1;
+
+    gw_untracked.used = true;
+    gw_untracked.mac = 0;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    now = now_ms();
+    wheel_init(now);
+    next_report = now + 1000 * (uint64_t)report_s;
+
     while (1) {
-        /* wait to receive a packet */
-        byte_nb = recvfrom(sock, databuf, sizeof databuf, 0, (struct sockaddr *)&dist_addr, &addr_len);
-        if (byte_nb == -1) {
-            MSG("ERROR: recvfrom returned %s \n", strerror(errno));
-            exit(EXIT_FAILURE);
+        /* wait for a packet, or for the next ms if acknowledges are waiting */
+        if (wheel_count > 0) {
+            timeout = 1;
+        } else if (report_s > 0) {
+            timeout = (next_report > now) ? (int)(next_report - now) : 0;
+        } else {
+            timeout = -1;
         }
-
-        /* display info about the sender */
-        i = getnameinfo((struct sockaddr *)&dist_addr, addr_len, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
-        if (i == -1) {
-            MSG("ERROR: getnameinfo returned %s \n", gai_strerror(i));
+        if ((poll(&pfd, 1, timeout) == -1) && (errno != EINTR)) {
+            MSG("ERROR: poll returned %s \n", strerror(errno));
             exit(EXIT_FAILURE);
         }
-        printf(" -> pkt in , host %s (port %s), %i bytes", host_name, port_name, byte_nb);
+        now = now_ms();
 
-        /* check and parse the payload */
-        if (byte_nb < 12) { /* not enough bytes for packet from gateway */
-            printf(" (too short for GW <-> MAC protocol)\n");
-            continue;
-        }
-        /* don't touch the token in position 1-2, it will be sent back "as is" for acknowledgement */
-        if (databuf[0] != PROTOCOL_VERSION) { /* check protocol version number */
-            printf(", invalid version %u\n", databuf[0]);
-            continue;
-        }
-        raw_mac_h = *((uint32_t *)(databuf+4));
-        raw_mac_l = *((uint32_t *)(databuf+8));
-        gw_mac = ((uint64_t)ntohl(raw_mac_h) << 32) + (uint64_t)ntohl(raw_mac_l);
-
-        /* interpret gateway command */
-        switch (databuf[3]) {
-            case PKT_PUSH_DATA:
-                printf(", PUSH_DATA from gateway 0x%08X%08X\n", (uint32_t)(gw_mac >> 32), (uint32_t)(gw_mac & 0xFFFFFFFF));
-                ack_command = PKT_PUSH_ACK;
-                printf("<-  pkt out, PUSH_ACK for host %s (port %s)", host_name, port_name);
+        /* take the packets received, a burst must not delay the acknowledges too long */
+        for (i = 0; i < ACK_RECV_BATCH; i++) {
+            addr_len = sizeof dist_addr;
+            byte_nb = recvfrom(sock, databuf, sizeof databuf, MSG_DONTWAIT, (struct sockaddr *)&dist_addr, &addr_len);
+            if (byte_nb == -1) {
+                if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                    MSG("ERROR: recvfrom returned %s \n", strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
                 break;
-            case PKT_PULL_DATA:
-                printf(", PULL_DATA from gateway 0x%08X%08X\n", (uint32_t)(gw_mac >> 32), (uint32_t)(gw_mac & 0xFFFFFFFF));
-                ack_command = PKT_PULL_ACK;
-                printf("<-  pkt out, PULL_ACK for host %s (port %s)", host_name, port_name);
-                break;
-            default:
-                printf(", unexpected command %u\n", databuf[3]);
+            }
+
+            /* display info about the sender */
+            if (verbose) {
+                getnameinfo((struct sockaddr *)&dist_addr, addr_len, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
+                printf(" -> pkt in , host %s (port %s), %i bytes", host_name, port_name, byte_nb);
+            }
+
+            /* check and parse the payload */
+            if (byte_nb < 12) { /* not enough bytes for packet from gateway */
+                nb_invalid += 1;
+                if (verbose) {
+                    printf(" (too short for GW <-> MAC protocol)\n");
+                }
+                continue;
+            }
+            /* don't touch the token in position 1-2, it will be sent back "as is" for acknowledgement */
+            if (databuf[0] != PROTOCOL_VERSION) { /* check protocol version number */
+                nb_invalid += 1;
+                if (verbose) {
+                    printf(", invalid version %u\n", databuf[0]);
+                }
+                continue;
+            }
+            memcpy(&raw_mac_h, databuf + 4, sizeof raw_mac_h);
+            memcpy(&raw_mac_l, databuf + 8, sizeof raw_mac_l);
+            gw_mac = ((uint64_t)ntohl(raw_mac_h) << 32) + (uint64_t)ntohl(raw_mac_l);
+
+            /* interpret gateway command */
+            switch (databuf[3]) {
+                case PKT_PUSH_DATA:
+                    ack_command = PKT_PUSH_ACK;
+                    break;
+                case PKT_PULL_DATA:
+                    ack_command = PKT_PULL_ACK;
+                    break;
+                default:
+                    nb_invalid += 1;
+                    if (verbose) {
+                        printf(", unexpected command %u\n", databuf[3]);
+                    }
+                    continue;
+            }
+            if (verbose) {
+                printf(", %s from gateway 0x%08X%08X\n", (ack_command == PKT_PUSH_ACK) ? "PUSH_DATA" : "PULL_DATA",
+                       (uint32_t)(gw_mac >> 32), (uint32_t)(gw_mac & 0xFFFFFFFF));
+            }
+            gw = gw_lookup(gw_mac);
+            if (gw == NULL) {
+                gw = &gw_untracked;
+            }
+            gw->nb_push += (ack_command == PKT_PUSH_ACK) ? 1 : 0;
+            gw->nb_pull += (ack_command == PKT_PULL_ACK) ? 1 : 0;
+
+            /* emulate the backhaul, all draws are made for every datagram so that a seed gives the same sequence */
+            lost = (rng_uniform() < loss_prob);
+            reorder = (rng_uniform() < reorder_prob);
+            dup = (rng_uniform() < dup_prob);
+            delay = draw_latency();
+            delay += reorder ? draw_latency() : 0;
+            dup_delay = draw_latency();
+            databuf[3] = ack_command;
+            if (lost) {
+                gw->nb_lost += 1;
                 continue;
+            }
+            if (schedule_ack(databuf, &dist_addr, addr_len, gw, delay, now) != 0) {
+                gw->nb_overflow += 1;
+                continue;
+            }
+            gw->nb_reorder += reorder ? 1 : 0;
+            if (dup) {
+                if (schedule_ack(databuf, &dist_addr, addr_len, gw, dup_delay, now) != 0) {
+                    gw->nb_overflow += 1;
+                } else {
+                    gw->nb_dup += 1;
+                }
+            }
         }
 
-        /* add some artificial latency */
-        usleep(30000); /* 30 ms */
+        /* send the acknowledges due */
+        run_timers(sock, now);
 
-        /* send acknowledge and check return value */
-        databuf[3] = ack_command;
-        byte_nb = sendto(sock, (void *)databuf, 4, 0, (struct sockaddr *)&dist_addr, addr_len);
-        if (byte_nb == -1) {
-            printf(", send error:%s\n", strerror(errno));
-        } else {
-            printf(", %i bytes sent\n", byte_nb);
+        if ((report_s > 0) && (now >= next_report)) {
+            report();
+            next_report += 1000 * (uint64_t)report_s;
         }
     }
 }
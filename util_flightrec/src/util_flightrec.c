@@ -0,0 +1,382 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    Flight recorder decoder
+    Prints the events recorded by the packet forwarder flight recorder, oldest
+    first, as one line of text per event, and benchmarks the recorder
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen, fread */
+#include <unistd.h>     /* getopt */
+
+#include <string.h>     /* memcmp, strcmp, strerror */
+#include <errno.h>      /* error messages */
+#include <time.h>       /* gmtime_r, strftime */
+#include <stdlib.h>     /* exit codes, malloc, strtoul */
+
+#include "flightrec.h"
+#include "jitqueue.h"
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_SIZE(a)   (sizeof(a) / sizeof((a)[0]))
+#define MSG(args...)    fprintf(stderr, args) /* message that is destined to the user */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define FR_TYPE_NB      (FLIGHTREC_GPS_VALID + 1)
+#define FR_JIT_ERROR_NB (JIT_ERROR_INVALID + 1)
+#define FR_CLASS_NB     (JIT_PKT_TYPE_BEACON + 1)
+
+#define BENCH_MAX_NS    1000    /* recording an event must cost less than 1 us */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static const char * type_name[FR_TYPE_NB] = {"?", "RX", "ENQUEUE", "PEEK", "DEQUEUE", "SEND", "TIMERSYNC", "GPS_SYNC", "GPS_VALID"};
+static const char * error_name[FR_JIT_ERROR_NB] = {"OK", "TOO_LATE", "TOO_EARLY", "FULL", "EMPTY",
+    "COLLISION_PACKET", "COLLISION_BEACON", "TX_FREQ", "TX_POWER", "GPS_UNLOCKED", "DUTY_CYCLE", "INVALID"};
+static const char * class_name[FR_CLASS_NB] = {"A", "B", "C", "BEACON"};
+static const char * tx_status_name[] = {"UNKNOWN", "OFF", "FREE", "SCHEDULED", "EMITTING"};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+void usage(void);
+
+static const char * jit_error_str(uint8_t code);
+
+static const char * crc_str(uint8_t status);
+
+static int sf_of(uint32_t datarate);
+
+static int bw_khz_of(uint32_t bw);
+
+static void print_event(uint32_t idx, const struct flightrec_record_s *rec);
+
+static struct flightrec_record_s * read_log(const char *path, struct flightrec_header_s *hdr);
+
+static uint32_t kept_events(const struct flightrec_header_s *hdr, const struct flightrec_record_s *records);
+
+static int bench_record(const char *path, uint32_t nb_events);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+void usage(void) {
+    MSG("Usage: util_flightrec {options} <log file>\n");
+    MSG("Available options:\n");
+    MSG(" -h print this help\n");
+    MSG(" -n <uint> only print the last n events\n");
+    MSG(" -t <name> only print events of a type (RX, ENQUEUE, PEEK, DEQUEUE, SEND, TIMERSYNC, GPS_SYNC, GPS_VALID)\n");
+    MSG(" -B <uint> record that many events in a new log file, measure the cost per event and check the log\n");
+}
+
+static const char * jit_error_str(uint8_t code) {
+    return (code < FR_JIT_ERROR_NB) ? error_name[code] : "?";
+}
+
+static const char * crc_str(uint8_t status) {
+    switch (status) {
+        case STAT_CRC_OK:   return "OK";
+        case STAT_CRC_BAD:  return "BAD";
+        case STAT_NO_CRC:   return "NOCRC";
+        default:            return "?";
+    }
+}
+
+static int sf_of(uint32_t datarate) {
+    switch (datarate) {
+        case DR_LORA_SF7:   return 7;
+        case DR_LORA_SF8:   return 8;
+        case DR_LORA_SF9:   return 9;
+        case DR_LORA_SF10:  return 10;
+        case DR_LORA_SF11:  return 11;
+        case DR_LORA_SF12:  return 12;
+        default:            return -1;
+    }
+}
+
+static int bw_khz_of(uint32_t bw) {
+    switch (bw) {
+        case BW_125KHZ: return 125;
+        case BW_250KHZ: return 250;
+        case BW_500KHZ: return 500;
+        default:        return -1;
+    }
+}
+
+static void print_event(uint32_t idx, const struct flightrec_record_s *rec) {
+    struct tm t;
+    time_t sec = (time_t)(rec->time_ns / 1000000000ULL);
+    char date[32];
+
+    gmtime_r(&sec, &t);
+    strftime(date, sizeof date, "%F %T", &t);
+    printf("%s.%06u  #%-10u %-9s", date, (unsigned)((rec->time_ns % 1000000000ULL) / 1000), idx, (rec->type < FR_TYPE_NB) ? type_name[rec->type] : "?");
+
+    switch (rec->type) {
+        case FLIGHTREC_RX:
+            printf(" count_us=%u freq=%.4f chan=%u ", rec->count_us, rec->freq_hz / 1E6, FLIGHTREC_RX_CHAN(rec->arg2));
+            if (FLIGHTREC_RX_FSK(rec->arg2)) {
+                printf("FSK%u", rec->arg1);
+            } else {
+                printf("SF%dBW%d", sf_of(rec->arg1), bw_khz_of(FLIGHTREC_RX_BW(rec->arg2)));
+            }
+            printf(" rssi=%.1f snr=%.2f size=%u crc=%s\n", FLIGHTREC_RX_RSSI(rec->arg2) / 10.0, FLIGHTREC_RX_SNR(rec->arg2) / 4.0, rec->size, crc_str(rec->code));
+            break;
+        case FLIGHTREC_ENQUEUE:
+            printf(" count_us=%u freq=%.4f class=%s size=%u now=%u (%+.3f s) result=%s\n", rec->count_us, rec->freq_hz / 1E6,
+                   (rec->arg1 < FR_CLASS_NB) ? class_name[rec->arg1] : "?", rec->size, rec->arg2,
+                   (int32_t)(rec->count_us - rec->arg2) / 1E6, jit_error_str(rec->code));
+            break;
+        case FLIGHTREC_PEEK:
+            printf(" now=%u index=%d result=%s\n", rec->count_us, (int32_t)rec->arg1, jit_error_str(rec->code));
+            break;
+        case FLIGHTREC_DEQUEUE:
+            printf(" count_us=%u freq=%.4f class=%s size=%u index=%u result=%s\n", rec->count_us, rec->freq_hz / 1E6,
+                   (rec->arg1 < FR_CLASS_NB) ? class_name[rec->arg1] : "?", rec->size, rec->arg2, jit_error_str(rec->code));
+            break;
+        case FLIGHTREC_SEND:
+            printf(" count_us=%u freq=%.4f size=%u power=%d tx_status=%s result=%s\n", rec->count_us, rec->freq_hz / 1E6, rec->size,
+                   (int8_t)rec->arg2, (rec->arg1 < ARRAY_SIZE(tx_status_name)) ? tx_status_name[rec->arg1] : "?",
+                   (rec->code == 0) ? "OK" : "FAILED");
+            break;
+        case FLIGHTREC_TIMERSYNC:
+            printf(" count_us=%u drift=%.3f ppm residual=%.3f us samples=%u\n", rec->count_us, (int32_t)rec->arg1 / 1E3, rec->arg2 / 1E3, rec->size);
+            break;
+        case FLIGHTREC_GPS_SYNC:
+            printf(" count_us=%u utc=%u xtal_err=%+.3f ppm result=%s\n", rec->count_us, rec->arg1, (int32_t)rec->arg2 / 1E3,
+                   (rec->code == 0) ? "OK" : "OUT_OF_SYNC");
+            break;
+        case FLIGHTREC_GPS_VALID:
+            printf(" count_us=%u reference %s\n", rec->count_us, (rec->code != 0) ? "VALID" : "INVALID");
+            break;
+        default:
+            printf(" code=%u size=%u count_us=%u freq_hz=%u arg1=%u arg2=%u\n", rec->code, rec->size, rec->count_us, rec->freq_hz, rec->arg1, rec->arg2);
+            break;
+    }
+}
+
+/* Read and check the header and the records of a log, records are allocated */
+static struct flightrec_record_s * read_log(const char *path, struct flightrec_header_s *hdr) {
+    FILE *f;
+    struct flightrec_record_s *records;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        MSG("ERROR: failed to open %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fread(hdr, sizeof *hdr, 1, f) != 1) {
+        MSG("ERROR: %s is too short to be a flight recorder log\n", path);
+        fclose(f);
+        return NULL;
+    }
+    if (memcmp(hdr->magic, FLIGHTREC_MAGIC, sizeof FLIGHTREC_MAGIC) != 0) {
+        MSG("ERROR: %s is not a flight recorder log\n", path);
+        fclose(f);
+        return NULL;
+    }
+    if ((hdr->version != FLIGHTREC_VERSION) || (hdr->header_size != sizeof *hdr) || (hdr->record_size != sizeof(struct flightrec_record_s))
+        || (hdr->nb_records == 0) || ((hdr->nb_records & (hdr->nb_records - 1)) != 0) || (hdr->nb_records > FLIGHTREC_MAX_SIZE)) {
+        MSG("ERROR: unsupported flight recorder log (version %u), or log written on a host of different byte order\n", hdr->version);
+        fclose(f);
+        return NULL;
+    }
+
+    records = malloc((size_t)hdr->nb_records * sizeof *records);
+    if (records == NULL) {
+        MSG("ERROR: failed to allocate memory for %u records\n", hdr->nb_records);
+        fclose(f);
+        return NULL;
+    }
+    if (fread(records, sizeof *records, hdr->nb_records, f) != hdr->nb_records) {
+        MSG("ERROR: %s is truncated\n", path);
+        free(records);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    return records;
+}
+
+/* Events still in the log: all of them, unless the log did not wrap (index itself wraps after 2^32 events) */
+static uint32_t kept_events(const struct flightrec_header_s *hdr, const struct flightrec_record_s *records) {
+    if ((hdr->write_idx < hdr->nb_records) && (records[hdr->nb_records - 1].seq == 0)) {
+        return hdr->write_idx;
+    } else {
+        return hdr->nb_records;
+    }
+}
+
+/* Record events as fast as possible in a log of default size, then read the log back and check every event kept */
+static int bench_record(const char *path, uint32_t nb_events) {
+    struct flightrec_header_s hdr;
+    struct flightrec_record_s *records;
+    const struct flightrec_record_s *rec;
+    struct timespec start, end;
+    uint32_t idx, nb_kept, nb_bad = 0;
+    double ns;
+
+    if (flightrec_open(path, FLIGHTREC_DEFAULT_SIZE, 0) != 0) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (idx = 0; idx < nb_events; idx++) {
+        flightrec_log(FLIGHTREC_RX, STAT_CRC_OK, (uint16_t)idx, idx, 868100000, DR_LORA_SF7, FLIGHTREC_RX_ARG2(-870, 37, BW_125KHZ, 0, idx & 0x7));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    flightrec_flush();
+    ns = (1E9 * (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)) / nb_events;
+
+    records = read_log(path, &hdr);
+    if (records == NULL) {
+        return -1;
+    }
+    nb_kept = kept_events(&hdr, records);
+    for (idx = hdr.write_idx - nb_kept; idx != hdr.write_idx; idx++) {
+        rec = &records[idx & (hdr.nb_records - 1)];
+        if ((rec->seq != (idx + 1)) || (rec->type != FLIGHTREC_RX) || (rec->size != (uint16_t)idx) || (rec->count_us != idx)
+            || (rec->arg1 != DR_LORA_SF7) || (FLIGHTREC_RX_RSSI(rec->arg2) != -870) || (FLIGHTREC_RX_CHAN(rec->arg2) != (idx & 0x7))) {
+            nb_bad += 1;
+        }
+    }
+    free(records);
+
+    MSG("INFO: %u events recorded in %.1f ns each (%u max), %u kept in the log, %u not intact\n", nb_events, ns, BENCH_MAX_NS, nb_kept, nb_bad);
+    if ((hdr.write_idx != nb_events) || (nb_kept != ((nb_events < hdr.nb_records) ? nb_events : hdr.nb_records)) || (nb_bad > 0) || (ns > BENCH_MAX_NS)) {
+        MSG("FAIL\n");
+        return -1;
+    }
+    MSG("PASS\n");
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    int i;
+    struct flightrec_header_s hdr;
+    struct flightrec_record_s *records;
+    uint32_t nb_events, first, idx, last = 0;
+    uint32_t nb_torn = 0;
+    int type_filter = 0;
+    uint32_t bench_events = 0;
+    time_t open_sec;
+    char date[32];
+    struct tm t;
+
+    while ((i = getopt (argc, argv, "hn:t:B:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+
+            case 'n': /* -n <uint> only print the last n events */
+                last = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+
+            case 't': /* -t <name> only print events of a type */
+                for (type_filter = 1; type_filter < FR_TYPE_NB; type_filter++) {
+                    if (strcmp(optarg, type_name[type_filter]) == 0) {
+                        break;
+                    }
+                }
+                if (type_filter == FR_TYPE_NB) {
+                    MSG("ERROR: unknown event type %s\n", optarg);
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'B': /* -B <uint> benchmark the recorder with that many events */
+                bench_events = (uint32_t)strtoul(optarg, NULL, 10);
+                if (bench_events == 0) {
+                    MSG("ERROR: invalid number of events\n");
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            default:
+                MSG("ERROR: argument parsing options, use -h option for help\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != (argc - 1)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (bench_events > 0) {
+        return (bench_record(argv[optind], bench_events) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* read and check log */
+    records = read_log(argv[optind], &hdr);
+    if (records == NULL) {
+        return EXIT_FAILURE;
+    }
+    nb_events = kept_events(&hdr, records);
+    if ((last > 0) && (last < nb_events)) {
+        nb_events = last;
+    }
+    first = hdr.write_idx - nb_events;
+
+    open_sec = (time_t)(hdr.open_time_ns / 1000000000ULL);
+    gmtime_r(&open_sec, &t);
+    strftime(date, sizeof date, "%F %T", &t);
+    MSG("INFO: gateway %016llX, log started %s UTC, %u events recorded, %u kept\n", (unsigned long long)hdr.gateway_id, date, hdr.write_idx,
+        (hdr.write_idx < hdr.nb_records) ? hdr.write_idx : hdr.nb_records);
+
+    /* print events, oldest first */
+    for (idx = first; idx != hdr.write_idx; idx++) {
+        const struct flightrec_record_s *rec = &records[idx & (hdr.nb_records - 1)];
+        if (rec->seq != (idx + 1)) {
+            /* event was being recorded when the process stopped, or overwritten by a more recent one */
+            nb_torn += 1;
+            continue;
+        }
+        if ((type_filter != 0) && (rec->type != type_filter)) {
+            continue;
+        }
+        print_event(idx, rec);
+    }
+    if (nb_torn > 0) {
+        MSG("WARNING: %u incomplete events skipped\n", nb_torn);
+    }
+
+    free(records);
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,931 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    GPS serial replay tool
+    Feeds a GPS serial capture (UBX and NMEA) through the packet forwarder GPS
+    pipeline, with a simulated concentrator counter, and checks the resulting
+    time references
+    Stress test of the GPS time reference sequence lock
+    Replay of XTAL error series through the XTAL correction estimator
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#define _GNU_SOURCE     /* posix_openpt, cfmakeraw */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen, fwrite */
+#include <unistd.h>     /* getopt, read, write */
+
+#include <string.h>     /* memset, strerror */
+#include <time.h>       /* clock_gettime, gmtime */
+#include <stdlib.h>     /* exit codes, posix_openpt */
+#include <math.h>       /* floor, fabs */
+#include <errno.h>      /* errno */
+#include <fcntl.h>      /* open */
+#include <termios.h>    /* tcgetattr, tcsetattr, cfmakeraw */
+#include <pthread.h>
+#include <sys/stat.h>   /* fstat */
+
+#include "gpsframe.h"
+#include "gpsproc.h"
+#include "timeref.h"
+#include "xtalcorr.h"
+#include "loragw_gps.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define MSG(args...)    fprintf(stderr, args) /* message that is destined to the user */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define GPS_SERIAL_VMIN     255         /* same serial settings as thread_gps */
+#define GPS_SERIAL_VTIME    1
+
+#define UNIX_GPS_EPOCH_OFFSET 315964800 /* Number of seconds ellapsed between 01.Jan.1970 00:00:00 and 06.Jan.1980 00:00:00 */
+#define GEN_START_UNIX      1496275200  /* generated captures start on 01.Jun.2017 00:00:00 UTC */
+#define GEN_LEAP_SECONDS    18          /* GPS-UTC offset at that date */
+
+#define CHECK_AHEAD_NS      500000000   /* conversion check is done half a second after the PPS */
+#define CHECK_MAX_CNT_ERR   2           /* max error on converted counter value, in µs */
+#define CHECK_MAX_XTAL_ERR  2E-6        /* max error on XTAL error estimated by the HAL */
+#define CHECK_MAX_REPORTED  10          /* max number of failed checks detailed */
+
+#define PACE_PERIOD_MS      10          /* pseudo-terminal writer pacing period */
+
+#define STRESS_READERS_MAX  64          /* time reference reader threads of the stress test */
+#define STRESS_DURATION_MS  2000        /* duration of the stress test */
+
+#define XERR_INIT_AVG       128         /* former XTAL correction: nb of measurements averaged as initial value */
+#define XERR_FILT_COEF      256         /* former XTAL correction: coefficient for low-pass tracking */
+#define XREPLAY_STEADY      600         /* steady-state error is measured from that sample on */
+#define XREPLAY_TRUTH_HALF  300         /* half window of the moving average used as reference, if none recorded */
+#define XREPLAY_MARGIN      1.05        /* Kalman steady-state error must be within 5% of the former one */
+#define XGEN_DRIFT_PPM      0.5         /* generated series: thermal drift amplitude */
+#define XGEN_DRIFT_PERIOD   3600.0      /* generated series: thermal drift period, in seconds */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+/* replay parameters */
+static double xtal_ppm = 0.0;       /* simulated concentrator XTAL error */
+static uint32_t start_count = 0;    /* simulated concentrator counter value on first PPS */
+static bool use_pty = false;        /* replay through a pseudo-terminal instead of reading the file */
+static unsigned baudrate = 0;       /* pseudo-terminal pacing, 0 for none */
+static uint64_t prng_state = 1;     /* random generator state (seed) */
+static double pps_jitter = 0.3;     /* generated XTAL error series: PPS jitter standard deviation, in µs */
+static double xcorr_max_stddev = XCORR_DEFAULT_MAX_STDDEV; /* XTAL correction precision required, in ppm */
+
+/* simulated concentrator counter */
+static bool gps0_valid = false;
+static struct timespec gps0;        /* GPS time of the first PPS */
+
+/* pseudo-terminal writer */
+static int pty_master = -1;
+static int replay_fd = -1;
+static off_t replay_size = 0;
+
+/* GPS time reference and gateway position, as in thread_gps */
+static struct timeref_s replay_timeref;
+static pthread_mutex_t mx_replay_pos = PTHREAD_MUTEX_INITIALIZER;
+static struct gps_pos_s replay_pos;
+
+/* GPS time reference stress test */
+static struct timeref_s stress_timeref_gps;
+static bool stress_stop = false;    /* accessed with __atomic builtins */
+
+/* statistics */
+static uint32_t nb_ubx_timegps = 0;
+static uint32_t nb_nmea_rmc = 0;
+static uint32_t nb_coords = 0;
+static uint32_t nb_sync_ok = 0;
+static uint32_t nb_sync_failed = 0;
+static uint32_t nb_check_ok = 0;
+static uint32_t nb_check_failed = 0;
+static double cnt_err_max = 0.0;
+static double xtal_err_max = 0.0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+void usage(void);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* describe command line options */
+void usage(void) {
+    MSG("Usage: util_gps_replay {options} <capture file>\n");
+    MSG("Available options:\n");
+    MSG(" -h print this help\n");
+    MSG(" -g <uint> generate a capture of that many seconds in the capture file, instead of replaying it\n");
+    MSG(" -e <float> ratio of generated frames corrupted by a random byte [0:1] (default 0)\n");
+    MSG(" -s <uint> random generator seed (default 1)\n");
+    MSG(" -x <float> simulated concentrator XTAL error in ppm (default 0)\n");
+    MSG(" -t <uint> simulated concentrator counter value on first PPS, in µs (default 0)\n");
+    MSG(" -p replay through a pseudo-terminal, with thread_gps serial settings\n");
+    MSG(" -b <uint> pseudo-terminal pacing in baud (default none)\n");
+    MSG(" -T <uint> stress the time reference sequence lock with that many reader threads, no capture file\n");
+    MSG(" -X <path> replay an XTAL error series through the XTAL correction estimator, or generate it with -g\n");
+    MSG(" -j <float> generated XTAL error series: PPS jitter standard deviation in µs (default 0.3)\n");
+    MSG(" -d <float> XTAL correction standard deviation required to use it, in ppm (default %.3f)\n", XCORR_DEFAULT_MAX_STDDEV);
+}
+
+/* xorshift64* pseudo random generator, for reproducible runs */
+static uint64_t prng_next(void) {
+    prng_state ^= prng_state >> 12;
+    prng_state ^= prng_state << 25;
+    prng_state ^= prng_state >> 27;
+    return prng_state * 2685821657736338717ULL;
+}
+
+/* uniform in [0:1) */
+static double prng_uniform(void) {
+    return (double)(prng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* standard normal distribution (Box-Muller) */
+static double prng_normal(void) {
+    double u = prng_uniform();
+
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * prng_uniform());
+}
+
+static double timespec_diff(struct timespec end, struct timespec beginning) {
+    return (double)(end.tv_sec - beginning.tv_sec) + 1E-9 * (double)(end.tv_nsec - beginning.tv_nsec);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- CAPTURE GENERATION --------------------------------------------------- */
+
+/* corrupt one random byte of a frame, with the configured probability */
+static void gen_write(FILE *f, uint8_t *frame, size_t size, double err_ratio) {
+    if ((err_ratio > 0.0) && (prng_uniform() < err_ratio)) {
+        frame[(size_t)(prng_uniform() * (double)size)] ^= (uint8_t)(1 + (prng_next() % 255));
+    }
+    fwrite(frame, 1, size, f);
+}
+
+static size_t gen_nmea(uint8_t *buf, size_t max, const char *body) {
+    uint8_t checksum = 0;
+    const char *p;
+
+    for (p = body; *p != '\0'; ++p) {
+        checksum ^= (uint8_t)*p;
+    }
+    return (size_t)snprintf((char *)buf, max, "$%s*%02X\r\n", body, checksum);
+}
+
+static size_t gen_ubx_timegps(uint8_t *buf, uint32_t gps_sec) {
+    uint32_t itow = (gps_sec % 604800) * 1000;
+    uint16_t week = (uint16_t)(gps_sec / 604800);
+    uint32_t tacc = 20;
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+    int i;
+
+    buf[0] = 0xB5;
+    buf[1] = 0x62;
+    buf[2] = 0x01; /* NAV */
+    buf[3] = 0x20; /* TIMEGPS */
+    buf[4] = 16;
+    buf[5] = 0;
+    for (i = 0; i < 4; ++i) { /* UBX fields are little endian */
+        buf[6 + i] = (uint8_t)(itow >> (8 * i));
+        buf[10 + i] = 0; /* fTOW */
+        buf[18 + i] = (uint8_t)(tacc >> (8 * i));
+    }
+    buf[14] = (uint8_t)week;
+    buf[15] = (uint8_t)(week >> 8);
+    buf[16] = GEN_LEAP_SECONDS;
+    buf[17] = 0x07; /* towValid, weekValid, leapSValid */
+    for (i = 2; i < 22; ++i) {
+        ck_a += buf[i];
+        ck_b += ck_a;
+    }
+    buf[22] = ck_a;
+    buf[23] = ck_b;
+    return 24;
+}
+
+/* one burst per second, as a u-blox 7 configured by the HAL: NMEA sentences, then UBX NAV-TIMEGPS */
+static int generate(const char *path, unsigned duration, double err_ratio) {
+    FILE *f;
+    uint8_t frame[128];
+    char body[96];
+    size_t size;
+    unsigned i;
+    time_t t;
+    struct tm *utc;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        MSG("ERROR: failed to create %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < duration; ++i) {
+        t = GEN_START_UNIX + i;
+        utc = gmtime(&t);
+
+        snprintf(body, sizeof body, "GPRMC,%02d%02d%02d.00,A,4330.1234,N,00125.5678,E,0.012,,%02d%02d%02d,,,A", utc->tm_hour, utc->tm_min, utc->tm_sec, utc->tm_mday, utc->tm_mon + 1, utc->tm_year % 100);
+        size = gen_nmea(frame, sizeof frame, body);
+        gen_write(f, frame, size, err_ratio);
+
+        snprintf(body, sizeof body, "GPGGA,%02d%02d%02d.00,4330.1234,N,00125.5678,E,1,09,0.98,153.2,M,49.5,M,,", utc->tm_hour, utc->tm_min, utc->tm_sec);
+        size = gen_nmea(frame, sizeof frame, body);
+        gen_write(f, frame, size, err_ratio);
+
+        size = gen_nmea(frame, sizeof frame, "GPGSA,A,3,05,07,09,13,15,20,21,28,30,,,,1.71,0.98,1.40");
+        gen_write(f, frame, size, err_ratio);
+
+        size = gen_ubx_timegps(frame, (uint32_t)(t - UNIX_GPS_EPOCH_OFFSET + GEN_LEAP_SECONDS));
+        gen_write(f, frame, size, err_ratio);
+    }
+    fclose(f);
+    MSG("INFO: %u seconds of GPS serial data written to %s\n", duration, path);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- SIMULATED CONCENTRATOR ----------------------------------------------- */
+
+/* counter value the concentrator would have at a given GPS time */
+static uint32_t sim_count(struct timespec gps_time) {
+    double elapsed = timespec_diff(gps_time, gps0);
+
+    return start_count + (uint32_t)(int64_t)floor(elapsed * 1E6 * (1.0 + xtal_ppm / 1E6));
+}
+
+/* replaces lgw_get_trigcnt: counter value captured on the PPS of the GPS time being processed */
+static int sim_get_trigcnt(struct timespec gps_time, uint32_t *trig_tstamp) {
+    if (gps0_valid == false) {
+        gps0 = gps_time;
+        gps0_valid = true;
+    }
+    *trig_tstamp = sim_count(gps_time);
+    return 0;
+}
+
+/* check the time reference against the simulated concentrator */
+static void check_tref(const struct tref *ref, struct timespec gps_time, uint32_t trig_tstamp) {
+    struct timespec later;
+    struct timespec utc;
+    uint32_t cnt;
+    double cnt_err;
+    double xtal_err;
+    bool ok = true;
+
+    /* GPS time -> counter, away from the reference point so that the XTAL error matters */
+    later = gps_time;
+    later.tv_nsec += CHECK_AHEAD_NS;
+    if (lgw_gps2cnt(*ref, later, &cnt) != LGW_GPS_SUCCESS) {
+        MSG("WARNING: lgw_gps2cnt failed for GPS time %ld\n", (long)gps_time.tv_sec);
+        ok = false;
+    } else {
+        cnt_err = fabs((double)(int32_t)(cnt - sim_count(later)));
+        if (cnt_err > cnt_err_max) {
+            cnt_err_max = cnt_err;
+        }
+        if (cnt_err > CHECK_MAX_CNT_ERR) {
+            if (nb_check_failed < CHECK_MAX_REPORTED) {
+                MSG("WARNING: GPS time %ld converted to counter %u, expected %u\n", (long)later.tv_sec, cnt, sim_count(later));
+            }
+            ok = false;
+        }
+    }
+
+    /* counter -> UTC must give back the reference */
+    if (lgw_cnt2utc(*ref, trig_tstamp, &utc) != LGW_GPS_SUCCESS) {
+        MSG("WARNING: lgw_cnt2utc failed for counter %u\n", trig_tstamp);
+        ok = false;
+    } else if (fabs(timespec_diff(utc, ref->utc)) > 1E-6) {
+        if (nb_check_failed < CHECK_MAX_REPORTED) {
+            MSG("WARNING: counter %u converted to UTC %ld.%09ld, expected %ld.%09ld\n", trig_tstamp, (long)utc.tv_sec, utc.tv_nsec, (long)ref->utc.tv_sec, ref->utc.tv_nsec);
+        }
+        ok = false;
+    }
+
+    /* XTAL error, estimated by the HAL on consecutive syncs */
+    xtal_err = fabs(ref->xtal_err - (1.0 + xtal_ppm / 1E6));
+    if (xtal_err > xtal_err_max) {
+        xtal_err_max = xtal_err;
+    }
+    if (xtal_err > CHECK_MAX_XTAL_ERR) {
+        if (nb_check_failed < CHECK_MAX_REPORTED) {
+            MSG("WARNING: XTAL error %.9f, expected %.9f\n", ref->xtal_err, 1.0 + xtal_ppm / 1E6);
+        }
+        ok = false;
+    }
+
+    if (ok == true) {
+        nb_check_ok += 1;
+    } else {
+        nb_check_failed += 1;
+    }
+}
+
+/* same processing as thread_gps, with a simulated trigger counter */
+static void replay_sync(void) {
+    struct gps_sync_s sync;
+
+    /* the HAL ignores (and reports as failed) syncs giving an aberrant XTAL error, until it re-locks */
+    if (gps_process_sync(&replay_timeref, sim_get_trigcnt, &sync) != GPS_SYNC_OK) {
+        nb_sync_failed += 1;
+        return;
+    }
+    nb_sync_ok += 1;
+    check_tref(&sync.ref, sync.gps_time, sync.trig_tstamp);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PSEUDO-TERMINAL WRITER ----------------------------------------------- */
+
+static void *pty_writer(void *arg) {
+    uint8_t buff[4096];
+    size_t chunk = sizeof buff;
+    ssize_t nb_read, nb_written, n;
+    struct timespec period = {0, PACE_PERIOD_MS * 1000000};
+
+    (void)arg;
+    if (baudrate > 0) {
+        /* 10 bits per char on the serial line */
+        chunk = baudrate / 10 / (1000 / PACE_PERIOD_MS);
+        if (chunk == 0) {
+            chunk = 1;
+        } else if (chunk > sizeof buff) {
+            chunk = sizeof buff;
+        }
+    }
+    while ((nb_read = read(replay_fd, buff, chunk)) > 0) {
+        for (nb_written = 0; nb_written < nb_read; nb_written += n) {
+            n = write(pty_master, buff + nb_written, nb_read - nb_written);
+            if (n < 0) {
+                MSG("ERROR: write to pseudo-terminal failed (%s)\n", strerror(errno));
+                return NULL;
+            }
+        }
+        if (baudrate > 0) {
+            nanosleep(&period, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* open a pseudo-terminal, with the same serial settings as thread_gps on the slave side */
+static int pty_open(void) {
+    int fd;
+    struct termios ttyopt;
+
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((pty_master < 0) || (grantpt(pty_master) != 0) || (unlockpt(pty_master) != 0)) {
+        MSG("ERROR: failed to create pseudo-terminal (%s)\n", strerror(errno));
+        return -1;
+    }
+    fd = open(ptsname(pty_master), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        MSG("ERROR: failed to open %s (%s)\n", ptsname(pty_master), strerror(errno));
+        return -1;
+    }
+    if (tcgetattr(fd, &ttyopt) != 0) {
+        MSG("ERROR: failed to get pseudo-terminal settings (%s)\n", strerror(errno));
+        return -1;
+    }
+    cfmakeraw(&ttyopt);
+    ttyopt.c_cc[VMIN] = GPS_SERIAL_VMIN;
+    ttyopt.c_cc[VTIME] = GPS_SERIAL_VTIME;
+    if (tcsetattr(fd, TCSANOW, &ttyopt) != 0) {
+        MSG("ERROR: failed to set pseudo-terminal settings (%s)\n", strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- TIME REFERENCE STRESS TEST ------------------------------------------- */
+
+struct stress_reader_s {
+    pthread_t thread;
+    uint64_t nb_read;
+    uint64_t nb_torn;
+    uint64_t nb_backwards;
+};
+
+/* Every field of reference n is derived from n, so that a torn copy can be detected */
+static void stress_fill(struct tref *ref, uint64_t n) {
+    memset(ref, 0, sizeof *ref);
+    ref->systime = (time_t)n;
+    ref->count_us = (uint32_t)(n * 1000003ULL);
+    ref->utc.tv_sec = (time_t)(n + 1);
+    ref->utc.tv_nsec = (long)(n % 1000000000ULL);
+    ref->gps.tv_sec = (time_t)(n + 2);
+    ref->gps.tv_nsec = (long)((n * 7) % 1000000000ULL);
+    ref->xtal_err = 1.0 + 1E-12 * (double)(n % 1000000ULL);
+}
+
+/* Reader thread, as thread_up, thread_down and thread_jit */
+static void *stress_reader(void *arg) {
+    struct stress_reader_s *r = (struct stress_reader_s *)arg;
+    struct tref ref, expected;
+    bool valid;
+    uint64_t n, last_n = 0;
+
+    while (__atomic_load_n(&stress_stop, __ATOMIC_RELAXED) == false) {
+        valid = timeref_read(&stress_timeref_gps, &ref);
+        r->nb_read += 1;
+        n = (uint64_t)ref.systime;
+        stress_fill(&expected, n);
+        if ((ref.count_us != expected.count_us) || (ref.utc.tv_sec != expected.utc.tv_sec) ||
+            (ref.utc.tv_nsec != expected.utc.tv_nsec) || (ref.gps.tv_sec != expected.gps.tv_sec) ||
+            (ref.gps.tv_nsec != expected.gps.tv_nsec) || (ref.xtal_err != expected.xtal_err) ||
+            (valid != ((n & 1) != 0))) {
+            r->nb_torn += 1;
+        }
+        if (n < last_n) {
+            r->nb_backwards += 1;
+        }
+        last_n = n;
+    }
+    return NULL;
+}
+
+/* Publish references back to back while readers check every copy they get */
+static int stress_timeref(int nb_readers) {
+    struct stress_reader_s readers[STRESS_READERS_MAX];
+    struct tref ref;
+    struct timespec start, now;
+    uint64_t n = 0;
+    uint64_t nb_read = 0, nb_torn = 0, nb_backwards = 0;
+    double elapsed;
+    int i;
+
+    timeref_init(&stress_timeref_gps);
+    stress_fill(&ref, n);
+    timeref_publish(&stress_timeref_gps, &ref, false);
+    memset(readers, 0, sizeof readers);
+    for (i = 0; i < nb_readers; i++) {
+        if (pthread_create(&readers[i].thread, NULL, stress_reader, &readers[i]) != 0) {
+            MSG("ERROR: failed to create reader thread\n");
+            return -1;
+        }
+    }
+
+    /* this thread is the writer, serialized by the reference mutex as thread_gps and thread_valid */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        for (i = 0; i < 1000; i++) {
+            n += 1;
+            stress_fill(&ref, n);
+            pthread_mutex_lock(&stress_timeref_gps.mx);
+            timeref_publish(&stress_timeref_gps, &ref, (n & 1) != 0);
+            pthread_mutex_unlock(&stress_timeref_gps.mx);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = timespec_diff(now, start);
+    } while (elapsed < 1E-3 * STRESS_DURATION_MS);
+    __atomic_store_n(&stress_stop, true, __ATOMIC_RELAXED);
+
+    for (i = 0; i < nb_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        nb_read += readers[i].nb_read;
+        nb_torn += readers[i].nb_torn;
+        nb_backwards += readers[i].nb_backwards;
+    }
+
+    MSG("### GPS time reference sequence lock stress test ###\n");
+    MSG("# %d readers, %.3f sec: %llu updates, %llu reads\n", nb_readers, elapsed,
+        (unsigned long long)n, (unsigned long long)nb_read);
+    MSG("# checks: %llu torn references, %llu references older than a previous one\n",
+        (unsigned long long)nb_torn, (unsigned long long)nb_backwards);
+    MSG("##### END #####\n");
+
+    return ((nb_torn == 0) && (nb_backwards == 0) && (nb_read > 0)) ? 0 : -1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- XTAL CORRECTION REPLAY ----------------------------------------------- */
+
+/* former thread_valid XTAL correction: average of the first samples, then low-pass tracking */
+struct xavg_s {
+    unsigned init_cpt;
+    double init_acc;
+    double correct;
+    bool ready;
+};
+
+struct xstats_s {
+    unsigned ready_at;      /* number of samples before the correction was used */
+    double ready_err;       /* error when the correction was first used, in ppm */
+    double sum2;            /* steady-state errors, in ppm */
+    double max;
+    unsigned nb;
+};
+
+/* Same as the former thread_valid, one call per sample */
+static void xavg_update(struct xavg_s *xa, double xtal_err) {
+    if (xa->init_cpt < XERR_INIT_AVG) {
+        /* initial accumulation */
+        xa->init_acc += xtal_err;
+        ++xa->init_cpt;
+    } else if (xa->init_cpt == XERR_INIT_AVG) {
+        /* initial average calculation */
+        xa->correct = (double)(XERR_INIT_AVG) / xa->init_acc;
+        xa->ready = true;
+        ++xa->init_cpt;
+    } else {
+        /* tracking with low-pass filter */
+        xa->correct = xa->correct - xa->correct / XERR_FILT_COEF + (1 / xtal_err) / XERR_FILT_COEF;
+    }
+}
+
+static void xstats_update(struct xstats_s *st, unsigned i, bool ready, double correct, double truth) {
+    double err;
+
+    if (ready == false) {
+        return;
+    }
+    err = fabs(correct / truth - 1.0) * 1E6;
+    if (st->ready_at == 0) {
+        st->ready_at = i + 1;
+        st->ready_err = err;
+    }
+    if (i >= XREPLAY_STEADY) {
+        st->sum2 += err * err;
+        st->max = (err > st->max) ? err : st->max;
+        st->nb += 1;
+    }
+}
+
+static void xstats_print(const char *name, const struct xstats_s *st) {
+    if (st->ready_at == 0) {
+        MSG("# %-24s never used\n", name);
+    } else {
+        MSG("# %-24s used after %4u s, error %.3f ppm, steady-state error %.3f ppm rms, %.3f ppm max\n", name,
+            st->ready_at, st->ready_err, (st->nb > 0) ? sqrt(st->sum2 / st->nb) : 0.0, st->max);
+    }
+}
+
+/* One sample per second: XTAL error as measured by the HAL on a PPS interval, and the true one */
+static int generate_xtal(const char *path, unsigned duration) {
+    FILE *f;
+    unsigned i;
+    double ppm, phase = 0.0;
+    double count, count_prev = 0.0;
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        MSG("ERROR: failed to create %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "# xtal_err,true_xtal_err\n");
+    for (i = 0; i <= duration; ++i) {
+        ppm = xtal_ppm + XGEN_DRIFT_PPM * sin(2.0 * M_PI * (double)i / XGEN_DRIFT_PERIOD);
+        phase += 1E6 * (1.0 + ppm / 1E6);
+        count = floor(phase + pps_jitter * prng_normal()); /* counter captured on PPS, 1 µs resolution */
+        if (i > 0) {
+            fprintf(f, "%.15f,%.15f\n", (count - count_prev) / 1E6, 1.0 + ppm / 1E6);
+        }
+        count_prev = count;
+    }
+    fclose(f);
+    MSG("INFO: %u seconds of XTAL error samples written to %s\n", duration, path);
+    return 0;
+}
+
+/* Replay a series through both estimators, the Kalman one must be used no later and be as precise */
+static int replay_xtal(const char *path) {
+    FILE *f;
+    char line[128];
+    double *xerr = NULL, *truth = NULL, *tmp;
+    double *sum = NULL;
+    size_t nb = 0, size = 0, i, lo, hi;
+    bool has_truth = true;
+    struct xcorr_s xc;
+    struct xavg_s xa;
+    struct xstats_s st_kalman, st_avg;
+    char name[32];
+    double rms_kalman, rms_avg;
+    int ret = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        MSG("ERROR: failed to open %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    while (fgets(line, sizeof line, f) != NULL) {
+        if ((line[0] == '#') || (line[0] == '"') || (line[0] == '\n')) {
+            continue;
+        }
+        if (nb == size) {
+            size = (size == 0) ? 4096 : 2 * size;
+            tmp = realloc(xerr, size * sizeof *xerr);
+            if (tmp != NULL) {
+                xerr = tmp;
+                tmp = realloc(truth, size * sizeof *truth);
+            }
+            if (tmp == NULL) {
+                MSG("ERROR: out of memory\n");
+                ret = -1;
+                break;
+            }
+            truth = tmp;
+        }
+        i = (size_t)sscanf(line, "%lf,%lf", &xerr[nb], &truth[nb]);
+        if (i == 0) {
+            MSG("ERROR: invalid XTAL error sample: %s", line);
+            ret = -1;
+            break;
+        } else if (i == 1) {
+            has_truth = false;
+        }
+        nb += 1;
+    }
+    fclose(f);
+    if ((ret == 0) && (nb <= XREPLAY_STEADY)) {
+        MSG("ERROR: %u samples in %s, more than %u are needed\n", (unsigned)nb, path, XREPLAY_STEADY);
+        ret = -1;
+    }
+
+    /* without recorded reference, compare to the centered moving average of the series */
+    if ((ret == 0) && (has_truth == false)) {
+        sum = malloc((nb + 1) * sizeof *sum);
+        if (sum == NULL) {
+            MSG("ERROR: out of memory\n");
+            ret = -1;
+        } else {
+            sum[0] = 0.0;
+            for (i = 0; i < nb; i++) {
+                sum[i + 1] = sum[i] + xerr[i];
+            }
+            for (i = 0; i < nb; i++) {
+                lo = (i > XREPLAY_TRUTH_HALF) ? i - XREPLAY_TRUTH_HALF : 0;
+                hi = (i + XREPLAY_TRUTH_HALF + 1 < nb) ? i + XREPLAY_TRUTH_HALF + 1 : nb;
+                truth[i] = (sum[hi] - sum[lo]) / (double)(hi - lo);
+            }
+            free(sum);
+        }
+    }
+
+    if (ret == 0) {
+        xcorr_reset(&xc);
+        memset(&xa, 0, sizeof xa);
+        memset(&st_kalman, 0, sizeof st_kalman);
+        memset(&st_avg, 0, sizeof st_avg);
+        for (i = 0; i < nb; i++) {
+            xcorr_update(&xc, xerr[i], xcorr_max_stddev);
+            xavg_update(&xa, xerr[i]);
+            xstats_update(&st_kalman, i, xc.ready, xc.estimate, 1.0 / truth[i]);
+            xstats_update(&st_avg, i, xa.ready, xa.correct, 1.0 / truth[i]);
+        }
+
+        MSG("### XTAL correction replay of %s ###\n", path);
+        MSG("# %u samples, reference: %s\n", (unsigned)nb, (has_truth == true) ? "recorded" : "moving average of the series");
+        snprintf(name, sizeof name, "Kalman (%.3f ppm):", xcorr_max_stddev);
+        xstats_print(name, &st_kalman);
+        xstats_print("average 128, 1/256:", &st_avg);
+        MSG("# Kalman estimator: %u samples rejected as outliers\n", xc.nb_rejected);
+        MSG("##### END #####\n");
+
+        rms_kalman = (st_kalman.nb > 0) ? sqrt(st_kalman.sum2 / st_kalman.nb) : 0.0;
+        rms_avg = (st_avg.nb > 0) ? sqrt(st_avg.sum2 / st_avg.nb) : 0.0;
+        if ((st_kalman.ready_at == 0) || (st_kalman.ready_at > st_avg.ready_at) || (rms_kalman > XREPLAY_MARGIN * rms_avg)) {
+            ret = -1;
+        }
+    }
+
+    free(xerr);
+    free(truth);
+    return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    int i;
+    unsigned gen_duration = 0;
+    double err_ratio = 0.0;
+    int stress_readers = 0;
+    const char *xtal_path = NULL;
+    unsigned long long ull;
+    const char *path;
+    struct stat st;
+    pthread_t thrid_writer;
+    int serial_fd;
+    struct timespec wall_start, wall_end;
+    double elapsed;
+    uint64_t nb_bytes = 0;
+
+    /* GPS pipeline variables, as in thread_gps */
+    struct gps_frame_decoder_s decoder;
+    char frame[GPS_FRAME_MAX_SIZE + 1];
+    size_t frame_size;
+    enum gps_frame_type_e frame_type;
+    enum gps_msg latest_msg;
+    uint8_t *wr_ptr;
+    size_t wr_size;
+    ssize_t nb_char;
+
+    /* parse command line options */
+    while ((i = getopt (argc, argv, "hg:e:s:x:t:pb:T:X:j:d:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return EXIT_FAILURE;
+
+            case 'g': /* -g <uint> generate a capture */
+                i = sscanf(optarg, "%u", &gen_duration);
+                if ((i != 1) || (gen_duration == 0)) {
+                    MSG("ERROR: invalid capture duration\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'e': /* -e <float> ratio of corrupted frames */
+                i = sscanf(optarg, "%lf", &err_ratio);
+                if ((i != 1) || (err_ratio < 0.0) || (err_ratio > 1.0)) {
+                    MSG("ERROR: invalid ratio of corrupted frames\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 's': /* -s <uint> random generator seed */
+                i = sscanf(optarg, "%llu", &ull);
+                if (i != 1) {
+                    MSG("ERROR: invalid seed\n");
+                    return EXIT_FAILURE;
+                }
+                prng_state = (ull != 0) ? (uint64_t)ull : 1; /* xorshift state must not be 0 */
+                break;
+
+            case 'x': /* -x <float> XTAL error in ppm */
+                i = sscanf(optarg, "%lf", &xtal_ppm);
+                if ((i != 1) || (fabs(xtal_ppm) > 10.0)) {
+                    MSG("ERROR: invalid XTAL error, the HAL only accepts +/-10 ppm\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 't': /* -t <uint> counter value on first PPS */
+                i = sscanf(optarg, "%llu", &ull);
+                if ((i != 1) || (ull > UINT32_MAX)) {
+                    MSG("ERROR: invalid counter value\n");
+                    return EXIT_FAILURE;
+                }
+                start_count = (uint32_t)ull;
+                break;
+
+            case 'p': /* -p replay through a pseudo-terminal */
+                use_pty = true;
+                break;
+
+            case 'b': /* -b <uint> pseudo-terminal pacing */
+                i = sscanf(optarg, "%u", &baudrate);
+                if (i != 1) {
+                    MSG("ERROR: invalid baudrate\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'T': /* -T <uint> time reference stress test */
+                i = sscanf(optarg, "%d", &stress_readers);
+                if ((i != 1) || (stress_readers < 1) || (stress_readers > STRESS_READERS_MAX)) {
+                    MSG("ERROR: invalid number of reader threads, must be 1 to %d\n", STRESS_READERS_MAX);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'X': /* -X <path> XTAL error series */
+                xtal_path = optarg;
+                break;
+
+            case 'j': /* -j <float> PPS jitter */
+                i = sscanf(optarg, "%lf", &pps_jitter);
+                if ((i != 1) || (pps_jitter < 0.0)) {
+                    MSG("ERROR: invalid PPS jitter\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'd': /* -d <float> XTAL correction standard deviation */
+                i = sscanf(optarg, "%lf", &xcorr_max_stddev);
+                if ((i != 1) || (xcorr_max_stddev <= 0.0)) {
+                    MSG("ERROR: invalid XTAL correction standard deviation\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            default:
+                MSG("ERROR: argument parsing failure, use -h option for help\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (stress_readers > 0) {
+        return (stress_timeref(stress_readers) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if ((xtal_path != NULL) && (gen_duration > 0)) {
+        return (generate_xtal(xtal_path, gen_duration) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (xtal_path != NULL) {
+        return (replay_xtal(xtal_path) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (optind != (argc - 1)) {
+        MSG("ERROR: one capture file must be given\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+    path = argv[optind];
+
+    if (gen_duration > 0) {
+        return (generate(path, gen_duration, err_ratio) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* open capture, directly or through a pseudo-terminal */
+    replay_fd = open(path, O_RDONLY);
+    if ((replay_fd < 0) || (fstat(replay_fd, &st) != 0)) {
+        MSG("ERROR: failed to open %s (%s)\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    replay_size = st.st_size;
+    if (use_pty == true) {
+        serial_fd = pty_open();
+        if (serial_fd < 0) {
+            return EXIT_FAILURE;
+        }
+        if (pthread_create(&thrid_writer, NULL, pty_writer, NULL) != 0) {
+            MSG("ERROR: failed to create pseudo-terminal writer thread\n");
+            return EXIT_FAILURE;
+        }
+    } else {
+        serial_fd = replay_fd;
+    }
+
+    /* same pipeline as thread_gps */
+    gps_frame_init(&decoder);
+    timeref_init(&replay_timeref);
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    while (nb_bytes < (uint64_t)replay_size) {
+        wr_ptr = gps_frame_write_ptr(&decoder, &wr_size);
+        nb_char = read(serial_fd, wr_ptr, wr_size);
+        if (nb_char <= 0) {
+            MSG("ERROR: read() returned value %d after %llu bytes\n", (int)nb_char, (unsigned long long)nb_bytes);
+            break;
+        }
+        nb_bytes += (uint64_t)nb_char;
+        gps_frame_commit(&decoder, (size_t)nb_char);
+
+        while ((frame_type = gps_frame_next(&decoder, frame, &frame_size)) != GPS_FRAME_NONE) {
+            if (frame_type == GPS_FRAME_UBX) {
+                latest_msg = lgw_parse_ubx(frame, frame_size, &frame_size);
+                if (latest_msg == UBX_NAV_TIMEGPS) {
+                    nb_ubx_timegps += 1;
+                    replay_sync();
+                }
+            } else {
+                latest_msg = lgw_parse_nmea(frame, frame_size);
+                if (latest_msg == NMEA_RMC) {
+                    nb_nmea_rmc += 1;
+                    if (gps_process_coords(&mx_replay_pos, &replay_pos) == 0) {
+                        nb_coords += 1;
+                    }
+                }
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    elapsed = timespec_diff(wall_end, wall_start);
+
+    if (use_pty == true) {
+        pthread_join(thrid_writer, NULL);
+        close(serial_fd);
+        close(pty_master);
+    }
+    close(replay_fd);
+
+    /* report */
+    MSG("### GPS replay of %s (%s) ###\n", path, (use_pty == true) ? "pseudo-terminal" : "file");
+    MSG("# %llu bytes in %.3f sec: %.2f MB/s, %.0f frames/s\n", (unsigned long long)nb_bytes, elapsed, (double)nb_bytes / elapsed / 1E6, (double)(decoder.stats.nb_ubx + decoder.stats.nb_nmea) / elapsed);
+    MSG("# framing: %u UBX frames, %u NMEA sentences, %u framing errors, %u bytes discarded\n", decoder.stats.nb_ubx, decoder.stats.nb_nmea, decoder.stats.nb_errors, decoder.stats.nb_discarded);
+    MSG("# parsing: %u UBX NAV-TIMEGPS, %u NMEA RMC, %u valid coordinates\n", nb_ubx_timegps, nb_nmea_rmc, nb_coords);
+    MSG("# time reference: %u syncs, %u failed (HAL locking or missing time)\n", nb_sync_ok, nb_sync_failed);
+    MSG("# checks: %u passed, %u failed, max counter error %.0f us, max XTAL error %.3f ppm\n", nb_check_ok, nb_check_failed, cnt_err_max, xtal_err_max * 1E6);
+    MSG("##### END #####\n");
+
+    return ((nb_check_failed == 0) && (nb_check_ok > 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
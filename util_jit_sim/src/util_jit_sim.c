@@ -0,0 +1,1375 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2013 Semtech-Cycleo
+
+Description:
+    Just In Time TX scheduling simulator
+    Replays downlink traffic through the packet forwarder JiT queue, driven by
+    a virtual concentrator clock, and reports scheduling statistics
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf, fopen, fgets */
+#include <unistd.h>     /* getopt */
+
+#include <string.h>     /* memset */
+#include <time.h>       /* clock_gettime */
+#include <stdlib.h>     /* exit codes */
+#include <math.h>       /* ceil, log */
+#include <pthread.h>
+
+#include "jitqueue.h"
+#include "timersync.h"
+#include "loragw_hal.h"
+#include "loragw_reg.h"
+#include "loragw_aux.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define ARRAY_SIZE(a)   (sizeof(a) / sizeof((a)[0]))
+#define MSG(args...)    fprintf(stderr, args) /* message that is destined to the user */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define SIM_TICK_US         10000       /* thread_jit polling period (wait_ms(10)) */
+#define SIM_PEEK_WINDOW_US  30000       /* TX_JIT_DELAY of jitqueue.c, jit_peek returns packets due within that time */
+#define SIM_PEEK_HORIZON_US 100000      /* self-check: packets must be dequeued at most that long before departure */
+#define SIM_NEVER           UINT64_MAX
+
+#define SIM_RX1_DELAY_US    1000000     /* Class A RX1 window */
+#define SIM_RX2_DELAY_US    2000000     /* Class A RX2 window */
+#define SIM_PINGSLOT_US     30000       /* Class B ping slot length */
+#define SIM_PINGSLOT_NB     4096        /* Class B ping slots in a beacon window */
+#define SIM_BEACON_RESERVED 2120000     /* Class B beacon reserved time */
+
+#define SIM_PENDING_MAX     256         /* Class A responses "in flight" from the server */
+#define SIM_JIT_ERROR_NB    (JIT_ERROR_INVALID + 1)
+#define SIM_CLASS_NB        (JIT_PKT_TYPE_BEACON + 1)
+
+#define CHECK_NB_WRAPS      6           /* counter wraps crossed by the self-checks */
+#define CHECK_JIT_STEP_US   7777777     /* time between two JiT queue checks */
+#define CHECK_FAR_US        2000000000  /* beyond the queue horizon, but less than half a wrap */
+#define CHECK_DC_STEP_US    3000000     /* time between two SF12 packets of the duty-cycle check */
+#define CHECK_TS_START      4294367296U /* initial counter of the clock model check, 10 minutes before a wrap */
+#define CHECK_TS_PPM        12.5        /* concentrator frequency error compared to host */
+#define CHECK_TS_JITTER_US  3.0         /* host sampling jitter, +/- */
+#define CHECK_TS_FAST_NB    4           /* same sampling rhythm as thread_timersync */
+#define CHECK_TS_FAST_US    5000000
+#define CHECK_TS_PERIOD_US  60000000
+#define CHECK_TS_RESET_US   23400000000LL /* concentrator counter reset after 6.5 hours */
+#define CHECK_TS_TOLERANCE  20.0        /* maximum error of the extended counter, in µs */
+
+#define BENCH_READERS_MAX   64          /* concentrator time readers of the contention benchmark */
+#define BENCH_DURATION_MS   1000        /* duration of each benchmark run */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* clock model copy of the mutex baseline, same content as the timersync model */
+struct bench_model_s {
+    bool valid;
+    int64_t host_ref;
+    int64_t count_ref;
+    double ppm;
+    double residual;
+    int nb_samples;
+    double uncertainty;
+};
+
+/* one benchmark reader thread */
+struct bench_reader_s {
+    pthread_t thread;
+    uint64_t nb_read;
+    uint64_t nb_fail;
+};
+
+/* one downlink request, as it arrives from the server */
+struct sim_req_s {
+    uint64_t arrival_us;            /* virtual time at which thread_down gets the PULL_RESP */
+    uint64_t target_us;             /* requested departure time (unused for Class C) */
+    enum jit_pkt_type_e type;
+    uint8_t datarate;
+    uint8_t bandwidth;
+    uint16_t size;
+};
+
+struct sim_class_stats_s {
+    uint32_t requested;
+    uint32_t rejected[SIM_JIT_ERROR_NB];
+    uint32_t accepted;
+    uint32_t sent;
+    uint32_t lost_emitting;         /* dequeued while the concentrator was emitting */
+    uint32_t lost_overwritten;      /* programmed in concentrator, but overwritten by next one */
+    uint32_t dropped;               /* purged from queue by jit_peek */
+    int64_t slack_min;              /* time between lgw_send and departure */
+    int64_t slack_max;
+    double slack_sum;
+    int64_t lead_min;               /* time between request arrival and departure */
+    int64_t lead_max;
+    double lead_sum;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
+
+/* simulation parameters */
+static double sim_hours = 24.0;     /* simulated duration */
+static uint64_t sim_start_us = 0;   /* initial value of the virtual concentrator clock */
+static uint64_t prng_state = 1;     /* random generator state (seed) */
+static double uplink_rate = 1.0;    /* uplinks per second */
+static double classa_ratio = 0.1;   /* ratio of uplinks answered by a Class A downlink */
+static double rx2_ratio = 0.2;      /* ratio of Class A downlinks sent in RX2 */
+static double classb_rate = 0.0;    /* Class B downlinks per second */
+static double classc_rate = 0.0;    /* Class C downlinks per second */
+static uint32_t beacon_period = 0;  /* beacon period in seconds, 0 to disable */
+static uint32_t ns_lat_min = 50000; /* network server latency range, in µs */
+static uint32_t ns_lat_max = 500000;
+static uint32_t asap_floor = JIT_ASAP_DELAY_FLOOR; /* Class C ASAP delay bounds, in µs */
+static uint32_t asap_ceiling = JIT_ASAP_DELAY_CEILING;
+static FILE * trace_file = NULL;    /* replay requests from a trace instead of generating them */
+static bool verbose = false;
+static bool self_check = false;     /* run the counter wrap self-checks instead of a simulation */
+static int bench_readers = 0;       /* run the clock model contention benchmark with that many readers */
+
+/* virtual concentrator clock */
+static uint64_t sim_now = 0;
+
+/* virtual concentrator TX state */
+static uint64_t tx_start_us = 0;
+static uint64_t tx_end_us = 0;
+static enum jit_pkt_type_e tx_type;
+
+/* request generators */
+static struct sim_req_s pending[SIM_PENDING_MAX]; /* Class A responses not yet received */
+static int pending_nb = 0;
+static uint64_t next_uplink_us = SIM_NEVER;
+static uint64_t next_classb_us = SIM_NEVER;
+static uint64_t next_classc_us = SIM_NEVER;
+static struct sim_req_s trace_req;
+static bool trace_req_valid = false;
+static unsigned trace_line = 0;
+static uint64_t last_beacon_us = 0;
+
+/* statistics */
+static struct sim_class_stats_s stats[SIM_CLASS_NB];
+static uint32_t nb_uplink = 0;
+static uint32_t nb_pending_overflow = 0;
+static uint32_t nb_peek = 0;
+
+/* Just In Time TX scheduling */
+static struct jit_queue_s jit_queue;
+
+/* contention benchmark */
+static bool bench_stop = false;     /* accessed with __atomic builtins */
+static bool bench_use_mutex = false;
+static pthread_mutex_t mx_bench = PTHREAD_MUTEX_INITIALIZER; /* protects bench_model */
+static struct bench_model_s bench_model;
+static int64_t bench_host_us = 0;   /* virtual host time of the benchmark writer */
+static uint64_t bench_nb_update = 0;
+
+static const char * class_name[SIM_CLASS_NB] = {"Class A", "Class B", "Class C", "Beacon"};
+/* packet forwarder globals used by the clock model (timersync.c) */
+bool exit_sig = false;
+bool quit_sig = false;
+pthread_mutex_t mx_concent = PTHREAD_MUTEX_INITIALIZER;
+
+static const char * error_name[SIM_JIT_ERROR_NB] = {"OK", "TOO_LATE", "TOO_EARLY", "FULL", "EMPTY",
+    "COLLISION_PACKET", "COLLISION_BEACON", "TX_FREQ", "TX_POWER", "GPS_UNLOCKED", "DUTY_CYCLE", "INVALID"};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+void usage(void);
+
+/* -------------------------------------------------------------------------- */
+/* --- HAL REPLACEMENT FUNCTIONS -------------------------------------------- */
+
+/* Same computation as the HAL, returns the time on air in milliseconds */
+uint32_t lgw_time_on_air(struct lgw_pkt_tx_s *packet) {
+    int32_t val;
+    uint8_t SF, H, DE;
+    uint16_t BW;
+    uint32_t payloadSymbNb, Tpacket;
+    double Tsym, Tpreamble, Tpayload, Tfsk;
+
+    if (packet == NULL) {
+        return 0;
+    }
+
+    if (packet->modulation == MOD_LORA) {
+        switch (packet->bandwidth) {
+            case BW_125KHZ: BW = 125; break;
+            case BW_250KHZ: BW = 250; break;
+            case BW_500KHZ: BW = 500; break;
+            default: return 0;
+        }
+        switch (packet->datarate) {
+            case DR_LORA_SF7:  SF = 7;  break;
+            case DR_LORA_SF8:  SF = 8;  break;
+            case DR_LORA_SF9:  SF = 9;  break;
+            case DR_LORA_SF10: SF = 10; break;
+            case DR_LORA_SF11: SF = 11; break;
+            case DR_LORA_SF12: SF = 12; break;
+            default: return 0;
+        }
+        H = (packet->no_header == false) ? 0 : 1;
+        DE = ((BW == 125) && (SF >= 11)) ? 1 : 0;
+
+        Tsym = pow(2, SF) / BW; /* in ms */
+        Tpreamble = ((double)(packet->preamble) + 4.25) * Tsym;
+        val = (int32_t)ceil((double)(8 * packet->size - 4 * SF + 28 + (packet->no_crc ? 0 : 16) - 20 * H) / (double)(4 * (SF - 2 * DE)));
+        payloadSymbNb = 8 + (((val > 0) ? val : 0) * (packet->coderate + 4));
+        Tpayload = payloadSymbNb * Tsym;
+        Tpacket = (uint32_t)ceil(Tpreamble + Tpayload);
+    } else if (packet->modulation == MOD_FSK) {
+        /* preamble + sync word (3) + length (1) + payload + crc (2) */
+        Tfsk = (8 * (double)(packet->preamble + 3 + 1 + packet->size + (packet->no_crc ? 0 : 2)) / (double)packet->datarate) * 1E3;
+        Tpacket = (uint32_t)ceil(Tfsk);
+    } else {
+        Tpacket = 0;
+    }
+
+    return Tpacket;
+}
+
+/* The clock model is driven through timersync_sample() by the self-checks,
+   the concentrator accesses of thread_timersync are never called */
+int lgw_reg_w(uint16_t register_id, int32_t reg_value) {
+    (void)register_id;
+    (void)reg_value;
+    return LGW_REG_ERROR;
+}
+
+int lgw_get_trigcnt(uint32_t *trig_cnt_us) {
+    (void)trig_cnt_us;
+    return LGW_HAL_ERROR;
+}
+
+void wait_ms(unsigned long t) {
+    (void)t;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* describe command line options */
+void usage(void) {
+    MSG("Usage: util_jit_sim {options}\n");
+    MSG("Available options:\n");
+    MSG(" -h print this help\n");
+    MSG(" -d <float> simulated duration in hours (default 24)\n");
+    MSG(" -s <uint> random generator seed (default 1)\n");
+    MSG(" -t <uint> initial concentrator counter value in µs, to exercise wrap-around\n");
+    MSG(" -u <float> uplink rate in packets per second (default 1.0)\n");
+    MSG(" -a <float> ratio of uplinks answered with a Class A downlink [0:1] (default 0.1)\n");
+    MSG(" -r <float> ratio of Class A downlinks sent in RX2 [0:1] (default 0.2)\n");
+    MSG(" -B <float> Class B downlink rate in packets per second (default 0)\n");
+    MSG(" -C <float> Class C downlink rate in packets per second (default 0)\n");
+    MSG(" -b <uint> beacon period in seconds, 0 to disable (default 0)\n");
+    MSG(" -l <uint>:<uint> network server latency range in ms (default 50:500)\n");
+    MSG(" -A <uint>:<uint> Class C ASAP delay bounds in ms (default %u:%u)\n", JIT_ASAP_DELAY_FLOOR / 1000, JIT_ASAP_DELAY_CEILING / 1000);
+    MSG(" -f <path> replay downlink requests from a trace file instead of generating them\n");
+    MSG(" -v keep JiT queue traces on stdout\n");
+    MSG(" -T check JiT queue, duty-cycle ledger and clock model across counter wraps, starting at -t counter value\n");
+    MSG(" -S <uint> benchmark concentrator time readers against clock model updates, with that many reader threads\n");
+}
+
+/* xorshift64* pseudo random generator, for reproducible runs */
+static uint64_t prng_next(void) {
+    prng_state ^= prng_state >> 12;
+    prng_state ^= prng_state << 25;
+    prng_state ^= prng_state >> 27;
+    return prng_state * 2685821657736338717ULL;
+}
+
+/* uniform in [0:1) */
+static double prng_uniform(void) {
+    return (double)(prng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* next event of a Poisson process, in µs from now */
+static uint64_t prng_exp_us(double rate) {
+    return (uint64_t)(-log(1.0 - prng_uniform()) / rate * 1E6) + 1;
+}
+
+static uint8_t sf_to_dr(int sf) {
+    switch (sf) {
+        case 7:  return DR_LORA_SF7;
+        case 8:  return DR_LORA_SF8;
+        case 9:  return DR_LORA_SF9;
+        case 10: return DR_LORA_SF10;
+        case 11: return DR_LORA_SF11;
+        case 12: return DR_LORA_SF12;
+        default: return DR_UNDEFINED;
+    }
+}
+
+static uint8_t khz_to_bw(int bw) {
+    switch (bw) {
+        case 125: return BW_125KHZ;
+        case 250: return BW_250KHZ;
+        case 500: return BW_500KHZ;
+        default:  return BW_UNDEFINED;
+    }
+}
+
+static void fill_packet(struct lgw_pkt_tx_s *pkt, const struct sim_req_s *req) {
+    memset(pkt, 0, sizeof *pkt);
+    pkt->tx_mode = TIMESTAMPED;
+    pkt->count_us = (uint32_t)req->target_us; /* 32-bit concentrator counter */
+    pkt->rf_chain = 0;
+    pkt->rf_power = 14;
+    pkt->freq_hz = 869525000;
+    pkt->modulation = MOD_LORA;
+    pkt->datarate = req->datarate;
+    pkt->bandwidth = req->bandwidth;
+    pkt->coderate = CR_LORA_4_5;
+    pkt->invert_pol = true;
+    pkt->preamble = 8;
+    pkt->size = req->size;
+    if (req->type == JIT_PKT_TYPE_DOWNLINK_CLASS_C) {
+        pkt->tx_mode = IMMEDIATE;
+    } else if (req->type == JIT_PKT_TYPE_BEACON) {
+        pkt->tx_mode = ON_GPS;
+        pkt->invert_pol = false;
+        pkt->preamble = 10;
+        pkt->no_crc = true;
+        pkt->no_header = true;
+    }
+}
+
+/* give the JiT queue the same view of time as get_concentrator_time() does */
+static void sim_time(struct timeval *tv) {
+    tv->tv_sec = (time_t)(sim_now / 1000000ULL);
+    tv->tv_usec = (suseconds_t)(sim_now % 1000000ULL);
+}
+
+/* extend a 32-bit counter value to the 64-bit virtual timeline, around now */
+static uint64_t sim_extend(uint32_t count_us) {
+    return sim_now + (int64_t)(int32_t)(count_us - (uint32_t)sim_now);
+}
+
+static void record_delay(int64_t *min, int64_t *max, double *sum, uint32_t nb, int64_t x) {
+    if ((nb == 0) || (x < *min)) {
+        *min = x;
+    }
+    if ((nb == 0) || (x > *max)) {
+        *max = x;
+    }
+    *sum += (double)x;
+}
+
+static void sim_enqueue(const struct sim_req_s *req) {
+    struct lgw_pkt_tx_s pkt;
+    struct timeval tv;
+    enum jit_error_e err;
+    struct sim_class_stats_s *st = &stats[req->type];
+
+    fill_packet(&pkt, req);
+    sim_time(&tv);
+    err = jit_enqueue(&jit_queue, &tv, &pkt, req->type);
+    st->requested += 1;
+    if (err == JIT_ERROR_OK) {
+        /* Class C packets have been given their departure time by the queue */
+        record_delay(&st->lead_min, &st->lead_max, &st->lead_sum, st->accepted, (int64_t)sim_extend(pkt.count_us) - (int64_t)sim_now);
+        st->accepted += 1;
+    } else if (err < SIM_JIT_ERROR_NB) {
+        st->rejected[err] += 1;
+    }
+}
+
+/* Same as thread_down: keep JIT_NUM_BEACON_IN_QUEUE beacons pre-allocated in queue */
+static void sim_beacons(void) {
+    struct sim_req_s req;
+    struct lgw_pkt_tx_s pkt;
+    struct timeval tv;
+    enum jit_error_e err;
+    int retry = 0;
+    uint64_t period_us = (uint64_t)beacon_period * 1000000ULL;
+
+    if (beacon_period == 0) {
+        return;
+    }
+    while (jit_queue.num_beacon < JIT_NUM_BEACON_IN_QUEUE) {
+        if (last_beacon_us == 0) {
+            req.target_us = (sim_now / period_us + 1) * period_us;
+        } else {
+            req.target_us = last_beacon_us + period_us;
+        }
+        req.target_us += retry * period_us;
+        req.arrival_us = sim_now;
+        req.type = JIT_PKT_TYPE_BEACON;
+        req.datarate = DR_LORA_SF9;
+        req.bandwidth = BW_125KHZ;
+        req.size = 17;
+        fill_packet(&pkt, &req);
+        sim_time(&tv);
+        err = jit_enqueue(&jit_queue, &tv, &pkt, JIT_PKT_TYPE_BEACON);
+        stats[JIT_PKT_TYPE_BEACON].requested += 1;
+        if (err == JIT_ERROR_OK) {
+            last_beacon_us = req.target_us;
+            retry = 0;
+        } else {
+            if ((err != JIT_ERROR_COLLISION_BEACON) && (err < SIM_JIT_ERROR_NB)) {
+                stats[JIT_PKT_TYPE_BEACON].rejected[err] += 1;
+            } else {
+                stats[JIT_PKT_TYPE_BEACON].requested -= 1; /* expected, not a rejection */
+            }
+            retry++;
+        }
+    }
+}
+
+/* Same as thread_jit: peek, dequeue and "send" to the virtual concentrator */
+static void sim_jit_tick(void) {
+    struct lgw_pkt_tx_s pkt;
+    struct timeval tv;
+    enum jit_pkt_type_e pkt_type;
+    enum jit_error_e err;
+    int pkt_index = -1;
+    int i;
+    int nb_before;
+    int nb_type_before[SIM_CLASS_NB] = {0};
+    uint64_t departure;
+    int64_t slack;
+    struct sim_class_stats_s *st;
+
+    /* keep track of packets purged by peek */
+    nb_before = jit_queue.num_pkt;
+    for (i = 0; i < jit_queue.num_pkt; i++) {
+        nb_type_before[jit_queue.nodes[i].pkt_type] += 1;
+    }
+
+    sim_time(&tv);
+    err = jit_peek(&jit_queue, &tv, &pkt_index);
+    nb_peek += 1;
+    if (jit_queue.num_pkt != nb_before) {
+        for (i = 0; i < jit_queue.num_pkt; i++) {
+            nb_type_before[jit_queue.nodes[i].pkt_type] -= 1;
+        }
+        for (i = 0; i < SIM_CLASS_NB; i++) {
+            stats[i].dropped += nb_type_before[i];
+        }
+    }
+    if ((err != JIT_ERROR_OK) || (pkt_index < 0)) {
+        return;
+    }
+
+    err = jit_dequeue(&jit_queue, pkt_index, &pkt, &pkt_type);
+    if (err != JIT_ERROR_OK) {
+        return;
+    }
+    st = &stats[pkt_type];
+    departure = sim_extend(pkt.count_us);
+
+    /* check virtual concentrator status, as lgw_status(TX_STATUS) would */
+    if ((sim_now >= tx_start_us) && (sim_now < tx_end_us)) {
+        st->lost_emitting += 1;
+        jit_cancel_tx(&jit_queue);
+        return;
+    } else if (sim_now < tx_start_us) {
+        stats[tx_type].lost_overwritten += 1;
+        stats[tx_type].sent -= 1;
+        jit_cancel_scheduled_tx(&jit_queue);
+    }
+
+    /* "lgw_send" */
+    slack = (int64_t)departure - (int64_t)sim_now;
+    record_delay(&st->slack_min, &st->slack_max, &st->slack_sum, st->sent, slack);
+    st->sent += 1;
+    jit_report_tx(&jit_queue, &tv, pkt.count_us);
+    tx_type = pkt_type;
+    tx_start_us = departure;
+    if (pkt_type == JIT_PKT_TYPE_BEACON) {
+        tx_end_us = departure + SIM_BEACON_RESERVED;
+    } else {
+        tx_end_us = departure + 1000ULL * lgw_time_on_air(&pkt);
+    }
+}
+
+/* Generate the next Class A/B/C requests from the traffic model */
+static void sim_generate(uint64_t until) {
+    struct sim_req_s *req;
+    uint64_t period_us;
+    double x;
+
+    /* uplinks, some of them answered by a Class A downlink after network latency */
+    while (next_uplink_us <= until) {
+        nb_uplink += 1;
+        if (prng_uniform() < classa_ratio) {
+            if (pending_nb < SIM_PENDING_MAX) {
+                req = &pending[pending_nb++];
+                req->type = JIT_PKT_TYPE_DOWNLINK_CLASS_A;
+                req->arrival_us = next_uplink_us + ns_lat_min + (uint64_t)(prng_uniform() * (ns_lat_max - ns_lat_min));
+                if (prng_uniform() < rx2_ratio) {
+                    req->target_us = next_uplink_us + SIM_RX2_DELAY_US;
+                    req->datarate = DR_LORA_SF12;
+                } else {
+                    req->target_us = next_uplink_us + SIM_RX1_DELAY_US;
+                    req->datarate = sf_to_dr(7 + (int)(prng_uniform() * 6));
+                }
+                req->bandwidth = BW_125KHZ;
+                req->size = 12 + (uint16_t)(prng_uniform() * 40);
+            } else {
+                nb_pending_overflow += 1;
+            }
+        }
+        next_uplink_us += prng_exp_us(uplink_rate);
+    }
+
+    /* Class B: random ping slot in the next beacon window */
+    while (next_classb_us <= until) {
+        if (pending_nb < SIM_PENDING_MAX) {
+            period_us = 128000000ULL;
+            req = &pending[pending_nb++];
+            req->type = JIT_PKT_TYPE_DOWNLINK_CLASS_B;
+            req->arrival_us = next_classb_us;
+            x = prng_uniform() * SIM_PINGSLOT_NB;
+            req->target_us = (next_classb_us / period_us + 1) * period_us + SIM_BEACON_RESERVED + (uint64_t)x * SIM_PINGSLOT_US;
+            req->datarate = DR_LORA_SF9;
+            req->bandwidth = BW_125KHZ;
+            req->size = 12 + (uint16_t)(prng_uniform() * 40);
+        } else {
+            nb_pending_overflow += 1;
+        }
+        next_classb_us += prng_exp_us(classb_rate);
+    }
+
+    /* Class C: as soon as possible */
+    while (next_classc_us <= until) {
+        if (pending_nb < SIM_PENDING_MAX) {
+            req = &pending[pending_nb++];
+            req->type = JIT_PKT_TYPE_DOWNLINK_CLASS_C;
+            req->arrival_us = next_classc_us;
+            req->target_us = 0;
+            req->datarate = DR_LORA_SF9;
+            req->bandwidth = BW_125KHZ;
+            req->size = 12 + (uint16_t)(prng_uniform() * 40);
+        } else {
+            nb_pending_overflow += 1;
+        }
+        next_classc_us += prng_exp_us(classc_rate);
+    }
+}
+
+/* Read next request from trace file: <arrival_us> <A|B|C> <target_us> <sf> <bw_khz> <size> */
+static bool trace_read(struct sim_req_s *req) {
+    char line[256];
+    unsigned long long arrival, target;
+    char type;
+    int sf, bw, size;
+
+    while (fgets(line, sizeof line, trace_file) != NULL) {
+        trace_line += 1;
+        if ((line[0] == '#') || (line[0] == '\n')) {
+            continue;
+        }
+        if (sscanf(line, "%llu %c %llu %i %i %i", &arrival, &type, &target, &sf, &bw, &size) != 6) {
+            MSG("WARNING: trace line %u ignored, wrong format\n", trace_line);
+            continue;
+        }
+        switch (type) {
+            case 'A': req->type = JIT_PKT_TYPE_DOWNLINK_CLASS_A; break;
+            case 'B': req->type = JIT_PKT_TYPE_DOWNLINK_CLASS_B; break;
+            case 'C': req->type = JIT_PKT_TYPE_DOWNLINK_CLASS_C; break;
+            default:
+                MSG("WARNING: trace line %u ignored, unknown type %c\n", trace_line, type);
+                continue;
+        }
+        req->arrival_us = sim_start_us + arrival;
+        req->target_us = sim_start_us + target;
+        req->datarate = sf_to_dr(sf);
+        req->bandwidth = khz_to_bw(bw);
+        req->size = (uint16_t)size;
+        if ((req->datarate == DR_UNDEFINED) || (req->bandwidth == BW_UNDEFINED) || (size < 0) || (size > 255)) {
+            MSG("WARNING: trace line %u ignored, invalid modulation parameters\n", trace_line);
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Time of the next request to be received by thread_down */
+static uint64_t next_arrival(int *pending_idx) {
+    uint64_t t = SIM_NEVER;
+    int i;
+
+    *pending_idx = -1;
+    if (trace_file != NULL) {
+        return trace_req_valid ? trace_req.arrival_us : SIM_NEVER;
+    }
+    for (i = 0; i < pending_nb; i++) {
+        if (pending[i].arrival_us < t) {
+            t = pending[i].arrival_us;
+            *pending_idx = i;
+        }
+    }
+    /* generators may still produce a request arriving before that */
+    if (next_uplink_us < t) t = next_uplink_us;
+    if (next_classb_us < t) t = next_classb_us;
+    if (next_classc_us < t) t = next_classc_us;
+    return t;
+}
+
+/* Time of the next thread_jit poll that finds something to do: the first poll at which the next
+   queued packet is in the peek window, or is late and dropped. Polls before it are skipped, as
+   jit_peek would return no packet and leave the queue unchanged. */
+static uint64_t next_tick(void) {
+    int32_t delta;
+    int32_t delta_min = INT32_MAX;
+    uint64_t t;
+    int i;
+
+    if (jit_queue.num_pkt == 0) {
+        return SIM_NEVER;
+    }
+    for (i = 0; i < jit_queue.num_pkt; i++) {
+        delta = (int32_t)(jit_queue.nodes[i].pkt.count_us - (uint32_t)sim_now);
+        if (delta < delta_min) {
+            delta_min = delta;
+        }
+    }
+    if (delta_min >= SIM_PEEK_WINDOW_US) {
+        t = sim_now + (uint64_t)(delta_min - SIM_PEEK_WINDOW_US) + 1;
+    } else {
+        t = sim_now + 1;
+    }
+    return ((t + SIM_TICK_US - 1) / SIM_TICK_US) * SIM_TICK_US; /* align on polling grid */
+}
+
+static void print_report(double wall_s) {
+    int i, j;
+    uint32_t nb_req = 0, nb_ok = 0;
+    uint32_t nb_rej;
+    struct sim_class_stats_s *st;
+    uint32_t asap_delay, latency_p50, latency_p99;
+
+    MSG("\n##### JiT simulation: %.2f hours, seed %llu #####\n", sim_hours, (unsigned long long)prng_state);
+    MSG("# wall time: %.3f s (%.0f simulated hours per second), %u polls\n", wall_s, sim_hours / wall_s, nb_peek);
+    if (trace_file == NULL) {
+        MSG("# uplinks: %u, requests lost by generator: %u\n", nb_uplink, nb_pending_overflow);
+    }
+    for (i = 0; i < SIM_CLASS_NB; i++) {
+        st = &stats[i];
+        if (st->requested == 0) {
+            continue;
+        }
+        nb_rej = 0;
+        for (j = 0; j < SIM_JIT_ERROR_NB; j++) {
+            nb_rej += st->rejected[j];
+        }
+        nb_req += st->requested;
+        nb_ok += st->requested - nb_rej;
+        MSG("### [%s] ###\n", class_name[i]);
+        MSG("# requested: %u, accepted: %.2f%%\n", st->requested, 100.0 * (st->requested - nb_rej) / st->requested);
+        for (j = 1; j < SIM_JIT_ERROR_NB; j++) {
+            if (st->rejected[j] > 0) {
+                MSG("# rejected (%s): %u (%.2f%%)\n", error_name[j], st->rejected[j], 100.0 * st->rejected[j] / st->requested);
+            }
+        }
+        MSG("# sent: %u, lost (emitting): %u, lost (overwritten): %u, dropped: %u\n", st->sent, st->lost_emitting, st->lost_overwritten, st->dropped);
+        if (st->sent > 0) {
+            MSG("# scheduling slack: min %.1f ms, avg %.1f ms, max %.1f ms\n", st->slack_min / 1E3, st->slack_sum / st->sent / 1E3, st->slack_max / 1E3);
+        }
+        if ((st->accepted > 0) && (i != JIT_PKT_TYPE_BEACON)) {
+            MSG("# enqueue to departure: min %.1f ms, avg %.1f ms, max %.1f ms\n", st->lead_min / 1E3, st->lead_sum / st->accepted / 1E3, st->lead_max / 1E3);
+        }
+    }
+    jit_asap_get_stats(&jit_queue, &asap_delay, &latency_p50, &latency_p99);
+    MSG("### [JIT] ###\n");
+    MSG("# TX latency: p50 %.1f ms, p99 %.1f ms\n", latency_p50 / 1E3, latency_p99 / 1E3);
+    MSG("# Class C ASAP delay: %u ms\n", asap_delay / 1000);
+    MSG("### [TOTAL] ###\n");
+    if (nb_req > 0) {
+        MSG("# requested: %u, accepted: %.2f%%\n", nb_req, 100.0 * nb_ok / nb_req);
+    } else {
+        MSG("# no downlink requested\n");
+    }
+    MSG("##### END #####\n");
+}
+
+/* Enqueue one request at current virtual time, returns the 64-bit departure time of accepted packets */
+static enum jit_error_e check_enqueue(enum jit_pkt_type_e type, uint64_t target_us, uint8_t datarate, uint64_t *departure) {
+    struct sim_req_s req;
+    struct lgw_pkt_tx_s pkt;
+    struct timeval tv;
+    enum jit_error_e err;
+
+    memset(&req, 0, sizeof req);
+    req.type = type;
+    req.target_us = target_us;
+    req.datarate = datarate;
+    req.bandwidth = BW_125KHZ;
+    req.size = 20;
+    fill_packet(&pkt, &req);
+    sim_time(&tv);
+    err = jit_enqueue(&jit_queue, &tv, &pkt, type);
+    *departure = sim_extend(pkt.count_us);
+    return err;
+}
+
+/* Drive the JiT queue across counter wraps: requests must be accepted,
+   rejected and dequeued exactly as with a 64-bit counter */
+static int check_jit_wraps(uint64_t start_us, unsigned *nb_check) {
+    struct lgw_pkt_tx_s pkt;
+    struct timeval tv;
+    enum jit_pkt_type_e pkt_type;
+    enum jit_error_e err;
+    int pkt_index;
+    int nb_error = 0;
+    int nb_due;
+    uint64_t end_us = start_us + CHECK_NB_WRAPS * 0x100000000ULL;
+    uint64_t rx1_us, asap_us, deadline_us, departure;
+
+    jit_queue_init(&jit_queue);
+    for (sim_now = start_us; sim_now < end_us; sim_now += CHECK_JIT_STEP_US) {
+        /* a request in the past is too late, not 71 minutes ahead */
+        err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_A, sim_now - SIM_RX1_DELAY_US, DR_LORA_SF7, &departure);
+        if (err != JIT_ERROR_TOO_LATE) {
+            MSG("ERROR: counter %llu, request 1s in the past: %s\n", (unsigned long long)sim_now, error_name[err]);
+            nb_error += 1;
+        }
+        /* a request beyond the queue horizon is too early, whichever side of a wrap it is */
+        err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_A, sim_now + CHECK_FAR_US, DR_LORA_SF7, &departure);
+        if (err != JIT_ERROR_TOO_EARLY) {
+            MSG("ERROR: counter %llu, request %us ahead: %s\n", (unsigned long long)sim_now, CHECK_FAR_US / 1000000, error_name[err]);
+            nb_error += 1;
+        }
+        /* RX1 response, and an immediate downlink */
+        nb_due = 0;
+        rx1_us = sim_now + SIM_RX1_DELAY_US;
+        err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_A, rx1_us, DR_LORA_SF7, &departure);
+        if (err == JIT_ERROR_OK) {
+            nb_due += 1;
+        } else {
+            MSG("ERROR: counter %llu, RX1 request: %s\n", (unsigned long long)sim_now, error_name[err]);
+            nb_error += 1;
+        }
+        err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_C, 0, DR_LORA_SF7, &asap_us);
+        if ((err == JIT_ERROR_OK) && (asap_us > sim_now) && (asap_us - sim_now <= 2 * JIT_ASAP_DELAY_CEILING)) {
+            nb_due += 1;
+        } else {
+            MSG("ERROR: counter %llu, immediate request: %s, departure %+lld us\n", (unsigned long long)sim_now, error_name[err], (long long)(asap_us - sim_now));
+            nb_error += 1;
+            if (err == JIT_ERROR_OK) {
+                nb_due += 1;
+            }
+        }
+        *nb_check += 4;
+
+        /* both must be dequeued shortly before their departure time */
+        deadline_us = rx1_us + SIM_PEEK_HORIZON_US;
+        while ((nb_due > 0) && (sim_now < deadline_us)) {
+            sim_now += SIM_TICK_US;
+            sim_time(&tv);
+            if ((jit_peek(&jit_queue, &tv, &pkt_index) != JIT_ERROR_OK) || (pkt_index < 0)) {
+                continue;
+            }
+            if (jit_dequeue(&jit_queue, pkt_index, &pkt, &pkt_type) != JIT_ERROR_OK) {
+                continue;
+            }
+            nb_due -= 1;
+            departure = sim_extend(pkt.count_us);
+            if ((departure < sim_now) || (departure - sim_now > SIM_PEEK_HORIZON_US) ||
+                ((pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_A) && (departure != rx1_us)) ||
+                ((pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_C) && (departure != asap_us))) {
+                MSG("ERROR: counter %llu, %s dequeued for departure %+lld us\n", (unsigned long long)sim_now, class_name[pkt_type], (long long)(departure - sim_now));
+                nb_error += 1;
+            }
+        }
+        if (nb_due > 0) {
+            MSG("ERROR: counter %llu, %d packets never dequeued\n", (unsigned long long)sim_now, nb_due);
+            nb_error += 1;
+            jit_queue_init(&jit_queue);
+        }
+    }
+
+    return nb_error;
+}
+
+/* Airtime booked in the duty-cycle ledger, on the window around current virtual time */
+static uint64_t check_dc_used(void) {
+    struct jit_dc_stats_s dc[JIT_DC_BAND_MAX];
+    struct timeval tv;
+
+    sim_time(&tv);
+    return (jit_duty_cycle_get_stats(&jit_queue, &tv, dc) > 0) ? dc[0].used_us : 0;
+}
+
+/* Fill a 1% duty-cycle budget, the airtime of packets dropped by jit_peek,
+   dequeued but not emitted, or overwritten in the concentrator, must be released */
+static int check_dc_release(uint64_t start_us, unsigned *nb_check) {
+    struct lgw_pkt_tx_s pkt;
+    struct timeval tv;
+    enum jit_pkt_type_e pkt_type;
+    enum jit_error_e err = JIT_ERROR_OK;
+    int pkt_index = -1;
+    int nb_error = 0;
+    int nb_fill = 0;
+    int k;
+    uint64_t departure, used;
+    uint32_t sched_airtime;
+
+    jit_queue_init(&jit_queue);
+    jit_duty_cycle_add_band(&jit_queue, 869400000, 869650000, 1.0, 600);
+    sim_now = start_us;
+
+    /* enqueue SF12 packets until the budget is exceeded */
+    while (nb_fill < JIT_QUEUE_MAX) {
+        err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_A, sim_now + (nb_fill + 1) * CHECK_DC_STEP_US, DR_LORA_SF12, &departure);
+        if (err != JIT_ERROR_OK) {
+            break;
+        }
+        nb_fill += 1;
+    }
+    *nb_check += 1;
+    if ((nb_fill == 0) || (err != JIT_ERROR_DUTY_CYCLE)) {
+        MSG("ERROR: duty-cycle budget filled with %d packets, then %s\n", nb_fill, error_name[err]);
+        return nb_error + 1;
+    }
+
+    /* all packets are missed, and dropped by jit_peek */
+    sim_now += (nb_fill + 1) * CHECK_DC_STEP_US;
+    sim_time(&tv);
+    jit_peek(&jit_queue, &tv, &pkt_index);
+    used = check_dc_used();
+    *nb_check += 1;
+    if ((jit_queue.num_pkt != 0) || (used != 0)) {
+        MSG("ERROR: %u packets left after drop, %llu us of airtime still booked\n", jit_queue.num_pkt, (unsigned long long)used);
+        nb_error += 1;
+    }
+
+    /* the same packets must be accepted again */
+    for (k = 0; k < nb_fill; k++) {
+        err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_A, sim_now + (k + 1) * CHECK_DC_STEP_US, DR_LORA_SF12, &departure);
+        *nb_check += 1;
+        if (err != JIT_ERROR_OK) {
+            MSG("ERROR: packet %d enqueued after drop: %s\n", k, error_name[err]);
+            nb_error += 1;
+        }
+    }
+
+    /* the first one is dequeued, but the concentrator can not emit it */
+    used = check_dc_used();
+    sim_now += CHECK_DC_STEP_US - SIM_TICK_US;
+    sim_time(&tv);
+    if ((jit_peek(&jit_queue, &tv, &pkt_index) != JIT_ERROR_OK) || (pkt_index < 0) ||
+        (jit_dequeue(&jit_queue, pkt_index, &pkt, &pkt_type) != JIT_ERROR_OK)) {
+        MSG("ERROR: first packet not dequeued\n");
+        return nb_error + 1;
+    }
+    jit_cancel_tx(&jit_queue);
+    jit_cancel_tx(&jit_queue); /* released only once */
+    *nb_check += 1;
+    if (used - check_dc_used() != 1000ULL * lgw_time_on_air(&pkt)) {
+        MSG("ERROR: %llu us of airtime released by cancelled TX, instead of %u\n", (unsigned long long)(used - check_dc_used()), 1000 * lgw_time_on_air(&pkt));
+        nb_error += 1;
+    }
+
+    /* so one more packet must be accepted */
+    err = check_enqueue(JIT_PKT_TYPE_DOWNLINK_CLASS_A, sim_now + (nb_fill + 1) * CHECK_DC_STEP_US, DR_LORA_SF12, &departure);
+    *nb_check += 1;
+    if (err != JIT_ERROR_OK) {
+        MSG("ERROR: packet enqueued after cancelled TX: %s\n", error_name[err]);
+        nb_error += 1;
+    }
+
+    /* the second one is programmed, then overwritten by the third one before it is emitted */
+    for (k = 0; k < 2; k++) {
+        sim_now += CHECK_DC_STEP_US;
+        sim_time(&tv);
+        if ((jit_peek(&jit_queue, &tv, &pkt_index) != JIT_ERROR_OK) || (pkt_index < 0) ||
+            (jit_dequeue(&jit_queue, pkt_index, &pkt, &pkt_type) != JIT_ERROR_OK)) {
+            MSG("ERROR: packet %d not dequeued\n", k + 1);
+            return nb_error + 1;
+        }
+        if (k == 0) {
+            jit_report_tx(&jit_queue, &tv, pkt.count_us);
+            sched_airtime = 1000 * lgw_time_on_air(&pkt);
+        }
+    }
+    used = check_dc_used();
+    jit_cancel_scheduled_tx(&jit_queue);
+    jit_cancel_scheduled_tx(&jit_queue); /* released only once */
+    *nb_check += 1;
+    if (used - check_dc_used() != sched_airtime) {
+        MSG("ERROR: %llu us of airtime released by overwritten TX, instead of %u\n", (unsigned long long)(used - check_dc_used()), sched_airtime);
+        nb_error += 1;
+    }
+
+    return nb_error;
+}
+
+/* Drive the clock model with simulated counter samples for several wraps, then
+   a counter reset: the extended counter must follow the true counter, and
+   the timeline stay monotonic */
+static int check_timersync_wraps(unsigned *nb_check, double *max_error) {
+    const double rate = 1.0 + CHECK_TS_PPM / 1E6;
+    const int64_t end_us = CHECK_TS_RESET_US + 2 * 0x100000000LL + CHECK_TS_PERIOD_US; /* 2 more wraps after the reset */
+    int64_t host_us = 0;        /* host time, relative to the first sample */
+    int64_t period_us, t_us;
+    int64_t count_ref = CHECK_TS_START; /* true counter at host_ref, 64 bits */
+    int64_t host_ref = 0;
+    int64_t offset = 0;         /* expected extended counter minus true counter */
+    int64_t truth, last_truth = 0, last_ext = 0, ext, jitter;
+    bool reset_done = false;
+    int nb_error = 0;
+    int nb_reject = 0;
+    int nb_samples = 0;
+    int k;
+    double err;
+    struct timeval host_tv, count_tv;
+
+    while (host_us < end_us) {
+        /* the concentrator counter is reset, it restarts from 0 */
+        if ((reset_done == false) && (host_us >= CHECK_TS_RESET_US)) {
+            offset = (((last_truth >> 32) + 1) << 32);
+            count_ref = 0;
+            host_ref = host_us;
+            reset_done = true;
+        }
+        truth = count_ref + (int64_t)llround(rate * (double)(host_us - host_ref));
+        jitter = (int64_t)lround((2.0 * prng_uniform() - 1.0) * CHECK_TS_JITTER_US);
+        if (timersync_sample(host_us + jitter, (uint32_t)truth, CHECK_TS_JITTER_US) != 0) {
+            nb_reject += 1;
+            host_us += CHECK_TS_FAST_US;
+            continue;
+        }
+        if (reset_done == false) {
+            last_truth = truth;
+        }
+        get_timersync_model(NULL, NULL, NULL, &nb_samples);
+        period_us = (nb_samples < CHECK_TS_FAST_NB) ? CHECK_TS_FAST_US : CHECK_TS_PERIOD_US;
+
+        /* read the extended counter until next sample */
+        for (k = 1; k <= 4; k++) {
+            t_us = host_us + k * period_us / 4;
+            host_tv.tv_sec = (time_t)(t_us / 1000000);
+            host_tv.tv_usec = (suseconds_t)(t_us % 1000000);
+            if (get_concentrator_time(&count_tv, host_tv) != 0) {
+                MSG("ERROR: host time %llds, clock model not valid\n", (long long)(t_us / 1000000));
+                nb_error += 1;
+                continue;
+            }
+            ext = (int64_t)count_tv.tv_sec * 1000000 + count_tv.tv_usec;
+            if ((*nb_check > 0) && (ext <= last_ext)) {
+                MSG("ERROR: host time %llds, concentrator time goes backwards by %lld us\n", (long long)(t_us / 1000000), (long long)(last_ext - ext));
+                nb_error += 1;
+            }
+            last_ext = ext;
+            *nb_check += 1;
+            if (nb_samples < CHECK_TS_FAST_NB) {
+                continue; /* drift not estimated yet */
+            }
+            truth = offset + count_ref + (int64_t)llround(rate * (double)(t_us - host_ref));
+            err = fabs((double)(ext - truth));
+            if (err > *max_error) {
+                *max_error = err;
+            }
+            if (err > CHECK_TS_TOLERANCE) {
+                MSG("ERROR: host time %llds, extended counter %lld instead of %lld\n", (long long)(t_us / 1000000), (long long)ext, (long long)truth);
+                nb_error += 1;
+            }
+        }
+        host_us += period_us;
+    }
+
+    /* a counter reset is only accepted after TS_MAX_REJECT (3) consecutive outliers */
+    if (nb_reject != 2) {
+        MSG("ERROR: %d samples rejected, 2 expected after counter reset\n", nb_reject);
+        nb_error += 1;
+    }
+    if ((last_ext >> 32) < CHECK_NB_WRAPS) {
+        MSG("ERROR: only %lld counter epochs crossed\n", (long long)(last_ext >> 32));
+        nb_error += 1;
+    }
+
+    return nb_error;
+}
+
+/* Feed the clock model with one more sample, 60s after the previous one */
+static void bench_sample(void) {
+    struct bench_model_s m;
+
+    bench_host_us += CHECK_TS_PERIOD_US;
+    timersync_sample(bench_host_us, (uint32_t)llround((1.0 + CHECK_TS_PPM / 1E6) * (double)bench_host_us), 1.0);
+    if (bench_use_mutex == true) {
+        /* baseline: same model, published under a mutex as before the seqlock */
+        m.valid = (get_timersync_model(&m.ppm, &m.residual, &m.uncertainty, &m.nb_samples) == 0);
+        m.host_ref = bench_host_us;
+        m.count_ref = llround((1.0 + CHECK_TS_PPM / 1E6) * (double)bench_host_us);
+        pthread_mutex_lock(&mx_bench);
+        bench_model = m;
+        pthread_mutex_unlock(&mx_bench);
+    }
+}
+
+/* Same extrapolation as get_concentrator_time, from the mutex protected model */
+static int bench_mutex_time(struct timeval *concent_time, struct timeval host_time) {
+    struct bench_model_s m;
+    int64_t host_us, count_us;
+
+    pthread_mutex_lock(&mx_bench);
+    m = bench_model;
+    pthread_mutex_unlock(&mx_bench);
+    if (m.valid == false) {
+        return -1;
+    }
+    host_us = (int64_t)host_time.tv_sec * 1000000 + host_time.tv_usec;
+    count_us = m.count_ref + (int64_t)((1.0 + m.ppm / 1E6) * (double)(host_us - m.host_ref));
+    concent_time->tv_sec = (time_t)(count_us / 1000000);
+    concent_time->tv_usec = (suseconds_t)(count_us % 1000000);
+    return 0;
+}
+
+/* Reader thread, as thread_jit and thread_down: get concentrator time as fast as possible */
+static void *bench_reader(void *arg) {
+    struct bench_reader_s *r = (struct bench_reader_s *)arg;
+    struct timeval host_tv, count_tv;
+    int ret;
+
+    while (__atomic_load_n(&bench_stop, __ATOMIC_RELAXED) == false) {
+        get_host_time(&host_tv);
+        if (bench_use_mutex == true) {
+            ret = bench_mutex_time(&count_tv, host_tv);
+        } else {
+            ret = get_concentrator_time(&count_tv, host_tv);
+        }
+        r->nb_read += 1;
+        if (ret != 0) {
+            r->nb_fail += 1;
+        }
+    }
+    return NULL;
+}
+
+/* Run readers for BENCH_DURATION_MS, with a writer updating the model back to back if busy */
+static int bench_run(int nb_readers, bool use_mutex, bool busy) {
+    struct bench_reader_s readers[BENCH_READERS_MAX];
+    struct timespec start, now;
+    double elapsed_ns;
+    uint64_t nb_read = 0, nb_fail = 0;
+    int i;
+
+    bench_use_mutex = use_mutex;
+    bench_sample();
+    bench_nb_update = 0;
+    __atomic_store_n(&bench_stop, false, __ATOMIC_RELAXED);
+    memset(readers, 0, sizeof readers);
+    for (i = 0; i < nb_readers; i++) {
+        if (pthread_create(&readers[i].thread, NULL, bench_reader, &readers[i]) != 0) {
+            MSG("ERROR: impossible to create reader thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* this thread is the writer, as thread_timersync */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        if (busy == true) {
+            bench_sample();
+            bench_nb_update += 1;
+        } else {
+            usleep(1000);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ns = 1E9 * (double)(now.tv_sec - start.tv_sec) + (double)(now.tv_nsec - start.tv_nsec);
+    } while (elapsed_ns < 1E6 * BENCH_DURATION_MS);
+    __atomic_store_n(&bench_stop, true, __ATOMIC_RELAXED);
+
+    for (i = 0; i < nb_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        nb_read += readers[i].nb_read;
+        nb_fail += readers[i].nb_fail;
+    }
+
+    MSG("%-7s %2d readers, %s writer: %7.1f ns/read, %6.2f Mreads/s", use_mutex ? "mutex" : "seqlock",
+        nb_readers, busy ? "busy" : "idle", elapsed_ns * nb_readers / (double)nb_read, 1E3 * (double)nb_read / elapsed_ns);
+    if (busy == true) {
+        MSG(", %.0f updates/s", 1E9 * (double)bench_nb_update / elapsed_ns);
+    }
+    MSG("\n");
+    if (nb_fail > 0) {
+        MSG("ERROR: %llu reads found no valid clock model\n", (unsigned long long)nb_fail);
+        return -1;
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    int i;
+    unsigned long long ull;
+    unsigned lat_min, lat_max;
+    uint64_t end_us;
+    uint64_t t_arrival, t_tick;
+    int pending_idx;
+    struct sim_req_s req;
+    struct timespec wall_start, wall_end;
+    uint64_t seed;
+    unsigned nb_check;
+    int nb_error;
+    double max_error;
+
+    /* parse command line options */
+    while ((i = getopt (argc, argv, "hd:s:t:u:a:r:B:C:b:l:A:f:vTS:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return EXIT_FAILURE;
+
+            case 'd': /* -d <float> simulated duration in hours */
+                i = sscanf(optarg, "%lf", &sim_hours);
+                if ((i != 1) || (sim_hours <= 0.0)) {
+                    MSG("ERROR: invalid duration\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 's': /* -s <uint> random generator seed */
+                i = sscanf(optarg, "%llu", &ull);
+                if ((i != 1) || (ull == 0)) {
+                    MSG("ERROR: invalid seed\n");
+                    return EXIT_FAILURE;
+                }
+                prng_state = ull;
+                break;
+
+            case 't': /* -t <uint> initial concentrator counter */
+                i = sscanf(optarg, "%llu", &ull);
+                if (i != 1) {
+                    MSG("ERROR: invalid initial counter value\n");
+                    return EXIT_FAILURE;
+                }
+                sim_start_us = ull;
+                break;
+
+            case 'u': /* -u <float> uplink rate */
+                i = sscanf(optarg, "%lf", &uplink_rate);
+                if ((i != 1) || (uplink_rate < 0.0)) {
+                    MSG("ERROR: invalid uplink rate\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'a': /* -a <float> Class A ratio */
+                i = sscanf(optarg, "%lf", &classa_ratio);
+                if ((i != 1) || (classa_ratio < 0.0) || (classa_ratio > 1.0)) {
+                    MSG("ERROR: invalid Class A ratio\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'r': /* -r <float> RX2 ratio */
+                i = sscanf(optarg, "%lf", &rx2_ratio);
+                if ((i != 1) || (rx2_ratio < 0.0) || (rx2_ratio > 1.0)) {
+                    MSG("ERROR: invalid RX2 ratio\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'B': /* -B <float> Class B rate */
+                i = sscanf(optarg, "%lf", &classb_rate);
+                if ((i != 1) || (classb_rate < 0.0)) {
+                    MSG("ERROR: invalid Class B rate\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'C': /* -C <float> Class C rate */
+                i = sscanf(optarg, "%lf", &classc_rate);
+                if ((i != 1) || (classc_rate < 0.0)) {
+                    MSG("ERROR: invalid Class C rate\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'b': /* -b <uint> beacon period */
+                i = sscanf(optarg, "%u", &beacon_period);
+                if ((i != 1) || ((beacon_period > 0) && (beacon_period < 6))) {
+                    MSG("ERROR: invalid beacon period, must be >= 6s\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'l': /* -l <uint>:<uint> network server latency range */
+                i = sscanf(optarg, "%u:%u", &lat_min, &lat_max);
+                if ((i != 2) || (lat_min > lat_max)) {
+                    MSG("ERROR: invalid latency range\n");
+                    return EXIT_FAILURE;
+                }
+                ns_lat_min = lat_min * 1000;
+                ns_lat_max = lat_max * 1000;
+                break;
+
+            case 'A': /* -A <uint>:<uint> Class C ASAP delay bounds */
+                i = sscanf(optarg, "%u:%u", &lat_min, &lat_max);
+                if ((i != 2) || (lat_min > lat_max)) {
+                    MSG("ERROR: invalid ASAP delay bounds\n");
+                    return EXIT_FAILURE;
+                }
+                asap_floor = lat_min * 1000;
+                asap_ceiling = lat_max * 1000;
+                break;
+
+            case 'f': /* -f <path> trace file */
+                trace_file = fopen(optarg, "r");
+                if (trace_file == NULL) {
+                    MSG("ERROR: impossible to open trace file %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            case 'T': /* -T self-checks */
+                self_check = true;
+                break;
+
+            case 'S': /* -S <uint> contention benchmark readers */
+                i = sscanf(optarg, "%d", &bench_readers);
+                if ((i != 1) || (bench_readers < 1) || (bench_readers > BENCH_READERS_MAX)) {
+                    MSG("ERROR: invalid number of reader threads, must be 1 to %d\n", BENCH_READERS_MAX);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            default:
+                MSG("ERROR: argument parsing failure, use -h option for help\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* JiT queue traces are only useful when debugging a short run, report goes to stderr */
+    if (verbose == false) {
+        if (freopen("/dev/null", "w", stdout) == NULL) {
+            MSG("WARNING: failed to silence JiT queue traces\n");
+        }
+    }
+
+    /* counter wrap self-checks, report goes to stderr */
+    if (self_check == true) {
+        nb_check = 0;
+        nb_error = check_jit_wraps(sim_start_us, &nb_check);
+        MSG("counter wraps, JiT queue: %u checks from counter %llu, %d errors\n", nb_check, (unsigned long long)sim_start_us, nb_error);
+        nb_check = 0;
+        i = check_dc_release(sim_start_us, &nb_check);
+        MSG("duty-cycle ledger: %u checks, %d errors\n", nb_check, i);
+        nb_error += i;
+        nb_check = 0;
+        max_error = 0.0;
+        i = check_timersync_wraps(&nb_check, &max_error);
+        MSG("counter wraps, clock model: %u checks, max error %.1f us, %d errors\n", nb_check, max_error, i);
+        nb_error += i;
+        return (nb_error == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* clock model contention benchmark, report goes to stderr */
+    if (bench_readers > 0) {
+        for (i = 0; i < 16; i++) {
+            bench_sample();
+        }
+        nb_error = 0;
+        nb_error += bench_run(bench_readers, false, false);
+        nb_error += bench_run(bench_readers, true, false);
+        nb_error += bench_run(bench_readers, false, true);
+        nb_error += bench_run(bench_readers, true, true);
+        return (nb_error == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* initialize simulation */
+    seed = prng_state;
+    jit_queue_init(&jit_queue);
+    if (jit_asap_set_bounds(&jit_queue, asap_floor, asap_ceiling) != JIT_ERROR_OK) {
+        MSG("ERROR: invalid ASAP delay bounds\n");
+        return EXIT_FAILURE;
+    }
+    sim_now = sim_start_us;
+    end_us = sim_start_us + (uint64_t)(sim_hours * 3600.0 * 1E6);
+    memset(stats, 0, sizeof stats);
+    if (trace_file != NULL) {
+        trace_req_valid = trace_read(&trace_req);
+    } else {
+        if (uplink_rate > 0.0) next_uplink_us = sim_now + prng_exp_us(uplink_rate);
+        if (classb_rate > 0.0) next_classb_us = sim_now + prng_exp_us(classb_rate);
+        if (classc_rate > 0.0) next_classc_us = sim_now + prng_exp_us(classc_rate);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    /* main loop: jump from one event to the next on the virtual clock */
+    while (sim_now < end_us) {
+        sim_beacons();
+
+        t_arrival = next_arrival(&pending_idx);
+        t_tick = next_tick();
+        if ((t_arrival == SIM_NEVER) && (t_tick == SIM_NEVER)) {
+            break; /* nothing left to do */
+        }
+
+        if (t_tick <= t_arrival) {
+            sim_now = (t_tick > sim_now) ? t_tick : sim_now;
+            if (sim_now >= end_us) {
+                break;
+            }
+            sim_jit_tick();
+            continue;
+        }
+
+        sim_now = (t_arrival > sim_now) ? t_arrival : sim_now;
+        if (sim_now >= end_us) {
+            break;
+        }
+        if (trace_file != NULL) {
+            req = trace_req;
+            sim_enqueue(&req);
+            trace_req_valid = trace_read(&trace_req);
+        } else if ((pending_idx >= 0) && (pending[pending_idx].arrival_us <= sim_now)) {
+            req = pending[pending_idx];
+            pending[pending_idx] = pending[--pending_nb];
+            sim_enqueue(&req);
+        } else {
+            sim_generate(sim_now);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    prng_state = seed;
+    print_report((double)(wall_end.tv_sec - wall_start.tv_sec) + 1E-9 * (double)(wall_end.tv_nsec - wall_start.tv_nsec));
+
+    if (trace_file != NULL) {
+        fclose(trace_file);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,1221 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2017 Semtech-Cycleo
+
+Description:
+    JSON parsing benchmark
+    Measures the cost of the packet forwarder JSON library (parson) on the
+    documents exchanged with the server and on configuration files, parsing,
+    looking up values and serializing, and checks its number conversions
+    Measures and checks the Base64 encoding of payloads, for each implementation
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+Maintainer: Michael Coracin
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf, fprintf */
+#include <unistd.h>     /* getopt */
+
+#include <string.h>     /* memcpy, strlen */
+#include <time.h>       /* clock_gettime */
+#include <stdlib.h>     /* exit codes, malloc, free, strtod, rand */
+#include <math.h>       /* isfinite */
+
+#include "parson.h"
+#include "base64.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define MSG(args...)    fprintf(stderr, args) /* message that is destined to the user */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define BENCH_DEFAULT_ITER  100000      /* default number of iterations of each benchmark */
+#define BENCH_ARENA_SIZE    (1 << 20)   /* arena size, large enough for big configuration files */
+#define BENCH_MAX_PATHS     4096        /* maximum number of values looked up */
+#define BENCH_PATH_SIZE     128         /* maximum size of a dotted path */
+#define BENCH_MAX_CHANNELS  720         /* maximum number of channels of a generated configuration (960 names per object) */
+#define BENCH_INDEX_DEFAULT 16          /* default parson hash index threshold */
+#define BENCH_SERIAL_SIZE   (1 << 20)   /* serialization buffer size */
+#define CHECK_NB_RANDOM     200000      /* number of random numbers checked by the self-check */
+#define CHECK_B64_BLOCKS    4096        /* Base64 blocks per buffer when checking all 2^24 blocks */
+#define CHECK_B64_MAX_SIZE  1024        /* Base64 round trips are checked for all sizes up to this one */
+#define CHECK_B64_INVALID   96          /* invalid characters are checked for all sizes up to this one */
+#define CHECK_INDEX_MIN     4           /* parson hash index threshold of the self-check, to index small objects */
+#define CHECK_INDEX_NAMES   100         /* names added one by one to an object, growing it past several resizes */
+#define CHECK_INDEX_CHAN    16          /* channels of the configuration looked up by the self-check */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+struct bench_result_s {
+    double ns;                  /* time per iteration, in ns */
+    double allocs;              /* heap allocations per iteration */
+    double arena_allocs;        /* arena allocations per iteration */
+    size_t arena_bytes;         /* arena bytes used by one iteration */
+};
+
+struct check_sax_s {
+    const char *stop_name;      /* the key handler of this name returns stop_result, NULL for none */
+    int stop_result;            /* JSONSaxStop or JSONSaxAbort */
+    bool stopped;               /* set when the key handler has returned stop_result */
+    unsigned nb_keys;           /* keys received, including the stopping one */
+    unsigned nb_late;           /* events received after the parsing was stopped */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* typical downlink request, as sent by a network server */
+static const char pull_resp_sample[] = "{\"txpk\":{\"imme\":false,\"tmst\":3512348611,\"freq\":869.525,\"rfch\":0,\"powe\":14,"
+    "\"modu\":\"LORA\",\"datr\":\"SF9BW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":32,\"ncrc\":true,"
+    "\"data\":\"YHBhYUoAAQABeAXhX3s0nb/v3w3GkB4xZsy3Xx7g6Qs=\"}}";
+
+/* typical status report, as received by a network server */
+static const char status_sample[] = "{\"stat\":{\"time\":\"2017-05-12 09:41:07 GMT\",\"lati\":46.24000,\"long\":3.25230,"
+    "\"alti\":145,\"rxnb\":127,\"rxok\":121,\"rxfw\":121,\"ackr\":100.0,\"dwnb\":12,\"txnb\":12,"
+    "\"uprt\":[18.3,22.1,41.9,63.0],\"dwrt\":[17.9,21.4,39.6,58.2],\"rxch\":["
+    "{\"chan\":0,\"freq\":868.100000,\"rxnb\":35,\"rxok\":33,\"rxbd\":2,\"byte\":812,\"toa\":2311,\"occu\":0.77},"
+    "{\"chan\":1,\"freq\":868.300000,\"rxnb\":31,\"rxok\":30,\"rxbd\":1,\"byte\":705,\"toa\":1984,\"occu\":0.66},"
+    "{\"chan\":2,\"freq\":868.500000,\"rxnb\":33,\"rxok\":32,\"rxbd\":1,\"byte\":751,\"toa\":2130,\"occu\":0.71},"
+    "{\"chan\":3,\"freq\":867.100000,\"rxnb\":28,\"rxok\":26,\"rxbd\":2,\"byte\":633,\"toa\":1770,\"occu\":0.59}],"
+    "\"rxdr\":[{\"datr\":\"SF7BW125\",\"rxnb\":96,\"rxok\":92,\"rxbd\":4,\"byte\":2180,\"toa\":5120},"
+    "{\"datr\":\"SF12BW125\",\"rxnb\":31,\"rxok\":29,\"rxbd\":2,\"byte\":721,\"toa\":3075}]}}";
+
+/* numbers checked against strtod, and documents which must be rejected */
+static const char *check_numbers[] = {
+    "0", "-0", "1", "-1", "7", "3512348611", "4294967295", "123456789012345", "-123456789012345",
+    "1234567890123456", "9007199254740991", "9007199254740992", "9007199254740993", "18446744073709551616",
+    "0.1", "0.2", "0.3", "-0.5", "868.1", "869.525", "902.3", "-166.0", "46.24000", "3.25230", "100.0",
+    "0.000001", "0.0000000000000000000001", "1.000000000000000000", "123.4560", "123.456e-5", "0.1e1",
+    "1e22", "1e23", "1E5", "1e+5", "1e-22", "1e-23", "5e-324", "4.9e-324", "2.4703282292062327e-324",
+    "2.2250738585072014e-308", "2.2250738585072011e-308", "1.7976931348623157e308", "1.7976931348623159e308",
+    "1e400", "-1e400", "1e-400", "9007199254740993.0", "0.30000000000000004", "3.141592653589793238462643383279",
+    "1.", "-0.0", "0.0e10", "1e0", "1e-0", "12345678901234567890123456789"
+};
+/* payload sizes of the Base64 benchmark, up to the largest LoRa payload */
+static const int b64_sizes[] = { 16, 32, 51, 64, 128, 222, 255 };
+
+static const char *check_rejected[] = {
+    "[01]", "[-01]", "[00]", "[0e5]", "[-0e5]", "[0x10]", "[-0x10]", "[-]", "[.5]", "[1e]", "[1.5.3]", "[1a]"
+};
+
+static uint32_t nb_malloc = 0;  /* heap allocations made by parson */
+static uint32_t nb_events = 0;  /* events of the streaming parser */
+
+static char arena_buf[BENCH_ARENA_SIZE];
+
+static char paths[BENCH_MAX_PATHS][BENCH_PATH_SIZE]; /* dotted paths of all values of the document */
+static int nb_paths = 0;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+void usage(void);
+
+static void * counting_malloc(size_t size);
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end);
+
+static int bench_parse(const char *json, bool use_arena, unsigned nb_iter, struct bench_result_s *res);
+
+static int count_event(void *context);
+
+static int count_key(void *context, const char *string, size_t len);
+
+static int count_number(void *context, double number);
+
+static int count_boolean(void *context, int boolean);
+
+static int bench_sax(const char *json, unsigned nb_iter, struct bench_result_s *res);
+
+static char * generate_config(int nb_chan);
+
+static void collect_paths(const JSON_Object *object, const char *prefix);
+
+static int bench_lookup(const char *json, size_t index_threshold, unsigned nb_iter, struct bench_result_s *res);
+
+static int bench_serialize(const char *json, bool to_string, unsigned nb_iter, struct bench_result_s *res);
+
+static bool check_number(const char *number);
+
+static bool check_format(double number);
+
+static int check_buffer_size(const char *json, bool is_pretty);
+
+static int check_lookup(const JSON_Object *object, const char *name, size_t n);
+
+static int check_index(const JSON_Object *object);
+
+static int check_object_index(void);
+
+static int check_sax_event(void *context);
+
+static int check_sax_key(void *context, const char *string, size_t len);
+
+static int check_sax_string(void *context, const char *string, size_t len);
+
+static int check_sax_number(void *context, double number);
+
+static int check_sax_boolean(void *context, int boolean);
+
+static int check_sax_parity(const char *json);
+
+static int check_sax(void);
+
+static int self_check(void);
+
+static char b64_ref_char(uint32_t code);
+
+static int check_base64(enum b64_impl_e impl);
+
+static void bench_base64(unsigned nb_iter);
+
+static void print_result(const char *name, const struct bench_result_s *res);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+void usage(void) {
+    MSG("Usage: util_json_bench {options}\n");
+    MSG("Available options:\n");
+    MSG(" -h print this help\n");
+    MSG(" -n <uint> number of iterations of each benchmark (default %u)\n", BENCH_DEFAULT_ITER);
+    MSG(" -f <path> JSON file to benchmark (with comments), instead of a typical PULL_RESP\n");
+    MSG(" -c <int> benchmark a generated configuration with this number of LoRa channels [1..%d]\n", BENCH_MAX_CHANNELS);
+    MSG(" -s benchmark a typical status report instead of a PULL_RESP\n");
+    MSG(" -b benchmark Base64 encoding and decoding of payloads, for each implementation, then exit\n");
+    MSG(" -t check number parsing and serialization against strtod, object name lookups, the streaming parser, and Base64 round trips, then exit\n");
+}
+
+static void * counting_malloc(size_t size) {
+    nb_malloc += 1;
+    return malloc(size);
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return 1E9 * (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+/* Parse (with comments, as the packet forwarder does) and release a document nb_iter times */
+static int bench_parse(const char *json, bool use_arena, unsigned nb_iter, struct bench_result_s *res) {
+    JSON_Arena arena;
+    JSON_Value *root_val;
+    struct timespec start, end;
+    unsigned i;
+
+    json_arena_init(&arena, arena_buf, sizeof arena_buf);
+    nb_malloc = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nb_iter; i++) {
+        if (use_arena) {
+            json_arena_reset(&arena);
+            root_val = json_parse_string_with_comments_arena(json, &arena);
+        } else {
+            root_val = json_parse_string_with_comments(json);
+        }
+        if (root_val == NULL) {
+            MSG("ERROR: failed to parse JSON%s\n", arena.overflow ? " (arena too small)" : "");
+            return -1;
+        }
+        json_value_free(root_val);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    res->ns = elapsed_ns(&start, &end) / nb_iter;
+    res->allocs = (double)nb_malloc / nb_iter;
+    res->arena_allocs = (double)arena.nb_allocs;
+    res->arena_bytes = arena.used;
+    return 0;
+}
+
+static int count_event(void *context) {
+    (void)context;
+    nb_events += 1;
+    return JSONSaxContinue;
+}
+
+static int count_key(void *context, const char *string, size_t len) {
+    (void)string;
+    (void)len;
+    return count_event(context);
+}
+
+static int count_number(void *context, double number) {
+    (void)number;
+    return count_event(context);
+}
+
+static int count_boolean(void *context, int boolean) {
+    (void)boolean;
+    return count_event(context);
+}
+
+/* Parse (with comments) with the streaming parser, counting events; the document is copied as
+   comments are removed in place, as the tree parser does */
+static int bench_sax(const char *json, unsigned nb_iter, struct bench_result_s *res) {
+    static const JSON_Sax sax = {count_event, count_event, count_event, count_event, count_key, count_key, count_number, count_boolean, count_event};
+    char scratch[4096];
+    size_t size = strlen(json) + 1;
+    char *copy;
+    struct timespec start, end;
+    unsigned i;
+
+    copy = malloc(size);
+    if (copy == NULL) {
+        return -1;
+    }
+    nb_malloc = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nb_iter; i++) {
+        memcpy(copy, json, size);
+        if (json_parse_string_with_comments_sax(copy, &sax, NULL, scratch, sizeof scratch) != JSONSuccess) {
+            MSG("ERROR: failed to parse JSON\n");
+            free(copy);
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(copy);
+
+    res->ns = elapsed_ns(&start, &end) / nb_iter;
+    res->allocs = (double)nb_malloc / nb_iter;
+    res->arena_allocs = 0;
+    res->arena_bytes = 0;
+    return 0;
+}
+
+/* Generate a concentrator configuration with nb_chan multi-SF channels, 4 per radio */
+static char * generate_config(int nb_chan) {
+    size_t size = 4096 + 160 * (size_t)nb_chan;
+    size_t len = 0;
+    char *json;
+    int i;
+
+    json = malloc(size);
+    if (json == NULL) {
+        return NULL;
+    }
+    len += snprintf(json + len, size - len, "{\"SX1301_conf\": {\"lorawan_public\": true, \"clksrc\": 1, \"antenna_gain\": 0");
+    for (i = 0; i < (nb_chan + 3) / 4; i++) {
+        len += snprintf(json + len, size - len, ", \"radio_%d\": {\"enable\": true, \"type\": \"SX1257\", \"freq\": %d, "
+                        "\"rssi_offset\": -166.0, \"tx_enable\": %s}", i, 902700000 + i * 800000, (i % 2) ? "false" : "true");
+    }
+    for (i = 0; i < nb_chan; i++) {
+        len += snprintf(json + len, size - len, ", \"chan_multiSF_%d\": {\"enable\": true, \"radio\": %d, \"if\": %d}",
+                        i, i / 4, -300000 + (i % 4) * 200000);
+    }
+    for (i = 0; i < 16; i++) {
+        len += snprintf(json + len, size - len, ", \"tx_lut_%d\": {\"pa_gain\": %d, \"mix_gain\": %d, \"rf_power\": %d, "
+                        "\"dig_gain\": 0}", i, i / 4, 8 + (i % 8), -6 + 2 * i);
+    }
+    snprintf(json + len, size - len, "}, \"gateway_conf\": {\"gateway_ID\": \"AA555A0000000000\", "
+             "\"server_address\": \"localhost\", \"serv_port_up\": 1680, \"serv_port_down\": 1680, "
+             "\"keepalive_interval\": 10, \"stat_interval\": 30, \"push_timeout_ms\": 100, "
+             "\"forward_crc_valid\": true, \"forward_crc_error\": false, \"forward_crc_disabled\": false}}");
+    return json;
+}
+
+/* Record the dotted path of every value of an object, recursively */
+static void collect_paths(const JSON_Object *object, const char *prefix) {
+    const char *name;
+    char path[BENCH_PATH_SIZE];
+    size_t i;
+    int len;
+
+    for (i = 0; i < json_object_get_count(object); i++) {
+        name = json_object_get_name(object, i);
+        if (strchr(name, '.') != NULL) {
+            continue; /* cannot be looked up with a dotted path */
+        }
+        len = snprintf(path, sizeof path, "%s%s%s", prefix, (prefix[0] != '\0') ? "." : "", name);
+        if ((len < 0) || (len >= (int)sizeof path)) {
+            continue;
+        }
+        if (json_value_get_type(json_object_get_value(object, name)) == JSONObject) {
+            collect_paths(json_object_get_object(object, name), path);
+        } else if (nb_paths < BENCH_MAX_PATHS) {
+            strcpy(paths[nb_paths++], path);
+        }
+    }
+}
+
+/* Look up all the values of a document by dotted path, as the configuration parsers do */
+static int bench_lookup(const char *json, size_t index_threshold, unsigned nb_iter, struct bench_result_s *res) {
+    JSON_Value *root_val;
+    JSON_Object *root_obj;
+    struct timespec start, end;
+    unsigned i;
+    int j;
+
+    json_set_object_index_threshold(index_threshold);
+    root_val = json_parse_string_with_comments(json);
+    root_obj = json_value_get_object(root_val);
+    if (root_obj == NULL) {
+        MSG("ERROR: failed to parse JSON object\n");
+        json_value_free(root_val);
+        return -1;
+    }
+    nb_paths = 0;
+    collect_paths(root_obj, "");
+    if (nb_paths == 0) {
+        MSG("ERROR: no value to look up\n");
+        json_value_free(root_val);
+        return -1;
+    }
+
+    nb_malloc = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nb_iter; i++) {
+        for (j = 0; j < nb_paths; j++) {
+            if (json_object_dotget_value(root_obj, paths[j]) == NULL) {
+                MSG("ERROR: %s not found\n", paths[j]);
+                json_value_free(root_val);
+                return -1;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    res->ns = elapsed_ns(&start, &end) / ((double)nb_iter * nb_paths);
+    res->allocs = (double)nb_malloc / ((double)nb_iter * nb_paths);
+    res->arena_allocs = 0;
+    res->arena_bytes = 0;
+    json_value_free(root_val);
+    json_set_object_index_threshold(BENCH_INDEX_DEFAULT);
+    return 0;
+}
+
+/* Serialize a parsed document, in a buffer or in an allocated string */
+static int bench_serialize(const char *json, bool to_string, unsigned nb_iter, struct bench_result_s *res) {
+    static char buf[BENCH_SERIAL_SIZE];
+    JSON_Value *root_val;
+    JSON_Writer writer;
+    char *str;
+    struct timespec start, end;
+    unsigned i;
+
+    root_val = json_parse_string_with_comments(json);
+    if ((root_val == NULL) || (json_serialization_size(root_val) > sizeof buf)) {
+        MSG("ERROR: failed to parse JSON or serialization too large\n");
+        json_value_free(root_val);
+        return -1;
+    }
+    nb_malloc = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nb_iter; i++) {
+        if (to_string) {
+            str = json_serialize_to_string(root_val);
+            if (str == NULL) {
+                MSG("ERROR: failed to serialize JSON\n");
+                json_value_free(root_val);
+                return -1;
+            }
+            json_free_serialized_string(str);
+        } else {
+            json_writer_init(&writer, buf, sizeof buf, NULL, NULL);
+            if ((json_serialize_to_writer(&writer, root_val) != JSONSuccess) || (json_writer_append(&writer, "", 1) != JSONSuccess)) {
+                MSG("ERROR: failed to serialize JSON\n");
+                json_value_free(root_val);
+                return -1;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    res->ns = elapsed_ns(&start, &end) / nb_iter;
+    res->allocs = (double)nb_malloc / nb_iter;
+    res->arena_allocs = 0;
+    res->arena_bytes = 0;
+    json_value_free(root_val);
+    return 0;
+}
+
+/* Parse a number in an array, the result must be bitwise identical to strtod */
+static bool check_number(const char *number) {
+    char doc[128];
+    JSON_Value *root_val;
+    double expected, parsed;
+
+    snprintf(doc, sizeof doc, "[%s]", number);
+    expected = strtod(number, NULL);
+    root_val = json_parse_string(doc);
+    if (json_value_get_type(json_array_get_value(json_value_get_array(root_val), 0)) != JSONNumber) {
+        printf("FAIL: %s not parsed\n", number);
+        json_value_free(root_val);
+        return false;
+    }
+    parsed = json_array_get_number(json_value_get_array(root_val), 0);
+    json_value_free(root_val);
+    if (memcmp(&parsed, &expected, sizeof parsed) != 0) {
+        printf("FAIL: %s parsed as %.17g, strtod gives %.17g\n", number, parsed, expected);
+        return false;
+    }
+    return true;
+}
+
+/* Serialize a number, it must be parsed back to the same double, with the fewest significant digits */
+static bool check_format(double number) {
+    char out[64], shortest[64];
+    JSON_Value *val;
+    double parsed;
+    int precision;
+
+    val = json_value_init_number(number);
+    if ((val == NULL) || (json_serialize_to_buffer(val, out, sizeof out) != JSONSuccess)) {
+        printf("FAIL: %.17g not serialized\n", number);
+        json_value_free(val);
+        return false;
+    }
+    json_value_free(val);
+    if (!isfinite(number)) {
+        if (strcmp(out, "null") != 0) {
+            printf("FAIL: %.17g serialized as %s\n", number, out);
+            return false;
+        }
+        return true;
+    }
+    parsed = strtod(out, NULL);
+    if (parsed != number) {
+        printf("FAIL: %.17g serialized as %s, parsed back as %.17g\n", number, out, parsed);
+        return false;
+    }
+    if (number == floor(number)) {
+        return true; /* written in full */
+    }
+    for (precision = 1; precision <= 17; precision++) {
+        snprintf(shortest, sizeof shortest, "%.*g", precision, number);
+        if (strtod(shortest, NULL) == number) {
+            break;
+        }
+    }
+    if (strlen(out) > strlen(shortest)) {
+        printf("FAIL: %.17g serialized as %s, %s is shorter\n", number, out, shortest);
+        return false;
+    }
+    return true;
+}
+
+/* Serialize in buffers one byte too small and just large enough, a too small buffer must be left untouched */
+static int check_buffer_size(const char *json, bool is_pretty) {
+    static char buf[BENCH_SERIAL_SIZE];
+    JSON_Value *root_val;
+    JSON_Status status;
+    size_t needed, i;
+    int nb_fail = 0;
+
+    root_val = json_parse_string(json);
+    needed = is_pretty ? json_serialization_size_pretty(root_val) : json_serialization_size(root_val);
+    if ((needed == 0) || (needed > sizeof buf)) {
+        printf("FAIL: serialization size of %s\n", json);
+        json_value_free(root_val);
+        return 1;
+    }
+
+    memset(buf, 'x', needed);
+    status = is_pretty ? json_serialize_to_buffer_pretty(root_val, buf, needed - 1) : json_serialize_to_buffer(root_val, buf, needed - 1);
+    for (i = 0; (i < needed) && (buf[i] == 'x'); ++i);
+    if ((status == JSONSuccess) || (i < needed)) {
+        printf("FAIL: %s serialization in %u bytes instead of %u %s\n", is_pretty ? "pretty" : "compact", (unsigned)(needed - 1), (unsigned)needed, (status == JSONSuccess) ? "succeeded" : "wrote the buffer");
+        nb_fail += 1;
+    }
+
+    status = is_pretty ? json_serialize_to_buffer_pretty(root_val, buf, needed) : json_serialize_to_buffer(root_val, buf, needed);
+    if ((status != JSONSuccess) || (strlen(buf) != (needed - 1))) {
+        printf("FAIL: %s serialization in %u bytes\n", is_pretty ? "pretty" : "compact", (unsigned)needed);
+        nb_fail += 1;
+    }
+
+    json_value_free(root_val);
+    return nb_fail;
+}
+
+/* Look up the first n characters of name, the hash index must give the value a linear scan gives */
+static int check_lookup(const JSON_Object *object, const char *name, size_t n) {
+    char buf[BENCH_PATH_SIZE];
+    JSON_Value *expected = NULL;
+    JSON_Value *found;
+    size_t i;
+
+    snprintf(buf, sizeof buf, "%.*s", (int)n, name);
+    for (i = 0; i < json_object_get_count(object); i++) {
+        if (strcmp(json_object_get_name(object, i), buf) == 0) {
+            expected = json_object_get_value_at(object, i);
+            break;
+        }
+    }
+    found = json_object_get_value(object, buf);
+    if (found != expected) {
+        printf("FAIL: lookup of \"%s\" in an object of %u names %s\n", buf, (unsigned)json_object_get_count(object), (found == NULL) ? "missed" : "found a wrong value");
+        return 1;
+    }
+    return 0;
+}
+
+/* Look up every name of an object and of its sub-objects, the prefixes of each name and the
+   name extended by one character, directly and by dotted path, returns the number of failures */
+static int check_index(const JSON_Object *object) {
+    char path[BENCH_PATH_SIZE];
+    const JSON_Object *child;
+    const char *name;
+    size_t i, j, len;
+    int nb_fail = 0;
+
+    nb_fail += check_lookup(object, "", 0);
+    nb_fail += check_lookup(object, "missing", 7);
+    for (i = 0; i < json_object_get_count(object); i++) {
+        name = json_object_get_name(object, i);
+        len = strlen(name);
+        for (j = 0; j <= len; j++) {
+            nb_fail += check_lookup(object, name, j);
+        }
+        snprintf(path, sizeof path, "%s_", name);
+        nb_fail += check_lookup(object, path, len + 1);
+
+        child = json_value_get_object(json_object_get_value_at(object, i));
+        if (child == NULL) {
+            continue;
+        }
+        for (j = 0; j < json_object_get_count(child); j++) {
+            snprintf(path, sizeof path, "%s.%s", name, json_object_get_name(child, j));
+            if (json_object_dotget_value(object, path) != json_object_get_value_at(child, j)) {
+                printf("FAIL: dotted lookup of \"%s\"\n", path);
+                nb_fail += 1;
+            }
+        }
+        nb_fail += check_index(child);
+    }
+    return nb_fail;
+}
+
+/* Check the hash index of object names: lookups of parsed, grown, shrunk and arena objects give
+   the values a linear scan gives, and duplicate names are rejected, returns the number of failures */
+static int check_object_index(void) {
+    static const char duplicate_first[] = "{\"a\":1,\"a\":2}";
+    static const char duplicate_indexed[] = "{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"c\":7}";
+    char name[16];
+    JSON_Arena arena;
+    JSON_Value *root_val;
+    JSON_Object *obj;
+    char *config;
+    int i, nb_fail = 0;
+
+    json_set_object_index_threshold(CHECK_INDEX_MIN);
+    config = generate_config(CHECK_INDEX_CHAN);
+    if (config == NULL) {
+        printf("FAIL: no memory for the configuration\n");
+        json_set_object_index_threshold(BENCH_INDEX_DEFAULT);
+        return 1;
+    }
+
+    /* parsed tree, on the heap and in an arena */
+    root_val = json_parse_string(config);
+    if (root_val == NULL) {
+        printf("FAIL: configuration not parsed\n");
+        nb_fail += 1;
+    } else {
+        nb_fail += check_index(json_value_get_object(root_val));
+    }
+    json_value_free(root_val);
+    json_arena_init(&arena, arena_buf, sizeof arena_buf);
+    root_val = json_parse_string_arena(config, &arena);
+    if (root_val == NULL) {
+        printf("FAIL: configuration not parsed in an arena\n");
+        nb_fail += 1;
+    } else {
+        nb_fail += check_index(json_value_get_object(root_val));
+    }
+    free(config);
+
+    /* duplicate names, before and after the index is built, on the heap and in an arena */
+    if ((json_parse_string(duplicate_first) != NULL) || (json_parse_string(duplicate_indexed) != NULL)) {
+        printf("FAIL: duplicate name accepted\n");
+        nb_fail += 1;
+    }
+    json_arena_reset(&arena);
+    if ((json_parse_string_arena(duplicate_first, &arena) != NULL) || (json_parse_string_arena(duplicate_indexed, &arena) != NULL)) {
+        printf("FAIL: duplicate name accepted in an arena\n");
+        nb_fail += 1;
+    }
+
+    /* object grown name by name, the index is dropped and rebuilt on each resize */
+    root_val = json_value_init_object();
+    obj = json_value_get_object(root_val);
+    for (i = 0; i < CHECK_INDEX_NAMES; i++) {
+        snprintf(name, sizeof name, "n%d", i);
+        if (json_object_set_number(obj, name, i) != JSONSuccess) {
+            printf("FAIL: %s not added\n", name);
+            nb_fail += 1;
+        }
+        nb_fail += check_index(obj);
+    }
+
+    /* setting an existing name replaces its value */
+    if ((json_object_set_number(obj, "n7", -7) != JSONSuccess) || (json_object_get_count(obj) != CHECK_INDEX_NAMES) ||
+        (json_object_get_number(obj, "n7") != -7)) {
+        printf("FAIL: existing name not replaced\n");
+        nb_fail += 1;
+    }
+
+    /* names removed, the last name is moved to the removed position */
+    for (i = 0; i < CHECK_INDEX_NAMES; i += 3) {
+        snprintf(name, sizeof name, "n%d", i);
+        if (json_object_remove(obj, name) != JSONSuccess) {
+            printf("FAIL: %s not removed\n", name);
+            nb_fail += 1;
+        }
+        nb_fail += check_lookup(obj, name, strlen(name));
+        nb_fail += check_index(obj);
+    }
+    for (i = 0; i < CHECK_INDEX_NAMES; i += 3) {
+        snprintf(name, sizeof name, "r%d", i);
+        json_object_set_null(obj, name); /* takes the position of a removed name */
+        nb_fail += check_index(obj);
+    }
+
+    /* all names removed, then added again */
+    json_object_clear(obj);
+    for (i = 0; i < CHECK_INDEX_NAMES; i++) {
+        snprintf(name, sizeof name, "n%d", i);
+        nb_fail += check_lookup(obj, name, strlen(name));
+    }
+    for (i = 0; i < 2 * CHECK_INDEX_MIN; i++) {
+        snprintf(name, sizeof name, "n%d", CHECK_INDEX_NAMES - i);
+        json_object_set_null(obj, name);
+    }
+    nb_fail += check_index(obj);
+    json_value_free(root_val);
+
+    json_set_object_index_threshold(BENCH_INDEX_DEFAULT);
+    return nb_fail;
+}
+
+static int check_sax_event(void *context) {
+    struct check_sax_s *c = (struct check_sax_s *)context;
+
+    if (c->stopped) {
+        c->nb_late += 1;
+    }
+    return JSONSaxContinue;
+}
+
+static int check_sax_key(void *context, const char *string, size_t len) {
+    struct check_sax_s *c = (struct check_sax_s *)context;
+
+    (void)len;
+    if (c->stopped) {
+        c->nb_late += 1;
+        return JSONSaxContinue;
+    }
+    c->nb_keys += 1;
+    if ((c->stop_name != NULL) && (strcmp(string, c->stop_name) == 0)) {
+        c->stopped = true;
+        return c->stop_result;
+    }
+    return JSONSaxContinue;
+}
+
+static int check_sax_string(void *context, const char *string, size_t len) {
+    (void)string;
+    (void)len;
+    return check_sax_event(context);
+}
+
+static int check_sax_number(void *context, double number) {
+    (void)number;
+    return check_sax_event(context);
+}
+
+static int check_sax_boolean(void *context, int boolean) {
+    (void)boolean;
+    return check_sax_event(context);
+}
+
+static const JSON_Sax check_sax_handlers = {check_sax_event, check_sax_event, check_sax_event, check_sax_event, check_sax_key, check_sax_string, check_sax_number, check_sax_boolean, check_sax_event};
+
+/* The streaming parser must accept a document if and only if the tree parser does */
+static int check_sax_parity(const char *json) {
+    struct check_sax_s c;
+    char scratch[256];
+    JSON_Value *root_val;
+    bool tree_ok, sax_ok;
+
+    memset(&c, 0, sizeof c);
+    root_val = json_parse_string(json);
+    tree_ok = (root_val != NULL);
+    json_value_free(root_val);
+    sax_ok = (json_parse_string_sax(json, &check_sax_handlers, &c, scratch, sizeof scratch) == JSONSuccess);
+    if (tree_ok != sax_ok) {
+        printf("FAIL: \"%s\" %s by the tree parser, %s by the streaming parser\n", json, tree_ok ? "accepted" : "rejected", sax_ok ? "accepted" : "rejected");
+        return 1;
+    }
+    return 0;
+}
+
+/* Check early termination and abort by a handler, and that the streaming parser accepts and
+   rejects the same documents as the tree parser, returns the number of failures */
+static int check_sax(void) {
+    static const char commented[] = "/* header */ {\"a\": 1, // first\n \"b\": [true, null, \"/* not a comment */\"]}";
+    static const char *structure[] = {
+        "", " ", "1", "\"a\"", "null", "{}", "[]", " [ ] ", "{} x", "[1] [2]", "{\"a\":1,}", "[1,]", "{\"a\" 1}", "[1 2]",
+        "{\"a\":}", "{1:2}", "[\"\\u12\"]", "[\"\\x\"]", "[tru]", "[nul]", "{\"a\":{\"b\":[{}]}}"
+    };
+    char doc[sizeof status_sample];
+    char scratch[256];
+    struct check_sax_s c;
+    JSON_Value *root_val;
+    JSON_Status status;
+    size_t i;
+    int nb_fail = 0;
+
+    /* stop and abort on the 4th key (txpk, imme, tmst, freq) */
+    memset(&c, 0, sizeof c);
+    c.stop_name = "freq";
+    c.stop_result = JSONSaxStop;
+    status = json_parse_string_sax(pull_resp_sample, &check_sax_handlers, &c, scratch, sizeof scratch);
+    if ((status != JSONSuccess) || (c.stopped == false) || (c.nb_keys != 4) || (c.nb_late != 0)) {
+        printf("FAIL: parsing stopped by a handler returned %d after %u keys and %u late events\n", (int)status, c.nb_keys, c.nb_late);
+        nb_fail += 1;
+    }
+    memset(&c, 0, sizeof c);
+    c.stop_name = "freq";
+    c.stop_result = JSONSaxAbort;
+    status = json_parse_string_sax(pull_resp_sample, &check_sax_handlers, &c, scratch, sizeof scratch);
+    if ((status != JSONFailure) || (c.stopped == false) || (c.nb_keys != 4) || (c.nb_late != 0)) {
+        printf("FAIL: parsing aborted by a handler returned %d after %u keys and %u late events\n", (int)status, c.nb_keys, c.nb_late);
+        nb_fail += 1;
+    }
+
+    /* a name longer than the scratch buffer fails the parsing */
+    memset(&c, 0, sizeof c);
+    if (json_parse_string_sax(pull_resp_sample, &check_sax_handlers, &c, scratch, 4) != JSONFailure) {
+        printf("FAIL: name longer than the scratch buffer accepted\n");
+        nb_fail += 1;
+    }
+
+    /* same outcome as the tree parser: rejected numbers, structures, valid samples and all their truncations */
+    for (i = 0; i < sizeof structure / sizeof structure[0]; i++) {
+        nb_fail += check_sax_parity(structure[i]);
+    }
+    for (i = 0; i < sizeof check_rejected / sizeof check_rejected[0]; i++) {
+        nb_fail += check_sax_parity(check_rejected[i]);
+    }
+    for (i = 0; i < sizeof check_numbers / sizeof check_numbers[0]; i++) {
+        snprintf(doc, sizeof doc, "[%s]", check_numbers[i]);
+        nb_fail += check_sax_parity(doc);
+    }
+    nb_fail += check_sax_parity(status_sample);
+    for (i = 0; i < sizeof pull_resp_sample - 1; i++) {
+        snprintf(doc, sizeof doc, "%.*s", (int)i, pull_resp_sample);
+        nb_fail += check_sax_parity(doc);
+    }
+
+    /* comments, blanked out of the caller's buffer */
+    root_val = json_parse_string_with_comments(commented);
+    memcpy(doc, commented, sizeof commented);
+    memset(&c, 0, sizeof c);
+    status = json_parse_string_with_comments_sax(doc, &check_sax_handlers, &c, scratch, sizeof scratch);
+    if ((root_val == NULL) || (status != JSONSuccess) || (c.nb_keys != 2)) {
+        printf("FAIL: document with comments not parsed\n");
+        nb_fail += 1;
+    }
+    json_value_free(root_val);
+    return nb_fail;
+}
+
+/* Check number conversions on edge cases and random values, returns the number of failures */
+static int self_check(void) {
+    char number[64];
+    double d;
+    uint64_t bits;
+    int i, j, nb_fail = 0;
+
+    for (i = 0; i < (int)(sizeof check_numbers / sizeof check_numbers[0]); i++) {
+        nb_fail += check_number(check_numbers[i]) ? 0 : 1;
+        nb_fail += check_format(strtod(check_numbers[i], NULL)) ? 0 : 1;
+    }
+    for (i = 0; i < (int)(sizeof check_rejected / sizeof check_rejected[0]); i++) {
+        if (json_parse_string(check_rejected[i]) != NULL) {
+            printf("FAIL: %s accepted\n", check_rejected[i]);
+            nb_fail += 1;
+        }
+    }
+    nb_fail += check_buffer_size(status_sample, false);
+    nb_fail += check_buffer_size(status_sample, true);
+    nb_fail += check_object_index();
+    nb_fail += check_sax();
+
+    srand(1);
+    for (i = 0; i < CHECK_NB_RANDOM; i++) {
+        /* random decimal number: up to 20 digits, decimal point anywhere, exponent within +/-30 */
+        j = snprintf(number, sizeof number, "%s%d", (rand() % 2) ? "-" : "", 1 + rand() % 9);
+        for (d = rand() % 20; d > 0; d--) {
+            number[j++] = (char)('0' + rand() % 10);
+            if ((rand() % 8) == 0 && strchr(number, '.') == NULL) {
+                number[j++] = '.';
+                number[j++] = (char)('0' + rand() % 10);
+            }
+        }
+        number[j] = '\0';
+        if ((rand() % 4) == 0) {
+            snprintf(number + j, sizeof number - j, "e%d", rand() % 61 - 30);
+        }
+        nb_fail += check_number(number) ? 0 : 1;
+        nb_fail += check_format(strtod(number, NULL)) ? 0 : 1;
+
+        /* random double, any exponent */
+        bits = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+        memcpy(&d, &bits, sizeof d);
+        nb_fail += check_format(d) ? 0 : 1;
+        if (nb_fail > 20) {
+            break;
+        }
+    }
+
+    for (i = B64_IMPL_SCALAR; i <= B64_IMPL_NEON; i++) {
+        if (b64_set_impl((enum b64_impl_e)i) == 0) {
+            nb_fail += check_base64((enum b64_impl_e)i);
+        }
+    }
+    b64_set_impl(B64_IMPL_AUTO);
+    return nb_fail;
+}
+
+/* Reference character of a Base64 code, computed rather than looked up */
+static char b64_ref_char(uint32_t code) {
+    if (code < 26) {
+        return (char)('A' + code);
+    } else if (code < 52) {
+        return (char)('a' + code - 26);
+    } else if (code < 62) {
+        return (char)('0' + code - 52);
+    } else {
+        return (code == 62) ? '+' : '/';
+    }
+}
+
+/* Check the selected Base64 implementation, returns the number of failures */
+static int check_base64(enum b64_impl_e impl) {
+    static uint8_t bin[3 * CHECK_B64_BLOCKS], dec[3 * CHECK_B64_BLOCKS];
+    static char b64[4 * CHECK_B64_BLOCKS + 1];
+    uint8_t *in, *out;
+    char *str;
+    uint32_t v, b;
+    int size, len, pos, c, i, nb_fail = 0;
+
+    /* all 2^24 blocks, encoded and decoded by full buffers to go through the vector kernels */
+    for (v = 0; v < (1U << 24); v += CHECK_B64_BLOCKS) {
+        for (i = 0; i < CHECK_B64_BLOCKS; i++) {
+            b = v + (uint32_t)i;
+            bin[3*i] = (uint8_t)(b >> 16);
+            bin[3*i + 1] = (uint8_t)(b >> 8);
+            bin[3*i + 2] = (uint8_t)b;
+        }
+        if (bin_to_b64_nopad(bin, sizeof bin, b64, sizeof b64) != 4 * CHECK_B64_BLOCKS) {
+            printf("FAIL: %s, encoding of blocks 0x%06X and next failed\n", b64_impl_name(impl), v);
+            return nb_fail + 1;
+        }
+        for (i = 0; i < CHECK_B64_BLOCKS; i++) {
+            b = v + (uint32_t)i;
+            if ((b64[4*i] != b64_ref_char(b >> 18)) || (b64[4*i + 1] != b64_ref_char((b >> 12) & 0x3F)) ||
+                (b64[4*i + 2] != b64_ref_char((b >> 6) & 0x3F)) || (b64[4*i + 3] != b64_ref_char(b & 0x3F))) {
+                printf("FAIL: %s, block 0x%06X encoded as %.4s\n", b64_impl_name(impl), b, b64 + 4*i);
+                return nb_fail + 1;
+            }
+        }
+        if ((b64_to_bin_nopad(b64, 4 * CHECK_B64_BLOCKS, dec, sizeof dec) != (int)sizeof dec) ||
+            (memcmp(bin, dec, sizeof dec) != 0)) {
+            printf("FAIL: %s, decoding of blocks 0x%06X and next failed\n", b64_impl_name(impl), v);
+            return nb_fail + 1;
+        }
+    }
+
+    /* round trips of random payloads of all sizes, in buffers of the exact size to catch overruns */
+    srand(2);
+    for (size = 0; size <= CHECK_B64_MAX_SIZE; size++) {
+        len = 4 * ((size + 2) / 3);
+        in = malloc(size + 1);
+        out = malloc(size + 1);
+        str = malloc(len + 1);
+        if ((in == NULL) || (out == NULL) || (str == NULL)) {
+            return nb_fail + 1;
+        }
+        for (i = 0; i < size; i++) {
+            in[i] = (uint8_t)rand();
+        }
+        if ((size > 0) && (bin_to_b64(in, size, str, len) != -1)) {
+            printf("FAIL: %s, %d bytes encoded without room for the null character\n", b64_impl_name(impl), size);
+            nb_fail += 1;
+        }
+        if (bin_to_b64(in, size, str, len + 1) != len) {
+            printf("FAIL: %s, %d bytes not encoded to %d characters\n", b64_impl_name(impl), size, len);
+            nb_fail += 1;
+        }
+        for (i = 0; i < len; i++) {
+            if (i < (4 * size + 2) / 3) {
+                b = (uint32_t)in[3*(i/4)] << 16;
+                b |= (3*(i/4) + 1 < size) ? (uint32_t)in[3*(i/4) + 1] << 8 : 0;
+                b |= (3*(i/4) + 2 < size) ? (uint32_t)in[3*(i/4) + 2] : 0;
+                c = b64_ref_char((b >> (18 - 6 * (i % 4))) & 0x3F);
+            } else {
+                c = '=';
+            }
+            if ((str[i] != c) || (str[len] != '\0')) {
+                printf("FAIL: %s, %d bytes encoded as %s\n", b64_impl_name(impl), size, str);
+                nb_fail += 1;
+                break;
+            }
+        }
+        if ((size > 0) && (b64_to_bin(str, len, out, size - 1) != -1)) {
+            printf("FAIL: %s, %d bytes decoded in a too small buffer\n", b64_impl_name(impl), size);
+            nb_fail += 1;
+        }
+        if ((b64_to_bin(str, len, out, size) != size) || (memcmp(in, out, size) != 0)) {
+            printf("FAIL: %s, %d bytes round trip failed\n", b64_impl_name(impl), size);
+            nb_fail += 1;
+        }
+        len = bin_to_b64_nopad(in, size, str, len + 1);
+        if ((b64_to_bin(str, len, out, size) != size) || (memcmp(in, out, size) != 0)) {
+            printf("FAIL: %s, %d bytes round trip without padding failed\n", b64_impl_name(impl), size);
+            nb_fail += 1;
+        }
+
+        /* every character out of the alphabet, at every position, must be rejected */
+        for (pos = 0; (size <= CHECK_B64_INVALID) && (pos < len); pos++) {
+            v = (uint8_t)str[pos];
+            for (c = 0; c < 256; c++) {
+                if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '+') || (c == '/')) {
+                    continue;
+                }
+                str[pos] = (char)c;
+                if (b64_to_bin_nopad(str, len, out, size) != -1) {
+                    printf("FAIL: %s, character 0x%02X at position %d of %d accepted\n", b64_impl_name(impl), c, pos, len);
+                    nb_fail += 1;
+                    break;
+                }
+            }
+            str[pos] = (char)v;
+        }
+        free(in);
+        free(out);
+        free(str);
+        if (nb_fail > 20) {
+            break;
+        }
+    }
+    return nb_fail;
+}
+
+/* Encode and decode payloads of typical sizes with each implementation supported by the CPU */
+static void bench_base64(unsigned nb_iter) {
+    static uint8_t bin[255], dec[255];
+    static char b64[341];
+    struct timespec start, end;
+    unsigned it;
+    int impl, i, j, len;
+    double enc_ns, dec_ns;
+
+    for (i = 0; i < (int)sizeof bin; i++) {
+        bin[i] = (uint8_t)rand();
+    }
+    MSG("INFO: Base64, %u iterations per benchmark, %s selected by default\n", nb_iter, b64_impl_name(b64_get_impl()));
+    for (impl = B64_IMPL_SCALAR; impl <= B64_IMPL_NEON; impl++) {
+        if (b64_set_impl((enum b64_impl_e)impl) != 0) {
+            continue;
+        }
+        for (j = 0; j < (int)(sizeof b64_sizes / sizeof b64_sizes[0]); j++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (it = 0; it < nb_iter; it++) {
+                len = bin_to_b64(bin, b64_sizes[j], b64, sizeof b64);
+                __asm__ volatile("" : : "r"(b64) : "memory"); /* keep the result alive */
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            enc_ns = elapsed_ns(&start, &end) / nb_iter;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (it = 0; it < nb_iter; it++) {
+                b64_to_bin(b64, len, dec, sizeof dec);
+                __asm__ volatile("" : : "r"(dec) : "memory");
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            dec_ns = elapsed_ns(&start, &end) / nb_iter;
+            printf("base64 (%-6s) %3d bytes   encode %7.0f ns %7.0f MB/s   decode %7.0f ns %7.0f MB/s\n",
+                   b64_impl_name((enum b64_impl_e)impl), b64_sizes[j], enc_ns, 1E3 * b64_sizes[j] / enc_ns,
+                   dec_ns, 1E3 * b64_sizes[j] / dec_ns);
+        }
+    }
+    b64_set_impl(B64_IMPL_AUTO);
+}
+
+static void print_result(const char *name, const struct bench_result_s *res) {
+    printf("%-32s %10.0f ns %8.1f heap allocs %8.1f arena allocs %8lu arena bytes\n", name, res->ns, res->allocs,
+           res->arena_allocs, (unsigned long)res->arena_bytes);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+    int i;
+    unsigned nb_iter = BENCH_DEFAULT_ITER;
+    const char *file_path = NULL;
+    char *json = NULL;
+    const char *doc_name = "PULL_RESP";
+    FILE *f;
+    long file_size;
+    int nb_chan = 0;
+    struct bench_result_s res;
+    bool base64 = false;
+
+    while ((i = getopt (argc, argv, "hn:f:c:sbt")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+
+            case 'n': /* -n <uint> number of iterations */
+                nb_iter = (unsigned)strtoul(optarg, NULL, 10);
+                if (nb_iter == 0) {
+                    MSG("ERROR: invalid number of iterations\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'f': /* -f <path> JSON file to benchmark */
+                file_path = optarg;
+                break;
+
+            case 'c': /* -c <int> number of channels of a generated configuration */
+                nb_chan = atoi(optarg);
+                if ((nb_chan < 1) || (nb_chan > BENCH_MAX_CHANNELS)) {
+                    MSG("ERROR: invalid number of channels\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 's': /* -s typical status report */
+                doc_name = "status report";
+                break;
+
+            case 'b': /* -b Base64 benchmark */
+                base64 = true;
+                break;
+
+            case 't': /* -t self-check */
+                i = self_check();
+                printf("%s: %d failure(s)\n", (i == 0) ? "PASS" : "FAIL", i);
+                return (i == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+            default:
+                MSG("ERROR: argument parsing options, use -h option for help\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (base64) {
+        bench_base64(nb_iter);
+        return EXIT_SUCCESS;
+    }
+
+    /* document to benchmark */
+    if (file_path != NULL) {
+        f = fopen(file_path, "r");
+        if (f == NULL) {
+            MSG("ERROR: failed to open %s\n", file_path);
+            return EXIT_FAILURE;
+        }
+        fseek(f, 0L, SEEK_END);
+        file_size = ftell(f);
+        rewind(f);
+        json = malloc(file_size + 1);
+        if ((json == NULL) || (fread(json, 1, file_size, f) != (size_t)file_size)) {
+            MSG("ERROR: failed to read %s\n", file_path);
+            fclose(f);
+            return EXIT_FAILURE;
+        }
+        json[file_size] = '\0';
+        fclose(f);
+        doc_name = file_path;
+    } else if (nb_chan > 0) {
+        json = generate_config(nb_chan);
+        if (json == NULL) {
+            return EXIT_FAILURE;
+        }
+        doc_name = "generated configuration";
+    } else if (strcmp(doc_name, "status report") == 0) {
+        json = malloc(sizeof status_sample);
+        if (json == NULL) {
+            return EXIT_FAILURE;
+        }
+        memcpy(json, status_sample, sizeof status_sample);
+    } else {
+        json = malloc(sizeof pull_resp_sample);
+        if (json == NULL) {
+            return EXIT_FAILURE;
+        }
+        memcpy(json, pull_resp_sample, sizeof pull_resp_sample);
+    }
+    json_set_allocation_functions(counting_malloc, free);
+
+    MSG("INFO: %s, %lu bytes, %u iterations per benchmark\n", doc_name, (unsigned long)strlen(json), nb_iter);
+
+    /* parse and release */
+    if (bench_parse(json, false, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    print_result("parse (heap)", &res);
+    if (bench_parse(json, true, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    print_result("parse (arena)", &res);
+    if (bench_sax(json, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    print_result("parse (streaming)", &res);
+
+    /* look up every value, per lookup */
+    if (bench_lookup(json, 0, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    printf("%d values looked up by dotted path\n", nb_paths);
+    print_result("dotget (linear)", &res);
+    if (bench_lookup(json, BENCH_INDEX_DEFAULT, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    print_result("dotget (hash index)", &res);
+
+    /* serialize */
+    if (bench_serialize(json, false, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    print_result("serialize (writer)", &res);
+    if (bench_serialize(json, true, nb_iter, &res) != 0) {
+        return EXIT_FAILURE;
+    }
+    print_result("serialize (string)", &res);
+
+    free(json);
+    return EXIT_SUCCESS;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
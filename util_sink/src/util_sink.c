@@ -8,6 +8,8 @@
 
 Description:
     Network sink, receives UDP packets on certain ports and discards them
+    Receives by batches and reports rates and inter-arrival jitter per gateway
+    every second, to measure packet forwarders under load
 
 License: Revised BSD License, see LICENSE.TXT file include in the project
 Maintainer: Sylvain Miermont
@@ -17,20 +19,20 @@ Maintainer: Sylvain Miermont
 /* -------------------------------------------------------------------------- */
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
-/* fix an issue between POSIX and C99 */
-#if __STDC_VERSION__ >= 199901L
-    #define _XOPEN_SOURCE 600
-#else
-    #define _XOPEN_SOURCE 500
-#endif
+/* recvmmsg, memmem and the socket timestamping options are Linux extensions */
+#define _GNU_SOURCE
 
 #include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
 #include <stdio.h>      /* printf, fprintf, sprintf, fopen, fputs */
+#include <unistd.h>     /* getopt */
 
-#include <string.h>     /* memset */
+#include <string.h>     /* memset, memmem */
 #include <time.h>       /* time, clock_gettime, strftime, gmtime, clock_nanosleep*/
-#include <stdlib.h>     /* atoi, exit */
+#include <stdlib.h>     /* atoi, exit, qsort */
 #include <errno.h>      /* error messages */
+#include <math.h>       /* sqrt */
+#include <pthread.h>
 
 #include <sys/socket.h> /* socket specific definitions */
 #include <netinet/in.h> /* INET constants and stuff */
@@ -45,6 +47,291 @@ Maintainer: Sylvain Miermont
 #define STR(x)          STRINGIFY(x)
 #define MSG(args...)    fprintf(stderr, args) /* message that is destined to the user */
 
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define PROTOCOL_VERSION    2
+
+#define PKT_PUSH_DATA       0
+#define PKT_PULL_DATA       2
+#define PKT_TX_ACK          5
+
+#define HEADER_SIZE         12          /* version, token, type, gateway MAC */
+
+#define SINK_BATCH          64          /* datagrams received per system call */
+#define SINK_BUFF_SIZE      8192        /* larger datagrams are truncated and counted as such */
+#define SINK_RCVBUF         (4 << 20)   /* requested socket receive buffer size, in bytes */
+#define SINK_MAX_GATEWAYS   4096        /* gateways tracked, the others are only counted in the totals */
+#define SINK_TABLE_SIZE     8192        /* hash table slots, a power of 2, twice SINK_MAX_GATEWAYS */
+#define SINK_DEFAULT_LINES  10          /* gateways displayed per report by default */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* Statistics of a gateway, counters are reset at each report */
+struct gw_stats_s {
+    bool used;
+    uint64_t mac;
+    uint32_t nb_dgram;      /* datagrams received */
+    uint32_t nb_push;       /* PUSH_DATA received */
+    uint32_t nb_pull;       /* PULL_DATA received */
+    uint32_t nb_txack;      /* TX_ACK received */
+    uint32_t nb_rxpk;       /* packets reported in PUSH_DATA */
+    uint64_t nb_bytes;      /* bytes of all datagrams */
+    uint64_t last_ns;       /* arrival time of the previous datagram, kept across reports */
+    uint32_t nb_interval;   /* inter-arrival times measured */
+    double sum_ms;          /* sum of the inter-arrival times */
+    double sum_sq_ms;       /* sum of the squares of the inter-arrival times */
+};
+
+/* Totals of all datagrams, counters are reset at each report */
+struct sink_totals_s {
+    uint32_t nb_dgram;
+    uint32_t nb_rxpk;
+    uint64_t nb_bytes;
+    uint32_t nb_invalid;    /* too short or wrong protocol version */
+    uint32_t nb_truncated;  /* larger than SINK_BUFF_SIZE */
+    uint32_t nb_untracked;  /* from gateways beyond SINK_MAX_GATEWAYS */
+    uint32_t nb_gateways;   /* gateways in the table */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+/* statistics, written by the receive loop and read by the report thread */
+static pthread_mutex_t mx_stats = PTHREAD_MUTEX_INITIALIZER;
+static struct gw_stats_s gw_table[SINK_TABLE_SIZE];
+static struct sink_totals_s totals;
+static uint32_t kernel_drops = 0; /* datagrams dropped by the kernel since the socket was opened */
+
+/* report thread copy, displayed without holding the lock */
+static struct gw_stats_s gw_report[SINK_MAX_GATEWAYS];
+
+/* receive buffers */
+static struct mmsghdr msgs[SINK_BATCH];
+static struct iovec iovs[SINK_BATCH];
+static uint8_t bufs[SINK_BATCH][SINK_BUFF_SIZE];
+static uint8_t ctrl_bufs[SINK_BATCH][CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))];
+
+static int report_lines = SINK_DEFAULT_LINES;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
+
+void usage(void);
+
+static struct gw_stats_s * gw_lookup(uint64_t mac);
+
+static uint32_t count_rxpk(const uint8_t *json, int size);
+
+static void update_stats(const uint8_t *dgram, int size, uint64_t arrival_ns);
+
+static int compare_dgram(const void *a, const void *b);
+
+static void * thread_report(void *arg);
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+void usage(void) {
+    MSG("Usage: util_sink {options} <port number>\n");
+    MSG("Available options:\n");
+    MSG(" -h print this help\n");
+    MSG(" -g <int> number of gateways displayed per report, most active first (default %d, 0 for totals only)\n", SINK_DEFAULT_LINES);
+}
+
+/* Find the statistics of a gateway, adding it if needed, NULL if the table is full (mx_stats held) */
+static struct gw_stats_s * gw_lookup(uint64_t mac) {
+    uint32_t i;
+
+    /* Fibonacci hashing, the MAC addresses of a fleet often differ only by their last bytes */
+    i = (uint32_t)((mac * 0x9E3779B97F4A7C15ULL) >> 51) & (SINK_TABLE_SIZE - 1);
+    while (gw_table[i].used) {
+        if (gw_table[i].mac == mac) {
+            return &gw_table[i];
+        }
+        i = (i + 1) & (SINK_TABLE_SIZE - 1);
+    }
+    if (totals.nb_gateways >= SINK_MAX_GATEWAYS) {
+        return NULL;
+    }
+    memset(&gw_table[i], 0, sizeof gw_table[i]);
+    gw_table[i].used = true;
+    gw_table[i].mac = mac;
+    totals.nb_gateways += 1;
+    return &gw_table[i];
+}
+
+/* Count the objects of the "rxpk" array of a PUSH_DATA, skipping the content of the objects */
+static uint32_t count_rxpk(const uint8_t *json, int size) {
+    const uint8_t *p, *end = json + size;
+    int depth = 0;
+    uint32_t nb = 0;
+
+    p = memmem(json, size, "\"rxpk\"", 6);
+    if (p == NULL) {
+        return 0;
+    }
+    p += 6;
+    while ((p < end) && (*p != '[')) {
+        if ((*p != ':') && (*p != ' ') && (*p != '\t') && (*p != '\r') && (*p != '\n')) {
+            return 0; /* not an array */
+        }
+        p++;
+    }
+    for (p++; p < end; p++) {
+        switch (*p) {
+            case '"': /* skip strings, they may contain brackets */
+                for (p++; (p < end) && (*p != '"'); p++) {
+                    if (*p == '\\') {
+                        p++;
+                    }
+                }
+                break;
+            case '{':
+                nb += (depth == 0) ? 1 : 0;
+                depth++;
+                break;
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0) {
+                    return nb; /* end of the rxpk array */
+                }
+                depth--;
+                break;
+            default:
+                break;
+        }
+    }
+    return nb; /* truncated datagram, count the packets seen */
+}
+
+/* Account a datagram (mx_stats held) */
+static void update_stats(const uint8_t *dgram, int size, uint64_t arrival_ns) {
+    struct gw_stats_s *gw;
+    uint64_t mac = 0;
+    uint32_t nb_rxpk = 0;
+    double interval_ms;
+    int i;
+
+    totals.nb_dgram += 1;
+    totals.nb_bytes += (uint64_t)size;
+    if ((size < HEADER_SIZE) || (dgram[0] != PROTOCOL_VERSION) ||
+        ((dgram[3] != PKT_PUSH_DATA) && (dgram[3] != PKT_PULL_DATA) && (dgram[3] != PKT_TX_ACK))) {
+        totals.nb_invalid += 1;
+        return;
+    }
+    for (i = 4; i < HEADER_SIZE; i++) {
+        mac = (mac << 8) | dgram[i];
+    }
+    if (dgram[3] == PKT_PUSH_DATA) {
+        nb_rxpk = count_rxpk(dgram + HEADER_SIZE, size - HEADER_SIZE);
+        totals.nb_rxpk += nb_rxpk;
+    }
+
+    gw = gw_lookup(mac);
+    if (gw == NULL) {
+        totals.nb_untracked += 1;
+        return;
+    }
+    gw->nb_dgram += 1;
+    gw->nb_push += (dgram[3] == PKT_PUSH_DATA) ? 1 : 0;
+    gw->nb_pull += (dgram[3] == PKT_PULL_DATA) ? 1 : 0;
+    gw->nb_txack += (dgram[3] == PKT_TX_ACK) ? 1 : 0;
+    gw->nb_rxpk += nb_rxpk;
+    gw->nb_bytes += (uint64_t)size;
+    if ((gw->last_ns != 0) && (arrival_ns >= gw->last_ns)) {
+        interval_ms = (double)(arrival_ns - gw->last_ns) / 1E6;
+        gw->nb_interval += 1;
+        gw->sum_ms += interval_ms;
+        gw->sum_sq_ms += interval_ms * interval_ms;
+    }
+    gw->last_ns = arrival_ns;
+}
+
+/* Most active gateways first */
+static int compare_dgram(const void *a, const void *b) {
+    const struct gw_stats_s *ga = a;
+    const struct gw_stats_s *gb = b;
+
+    if (ga->nb_dgram != gb->nb_dgram) {
+        return (ga->nb_dgram < gb->nb_dgram) ? 1 : -1;
+    }
+    return (ga->mac < gb->mac) ? -1 : ((ga->mac > gb->mac) ? 1 : 0);
+}
+
+/* Every second, take the counters of the period and display them */
+static void * thread_report(void *arg) {
+    struct timespec next, prev, now;
+    struct sink_totals_s tot;
+    uint32_t drops, prev_drops = 0;
+    double period, mean, jitter;
+    char stat_timestamp[24];
+    time_t t;
+    int i, nb;
+
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &prev);
+    next = prev;
+    while (1) {
+        next.tv_sec += 1;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        /* copy and reset, the receive loop is blocked only for the copy */
+        nb = 0;
+        pthread_mutex_lock(&mx_stats);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        tot = totals;
+        drops = kernel_drops;
+        memset(&totals, 0, sizeof totals);
+        totals.nb_gateways = tot.nb_gateways;
+        for (i = 0; i < SINK_TABLE_SIZE; i++) {
+            if (gw_table[i].used && (gw_table[i].nb_dgram > 0)) {
+                gw_report[nb++] = gw_table[i];
+                gw_table[i].nb_dgram = 0;
+                gw_table[i].nb_push = 0;
+                gw_table[i].nb_pull = 0;
+                gw_table[i].nb_txack = 0;
+                gw_table[i].nb_rxpk = 0;
+                gw_table[i].nb_bytes = 0;
+                gw_table[i].nb_interval = 0;
+                gw_table[i].sum_ms = 0.0;
+                gw_table[i].sum_sq_ms = 0.0;
+            }
+        }
+        pthread_mutex_unlock(&mx_stats);
+
+        period = (double)(now.tv_sec - prev.tv_sec) + (double)(now.tv_nsec - prev.tv_nsec) / 1E9;
+        prev = now;
+        t = time(NULL);
+        strftime(stat_timestamp, sizeof stat_timestamp, "%F %T %Z", gmtime(&t));
+        printf("### %s: %.0f datagrams/s, %.0f rxpk/s, %.0f bytes/s, %d/%u gateways active, %u invalid, %u truncated, %u untracked, %u dropped\n",
+               stat_timestamp, tot.nb_dgram / period, tot.nb_rxpk / period, tot.nb_bytes / period, nb, tot.nb_gateways,
+               tot.nb_invalid, tot.nb_truncated, tot.nb_untracked, drops - prev_drops);
+        prev_drops = drops;
+
+        qsort(gw_report, nb, sizeof gw_report[0], compare_dgram);
+        for (i = 0; (i < nb) && (i < report_lines); i++) {
+            mean = 0.0;
+            jitter = 0.0;
+            if (gw_report[i].nb_interval > 0) {
+                mean = gw_report[i].sum_ms / gw_report[i].nb_interval;
+                jitter = gw_report[i].sum_sq_ms / gw_report[i].nb_interval - mean * mean;
+                jitter = (jitter > 0.0) ? sqrt(jitter) : 0.0;
+            }
+            printf("  %016llX %8.0f dgram/s (push %u, pull %u, txack %u) %8.0f rxpk/s %10.0f bytes/s, inter-arrival %.3f ms, jitter %.3f ms\n",
+                   (unsigned long long)gw_report[i].mac, gw_report[i].nb_dgram / period, gw_report[i].nb_push,
+                   gw_report[i].nb_pull, gw_report[i].nb_txack, gw_report[i].nb_rxpk / period,
+                   gw_report[i].nb_bytes / period, mean, jitter);
+        }
+        fflush(stdout);
+    }
+    return NULL;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- MAIN FUNCTION -------------------------------------------------------- */
 
@@ -61,14 +348,38 @@ int main(int argc, char **argv)
     char port_name[64];
 
     /* variables for receiving packets */
-    struct sockaddr_storage dist_addr;
-    socklen_t addr_len = sizeof dist_addr;
-    uint8_t databuf[4096];
-    int byte_nb;
+    pthread_t thrid_report;
+    struct cmsghdr *cmsg;
+    struct timespec arrival, ts;
+    uint64_t arrival_ns;
+    uint32_t drops;
+    int nb_msg;
+    int opt;
+
+    while ((i = getopt (argc, argv, "hg:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return EXIT_SUCCESS;
+
+            case 'g': /* -g <int> number of gateways displayed */
+                report_lines = atoi(optarg);
+                if (report_lines < 0) {
+                    MSG("ERROR: invalid number of gateways\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            default:
+                MSG("ERROR: argument parsing options, use -h option for help\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
 
     /* check if port number was passed as parameter */
-    if (argc != 2) {
-        MSG("Usage: util_sink <port number>\n");
+    if (optind != argc - 1) {
+        usage();
         exit(EXIT_FAILURE);
     }
 
@@ -79,7 +390,7 @@ int main(int argc, char **argv)
     hints.ai_flags = AI_PASSIVE; /* will assign local IP automatically */
 
     /* look for address */
-    i = getaddrinfo(NULL, argv[1], &hints, &result);
+    i = getaddrinfo(NULL, argv[optind], &hints, &result);
     if (i != 0) {
         MSG("ERROR: getaddrinfo returned %s\n", gai_strerror(i));
         exit(EXIT_FAILURE);
@@ -110,16 +421,68 @@ int main(int argc, char **argv)
         }
         exit(EXIT_FAILURE);
     }
-    MSG("INFO: util_sink listening on port %s\n", argv[1]);
+    MSG("INFO: util_sink listening on port %s\n", argv[optind]);
     freeaddrinfo(result);
 
+    /* absorb bursts, get kernel arrival times and the number of datagrams dropped by the kernel */
+    opt = SINK_RCVBUF;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &opt, sizeof opt) != 0) {
+        MSG("WARNING: failed to set socket receive buffer size (%s)\n", strerror(errno));
+    }
+    opt = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof opt) != 0) {
+        MSG("WARNING: failed to enable receive timestamps, arrival times are taken after each batch (%s)\n", strerror(errno));
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof opt) != 0) {
+        MSG("WARNING: failed to enable the count of dropped datagrams (%s)\n", strerror(errno));
+    }
+
+    i = pthread_create(&thrid_report, NULL, thread_report, NULL);
+    if (i != 0) {
+        MSG("ERROR: impossible to create report thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < SINK_BATCH; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = SINK_BUFF_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
     while (1) {
-        byte_nb = recvfrom(sock, databuf, sizeof databuf, 0, (struct sockaddr *)&dist_addr, &addr_len);
-        if (byte_nb == -1) {
-            MSG("ERROR: recvfrom returned %s \n", strerror(errno));
+        /* wait for a datagram, then take all the ones already received, up to SINK_BATCH */
+        for (i = 0; i < SINK_BATCH; i++) {
+            msgs[i].msg_hdr.msg_control = ctrl_bufs[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof ctrl_bufs[i];
+        }
+        nb_msg = recvmmsg(sock, msgs, SINK_BATCH, MSG_WAITFORONE, NULL);
+        if (nb_msg == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            MSG("ERROR: recvmmsg returned %s \n", strerror(errno));
             exit(EXIT_FAILURE);
         }
-        getnameinfo((struct sockaddr *)&dist_addr, addr_len, host_name, sizeof host_name, port_name, sizeof port_name, NI_NUMERICHOST);
-        printf("Got packet from host %s port %s, %i bytes long\n", host_name, port_name, byte_nb);
+        clock_gettime(CLOCK_REALTIME, &arrival);
+
+        pthread_mutex_lock(&mx_stats);
+        for (i = 0; i < nb_msg; i++) {
+            arrival_ns = (uint64_t)arrival.tv_sec * 1000000000ULL + (uint64_t)arrival.tv_nsec;
+            for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+                    arrival_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+                } else if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+                    memcpy(&drops, CMSG_DATA(cmsg), sizeof drops);
+                    kernel_drops = drops;
+                }
+            }
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                totals.nb_truncated += 1;
+            }
+            update_stats(bufs[i], (int)msgs[i].msg_len, arrival_ns);
+        }
+        pthread_mutex_unlock(&mx_stats);
     }
 }
@@ -8,6 +8,8 @@
 
 Description:
     Ask a gateway to emit packets using GW <-> server protocol
+    In load mode, send a mix of Class A, B and C downlinks at a target rate to
+    one or many gateways, and measure the TX_ACK error codes and latency
 
 License: Revised BSD License, see LICENSE.TXT file include in the project
 Maintainer: Sylvain Miermont
@@ -31,8 +33,12 @@ Maintainer: Sylvain Miermont
 
 #include <string.h>     /* memset */
 #include <signal.h>     /* sigaction */
-#include <stdlib.h>     /* exit codes */
+#include <stdlib.h>     /* exit codes, qsort, realloc */
 #include <errno.h>      /* error messages */
+#include <time.h>       /* clock_gettime */
+
+#include <sys/select.h> /* select */
+#include <sys/time.h>   /* timeval */
 
 #include <sys/socket.h> /* socket specific definitions */
 #include <netinet/in.h> /* INET constants and stuff */
@@ -57,6 +63,61 @@ Maintainer: Sylvain Miermont
 #define PKT_PULL_DATA   2
 #define PKT_PULL_RESP   3
 #define PKT_PULL_ACK    4
+#define PKT_TX_ACK      5
+
+#define UNIX_GPS_EPOCH_OFFSET   315964800   /* seconds between the Unix and GPS epochs */
+#define GPS_LEAP_SECONDS        18          /* GPS time is ahead of UTC by the leap seconds since 1980 */
+
+#define LOAD_MAX_GATEWAYS   1024        /* gateways loaded, the others are ignored */
+#define LOAD_TABLE_SIZE     2048        /* hash table slots, a power of 2, twice LOAD_MAX_GATEWAYS */
+#define LOAD_NB_TOKENS      65536       /* downlinks in flight are identified by their 16-bit token */
+#define LOAD_ACK_TIMEOUT_MS 2000        /* time given to the last TX_ACK at the end of the test */
+#define LOAD_PROGRESS_S     10          /* progress display interval */
+#define NB_ACK_CODES        10          /* entries of ack_codes */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+enum load_class_e {
+    CLASS_A,    /* "tmst", concentrator counter extrapolated from the last uplink */
+    CLASS_B,    /* "tmms", GPS time */
+    CLASS_C,    /* "imme" */
+    NB_CLASSES
+};
+
+/* Gateway loaded, discovered by its PULL_DATA (and PUSH_DATA, for the time reference) */
+struct load_gw_s {
+    uint64_t mac;
+    bool has_addr;              /* a PULL_DATA was received, downlinks can be sent */
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    bool has_ref;               /* an uplink gave a concentrator counter reference */
+    uint32_t ref_tmst;          /* "tmst" of the last uplink */
+    uint64_t ref_us;            /* host time when it was received */
+    uint32_t nb_sent;
+    uint32_t nb_accepted;
+    uint32_t nb_rejected;
+    uint32_t nb_lost;           /* no TX_ACK */
+};
+
+/* Downlink waiting for its TX_ACK, indexed by token */
+struct load_dw_s {
+    bool pending;
+    uint8_t cls;
+    uint16_t gw;
+    uint64_t sent_us;
+};
+
+/* Statistics of a downlink class */
+struct load_class_stats_s {
+    uint32_t nb_sent;
+    uint32_t nb_noref;          /* Class A not sent, no time reference for the gateway yet */
+    uint32_t nb_lost;           /* no TX_ACK */
+    uint32_t nb_code[NB_ACK_CODES];       /* TX_ACK by error code, see ack_codes */
+    uint32_t *lat_us;           /* round-trip latency of every TX_ACK received */
+    size_t nb_lat;
+    size_t max_lat;
+};
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES (GLOBAL) ------------------------------------------- */
@@ -66,6 +127,27 @@ struct sigaction sigact; /* SIGQUIT&SIGINT&SIGTERM signal handling */
 static int exit_sig = 0; /* 1 -> application terminates cleanly (shut down hardware, close open files, etc) */
 static int quit_sig = 0; /* 1 -> application terminates without shutting down the hardware */
 
+/* load mode parameters */
+static double load_rate = 0.0; /* downlinks per second, 0 for the legacy sequence */
+static unsigned load_mix[NB_CLASSES] = {0, 0, 100}; /* percentage of each class */
+static unsigned load_duration = 60; /* seconds */
+static unsigned load_nb_gw = 1; /* gateways to wait for before starting */
+static unsigned load_lead_ms = 1000; /* Class A and B downlinks are scheduled that far in the future */
+
+/* TX_ACK error codes, the last one collects the codes not known */
+static const char *ack_codes[NB_ACK_CODES] = {"NONE", "TOO_LATE", "TOO_EARLY", "COLLISION_PACKET", "COLLISION_BEACON", "TX_FREQ", "TX_POWER", "GPS_UNLOCKED", "DUTY_CYCLE", "UNKNOWN"};
+static const char *class_names[NB_CLASSES] = {"Class A", "Class B", "Class C"};
+
+/* load mode state */
+static struct load_gw_s gw_list[LOAD_MAX_GATEWAYS];
+static int16_t gw_index[LOAD_TABLE_SIZE]; /* hash table of MAC addresses to gw_list, -1 if empty */
+static unsigned nb_gw = 0; /* entries used in gw_list */
+static unsigned nb_gw_addr = 0; /* gateways that can receive downlinks */
+static struct load_dw_s dw_table[LOAD_NB_TOKENS];
+static struct load_class_stats_s class_stats[NB_CLASSES];
+static uint32_t nb_pending = 0; /* downlinks waiting for their TX_ACK */
+static uint32_t nb_unexpected = 0; /* TX_ACK with no downlink pending, late or duplicated */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
 
@@ -73,6 +155,26 @@ static void sig_handler(int sigio);
 
 void usage (void);
 
+static void fill_payload(uint8_t *payload, uint8_t id, uint32_t cnt, int size);
+
+static uint64_t now_us(void);
+
+static struct load_gw_s * load_gw_lookup(uint64_t mac);
+
+static void load_recv_down(int sock);
+
+static void load_recv_up(int sock_up);
+
+static int load_send(int sock, unsigned gw, enum load_class_e cls, uint16_t token, uint32_t cnt, const uint8_t *params, int params_len, int payload_size, uint8_t id);
+
+static int compare_u32(const void *a, const void *b);
+
+static void print_latency(const char *name, uint32_t *lat, size_t nb);
+
+static void load_report(double elapsed_s);
+
+static void load_run(int sock, int sock_up, const uint8_t *params, int params_len, int payload_size, uint8_t id);
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
@@ -102,6 +204,472 @@ void usage(void) {
     MSG(" -x <int> numbers of times the sequence is repeated\n");
     MSG(" -v <uint> test ID, inserted in payload for PER test [0:255]\n");
     MSG(" -i send packet using inverted modulation polarity \n");
+    MSG("Load mode:\n");
+    MSG(" -L <float> send downlinks at this rate (packets/s) to all the gateways, instead of the sequence above\n");
+    MSG(" -M <a:b:c> percentage of Class A (tmst), Class B (tmms) and Class C (imme) downlinks (default 0:0:100)\n");
+    MSG(" -D <uint> duration of the test in seconds (default 60)\n");
+    MSG(" -G <uint> number of gateways to wait for before starting (default 1)\n");
+    MSG(" -w <uint> Class A and B downlinks are scheduled this many ms in the future (default 1000)\n");
+    MSG(" -u <int or service> port number for the gateway uplinks, gives the counter reference of Class A downlinks\n");
+}
+
+/* PER frame: id, 32-bit counter, 'P' 'E' 'R', checksum, then padding */
+static void fill_payload(uint8_t *payload, uint8_t id, uint32_t cnt, int size) {
+    int j;
+
+    payload[0] = id;
+    payload[1] = (uint8_t)(cnt >> 24);
+    payload[2] = (uint8_t)(cnt >> 16);
+    payload[3] = (uint8_t)(cnt >> 8);
+    payload[4] = (uint8_t)(cnt);
+    payload[5] = 'P';
+    payload[6] = 'E';
+    payload[7] = 'R';
+    payload[8] = (uint8_t)(payload[0] + payload[1] + payload[2] + payload[3] + payload[4] + payload[5] + payload[6] + payload[7]);
+    for (j = 0; j < (size - 9); j++) {
+        payload[9+j] = j;
+    }
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+/* Find a gateway, adding it if needed, NULL if the table is full */
+static struct load_gw_s * load_gw_lookup(uint64_t mac) {
+    uint32_t i;
+
+    /* Fibonacci hashing, the MAC addresses of a fleet often differ only by their last bytes */
+    i = (uint32_t)((mac * 0x9E3779B97F4A7C15ULL) >> 53) & (LOAD_TABLE_SIZE - 1);
+    while (gw_index[i] >= 0) {
+        if (gw_list[gw_index[i]].mac == mac) {
+            return &gw_list[gw_index[i]];
+        }
+        i = (i + 1) & (LOAD_TABLE_SIZE - 1);
+    }
+    if (nb_gw >= LOAD_MAX_GATEWAYS) {
+        return NULL;
+    }
+    gw_index[i] = (int16_t)nb_gw;
+    gw_list[nb_gw].mac = mac;
+    nb_gw += 1;
+    return &gw_list[nb_gw - 1];
+}
+
+/* Take the datagrams waiting on the downlink socket: PULL_DATA and TX_ACK */
+static void load_recv_down(int sock) {
+    struct sockaddr_storage dist_addr;
+    socklen_t addr_len;
+    uint8_t databuf[1024];
+    int byte_nb;
+    uint32_t raw_mac_h;
+    uint32_t raw_mac_l;
+    uint64_t gw_mac;
+    struct load_gw_s *gw;
+    struct load_dw_s *dw;
+    struct load_class_stats_s *cs;
+    char *p;
+    int code;
+    size_t len;
+    void *tmp;
+
+    while (1) {
+        addr_len = sizeof dist_addr;
+        byte_nb = recvfrom(sock, databuf, sizeof databuf - 1, MSG_DONTWAIT, (struct sockaddr *)&dist_addr, &addr_len);
+        if (byte_nb == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                MSG("WARNING: recvfrom returned an error %s\n", strerror(errno));
+            }
+            return;
+        }
+        if ((byte_nb < 12) || (databuf[0] != PROTOCOL_VERSION)) {
+            continue;
+        }
+        memcpy(&raw_mac_h, databuf + 4, sizeof raw_mac_h);
+        memcpy(&raw_mac_l, databuf + 8, sizeof raw_mac_l);
+        gw_mac = ((uint64_t)ntohl(raw_mac_h) << 32) + (uint64_t)ntohl(raw_mac_l);
+
+        if (databuf[3] == PKT_PULL_DATA) {
+            /* the address may change behind a NAT, always keep the last one */
+            gw = load_gw_lookup(gw_mac);
+            if (gw == NULL) {
+                continue;
+            }
+            if (!gw->has_addr) {
+                gw->has_addr = true;
+                nb_gw_addr += 1;
+                MSG("INFO: gateway 0x%08X%08X ready for downlinks (%u)\n", (uint32_t)(gw_mac >> 32), (uint32_t)(gw_mac & 0xFFFFFFFF), nb_gw_addr);
+            }
+            gw->addr = dist_addr;
+            gw->addr_len = addr_len;
+            databuf[3] = PKT_PULL_ACK;
+            sendto(sock, (void *)databuf, 4, 0, (struct sockaddr *)&dist_addr, addr_len);
+        } else if (databuf[3] == PKT_TX_ACK) {
+            dw = &dw_table[((unsigned)databuf[1] << 8) | databuf[2]];
+            if (!dw->pending) {
+                nb_unexpected += 1;
+                continue;
+            }
+            dw->pending = false;
+            nb_pending -= 1;
+            cs = &class_stats[dw->cls];
+
+            /* no JSON object, or no error, means the downlink was accepted */
+            code = 0;
+            databuf[byte_nb] = 0;
+            p = strstr((char *)(databuf + 12), "\"error\"");
+            if (p != NULL) {
+                p += strspn(p + 7, " \t\r\n:") + 7;
+                p += (*p == '"') ? 1 : 0;
+                for (code = 0; code < NB_ACK_CODES - 1; code++) {
+                    len = strlen(ack_codes[code]);
+                    if ((strncmp(p, ack_codes[code], len) == 0) && (p[len] == '"')) {
+                        break;
+                    }
+                }
+            }
+            cs->nb_code[code] += 1;
+            if (code == 0) {
+                gw_list[dw->gw].nb_accepted += 1;
+            } else {
+                gw_list[dw->gw].nb_rejected += 1;
+            }
+
+            /* keep every latency for the percentiles */
+            if (cs->nb_lat == cs->max_lat) {
+                len = (cs->max_lat > 0) ? 2 * cs->max_lat : 4096;
+                tmp = realloc(cs->lat_us, len * sizeof cs->lat_us[0]);
+                if (tmp == NULL) {
+                    continue;
+                }
+                cs->lat_us = tmp;
+                cs->max_lat = len;
+            }
+            cs->lat_us[cs->nb_lat++] = (uint32_t)(now_us() - dw->sent_us);
+        }
+    }
+}
+
+/* Take the datagrams waiting on the uplink socket, acknowledge them and keep the counter reference */
+static void load_recv_up(int sock_up) {
+    struct sockaddr_storage dist_addr;
+    socklen_t addr_len;
+    uint8_t databuf[4096];
+    int byte_nb;
+    uint32_t raw_mac_h;
+    uint32_t raw_mac_l;
+    struct load_gw_s *gw;
+    char *p;
+
+    while (1) {
+        addr_len = sizeof dist_addr;
+        byte_nb = recvfrom(sock_up, databuf, sizeof databuf - 1, MSG_DONTWAIT, (struct sockaddr *)&dist_addr, &addr_len);
+        if (byte_nb == -1) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                MSG("WARNING: recvfrom returned an error %s\n", strerror(errno));
+            }
+            return;
+        }
+        if ((byte_nb < 12) || (databuf[0] != PROTOCOL_VERSION) || (databuf[3] != PKT_PUSH_DATA)) {
+            continue;
+        }
+        databuf[3] = PKT_PUSH_ACK;
+        sendto(sock_up, (void *)databuf, 4, 0, (struct sockaddr *)&dist_addr, addr_len);
+
+        /* the first "tmst" of the rxpk array is recent enough, the leading time absorbs the error */
+        databuf[byte_nb] = 0;
+        p = strstr((char *)(databuf + 12), "\"tmst\":");
+        if (p == NULL) {
+            continue;
+        }
+        memcpy(&raw_mac_h, databuf + 4, sizeof raw_mac_h);
+        memcpy(&raw_mac_l, databuf + 8, sizeof raw_mac_l);
+        gw = load_gw_lookup(((uint64_t)ntohl(raw_mac_h) << 32) + (uint64_t)ntohl(raw_mac_l));
+        if (gw == NULL) {
+            continue;
+        }
+        gw->ref_tmst = (uint32_t)strtoul(p + 7, NULL, 10);
+        gw->ref_us = now_us();
+        gw->has_ref = true;
+    }
+}
+
+/* Send one downlink, 0 if sent, -1 if not (no time reference or send error) */
+static int load_send(int sock, unsigned gw, enum load_class_e cls, uint16_t token, uint32_t cnt, const uint8_t *params, int params_len, int payload_size, uint8_t id) {
+    struct load_gw_s *g = &gw_list[gw];
+    struct load_dw_s *dw = &dw_table[token];
+    uint8_t databuf[600];
+    uint8_t payload_bin[255];
+    struct timespec utc;
+    uint64_t now = now_us();
+    uint64_t tmms;
+    int buff_index;
+    int x;
+
+    databuf[0] = PROTOCOL_VERSION;
+    databuf[1] = (uint8_t)(token >> 8);
+    databuf[2] = (uint8_t)token;
+    databuf[3] = PKT_PULL_RESP;
+    buff_index = 4;
+
+    /* timing of the class, then the parameters common to all the downlinks */
+    switch (cls) {
+        case CLASS_A:
+            if (!g->has_ref) {
+                class_stats[cls].nb_noref += 1;
+                return -1;
+            }
+            x = snprintf((char *)(databuf + buff_index), 40, "{\"txpk\":{\"tmst\":%u", (uint32_t)(g->ref_tmst + (now - g->ref_us) + 1000 * load_lead_ms));
+            break;
+        case CLASS_B:
+            clock_gettime(CLOCK_REALTIME, &utc);
+            tmms = ((uint64_t)utc.tv_sec - UNIX_GPS_EPOCH_OFFSET + GPS_LEAP_SECONDS) * 1000 + (uint64_t)utc.tv_nsec / 1000000 + load_lead_ms;
+            x = snprintf((char *)(databuf + buff_index), 40, "{\"txpk\":{\"tmms\":%llu", (unsigned long long)tmms);
+            break;
+        default:
+            x = snprintf((char *)(databuf + buff_index), 40, "{\"txpk\":{\"imme\":true");
+    }
+    buff_index += x;
+    memcpy((void *)(databuf + buff_index), (void *)params, params_len);
+    buff_index += params_len;
+
+    /* payload and end of JSON structure */
+    fill_payload(payload_bin, id, cnt, payload_size);
+    x = bin_to_b64(payload_bin, payload_size, (char *)(databuf + buff_index), sizeof databuf - buff_index - 3);
+    if (x < 0) {
+        MSG("ERROR: bin_to_b64 failed line %u\n", (__LINE__ - 2));
+        exit(EXIT_FAILURE);
+    }
+    buff_index += x;
+    memcpy((void *)(databuf + buff_index), (void *)"\"}}", 3);
+    buff_index += 3;
+
+    /* a token still pending after 65536 downlinks will never be acknowledged */
+    if (dw->pending) {
+        class_stats[dw->cls].nb_lost += 1;
+        gw_list[dw->gw].nb_lost += 1;
+        dw->pending = false;
+        nb_pending -= 1;
+    }
+    if (sendto(sock, (void *)databuf, buff_index, 0, (struct sockaddr *)&g->addr, g->addr_len) == -1) {
+        MSG("WARNING: sendto returned an error %s\n", strerror(errno));
+        return -1;
+    }
+    dw->pending = true;
+    nb_pending += 1;
+    dw->cls = (uint8_t)cls;
+    dw->gw = (uint16_t)gw;
+    dw->sent_us = now;
+    class_stats[cls].nb_sent += 1;
+    g->nb_sent += 1;
+    return 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Sort the latencies and display their percentiles, nearest rank method */
+static void print_latency(const char *name, uint32_t *lat, size_t nb) {
+    static const unsigned pct[] = {50, 90, 99};
+    unsigned i;
+
+    if (nb == 0) {
+        printf("  %-8s latency: no TX_ACK\n", name);
+        return;
+    }
+    qsort(lat, nb, sizeof lat[0], compare_u32);
+    printf("  %-8s latency: min %.2f ms", name, lat[0] / 1000.0);
+    for (i = 0; i < ARRAY_SIZE(pct); i++) {
+        printf(", p%u %.2f ms", pct[i], lat[(nb * pct[i] + 99) / 100 - 1] / 1000.0);
+    }
+    printf(", max %.2f ms (%lu TX_ACK)\n", lat[nb - 1] / 1000.0, (unsigned long)nb);
+}
+
+static void load_report(double elapsed_s) {
+    struct load_class_stats_s *cs;
+    struct load_class_stats_s all;
+    uint32_t nb_ack;
+    unsigned i, j;
+    size_t n;
+
+    memset(&all, 0, sizeof all);
+    for (i = 0; i < NB_CLASSES; i++) {
+        all.nb_sent += class_stats[i].nb_sent;
+        all.nb_noref += class_stats[i].nb_noref;
+        all.nb_lost += class_stats[i].nb_lost;
+        all.nb_lat += class_stats[i].nb_lat;
+        for (j = 0; j < NB_ACK_CODES; j++) {
+            all.nb_code[j] += class_stats[i].nb_code[j];
+        }
+    }
+    all.lat_us = malloc((all.nb_lat > 0 ? all.nb_lat : 1) * sizeof all.lat_us[0]);
+    if (all.lat_us != NULL) {
+        for (n = 0, i = 0; i < NB_CLASSES; i++) {
+            memcpy(all.lat_us + n, class_stats[i].lat_us, class_stats[i].nb_lat * sizeof all.lat_us[0]);
+            n += class_stats[i].nb_lat;
+        }
+    } else {
+        all.nb_lat = 0;
+    }
+
+    printf("### load test: %u downlinks sent to %u gateways in %.1f s (%.1f/s), %u TX_ACK not expected\n",
+           all.nb_sent, nb_gw_addr, elapsed_s, (elapsed_s > 0) ? all.nb_sent / elapsed_s : 0.0, nb_unexpected);
+    for (i = 0; i <= NB_CLASSES; i++) {
+        cs = (i < NB_CLASSES) ? &class_stats[i] : &all;
+        if ((cs->nb_sent == 0) && (cs->nb_noref == 0)) {
+            continue;
+        }
+        for (nb_ack = 0, j = 0; j < NB_ACK_CODES; j++) {
+            nb_ack += cs->nb_code[j];
+        }
+        printf("  %-8s sent %u, TX_ACK %u, lost %u, accepted %u (%.1f%% of sent)", (i < NB_CLASSES) ? class_names[i] : "All",
+               cs->nb_sent, nb_ack, cs->nb_lost, cs->nb_code[0], (cs->nb_sent > 0) ? 100.0 * cs->nb_code[0] / cs->nb_sent : 0.0);
+        if (cs->nb_noref > 0) {
+            printf(", %u not sent for lack of uplink", cs->nb_noref);
+        }
+        for (j = 1; j < NB_ACK_CODES; j++) {
+            if (cs->nb_code[j] > 0) {
+                printf(", %s %u", ack_codes[j], cs->nb_code[j]);
+            }
+        }
+        printf("\n");
+    }
+    for (i = 0; i <= NB_CLASSES; i++) {
+        cs = (i < NB_CLASSES) ? &class_stats[i] : &all;
+        if (cs->nb_sent > 0) {
+            print_latency((i < NB_CLASSES) ? class_names[i] : "All", cs->lat_us, cs->nb_lat);
+        }
+    }
+    for (i = 0; i < nb_gw; i++) {
+        if (gw_list[i].nb_sent > 0) {
+            printf("  %016llX sent %u, accepted %u, rejected %u, lost %u\n", (unsigned long long)gw_list[i].mac,
+                   gw_list[i].nb_sent, gw_list[i].nb_accepted, gw_list[i].nb_rejected, gw_list[i].nb_lost);
+        }
+    }
+    fflush(stdout);
+    free(all.lat_us);
+}
+
+/* Load mode main loop: paced downlinks, round-robin on the gateways, classes interleaved by their credit */
+static void load_run(int sock, int sock_up, const uint8_t *params, int params_len, int payload_size, uint8_t id) {
+    uint64_t now, start, end, next_send, next_progress;
+    uint64_t period_us = (uint64_t)(1e6 / load_rate);
+    int credit[NB_CLASSES] = {0, 0, 0};
+    unsigned mix_sum = load_mix[CLASS_A] + load_mix[CLASS_B] + load_mix[CLASS_C];
+    unsigned gw = 0;
+    uint32_t cnt = 0;
+    uint16_t token = 0;
+    unsigned i, c;
+    struct timeval tv;
+    fd_set fds;
+    int max_fd = (sock_up > sock) ? sock_up : sock;
+
+    /* wait for the gateways, their PULL_DATA are sent every few seconds */
+    while (nb_gw_addr < load_nb_gw) {
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        if (sock_up != -1) {
+            FD_SET(sock_up, &fds);
+        }
+        if ((select(max_fd + 1, &fds, NULL, NULL, NULL) == -1) && (errno != EINTR)) {
+            MSG("ERROR: select returned %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if ((quit_sig == 1) || (exit_sig == 1)) {
+            return;
+        }
+        load_recv_down(sock);
+        if (sock_up != -1) {
+            load_recv_up(sock_up);
+        }
+    }
+    MSG("INFO: load test started, %.1f downlinks/s for %u s, mix A:B:C %u:%u:%u\n", load_rate, load_duration, load_mix[CLASS_A], load_mix[CLASS_B], load_mix[CLASS_C]);
+
+    start = now_us();
+    end = start + 1000000 * (uint64_t)load_duration;
+    next_send = start;
+    next_progress = start + 1000000 * LOAD_PROGRESS_S;
+    now = start;
+    while (1) {
+        /* send the downlinks due, the late ones in a burst to keep the average rate */
+        while ((now < end) && (next_send <= now)) {
+            /* the class with the most credit goes, exact proportions and no randomness */
+            for (c = 0, i = 0; i < NB_CLASSES; i++) {
+                credit[i] += (int)load_mix[i];
+                if (credit[i] > credit[c]) {
+                    c = i;
+                }
+            }
+            credit[c] -= (int)mix_sum;
+            for (i = 0; i < nb_gw; i++) {
+                gw = (gw + 1) % nb_gw;
+                if (gw_list[gw].has_addr) {
+                    break;
+                }
+            }
+            if (load_send(sock, gw, c, token, cnt, params, params_len, payload_size, id) == 0) {
+                token += 1;
+                cnt += 1;
+            }
+            next_send += period_us;
+        }
+
+        if ((quit_sig == 1) || (exit_sig == 1)) {
+            break;
+        }
+        if (now >= end) {
+            /* let the last TX_ACK come back */
+            if ((nb_pending == 0) || (now >= end + 1000 * LOAD_ACK_TIMEOUT_MS)) {
+                break;
+            }
+        }
+        if (now >= next_progress) {
+            MSG("INFO: %u s, %u downlinks sent\n", (unsigned)((now - start) / 1000000),
+                class_stats[CLASS_A].nb_sent + class_stats[CLASS_B].nb_sent + class_stats[CLASS_C].nb_sent);
+            next_progress += 1000000 * LOAD_PROGRESS_S;
+        }
+
+        /* wait for a datagram, or for the next downlink */
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        if (sock_up != -1) {
+            FD_SET(sock_up, &fds);
+        }
+        if (now < end) {
+            tv.tv_sec = (next_send > now) ? (next_send - now) / 1000000 : 0;
+            tv.tv_usec = (next_send > now) ? (next_send - now) % 1000000 : 0;
+        } else {
+            tv.tv_sec = 0;
+            tv.tv_usec = 10000;
+        }
+        if ((select(max_fd + 1, &fds, NULL, NULL, &tv) == -1) && (errno != EINTR)) {
+            MSG("ERROR: select returned %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        load_recv_down(sock);
+        if (sock_up != -1) {
+            load_recv_up(sock_up);
+        }
+        now = now_us();
+    }
+
+    /* the downlinks still waiting have lost their TX_ACK */
+    for (i = 0; i < LOAD_NB_TOKENS; i++) {
+        if (dw_table[i].pending) {
+            dw_table[i].pending = false;
+            class_stats[dw_table[i].cls].nb_lost += 1;
+            gw_list[dw_table[i].gw].nb_lost += 1;
+        }
+    }
+    nb_pending = 0;
+    load_report((((now < end) ? now : end) - start) / 1e6);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -109,7 +677,7 @@ void usage(void) {
 
 int main(int argc, char **argv)
 {
-    int i, j, x;
+    int i, x;
     unsigned int xu;
     char arg_s[64];
 
@@ -140,6 +708,8 @@ int main(int argc, char **argv)
     struct addrinfo *result; /* store result of getaddrinfo */
     struct addrinfo *q; /* pointer to move into *result data */
     char serv_port[8] = "1680";
+    char up_port[8] = "";
+    int sock_up = -1; /* uplink socket, only in load mode */
     char host_name[64];
     char port_name[64];
 
@@ -154,6 +724,7 @@ int main(int argc, char **argv)
     uint32_t raw_mac_h; /* Most Significant Nibble, network order */
     uint32_t raw_mac_l; /* Least Significant Nibble, network order */
     uint64_t gw_mac; /* MAC address of the client (gateway) */
+    struct load_gw_s *gw;
 
     /* prepare hints to open network sockets */
     memset(&hints, 0, sizeof hints);
@@ -162,7 +733,7 @@ int main(int argc, char **argv)
     hints.ai_flags = AI_PASSIVE; /* will assign local IP automatically */
 
     /* parse command line options */
-    while ((i = getopt (argc, argv, "hn:f:m:s:b:d:r:p:z:t:x:v:i")) != -1) {
+    while ((i = getopt (argc, argv, "hn:f:m:s:b:d:r:p:z:t:x:v:iL:M:D:G:w:u:")) != -1) {
         switch (i) {
             case 'h':
                 usage();
@@ -275,6 +846,50 @@ int main(int argc, char **argv)
                 invert = true;
                 break;
 
+            case 'L': /* -L <float> load mode rate */
+                i = sscanf(optarg, "%lf", &load_rate);
+                if ((i != 1) || (load_rate <= 0.0) || (load_rate > 1e6)) {
+                    MSG("ERROR: invalid downlink rate\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'M': /* -M <a:b:c> load mode class mix */
+                i = sscanf(optarg, "%u:%u:%u", &load_mix[CLASS_A], &load_mix[CLASS_B], &load_mix[CLASS_C]);
+                if ((i != 3) || (load_mix[CLASS_A] + load_mix[CLASS_B] + load_mix[CLASS_C] != 100)) {
+                    MSG("ERROR: invalid class mix, the three percentages must add up to 100\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'D': /* -D <uint> load mode duration */
+                i = sscanf(optarg, "%u", &load_duration);
+                if ((i != 1) || (load_duration < 1)) {
+                    MSG("ERROR: invalid test duration\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'G': /* -G <uint> load mode gateways */
+                i = sscanf(optarg, "%u", &load_nb_gw);
+                if ((i != 1) || (load_nb_gw < 1) || (load_nb_gw > LOAD_MAX_GATEWAYS)) {
+                    MSG("ERROR: invalid number of gateways [1:%u]\n", LOAD_MAX_GATEWAYS);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'w': /* -w <uint> load mode lead time of Class A and B */
+                i = sscanf(optarg, "%u", &load_lead_ms);
+                if ((i != 1) || (load_lead_ms > 60000)) {
+                    MSG("ERROR: invalid lead time\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'u': /* -u <int or service> port number for gateway uplinks */
+                strncpy(up_port, optarg, sizeof up_port - 1);
+                break;
+
             default:
                 MSG("ERROR: argument parsing failure, use -h option for help\n");
                 usage();
@@ -310,6 +925,35 @@ int main(int argc, char **argv)
     }
     freeaddrinfo(result);
 
+    /* the uplinks are only needed for the counter reference of Class A downlinks */
+    if ((load_rate > 0.0) && (up_port[0] != '\0')) {
+        i = getaddrinfo(NULL, up_port, &hints, &result);
+        if (i != 0) {
+            MSG("ERROR: getaddrinfo returned %s\n", gai_strerror(i));
+            exit(EXIT_FAILURE);
+        }
+        for (q=result; q!=NULL; q=q->ai_next) {
+            sock_up = socket(q->ai_family, q->ai_socktype,q->ai_protocol);
+            if (sock_up == -1) {
+                continue; /* socket failed, try next field */
+            } else if (bind(sock_up, q->ai_addr, q->ai_addrlen) == -1) {
+                shutdown(sock_up, SHUT_RDWR);
+                sock_up = -1;
+                continue; /* bind failed, try next field */
+            } else {
+                break; /* success, get out of loop */
+            }
+        }
+        if (q == NULL) {
+            MSG("ERROR: failed to open uplink socket or to bind to it\n");
+            exit(EXIT_FAILURE);
+        }
+        freeaddrinfo(result);
+    } else if ((load_rate > 0.0) && (load_mix[CLASS_A] > 0)) {
+        MSG("WARNING: no uplink port (-u), Class A downlinks cannot be timed and will not be sent\n");
+    }
+    memset(gw_index, 0xFF, sizeof gw_index);
+
     /* configure signal handling */
     sigemptyset(&sigact.sa_mask);
     sigact.sa_flags = 0;
@@ -319,7 +963,9 @@ int main(int argc, char **argv)
     sigaction(SIGTERM, &sigact, NULL);
 
     /* display setup summary */
-    if (strcmp(mod, "FSK") == 0) {
+    if (load_rate > 0.0) {
+        MSG("INFO: load mode, %s pkts @%f MHz, %uB payload, %i dBm\n", mod, f_target, payload_size, pow);
+    } else if (strcmp(mod, "FSK") == 0) {
         MSG("INFO: %i FSK pkts @%f MHz (FDev %u kHz, Bitrate %.2f kbps, %uB payload) %i dBm, %i ms between each\n", repeat, f_target, fdev_khz, br_kbps, payload_size, pow, delay);
     } else {
         MSG("INFO: %i LoRa pkts @%f MHz (BW %u kHz, SF%i, %uB payload) %i dBm, %i ms between each\n", repeat, f_target, bw, sf, payload_size, pow, delay);
@@ -353,6 +999,17 @@ int main(int argc, char **argv)
     }
     MSG("INFO: PULL_DATA request received from gateway 0x%08X%08X (host %s, port %s)\n", (uint32_t)(gw_mac >> 32), (uint32_t)(gw_mac & 0xFFFFFFFF), host_name, port_name);
 
+    /* in load mode, this is the first gateway of the test */
+    if (load_rate > 0.0) {
+        gw = load_gw_lookup(gw_mac);
+        gw->has_addr = true;
+        gw->addr = dist_addr;
+        gw->addr_len = addr_len;
+        nb_gw_addr = 1;
+        databuf[3] = PKT_PULL_ACK;
+        sendto(sock, (void *)databuf, 4, 0, (struct sockaddr *)&dist_addr, addr_len);
+    }
+
     /* PKT_PULL_RESP datagrams header */
     databuf[0] = PROTOCOL_VERSION;
     databuf[1] = 0; /* no token */
@@ -447,24 +1104,19 @@ int main(int argc, char **argv)
     memcpy((void *)(databuf + buff_index), (void *)"\"}}", 3);
     buff_index += 3; /* ends up being the total length of payload */
 
+    /* load mode: the parameters between the timing and the payload are common to all the downlinks */
+    if (load_rate > 0.0) {
+        load_run(sock, sock_up, databuf + 24, payload_index - 24, payload_size, id);
+        exit(EXIT_SUCCESS);
+    }
+
     /* main loop */
     for (i = 0; i < repeat; ++i) {
         /* fill payload */
-        payload_bin[0] = id;
-        payload_bin[1] = (uint8_t)(i >> 24);
-        payload_bin[2] = (uint8_t)(i >> 16);
-        payload_bin[3] = (uint8_t)(i >> 8);
-        payload_bin[4] = (uint8_t)(i);
-        payload_bin[5] = 'P';
-        payload_bin[6] = 'E';
-        payload_bin[7] = 'R';
-        payload_bin[8] = (uint8_t)(payload_bin[0] + payload_bin[1] + payload_bin[2] + payload_bin[3] + payload_bin[4] + payload_bin[5] + payload_bin[6] + payload_bin[7]);
-        for (j = 0; j < (payload_size - 9); j++) {
-            payload_bin[9+j] = j;
-        }
+        fill_payload(payload_bin, id, (uint32_t)i, payload_size);
 
 #if 0
-        for (j = 0; j < payload_size; j++ ) {
+        for (int j = 0; j < payload_size; j++ ) {
             printf("0x%02X ", payload_bin[j]);
         }
         printf("\n");